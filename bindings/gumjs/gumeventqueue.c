@@ -0,0 +1,777 @@
+/*
+ * Copyright (C) 2021 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumeventqueue.h"
+
+#include <string.h>
+
+#define GUM_COMPACT_EVENT_MAX_SIZE (1 + 10 + 10 + 5)
+#define GUM_EVENT_RING_MIN_CAPACITY (256 * sizeof (GumEvent))
+
+typedef struct _GumEventRing GumEventRing;
+typedef guint GumCompactEventTag;
+
+struct _GumEventQueue
+{
+  guint id;
+  GumEventEncoding encoding;
+  guint capacity;
+
+  GumEventRing * rings;
+  volatile gint n_rings;
+};
+
+/*
+ * Single-producer single-consumer byte ring: only the thread identified by
+ * thread_id advances head, and only the draining thread advances tail.
+ *
+ * Each ring is referenced by its queue and by the thread that owns it. Once
+ * the thread is gone the ring is retired, and the draining thread unlinks it
+ * after it has been drained and its drops reported.
+ *
+ * The queue's capacity is shared between its rings: a ring is sized for an
+ * even share of it when created, and producers stop at an even share of it
+ * among the rings currently linked, never going below a small minimum.
+ * Buffered events thus stay within the capacity plus that minimum per thread,
+ * and the memory held grows logarithmically with the number of threads rather
+ * than linearly, again plus that minimum per thread.
+ */
+struct _GumEventRing
+{
+  GumEventRing * next;
+  GumEventRing * next_owned;
+  guint queue_id;
+  GumThreadId thread_id;
+
+  volatile gint ref_count;
+  volatile gint retired;
+  volatile gint abandoned;
+
+  volatile guint head;
+  volatile guint tail;
+
+  volatile guint n_dropped;
+  guint n_dropped_reported;
+
+  guint capacity;
+  guint size;
+
+  guint64 producer_address;
+  guint64 consumer_address;
+
+  guint8 * data;
+};
+
+/*
+ * The compact encoding starts with a magic that cannot be mistaken for the
+ * GumEventType of a plain GumEvent. Each event is then a one-byte tag
+ * followed by LEB128 varints. Addresses are zigzag-encoded deltas relative
+ * to the previous event's location or start, the target of a call or ret is
+ * relative to its location, and a block's end is relative to its start.
+ * A base record resets the previous address, so that a buffer made out of
+ * several per-thread streams can be decoded without any external state.
+ */
+enum _GumCompactEventTag
+{
+  GUM_COMPACT_EVENT_CALL,
+  GUM_COMPACT_EVENT_RET,
+  GUM_COMPACT_EVENT_EXEC,
+  GUM_COMPACT_EVENT_BLOCK,
+  GUM_COMPACT_EVENT_COMPILE,
+  GUM_COMPACT_EVENT_BASE
+};
+
+static GumEventRing * gum_event_queue_get_ring (GumEventQueue * self);
+static guint gum_event_queue_compute_share (GumEventQueue * self,
+    guint n_rings);
+static void gum_event_queue_reclaim_rings (GumEventQueue * self);
+
+static void gum_event_ring_unref (GumEventRing * ring);
+static void gum_event_ring_retire_owned (GumEventRing * rings);
+
+static void gum_event_ring_write (GumEventRing * self, guint offset,
+    const guint8 * data, guint size);
+static void gum_event_ring_read (GumEventRing * self, guint offset,
+    guint8 * data, guint size);
+
+static guint gum_compact_event_encode (const GumEvent * event,
+    guint64 * previous_address, guint8 * output);
+static guint8 * gum_write_address_delta (guint8 * output, guint64 address,
+    guint64 base);
+static guint8 * gum_write_uleb128 (guint8 * output, guint64 value);
+static gboolean gum_read_address_delta (const guint8 ** data,
+    const guint8 * end, guint64 base, guint64 * address);
+static gboolean gum_read_uleb128 (const guint8 ** data, const guint8 * end,
+    guint64 * value);
+
+static const guint8 gum_compact_event_magic[4] = { 0xff, 'E', 'V', '1' };
+
+static volatile gint gum_event_queue_next_id = 1;
+static GPrivate gum_event_rings_owned =
+    G_PRIVATE_INIT ((GDestroyNotify) gum_event_ring_retire_owned);
+
+GumEventQueue *
+gum_event_queue_new (guint capacity,
+                     GumEventEncoding encoding)
+{
+  GumEventQueue * queue;
+
+  queue = g_slice_new (GumEventQueue);
+  queue->id = g_atomic_int_add (&gum_event_queue_next_id, 1);
+  queue->encoding = encoding;
+  queue->capacity = capacity * sizeof (GumEvent);
+  queue->rings = NULL;
+  queue->n_rings = 0;
+
+  return queue;
+}
+
+void
+gum_event_queue_free (GumEventQueue * queue)
+{
+  GumEventRing * ring, * next;
+
+  for (ring = queue->rings; ring != NULL; ring = next)
+  {
+    next = ring->next;
+
+    /*
+     * The owning thread may still be around, but it will not push to this
+     * queue again, so only the ring itself needs to stay alive.
+     */
+    g_clear_pointer (&ring->data, g_free);
+    g_atomic_int_set (&ring->abandoned, TRUE);
+
+    gum_event_ring_unref (ring);
+  }
+
+  g_slice_free (GumEventQueue, queue);
+}
+
+void
+gum_event_queue_push (GumEventQueue * self,
+                      const GumEvent * event)
+{
+  GumEventRing * ring;
+  guint head, tail, size, limit;
+  guint8 compact[GUM_COMPACT_EVENT_MAX_SIZE];
+  const guint8 * record;
+  guint64 address;
+
+  ring = gum_event_queue_get_ring (self);
+
+  if (self->encoding == GUM_EVENT_ENCODING_COMPACT)
+  {
+    address = ring->producer_address;
+    size = gum_compact_event_encode (event, &address, compact);
+    record = compact;
+  }
+  else
+  {
+    size = sizeof (GumEvent);
+    record = (const guint8 *) event;
+  }
+
+  head = ring->head;
+  tail = g_atomic_int_get (&ring->tail);
+
+  limit = MIN (ring->capacity, gum_event_queue_compute_share (self,
+      g_atomic_int_get (&self->n_rings)));
+
+  if ((head - tail) + size > limit)
+  {
+    g_atomic_int_inc (&ring->n_dropped);
+    return;
+  }
+
+  gum_event_ring_write (ring, head, record, size);
+
+  if (self->encoding == GUM_EVENT_ENCODING_COMPACT)
+    ring->producer_address = address;
+
+  g_atomic_int_set (&ring->head, head + size);
+}
+
+gpointer
+gum_event_queue_drain (GumEventQueue * self,
+                       gsize * size)
+{
+  gboolean compact;
+  guint8 * buffer, * cursor;
+  gsize total, remaining;
+  GumEventRing * ring;
+
+  compact = self->encoding == GUM_EVENT_ENCODING_COMPACT;
+
+  total = 0;
+  for (ring = g_atomic_pointer_get (&self->rings);
+      ring != NULL;
+      ring = ring->next)
+  {
+    guint n = g_atomic_int_get (&ring->head) - ring->tail;
+
+    if (n != 0 && compact)
+      n += 1 + 10;
+
+    total += n;
+  }
+
+  *size = 0;
+  if (total == 0)
+  {
+    gum_event_queue_reclaim_rings (self);
+    return NULL;
+  }
+
+  if (compact)
+    total += sizeof (gum_compact_event_magic);
+
+  buffer = g_malloc (total);
+  cursor = buffer;
+  remaining = total;
+
+  if (compact)
+  {
+    memcpy (cursor, gum_compact_event_magic, sizeof (gum_compact_event_magic));
+    cursor += sizeof (gum_compact_event_magic);
+    remaining -= sizeof (gum_compact_event_magic);
+  }
+
+  for (ring = g_atomic_pointer_get (&self->rings);
+      ring != NULL;
+      ring = ring->next)
+  {
+    guint tail, count;
+
+    tail = ring->tail;
+    count = g_atomic_int_get (&ring->head) - tail;
+
+    if (compact)
+    {
+      GumEventReader reader;
+      GumEvent event;
+      guint8 * start;
+
+      if (count == 0 || remaining < 1 + 10 + count)
+        continue;
+
+      start = cursor;
+      *cursor++ = GUM_COMPACT_EVENT_BASE;
+      cursor = gum_write_uleb128 (cursor, ring->consumer_address);
+
+      gum_event_ring_read (ring, tail, cursor, count);
+
+      reader.cursor = cursor;
+      reader.end = cursor + count;
+      reader.encoding = GUM_EVENT_ENCODING_COMPACT;
+      reader.previous_address = ring->consumer_address;
+      while (gum_event_reader_next (&reader, &event))
+        ;
+      ring->consumer_address = reader.previous_address;
+
+      cursor += count;
+      remaining -= cursor - start;
+    }
+    else
+    {
+      count = MIN (count, remaining);
+      if (count == 0)
+        continue;
+
+      gum_event_ring_read (ring, tail, cursor, count);
+
+      cursor += count;
+      remaining -= count;
+    }
+
+    g_atomic_int_set (&ring->tail, tail + count);
+  }
+
+  gum_event_queue_reclaim_rings (self);
+
+  if (compact && cursor == buffer + sizeof (gum_compact_event_magic))
+  {
+    g_free (buffer);
+    return NULL;
+  }
+
+  *size = cursor - buffer;
+
+  return buffer;
+}
+
+gboolean
+gum_event_queue_enumerate_drops (GumEventQueue * self,
+                                 GumEventQueueFoundDropsFunc func,
+                                 gpointer user_data)
+{
+  gboolean any_dropped = FALSE;
+  GumEventRing * ring;
+
+  for (ring = g_atomic_pointer_get (&self->rings);
+      ring != NULL;
+      ring = ring->next)
+  {
+    guint n_dropped;
+
+    n_dropped = g_atomic_int_get (&ring->n_dropped);
+    if (n_dropped == ring->n_dropped_reported)
+      continue;
+
+    func (ring->thread_id, n_dropped - ring->n_dropped_reported, user_data);
+    ring->n_dropped_reported = n_dropped;
+
+    any_dropped = TRUE;
+  }
+
+  gum_event_queue_reclaim_rings (self);
+
+  return any_dropped;
+}
+
+static GumEventRing *
+gum_event_queue_get_ring (GumEventQueue * self)
+{
+  GumEventRing * owned, * ring, * prev, * next, * head;
+
+  owned = g_private_get (&gum_event_rings_owned);
+  if (owned != NULL && owned->queue_id == self->id)
+    return owned;
+
+  prev = NULL;
+  for (ring = owned; ring != NULL; ring = next)
+  {
+    next = ring->next_owned;
+
+    if (ring->queue_id == self->id)
+      break;
+
+    if (g_atomic_int_get (&ring->abandoned))
+    {
+      if (prev != NULL)
+        prev->next_owned = next;
+      else
+        owned = next;
+
+      gum_event_ring_unref (ring);
+    }
+    else
+    {
+      prev = ring;
+    }
+  }
+
+  if (ring != NULL)
+  {
+    if (prev != NULL)
+      prev->next_owned = ring->next_owned;
+    else
+      owned = ring->next_owned;
+  }
+  else
+  {
+    ring = g_slice_new0 (GumEventRing);
+    ring->queue_id = self->id;
+    ring->thread_id = gum_process_get_current_thread_id ();
+    ring->ref_count = 2;
+    ring->capacity = gum_event_queue_compute_share (self,
+        g_atomic_int_add (&self->n_rings, 1) + 1);
+    ring->size = 1;
+    while (ring->size < ring->capacity)
+      ring->size <<= 1;
+    ring->data = g_malloc (ring->size);
+
+    do
+    {
+      head = g_atomic_pointer_get (&self->rings);
+      ring->next = head;
+    }
+    while (!g_atomic_pointer_compare_and_exchange (&self->rings, head, ring));
+  }
+
+  ring->next_owned = owned;
+  g_private_set (&gum_event_rings_owned, ring);
+
+  return ring;
+}
+
+static guint
+gum_event_queue_compute_share (GumEventQueue * self,
+                               guint n_rings)
+{
+  guint share;
+
+  share = self->capacity / MAX (n_rings, 1);
+
+  return MIN (MAX (share, GUM_EVENT_RING_MIN_CAPACITY), self->capacity);
+}
+
+/*
+ * Only the draining thread unlinks rings, so it may update the next pointers
+ * of other rings freely. New rings are only ever pushed at the head, which is
+ * why unlinking the head needs to be atomic.
+ */
+static void
+gum_event_queue_reclaim_rings (GumEventQueue * self)
+{
+  GumEventRing * prev, * ring, * next;
+
+  prev = NULL;
+  for (ring = g_atomic_pointer_get (&self->rings); ring != NULL; ring = next)
+  {
+    next = ring->next;
+
+    if (!g_atomic_int_get (&ring->retired) ||
+        (guint) g_atomic_int_get (&ring->head) != ring->tail ||
+        (guint) g_atomic_int_get (&ring->n_dropped) !=
+            ring->n_dropped_reported)
+    {
+      prev = ring;
+      continue;
+    }
+
+    if (prev != NULL)
+    {
+      prev->next = next;
+    }
+    else if (!g_atomic_pointer_compare_and_exchange (&self->rings, ring, next))
+    {
+      for (prev = g_atomic_pointer_get (&self->rings);
+          prev->next != ring;
+          prev = prev->next)
+      {
+      }
+      prev->next = next;
+    }
+
+    g_atomic_int_add (&self->n_rings, -1);
+
+    gum_event_ring_unref (ring);
+  }
+}
+
+static void
+gum_event_ring_unref (GumEventRing * ring)
+{
+  if (!g_atomic_int_dec_and_test (&ring->ref_count))
+    return;
+
+  g_free (ring->data);
+  g_slice_free (GumEventRing, ring);
+}
+
+static void
+gum_event_ring_retire_owned (GumEventRing * rings)
+{
+  GumEventRing * ring, * next;
+
+  for (ring = rings; ring != NULL; ring = next)
+  {
+    next = ring->next_owned;
+
+    g_atomic_int_set (&ring->retired, TRUE);
+    gum_event_ring_unref (ring);
+  }
+}
+
+static void
+gum_event_ring_write (GumEventRing * self,
+                      guint offset,
+                      const guint8 * data,
+                      guint size)
+{
+  guint start, first_part;
+
+  start = offset & (self->size - 1);
+  first_part = MIN (size, self->size - start);
+
+  memcpy (self->data + start, data, first_part);
+  memcpy (self->data, data + first_part, size - first_part);
+}
+
+static void
+gum_event_ring_read (GumEventRing * self,
+                     guint offset,
+                     guint8 * data,
+                     guint size)
+{
+  guint start, first_part;
+
+  start = offset & (self->size - 1);
+  first_part = MIN (size, self->size - start);
+
+  memcpy (data, self->data + start, first_part);
+  memcpy (data + first_part, self->data, size - first_part);
+}
+
+gboolean
+gum_event_reader_init (GumEventReader * reader,
+                       gconstpointer data,
+                       gsize size)
+{
+  reader->cursor = data;
+  reader->end = reader->cursor + size;
+  reader->previous_address = 0;
+
+  if (size >= sizeof (gum_compact_event_magic) &&
+      memcmp (data, gum_compact_event_magic,
+          sizeof (gum_compact_event_magic)) == 0)
+  {
+    reader->encoding = GUM_EVENT_ENCODING_COMPACT;
+    reader->cursor += sizeof (gum_compact_event_magic);
+
+    return TRUE;
+  }
+
+  reader->encoding = GUM_EVENT_ENCODING_DEFAULT;
+
+  return size % sizeof (GumEvent) == 0;
+}
+
+gboolean
+gum_event_reader_next (GumEventReader * self,
+                       GumEvent * event)
+{
+  const guint8 * cursor = self->cursor;
+  const guint8 * end = self->end;
+  guint64 location, target, depth, size;
+
+  if (self->encoding == GUM_EVENT_ENCODING_DEFAULT)
+  {
+    if (cursor == end)
+      return FALSE;
+
+    memcpy (event, cursor, sizeof (GumEvent));
+    self->cursor = cursor + sizeof (GumEvent);
+
+    return TRUE;
+  }
+
+  while (cursor != end)
+  {
+    switch (*cursor++)
+    {
+      case GUM_COMPACT_EVENT_CALL:
+      case GUM_COMPACT_EVENT_RET:
+      {
+        gboolean is_call = cursor[-1] == GUM_COMPACT_EVENT_CALL;
+
+        if (!gum_read_address_delta (&cursor, end, self->previous_address,
+              &location) ||
+            !gum_read_address_delta (&cursor, end, location, &target) ||
+            !gum_read_uleb128 (&cursor, end, &depth))
+        {
+          return FALSE;
+        }
+
+        event->type = is_call ? GUM_CALL : GUM_RET;
+        event->call.location = GSIZE_TO_POINTER (location);
+        event->call.target = GSIZE_TO_POINTER (target);
+        event->call.depth = (gint) ((depth >> 1) ^ -(gint64) (depth & 1));
+
+        self->previous_address = location;
+        self->cursor = cursor;
+
+        return TRUE;
+      }
+      case GUM_COMPACT_EVENT_EXEC:
+      {
+        if (!gum_read_address_delta (&cursor, end, self->previous_address,
+              &location))
+        {
+          return FALSE;
+        }
+
+        event->type = GUM_EXEC;
+        event->exec.location = GSIZE_TO_POINTER (location);
+
+        self->previous_address = location;
+        self->cursor = cursor;
+
+        return TRUE;
+      }
+      case GUM_COMPACT_EVENT_BLOCK:
+      case GUM_COMPACT_EVENT_COMPILE:
+      {
+        gboolean is_block = cursor[-1] == GUM_COMPACT_EVENT_BLOCK;
+
+        if (!gum_read_address_delta (&cursor, end, self->previous_address,
+              &location) ||
+            !gum_read_uleb128 (&cursor, end, &size))
+        {
+          return FALSE;
+        }
+
+        event->type = is_block ? GUM_BLOCK : GUM_COMPILE;
+        event->block.start = GSIZE_TO_POINTER (location);
+        event->block.end = GSIZE_TO_POINTER (location + size);
+
+        self->previous_address = location;
+        self->cursor = cursor;
+
+        return TRUE;
+      }
+      case GUM_COMPACT_EVENT_BASE:
+      {
+        if (!gum_read_uleb128 (&cursor, end, &self->previous_address))
+          return FALSE;
+
+        self->cursor = cursor;
+
+        break;
+      }
+      default:
+        return FALSE;
+    }
+  }
+
+  return FALSE;
+}
+
+gboolean
+gum_event_reader_is_at_end (const GumEventReader * self)
+{
+  return self->cursor == self->end;
+}
+
+static guint
+gum_compact_event_encode (const GumEvent * event,
+                          guint64 * previous_address,
+                          guint8 * output)
+{
+  guint8 * cursor = output;
+
+  switch (event->type)
+  {
+    case GUM_CALL:
+    case GUM_RET:
+    {
+      const GumCallEvent * call = &event->call;
+      guint64 location = GPOINTER_TO_SIZE (call->location);
+      gint64 depth = call->depth;
+
+      *cursor++ = (event->type == GUM_CALL)
+          ? GUM_COMPACT_EVENT_CALL
+          : GUM_COMPACT_EVENT_RET;
+      cursor = gum_write_address_delta (cursor, location, *previous_address);
+      cursor = gum_write_address_delta (cursor,
+          GPOINTER_TO_SIZE (call->target), location);
+      cursor = gum_write_uleb128 (cursor,
+          ((guint64) depth << 1) ^ (guint64) (depth >> 63));
+
+      *previous_address = location;
+
+      break;
+    }
+    case GUM_EXEC:
+    {
+      guint64 location = GPOINTER_TO_SIZE (event->exec.location);
+
+      *cursor++ = GUM_COMPACT_EVENT_EXEC;
+      cursor = gum_write_address_delta (cursor, location, *previous_address);
+
+      *previous_address = location;
+
+      break;
+    }
+    case GUM_BLOCK:
+    case GUM_COMPILE:
+    {
+      const GumBlockEvent * block = &event->block;
+      guint64 start = GPOINTER_TO_SIZE (block->start);
+
+      *cursor++ = (event->type == GUM_BLOCK)
+          ? GUM_COMPACT_EVENT_BLOCK
+          : GUM_COMPACT_EVENT_COMPILE;
+      cursor = gum_write_address_delta (cursor, start, *previous_address);
+      cursor = gum_write_uleb128 (cursor,
+          GPOINTER_TO_SIZE (block->end) - start);
+
+      *previous_address = start;
+
+      break;
+    }
+    default:
+      g_assert_not_reached ();
+  }
+
+  return cursor - output;
+}
+
+static guint8 *
+gum_write_address_delta (guint8 * output,
+                         guint64 address,
+                         guint64 base)
+{
+  gint64 delta = (gint64) (address - base);
+
+  return gum_write_uleb128 (output,
+      ((guint64) delta << 1) ^ (guint64) (delta >> 63));
+}
+
+static guint8 *
+gum_write_uleb128 (guint8 * output,
+                   guint64 value)
+{
+  do
+  {
+    guint8 byte = value & 0x7f;
+
+    value >>= 7;
+    if (value != 0)
+      byte |= 0x80;
+
+    *output++ = byte;
+  }
+  while (value != 0);
+
+  return output;
+}
+
+static gboolean
+gum_read_address_delta (const guint8 ** data,
+                        const guint8 * end,
+                        guint64 base,
+                        guint64 * address)
+{
+  guint64 value;
+
+  if (!gum_read_uleb128 (data, end, &value))
+    return FALSE;
+
+  *address = base + (guint64) ((value >> 1) ^ -(gint64) (value & 1));
+
+  return TRUE;
+}
+
+static gboolean
+gum_read_uleb128 (const guint8 ** data,
+                  const guint8 * end,
+                  guint64 * value)
+{
+  const guint8 * p = *data;
+  guint64 result = 0;
+  guint shift = 0;
+
+  while (p != end && shift < 64)
+  {
+    guint8 byte = *p++;
+
+    result |= ((guint64) (byte & 0x7f)) << shift;
+
+    if ((byte & 0x80) == 0)
+    {
+      *data = p;
+      *value = result;
+
+      return TRUE;
+    }
+
+    shift += 7;
+  }
+
+  return FALSE;
+}
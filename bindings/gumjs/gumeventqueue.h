@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2021 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_EVENT_QUEUE_H__
+#define __GUM_EVENT_QUEUE_H__
+
+#include <gum/gumevent.h>
+#include <gum/gumprocess.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumEventQueue GumEventQueue;
+typedef guint GumEventEncoding;
+typedef struct _GumEventReader GumEventReader;
+
+typedef void (* GumEventQueueFoundDropsFunc) (GumThreadId thread_id,
+    guint n_dropped, gpointer user_data);
+
+enum _GumEventEncoding
+{
+  GUM_EVENT_ENCODING_DEFAULT,
+  GUM_EVENT_ENCODING_COMPACT
+};
+
+struct _GumEventReader
+{
+  const guint8 * cursor;
+  const guint8 * end;
+  GumEventEncoding encoding;
+  guint64 previous_address;
+};
+
+G_GNUC_INTERNAL GumEventQueue * gum_event_queue_new (guint capacity,
+    GumEventEncoding encoding);
+G_GNUC_INTERNAL void gum_event_queue_free (GumEventQueue * queue);
+
+G_GNUC_INTERNAL void gum_event_queue_push (GumEventQueue * self,
+    const GumEvent * event);
+G_GNUC_INTERNAL gpointer gum_event_queue_drain (GumEventQueue * self,
+    gsize * size);
+G_GNUC_INTERNAL gboolean gum_event_queue_enumerate_drops (
+    GumEventQueue * self, GumEventQueueFoundDropsFunc func,
+    gpointer user_data);
+
+G_GNUC_INTERNAL gboolean gum_event_reader_init (GumEventReader * reader,
+    gconstpointer data, gsize size);
+G_GNUC_INTERNAL gboolean gum_event_reader_next (GumEventReader * self,
+    GumEvent * event);
+G_GNUC_INTERNAL gboolean gum_event_reader_is_at_end (
+    const GumEventReader * self);
+
+G_END_DECLS
+
+#endif
@@ -6,18 +6,18 @@
 
 #include "gumquickeventsink.h"
 
+#include "gumeventqueue.h"
 #include "gumquickvalue.h"
 
-#include <gum/gumspinlock.h>
 #include <string.h>
 
+typedef struct _GumQuickDropsContext GumQuickDropsContext;
+
 struct _GumQuickJSEventSink
 {
   GObject parent;
 
-  GumSpinlock lock;
-  GArray * queue;
-  guint queue_capacity;
+  GumEventQueue * queue;
   guint queue_drain_interval;
 
   GumQuickCore * core;
@@ -28,6 +28,12 @@ struct _GumQuickJSEventSink
   GSource * source;
 };
 
+struct _GumQuickDropsContext
+{
+  JSContext * ctx;
+  JSValue drops;
+};
+
 struct _GumQuickNativeEventSink
 {
   GObject parent;
@@ -50,6 +56,8 @@ static void gum_quick_js_event_sink_stop (GumEventSink * sink);
 static gboolean gum_quick_js_event_sink_stop_when_idle (
     GumQuickJSEventSink * self);
 static gboolean gum_quick_js_event_sink_drain (GumQuickJSEventSink * self);
+static void gum_quick_js_event_sink_add_drops (GumThreadId thread_id,
+    guint n_dropped, GumQuickDropsContext * dc);
 
 static void gum_quick_native_event_sink_iface_init (gpointer g_iface,
     gpointer iface_data);
@@ -94,9 +102,8 @@ gum_quick_event_sink_new (JSContext * ctx,
 
     sink = g_object_new (GUM_QUICK_TYPE_JS_EVENT_SINK, NULL);
 
-    sink->queue = g_array_sized_new (FALSE, FALSE, sizeof (GumEvent),
-        options->queue_capacity);
-    sink->queue_capacity = options->queue_capacity;
+    sink->queue = gum_event_queue_new (options->queue_capacity,
+        options->event_encoding);
     sink->queue_drain_interval = options->queue_drain_interval;
 
     g_object_ref (options->core->script);
@@ -136,7 +143,6 @@ gum_quick_js_event_sink_iface_init (gpointer g_iface,
 static void
 gum_quick_js_event_sink_init (GumQuickJSEventSink * self)
 {
-  gum_spinlock_init (&self->lock);
 }
 
 static void
@@ -180,7 +186,7 @@ gum_quick_js_event_sink_finalize (GObject * obj)
 
   g_assert (self->source == NULL);
 
-  g_array_free (self->queue, TRUE);
+  gum_event_queue_free (self->queue);
 
   G_OBJECT_CLASS (gum_quick_js_event_sink_parent_class)->finalize (obj);
 }
@@ -213,10 +219,7 @@ gum_quick_js_event_sink_process (GumEventSink * sink,
 {
   GumQuickJSEventSink * self = GUM_QUICK_JS_EVENT_SINK_CAST (sink);
 
-  gum_spinlock_acquire (&self->lock);
-  if (self->queue->len != self->queue_capacity)
-    g_array_append_val (self->queue, *event);
-  gum_spinlock_release (&self->lock);
+  gum_event_queue_push (self->queue, event);
 }
 
 static void
@@ -272,37 +275,37 @@ static gboolean
 gum_quick_js_event_sink_drain (GumQuickJSEventSink * self)
 {
   GumQuickCore * core = self->core;
-  JSContext * ctx = core->ctx;
+  JSContext * ctx;
   gpointer buffer_data;
   JSValue buffer_val;
-  guint len, size;
+  gsize size;
   GumQuickScope scope;
+  GumQuickDropsContext dc;
 
   if (core == NULL)
     return FALSE;
+  ctx = core->ctx;
 
-  len = self->queue->len;
-  if (len == 0)
+  buffer_data = gum_event_queue_drain (self->queue, &size);
+  if (size == 0)
     return TRUE;
-  size = len * sizeof (GumEvent);
-
-  buffer_data = g_memdup (self->queue->data, size);
-
-  gum_spinlock_acquire (&self->lock);
-  g_array_remove_range (self->queue, 0, len);
-  gum_spinlock_release (&self->lock);
 
   _gum_quick_scope_enter (&scope, core);
 
   buffer_val = JS_NewArrayBuffer (ctx, buffer_data, size,
       _gum_quick_array_buffer_free, buffer_data, FALSE);
 
+  dc.ctx = ctx;
+  dc.drops = JS_UNDEFINED;
+  gum_event_queue_enumerate_drops (self->queue,
+      (GumEventQueueFoundDropsFunc) gum_quick_js_event_sink_add_drops, &dc);
+
   if (!JS_IsNull (self->on_call_summary))
   {
     JSValue summary;
     GHashTable * frequencies;
-    GumCallEvent * ev;
-    guint i;
+    GumEventReader reader;
+    GumEvent ev;
     GHashTableIter iter;
     gpointer target, count;
     gchar target_str[32];
@@ -311,19 +314,19 @@ gum_quick_js_event_sink_drain (GumQuickJSEventSink * self)
 
     frequencies = g_hash_table_new (NULL, NULL);
 
-    ev = buffer_data;
-    for (i = 0; i != len; i++)
+    gum_event_reader_init (&reader, buffer_data, size);
+    while (gum_event_reader_next (&reader, &ev))
     {
-      if (ev->type == GUM_CALL)
+      if (ev.type == GUM_CALL)
       {
         gsize n;
 
-        n = GPOINTER_TO_SIZE (g_hash_table_lookup (frequencies, ev->target));
+        n = GPOINTER_TO_SIZE (
+            g_hash_table_lookup (frequencies, ev.call.target));
         n++;
-        g_hash_table_insert (frequencies, ev->target, GSIZE_TO_POINTER (n));
+        g_hash_table_insert (frequencies, ev.call.target,
+            GSIZE_TO_POINTER (n));
       }
-
-      ev++;
     }
 
     g_hash_table_iter_init (&iter, frequencies);
@@ -347,10 +350,16 @@ gum_quick_js_event_sink_drain (GumQuickJSEventSink * self)
 
   if (!JS_IsNull (self->on_receive))
   {
+    JSValue argv[2];
+
+    argv[0] = buffer_val;
+    argv[1] = dc.drops;
+
     _gum_quick_scope_call_void (&scope, self->on_receive, JS_UNDEFINED,
-        1, &buffer_val);
+        G_N_ELEMENTS (argv), argv);
   }
 
+  JS_FreeValue (ctx, dc.drops);
   JS_FreeValue (ctx, buffer_val);
 
   _gum_quick_scope_leave (&scope);
@@ -358,6 +367,24 @@ gum_quick_js_event_sink_drain (GumQuickJSEventSink * self)
   return TRUE;
 }
 
+static void
+gum_quick_js_event_sink_add_drops (GumThreadId thread_id,
+                                   guint n_dropped,
+                                   GumQuickDropsContext * dc)
+{
+  JSContext * ctx = dc->ctx;
+  gchar thread_id_str[32];
+
+  if (JS_IsUndefined (dc->drops))
+    dc->drops = JS_NewObject (ctx);
+
+  sprintf (thread_id_str, "%" G_GSIZE_MODIFIER "u", (gsize) thread_id);
+  JS_DefinePropertyValueStr (ctx, dc->drops,
+      thread_id_str,
+      JS_NewUint32 (ctx, n_dropped),
+      JS_PROP_C_W_E);
+}
+
 static void
 gum_quick_native_event_sink_class_init (GumQuickNativeEventSinkClass * klass)
 {
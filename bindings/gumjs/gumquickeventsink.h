@@ -7,6 +7,7 @@
 #ifndef __GUM_QUICK_EVENT_SINK_H__
 #define __GUM_QUICK_EVENT_SINK_H__
 
+#include "gumeventqueue.h"
 #include "gumquickcore.h"
 
 #include <gum/gumeventsink.h>
@@ -39,6 +40,7 @@ struct _GumQuickEventSinkOptions
 
   guint queue_capacity;
   guint queue_drain_interval;
+  GumEventEncoding event_encoding;
   JSValue on_receive;
   JSValue on_call_summary;
 
@@ -561,8 +561,9 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
 
   listener->parent = self;
 
-  attach_ret = gum_interceptor_attach (self->interceptor, target,
-      GUM_INVOCATION_LISTENER (listener), listener_function_data);
+  attach_ret = gum_interceptor_attach_full (self->interceptor, target,
+      GUM_INVOCATION_LISTENER (listener), listener_function_data,
+      GUM_LISTENER_PROFILE_FULL, sizeof (GumQuickInvocationState));
 
   if (attach_ret != GUM_ATTACH_OK)
     goto unable_to_attach;
@@ -592,6 +593,9 @@ unable_to_attach:
       case GUM_ATTACH_POLICY_VIOLATION:
         _gum_quick_throw_literal (ctx, "not permitted by code-signing policy");
         break;
+      case GUM_ATTACH_WRONG_TYPE:
+        _gum_quick_throw_literal (ctx, "wrong type");
+        break;
       default:
         g_assert_not_reached ();
     }
@@ -683,6 +687,9 @@ unable_to_replace:
       case GUM_REPLACE_POLICY_VIOLATION:
         _gum_quick_throw_literal (ctx, "not permitted by code-signing policy");
         break;
+      case GUM_REPLACE_WRONG_TYPE:
+        _gum_quick_throw_literal (ctx, "wrong type");
+        break;
       default:
         g_assert_not_reached ();
     }
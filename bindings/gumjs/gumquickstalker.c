@@ -85,6 +85,8 @@ GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_drain_interval)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_drain_interval)
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_event_encoding)
+GUMJS_DECLARE_SETTER (gumjs_stalker_set_event_encoding)
 
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_flush)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_garbage_collect)
@@ -174,6 +176,8 @@ static const JSCFunctionListEntry gumjs_stalker_entries[] =
       gumjs_stalker_set_queue_capacity),
   JS_CGETSET_DEF ("queueDrainInterval", gumjs_stalker_get_queue_drain_interval,
       gumjs_stalker_set_queue_drain_interval),
+  JS_CGETSET_DEF ("eventEncoding", gumjs_stalker_get_event_encoding,
+      gumjs_stalker_set_event_encoding),
   JS_CFUNC_DEF ("flush", 0, gumjs_stalker_flush),
   JS_CFUNC_DEF ("garbageCollect", 0, gumjs_stalker_garbage_collect),
   JS_CFUNC_DEF ("_exclude", 0, gumjs_stalker_exclude),
@@ -241,6 +245,7 @@ _gum_quick_stalker_init (GumQuickStalker * self,
   self->stalker = NULL;
   self->queue_capacity = 16384;
   self->queue_drain_interval = 250;
+  self->event_encoding = GUM_EVENT_ENCODING_DEFAULT;
 
   self->flush_timer = NULL;
 
@@ -464,6 +469,37 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_queue_drain_interval)
   return JS_UNDEFINED;
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_event_encoding)
+{
+  GumQuickStalker * self = gumjs_get_parent_module (core);
+
+  return JS_NewString (ctx,
+      (self->event_encoding == GUM_EVENT_ENCODING_COMPACT)
+          ? "compact"
+          : "default");
+}
+
+GUMJS_DEFINE_SETTER (gumjs_stalker_set_event_encoding)
+{
+  GumQuickStalker * self = gumjs_get_parent_module (core);
+  const char * str;
+  JSValue result = JS_UNDEFINED;
+
+  if (!_gum_quick_string_get (ctx, val, &str))
+    return JS_EXCEPTION;
+
+  if (strcmp (str, "default") == 0)
+    self->event_encoding = GUM_EVENT_ENCODING_DEFAULT;
+  else if (strcmp (str, "compact") == 0)
+    self->event_encoding = GUM_EVENT_ENCODING_COMPACT;
+  else
+    result = _gum_quick_throw_literal (ctx, "invalid event encoding value");
+
+  JS_FreeCString (ctx, str);
+
+  return result;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_flush)
 {
   GumStalker * stalker =
@@ -523,6 +559,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   so.main_context = gum_script_scheduler_get_js_context (core->scheduler);
   so.queue_capacity = parent->queue_capacity;
   so.queue_drain_interval = parent->queue_drain_interval;
+  so.event_encoding = parent->event_encoding;
 
   if (!_gum_quick_args_parse (args, "ZF*?uF?F?pp", &thread_id,
       &transformer_callback_js, &transformer_callback_c, &so.event_mask,
@@ -690,27 +727,28 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
   JSValue result = JS_NULL;
   JSValue events_value;
   gboolean annotate, stringify;
-  const GumEvent * events;
-  size_t size, count, row_index;
-  const GumEvent * ev;
+  const guint8 * events;
+  size_t size;
+  GumEventReader reader;
+  GumEvent event;
+  const GumEvent * ev = &event;
+  uint32_t row_index;
   JSValue row = JS_NULL;
 
   if (!_gum_quick_args_parse (args, "Vtt", &events_value, &annotate,
       &stringify))
     return JS_EXCEPTION;
 
-  events = (const GumEvent *) JS_GetArrayBuffer (ctx, &size, events_value);
+  events = JS_GetArrayBuffer (ctx, &size, events_value);
   if (events == NULL)
     return JS_EXCEPTION;
 
-  if (size % sizeof (GumEvent) != 0)
+  if (!gum_event_reader_init (&reader, events, size))
     goto invalid_buffer_shape;
 
-  count = size / sizeof (GumEvent);
-
   result = JS_NewArray (ctx);
 
-  for (ev = events, row_index = 0; row_index != count; ev++, row_index++)
+  for (row_index = 0; gum_event_reader_next (&reader, &event); row_index++)
   {
     size_t column_index = 0;
 
@@ -793,10 +831,14 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
 #undef GUM_APPEND_PTR
 #undef GUM_APPEND_INT
 
-    JS_DefinePropertyValueUint32 (ctx, result, (uint32_t) row_index, row,
+    JS_DefinePropertyValueUint32 (ctx, result, row_index, row,
         JS_PROP_C_W_E);
+    row = JS_NULL;
   }
 
+  if (!gum_event_reader_is_at_end (&reader))
+    goto invalid_buffer_shape;
+
   return result;
 
 invalid_buffer_shape:
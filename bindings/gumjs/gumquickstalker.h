@@ -7,6 +7,7 @@
 #ifndef __GUM_QUICK_STALKER_H__
 #define __GUM_QUICK_STALKER_H__
 
+#include "gumeventqueue.h"
 #include "gumquickcodewriter.h"
 #include "gumquickinstruction.h"
 
@@ -25,6 +26,7 @@ struct _GumQuickStalker
   GumStalker * stalker;
   guint queue_capacity;
   guint queue_drain_interval;
+  GumEventEncoding event_encoding;
 
   GSource * flush_timer;
 
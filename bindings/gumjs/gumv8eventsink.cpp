@@ -6,21 +6,25 @@
 
 #include "gumv8eventsink.h"
 
+#include "gumeventqueue.h"
 #include "gumv8scope.h"
 #include "gumv8value.h"
 
-#include <gum/gumspinlock.h>
 #include <string.h>
 
 using namespace v8;
 
+struct GumV8DropsContext
+{
+  GumV8Core * core;
+  Local<Object> drops;
+};
+
 struct _GumV8JSEventSink
 {
   GObject parent;
 
-  GumSpinlock lock;
-  GArray * queue;
-  guint queue_capacity;
+  GumEventQueue * queue;
   guint queue_drain_interval;
 
   GumV8Core * core;
@@ -52,6 +56,8 @@ static void gum_v8_js_event_sink_flush (GumEventSink * sink);
 static void gum_v8_js_event_sink_stop (GumEventSink * sink);
 static gboolean gum_v8_js_event_sink_stop_when_idle (GumV8JSEventSink * self);
 static gboolean gum_v8_js_event_sink_drain (GumV8JSEventSink * self);
+static void gum_v8_js_event_sink_add_drops (GumThreadId thread_id,
+    guint n_dropped, GumV8DropsContext * dc);
 
 static void gum_v8_native_event_sink_iface_init (gpointer g_iface,
     gpointer iface_data);
@@ -94,9 +100,8 @@ gum_v8_event_sink_new (const GumV8EventSinkOptions * options)
     auto sink = GUM_V8_JS_EVENT_SINK (
         g_object_new (GUM_V8_TYPE_JS_EVENT_SINK, NULL));
 
-    sink->queue = g_array_sized_new (FALSE, FALSE, sizeof (GumEvent),
-        options->queue_capacity);
-    sink->queue_capacity = options->queue_capacity;
+    sink->queue = gum_event_queue_new (options->queue_capacity,
+        options->event_encoding);
     sink->queue_drain_interval = options->queue_drain_interval;
 
     g_object_ref (options->core->script);
@@ -143,7 +148,6 @@ gum_v8_js_event_sink_iface_init (gpointer g_iface,
 static void
 gum_v8_js_event_sink_init (GumV8JSEventSink * self)
 {
-  gum_spinlock_init (&self->lock);
 }
 
 static void
@@ -183,7 +187,7 @@ gum_v8_js_event_sink_finalize (GObject * obj)
 
   g_assert (self->source == NULL);
 
-  g_array_free (self->queue, TRUE);
+  gum_event_queue_free (self->queue);
 
   G_OBJECT_CLASS (gum_v8_js_event_sink_parent_class)->finalize (obj);
 }
@@ -216,10 +220,7 @@ gum_v8_js_event_sink_process (GumEventSink * sink,
 {
   auto self = GUM_V8_JS_EVENT_SINK_CAST (sink);
 
-  gum_spinlock_acquire (&self->lock);
-  if (self->queue->len != self->queue_capacity)
-    g_array_append_val (self->queue, *event);
-  gum_spinlock_release (&self->lock);
+  gum_event_queue_push (self->queue, event);
 }
 
 static void
@@ -272,23 +273,14 @@ gum_v8_js_event_sink_stop_when_idle (GumV8JSEventSink * self)
 static gboolean
 gum_v8_js_event_sink_drain (GumV8JSEventSink * self)
 {
-  gpointer buffer = NULL;
-  guint len, size;
+  gpointer buffer;
+  gsize size;
 
   auto core = self->core;
   if (core == NULL)
     return FALSE;
 
-  len = self->queue->len;
-  size = len * sizeof (GumEvent);
-  if (len != 0)
-  {
-    buffer = g_memdup (self->queue->data, size);
-
-    gum_spinlock_acquire (&self->lock);
-    g_array_remove_range (self->queue, 0, len);
-    gum_spinlock_release (&self->lock);
-  }
+  buffer = gum_event_queue_drain (self->queue, &size);
 
   if (buffer != NULL)
   {
@@ -298,19 +290,19 @@ gum_v8_js_event_sink_drain (GumV8JSEventSink * self)
     {
       frequencies = g_hash_table_new (NULL, NULL);
 
-      auto ev = (GumCallEvent *) buffer;
-      for (guint i = 0; i != len; i++)
+      GumEventReader reader;
+      GumEvent ev;
+      gum_event_reader_init (&reader, buffer, size);
+      while (gum_event_reader_next (&reader, &ev))
       {
-        if (ev->type == GUM_CALL)
+        if (ev.type == GUM_CALL)
         {
           auto count = GPOINTER_TO_SIZE (
-              g_hash_table_lookup (frequencies, ev->target));
+              g_hash_table_lookup (frequencies, ev.call.target));
           count++;
-          g_hash_table_insert (frequencies, ev->target,
+          g_hash_table_insert (frequencies, ev.call.target,
               GSIZE_TO_POINTER (count));
         }
-
-        ev++;
       }
     }
 
@@ -319,6 +311,15 @@ gum_v8_js_event_sink_drain (GumV8JSEventSink * self)
     auto context = isolate->GetCurrentContext ();
     auto recv = Undefined (isolate);
 
+    /*
+     * Drops are always acknowledged, even without an onReceive callback, as
+     * rings of threads that are gone are only reclaimed once their drops have
+     * been reported.
+     */
+    GumV8DropsContext dc = { core, Local<Object> () };
+    gum_event_queue_enumerate_drops (self->queue,
+        (GumEventQueueFoundDropsFunc) gum_v8_js_event_sink_add_drops, &dc);
+
     if (frequencies != NULL)
     {
       auto summary = Object::New (isolate);
@@ -352,6 +353,9 @@ gum_v8_js_event_sink_drain (GumV8JSEventSink * self)
       Local<Value> argv[] = {
         _gum_v8_array_buffer_new_take (isolate, g_steal_pointer (&buffer),
             size),
+        dc.drops.IsEmpty ()
+            ? Local<Value> (Undefined (isolate))
+            : Local<Value> (dc.drops),
       };
       auto result = on_receive->Call (context, recv, G_N_ELEMENTS (argv), argv);
       if (result.IsEmpty ())
@@ -364,6 +368,22 @@ gum_v8_js_event_sink_drain (GumV8JSEventSink * self)
   return TRUE;
 }
 
+static void
+gum_v8_js_event_sink_add_drops (GumThreadId thread_id,
+                                guint n_dropped,
+                                GumV8DropsContext * dc)
+{
+  auto isolate = dc->core->isolate;
+
+  if (dc->drops.IsEmpty ())
+    dc->drops = Object::New (isolate);
+
+  gchar thread_id_str[32];
+  sprintf (thread_id_str, "%" G_GSIZE_MODIFIER "u", (gsize) thread_id);
+  _gum_v8_object_set (dc->drops, thread_id_str,
+      Integer::NewFromUnsigned (isolate, n_dropped), dc->core);
+}
+
 static void
 gum_v8_native_event_sink_class_init (GumV8NativeEventSinkClass * klass)
 {
@@ -7,6 +7,7 @@
 #ifndef __GUM_V8_EVENT_SINK_H__
 #define __GUM_V8_EVENT_SINK_H__
 
+#include "gumeventqueue.h"
 #include "gumv8core.h"
 
 #include <gum/gumeventsink.h>
@@ -33,6 +34,7 @@ struct GumV8EventSinkOptions
 
   guint queue_capacity;
   guint queue_drain_interval;
+  GumEventEncoding event_encoding;
   v8::Local<v8::Function> on_receive;
   v8::Local<v8::Function> on_call_summary;
 
@@ -634,8 +634,9 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
     listener_function_data = NULL;
   }
 
-  auto attach_ret = gum_interceptor_attach (module->interceptor, target,
-      GUM_INVOCATION_LISTENER (listener), listener_function_data);
+  auto attach_ret = gum_interceptor_attach_full (module->interceptor, target,
+      GUM_INVOCATION_LISTENER (listener), listener_function_data,
+      GUM_LISTENER_PROFILE_FULL, sizeof (GumV8InvocationState));
 
   if (attach_ret == GUM_ATTACH_OK)
   {
@@ -671,6 +672,9 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
       _gum_v8_throw_ascii_literal (isolate,
           "not permitted by code-signing policy");
       break;
+    case GUM_ATTACH_WRONG_TYPE:
+      _gum_v8_throw_ascii_literal (isolate, "wrong type");
+      break;
     default:
       g_assert_not_reached ();
   }
@@ -740,6 +744,9 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_replace)
       _gum_v8_throw_ascii_literal (isolate,
           "not permitted by code-signing policy");
       break;
+    case GUM_REPLACE_WRONG_TYPE:
+      _gum_v8_throw_ascii_literal (isolate, "wrong type");
+      break;
     default:
       g_assert_not_reached ();
   }
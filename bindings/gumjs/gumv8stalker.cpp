@@ -95,6 +95,8 @@ GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_drain_interval)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_drain_interval)
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_event_encoding)
+GUMJS_DECLARE_SETTER (gumjs_stalker_set_event_encoding)
 
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_flush)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_garbage_collect)
@@ -192,6 +194,11 @@ static const GumV8Property gumjs_stalker_values[] =
     gumjs_stalker_get_queue_drain_interval,
     gumjs_stalker_set_queue_drain_interval
   },
+  {
+    "eventEncoding",
+    gumjs_stalker_get_event_encoding,
+    gumjs_stalker_set_event_encoding
+  },
 
   { NULL, NULL, NULL }
 };
@@ -245,6 +252,7 @@ _gum_v8_stalker_init (GumV8Stalker * self,
   self->stalker = NULL;
   self->queue_capacity = 16384;
   self->queue_drain_interval = 250;
+  self->event_encoding = GUM_EVENT_ENCODING_DEFAULT;
 
   self->flush_timer = NULL;
 
@@ -506,6 +514,37 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_queue_drain_interval)
   module->queue_drain_interval = interval;
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_event_encoding)
+{
+  info.GetReturnValue ().Set (_gum_v8_string_new_ascii (isolate,
+      (module->event_encoding == GUM_EVENT_ENCODING_COMPACT)
+          ? "compact"
+          : "default"));
+}
+
+GUMJS_DEFINE_SETTER (gumjs_stalker_set_event_encoding)
+{
+  if (value->IsString ())
+  {
+    String::Utf8Value str_value (isolate, value);
+    auto str = *str_value;
+
+    if (strcmp (str, "default") == 0)
+    {
+      module->event_encoding = GUM_EVENT_ENCODING_DEFAULT;
+      return;
+    }
+
+    if (strcmp (str, "compact") == 0)
+    {
+      module->event_encoding = GUM_EVENT_ENCODING_COMPACT;
+      return;
+    }
+  }
+
+  _gum_v8_throw_ascii_literal (isolate, "invalid event encoding value");
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_flush)
 {
   auto stalker = _gum_v8_stalker_get (module);
@@ -550,6 +589,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   so.main_context = gum_script_scheduler_get_js_context (core->scheduler);
   so.queue_capacity = module->queue_capacity;
   so.queue_drain_interval = module->queue_drain_interval;
+  so.event_encoding = module->event_encoding;
 
   gpointer user_data;
 
@@ -701,23 +741,22 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
   }
 
   auto events_store = events_value.As<ArrayBuffer> ()->GetBackingStore ();
-  const GumEvent * events = (const GumEvent *) events_store->Data ();
-  size_t size = events_store->ByteLength ();
-  if (size % sizeof (GumEvent) != 0)
+  GumEventReader reader;
+  if (!gum_event_reader_init (&reader, events_store->Data (),
+      events_store->ByteLength ()))
   {
     _gum_v8_throw_ascii_literal (isolate, "invalid buffer shape");
     return;
   }
 
-  size_t count = size / sizeof (GumEvent);
+  auto rows = Array::New (isolate);
 
-  auto rows = Array::New (isolate, (int) count);
-
-  const GumEvent * ev;
-  size_t row_index;
-  for (ev = events, row_index = 0;
-      row_index != count;
-      ev++, row_index++)
+  GumEvent event;
+  const GumEvent * ev = &event;
+  uint32_t row_index;
+  for (row_index = 0;
+      gum_event_reader_next (&reader, &event);
+      row_index++)
   {
     Local<Array> row;
     guint column_index = 0;
@@ -841,7 +880,13 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
         return;
     }
 
-    rows->Set (context, (uint32_t) row_index, row).Check ();
+    rows->Set (context, row_index, row).Check ();
+  }
+
+  if (!gum_event_reader_is_at_end (&reader))
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid buffer shape");
+    return;
   }
 
   info.GetReturnValue ().Set (rows);
@@ -7,6 +7,7 @@
 #ifndef __GUM_V8_STALKER_H__
 #define __GUM_V8_STALKER_H__
 
+#include "gumeventqueue.h"
 #include "gumv8codewriter.h"
 #include "gumv8core.h"
 #include "gumv8instruction.h"
@@ -23,6 +24,7 @@ struct GumV8Stalker
   GumStalker * stalker;
   guint queue_capacity;
   guint queue_drain_interval;
+  GumEventEncoding event_encoding;
 
   GSource * flush_timer;
 
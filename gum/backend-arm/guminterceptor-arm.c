@@ -460,6 +460,13 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   return TRUE;
 }
 
+gboolean
+_gum_interceptor_backend_prepare_lazy_trampoline (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  return FALSE;
+}
+
 void
 _gum_interceptor_backend_destroy_trampoline (GumInterceptorBackend * self,
                                              GumFunctionContext * ctx)
@@ -548,6 +555,15 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
       ctx->overwritten_prologue_len);
 }
 
+gboolean
+_gum_interceptor_backend_create_probe (GumInterceptorBackend * self,
+                                       GumFunctionContext * ctx,
+                                       GumProbe * probe,
+                                       gpointer exit)
+{
+  return FALSE;
+}
+
 gpointer
 _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
 {
@@ -16,6 +16,7 @@
 #include "gumthumbwriter.h"
 #include "gumtls.h"
 
+#include <gio/gio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -789,6 +790,36 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->trust_threshold = trust_threshold;
 }
 
+void
+gum_stalker_set_superblock_threshold (GumStalker * self,
+                                      guint threshold)
+{
+}
+
+void
+gum_stalker_set_background_compilation_enabled (GumStalker * self,
+                                                gboolean enabled)
+{
+}
+
+gboolean
+gum_stalker_save_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported");
+  return FALSE;
+}
+
+gboolean
+gum_stalker_load_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported");
+  return FALSE;
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -550,6 +550,17 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   gum_darwin_enumerate_ranges (mach_task_self (), prot, func, user_data);
 }
 
+gpointer
+_gum_process_find_loader_notifier (void)
+{
+  GumDarwinAllImageInfos infos;
+
+  if (!gum_darwin_query_all_image_infos (mach_task_self (), &infos))
+    return NULL;
+
+  return GSIZE_TO_POINTER (infos.notification_address);
+}
+
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
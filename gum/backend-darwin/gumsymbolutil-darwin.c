@@ -11,6 +11,7 @@
 #include "gumdarwinsymbolicator.h"
 
 #include <mach-o/dyld.h>
+#include <string.h>
 
 #define GUM_TYPE_SYMBOL_CACHE_INVALIDATOR \
     (gum_symbol_cache_invalidator_get_type ())
@@ -108,6 +109,36 @@ gum_symbol_details_from_address (gpointer address,
   return success;
 }
 
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details)
+{
+  guint n_resolved, i;
+  GumDarwinSymbolicator * symbolicator;
+
+  if ((symbolicator = gum_try_obtain_symbolicator ()) == NULL)
+  {
+    memset (details, 0, n_addresses * sizeof (GumDebugSymbolDetails));
+    return 0;
+  }
+
+  n_resolved = 0;
+
+  for (i = 0; i != n_addresses; i++)
+  {
+    if (gum_darwin_symbolicator_details_from_address (symbolicator,
+        GUM_ADDRESS (addresses[i]), &details[i]))
+      n_resolved++;
+    else
+      memset (&details[i], 0, sizeof (GumDebugSymbolDetails));
+  }
+
+  g_object_unref (symbolicator);
+
+  return n_resolved;
+}
+
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
@@ -88,6 +88,26 @@ gum_symbol_details_from_address (gpointer address,
   return (has_sym_info || has_file_info);
 }
 
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details)
+{
+  guint n_resolved, i;
+
+  n_resolved = 0;
+
+  for (i = 0; i != n_addresses; i++)
+  {
+    if (gum_symbol_details_from_address (addresses[i], &details[i]))
+      n_resolved++;
+    else
+      memset (&details[i], 0, sizeof (GumDebugSymbolDetails));
+  }
+
+  return n_resolved;
+}
+
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
@@ -24,10 +24,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#define GUM_ELF_VERSION_HIDDEN 0x8000
+
 typedef struct _GumElfEnumerateDepsContext GumElfEnumerateDepsContext;
 typedef struct _GumElfEnumerateImportsContext GumElfEnumerateImportsContext;
 typedef struct _GumElfEnumerateExportsContext GumElfEnumerateExportsContext;
 typedef struct _GumElfStoreSymtabParamsContext GumElfStoreSymtabParamsContext;
+typedef struct _GumElfFindExportContext GumElfFindExportContext;
 
 enum
 {
@@ -59,16 +62,22 @@ struct _GumElfEnumerateExportsContext
 
 struct _GumElfStoreSymtabParamsContext
 {
-  guint pending;
-  gboolean found_hash;
-
   gpointer entries;
   gsize entry_size;
-  gsize entry_count;
+  const guint32 * gnu_hash;
+  const guint32 * sysv_hash;
+  const guint16 * versions;
 
   GumElfModule * module;
 };
 
+struct _GumElfFindExportContext
+{
+  const gchar * name;
+  GumAddress address;
+  GumAddress hidden_address;
+};
+
 struct _GumElfStoreFindStringTableContext
 {
   GumElfModule * module;
@@ -87,8 +96,24 @@ static gboolean gum_emit_elf_import (const GumElfSymbolDetails * details,
     gpointer user_data);
 static gboolean gum_emit_elf_export (const GumElfSymbolDetails * details,
     gpointer user_data);
+static gboolean gum_elf_symbol_is_export (const GumElfSymbolDetails * details);
+static void gum_elf_module_find_gnu_hashed_export (GumElfModule * self,
+    GumElfFindExportContext * ctx);
+static void gum_elf_module_find_sysv_hashed_export (GumElfModule * self,
+    GumElfFindExportContext * ctx);
+static gboolean gum_elf_module_check_export_candidate (GumElfModule * self,
+    gsize index, GumElfFindExportContext * ctx);
+static void gum_elf_module_read_dynamic_symbol (GumElfModule * self,
+    gsize index, GumElfSymbolDetails * details);
+static void gum_elf_module_load_symtab_params (GumElfModule * self);
 static gboolean gum_store_symtab_params (
     const GumElfDynamicEntryDetails * details, gpointer user_data);
+static gboolean gum_elf_module_measure_gnu_hash (GumElfModule * self,
+    const guint32 * hash_params, gsize * symbol_count);
+static gboolean gum_elf_module_measure_sysv_hash (GumElfModule * self,
+    const guint32 * hash_params, gsize * symbol_count);
+static gsize gum_elf_module_find_section_size (GumElfModule * self,
+    GumElfSectionHeaderType type);
 static void gum_elf_module_enumerate_symbols_in_section (GumElfModule * self,
     GumElfSectionHeaderType section, GumElfFoundSymbolFunc func,
     gpointer user_data);
@@ -201,6 +226,8 @@ gum_elf_module_constructed (GObject * object)
   gum_elf_module_enumerate_dynamic_entries (self,
       gum_store_dynamic_string_table, self);
 
+  gum_elf_module_load_symtab_params (self);
+
   self->valid = TRUE;
   return;
 
@@ -425,9 +452,7 @@ gum_emit_elf_export (const GumElfSymbolDetails * details,
 {
   GumElfEnumerateExportsContext * ctx = user_data;
 
-  if (details->section_header_index != SHN_UNDEF &&
-      (details->type == STT_FUNC || details->type == STT_OBJECT) &&
-      (details->bind == STB_GLOBAL || details->bind == STB_WEAK))
+  if (gum_elf_symbol_is_export (details))
   {
     GumExportDetails d;
 
@@ -444,67 +469,274 @@ gum_emit_elf_export (const GumElfSymbolDetails * details,
   return TRUE;
 }
 
+static gboolean
+gum_elf_symbol_is_export (const GumElfSymbolDetails * details)
+{
+  return details->section_header_index != SHN_UNDEF &&
+      (details->type == STT_FUNC || details->type == STT_OBJECT) &&
+      (details->bind == STB_GLOBAL || details->bind == STB_WEAK);
+}
+
+/*
+ * Looks the symbol up through the module's DT_GNU_HASH or DT_HASH table, so
+ * it costs the same no matter how many symbols the module has. Like the
+ * dynamic linker does for unversioned lookups, the default version of a
+ * symbol is preferred over hidden ones.
+ */
+GumAddress
+gum_elf_module_find_export_by_name (GumElfModule * self,
+                                    const gchar * name)
+{
+  GumElfFindExportContext ctx;
+
+#ifdef HAVE_ANDROID
+  GumAddress address;
+
+  if (gum_android_is_linker_module_name (self->path) &&
+      gum_android_try_resolve_magic_export (self->path, name, &address))
+    return address;
+#endif
+
+  ctx.name = name;
+  ctx.address = 0;
+  ctx.hidden_address = 0;
+
+  if (self->dynamic_gnu_hash != NULL)
+    gum_elf_module_find_gnu_hashed_export (self, &ctx);
+  else if (self->dynamic_sysv_hash != NULL)
+    gum_elf_module_find_sysv_hashed_export (self, &ctx);
+
+  return (ctx.address != 0) ? ctx.address : ctx.hidden_address;
+}
+
+static void
+gum_elf_module_find_gnu_hashed_export (GumElfModule * self,
+                                       GumElfFindExportContext * ctx)
+{
+  const guint32 * hash_params = self->dynamic_gnu_hash;
+  const guint bloom_word_bits = 8 * sizeof (gsize);
+  guint32 nbuckets, symoffset, bloom_size, bloom_shift;
+  const gsize * bloom;
+  const guint32 * buckets, * chain;
+  guint32 hash;
+  gsize index;
+  const guchar * cur;
+  gsize bloom_word, bloom_mask;
+
+  nbuckets = hash_params[0];
+  symoffset = hash_params[1];
+  bloom_size = hash_params[2];
+  bloom_shift = hash_params[3];
+  bloom = (const gsize *) (hash_params + 4);
+  buckets = (const guint32 *) (bloom + bloom_size);
+  chain = buckets + nbuckets;
+
+  if (nbuckets == 0 || bloom_size == 0)
+    return;
+
+  hash = 5381;
+  for (cur = (const guchar *) ctx->name; *cur != '\0'; cur++)
+    hash = (hash << 5) + hash + *cur;
+
+  bloom_word = bloom[(hash / bloom_word_bits) % bloom_size];
+  bloom_mask = ((gsize) 1 << (hash % bloom_word_bits)) |
+      ((gsize) 1 << ((hash >> bloom_shift) % bloom_word_bits));
+  if ((bloom_word & bloom_mask) != bloom_mask)
+    return;
+
+  /*
+   * The symbol count was derived from this table when the module was
+   * loaded, with every chain checked against the size of its section, so
+   * staying below it keeps us inside the table.
+   */
+  for (index = buckets[hash % nbuckets];
+      index >= symoffset && index < self->dynamic_symbol_count;
+      index++)
+  {
+    guint32 candidate_hash = chain[index - symoffset];
+
+    if ((candidate_hash | 1) == (hash | 1) &&
+        gum_elf_module_check_export_candidate (self, index, ctx))
+      return;
+
+    if ((candidate_hash & 1) != 0)
+      return;
+  }
+}
+
+static void
+gum_elf_module_find_sysv_hashed_export (GumElfModule * self,
+                                        GumElfFindExportContext * ctx)
+{
+  const guint32 * hash_params = self->dynamic_sysv_hash;
+  guint32 nbucket, nchain;
+  const guint32 * buckets, * chain;
+  guint32 hash, index, remaining;
+  const guchar * cur;
+
+  nbucket = hash_params[0];
+  nchain = hash_params[1];
+  buckets = hash_params + 2;
+  chain = buckets + nbucket;
+
+  if (nbucket == 0)
+    return;
+
+  hash = 0;
+  for (cur = (const guchar *) ctx->name; *cur != '\0'; cur++)
+  {
+    guint32 high;
+
+    hash = (hash << 4) + *cur;
+    high = hash & 0xf0000000;
+    if (high != 0)
+      hash ^= high >> 24;
+    hash &= ~high;
+  }
+
+  /* Bounding the walk by the chain length also guards against cycles. */
+  for (index = buckets[hash % nbucket], remaining = nchain;
+      index != STN_UNDEF && index < nchain &&
+          index < self->dynamic_symbol_count && remaining != 0;
+      index = chain[index], remaining--)
+  {
+    if (gum_elf_module_check_export_candidate (self, index, ctx))
+      return;
+  }
+}
+
+static gboolean
+gum_elf_module_check_export_candidate (GumElfModule * self,
+                                       gsize index,
+                                       GumElfFindExportContext * ctx)
+{
+  GumElfSymbolDetails details;
+
+  gum_elf_module_read_dynamic_symbol (self, index, &details);
+
+  if (strcmp (details.name, ctx->name) != 0 ||
+      !gum_elf_symbol_is_export (&details))
+    return FALSE;
+
+  if (self->dynamic_versions != NULL &&
+      (self->dynamic_versions[index] & GUM_ELF_VERSION_HIDDEN) != 0)
+  {
+    if (ctx->hidden_address == 0)
+      ctx->hidden_address = details.address;
+    return FALSE;
+  }
+
+  ctx->address = details.address;
+  return TRUE;
+}
+
 void
 gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
                                           GumElfFoundSymbolFunc func,
                                           gpointer user_data)
 {
-  GumElfStoreSymtabParamsContext ctx;
   gsize entry_index;
+
+  for (entry_index = 1; entry_index < self->dynamic_symbol_count;
+      entry_index++)
+  {
+    GumElfSymbolDetails details;
+
+    gum_elf_module_read_dynamic_symbol (self, entry_index, &details);
+
+    if (!func (&details, user_data))
+      return;
+  }
+}
+
+static void
+gum_elf_module_read_dynamic_symbol (GumElfModule * self,
+                                    gsize index,
+                                    GumElfSymbolDetails * details)
+{
+  gpointer entry = self->dynamic_symbols + (index * self->dynamic_symbol_size);
   const gchar * dynamic_strings = self->dynamic_strings;
+  GumAddress raw_address;
+
+  if (sizeof (gpointer) == 4)
+  {
+    Elf32_Sym * sym = entry;
 
-  ctx.pending = 3;
-  ctx.found_hash = FALSE;
+    details->name = dynamic_strings + sym->st_name;
+    details->size = sym->st_size;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+
+    raw_address = sym->st_value;
+  }
+  else
+  {
+    Elf64_Sym * sym = entry;
+
+    details->name = dynamic_strings + sym->st_name;
+    details->size = sym->st_size;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+
+    raw_address = sym->st_value;
+  }
+
+  details->address = (raw_address != 0)
+      ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
+      : 0;
+}
+
+static void
+gum_elf_module_load_symtab_params (GumElfModule * self)
+{
+  GumElfStoreSymtabParamsContext ctx;
+  gsize symbol_count, n;
 
   ctx.entries = NULL;
   ctx.entry_size = 0;
-  ctx.entry_count = 0;
+  ctx.gnu_hash = NULL;
+  ctx.sysv_hash = NULL;
+  ctx.versions = NULL;
 
   ctx.module = self;
 
   gum_elf_module_enumerate_dynamic_entries (self, gum_store_symtab_params,
       &ctx);
-  if (ctx.pending != 0)
+  if (ctx.entries == NULL || ctx.entry_size == 0)
     return;
 
-  for (entry_index = 1; entry_index != ctx.entry_count; entry_index++)
-  {
-    gpointer entry = ctx.entries + (entry_index * ctx.entry_size);
-    GumElfSymbolDetails details;
-    GumAddress raw_address;
-
-    if (sizeof (gpointer) == 4)
-    {
-      Elf32_Sym * sym = entry;
+  symbol_count = G_MAXSIZE;
 
-      details.name = dynamic_strings + sym->st_name;
-      details.size = sym->st_size;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
-
-      raw_address = sym->st_value;
-    }
+  if (ctx.gnu_hash != NULL)
+  {
+    if (gum_elf_module_measure_gnu_hash (self, ctx.gnu_hash, &n))
+      symbol_count = MIN (n, symbol_count);
     else
-    {
-      Elf64_Sym * sym = entry;
+      ctx.gnu_hash = NULL;
+  }
 
-      details.name = dynamic_strings + sym->st_name;
-      details.size = sym->st_size;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
+  if (ctx.sysv_hash != NULL)
+  {
+    if (gum_elf_module_measure_sysv_hash (self, ctx.sysv_hash, &n))
+      symbol_count = MIN (n, symbol_count);
+    else
+      ctx.sysv_hash = NULL;
+  }
 
-      raw_address = sym->st_value;
-    }
+  if (ctx.gnu_hash == NULL && ctx.sysv_hash == NULL)
+    return;
 
-    details.address = (raw_address != 0)
-        ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
-        : 0;
+  symbol_count = MIN (symbol_count,
+      gum_elf_module_find_section_size (self, SHT_DYNSYM) / ctx.entry_size);
 
-    if (!func (&details, user_data))
-      return;
-  }
+  self->dynamic_symbols = ctx.entries;
+  self->dynamic_symbol_size = ctx.entry_size;
+  self->dynamic_symbol_count = symbol_count;
+  self->dynamic_gnu_hash = ctx.gnu_hash;
+  self->dynamic_sysv_hash = ctx.sysv_hash;
+  self->dynamic_versions = ctx.versions;
 }
 
 static gboolean
@@ -519,87 +751,135 @@ gum_store_symtab_params (const GumElfDynamicEntryDetails * details,
       ctx->entries = GSIZE_TO_POINTER (
           gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
               details->value));
-      ctx->pending--;
       break;
     case DT_SYMENT:
       ctx->entry_size = details->value;
-      ctx->pending--;
       break;
     case DT_HASH:
-    {
-      const guint32 * hash_params;
-      guint32 nchain;
-
-      if (ctx->found_hash)
-        break;
-      ctx->found_hash = TRUE;
-
-      hash_params = GSIZE_TO_POINTER (
+      ctx->sysv_hash = GSIZE_TO_POINTER (
           gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
               details->value));
-      nchain = hash_params[1];
-
-      ctx->entry_count = nchain;
-      ctx->pending--;
-
       break;
-    }
 #ifdef DT_GNU_HASH
     case DT_GNU_HASH:
-    {
-      const guint32 * hash_params;
-      guint32 nbuckets;
-      guint32 symoffset;
-      guint32 bloom_size;
-      const gsize * bloom;
-      const guint32 * buckets;
-      const guint32 * chain;
-      guint32 highest_index, bucket_index;
-
-      if (ctx->found_hash)
-        break;
-      ctx->found_hash = TRUE;
-
-      hash_params = GSIZE_TO_POINTER (
+      ctx->gnu_hash = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+#endif
+#ifdef DT_VERSYM
+    case DT_VERSYM:
+      ctx->versions = GSIZE_TO_POINTER (
           gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
               details->value));
-      nbuckets = hash_params[0];
-      symoffset = hash_params[1];
-      bloom_size = hash_params[2];
-      bloom = (gsize *) (hash_params + 4);
-      buckets = (const guint32 *) (bloom + bloom_size);
-      chain = buckets + nbuckets;
-
-      highest_index = 0;
-      for (bucket_index = 0; bucket_index != nbuckets; bucket_index++)
-      {
-        highest_index = MAX (buckets[bucket_index], highest_index);
-      }
-
-      if (highest_index >= symoffset)
-      {
-        while (TRUE)
-        {
-          guint32 hash = chain[highest_index - symoffset];
-
-          if ((hash & 1) != 0)
-            break;
-
-          highest_index++;
-        }
-      }
-
-      ctx->entry_count = highest_index + 1;
-      ctx->pending--;
-
       break;
-    }
 #endif
     default:
       break;
   }
 
-  return ctx->pending != 0;
+  return TRUE;
+}
+
+/*
+ * Works out how many dynamic symbols the table covers, making sure that its
+ * buckets and every chain fit inside its section. When the section headers
+ * are missing only the chain terminators bound the walk.
+ */
+static gboolean
+gum_elf_module_measure_gnu_hash (GumElfModule * self,
+                                 const guint32 * hash_params,
+                                 gsize * symbol_count)
+{
+  gsize size, chain_length;
+  guint32 nbuckets, symoffset, bloom_size;
+  guint64 chain_offset;
+  const gsize * bloom;
+  const guint32 * buckets, * chain;
+  guint32 highest_index, bucket_index;
+
+  size = gum_elf_module_find_section_size (self, SHT_GNU_HASH);
+  if (size < 4 * sizeof (guint32))
+    return FALSE;
+
+  nbuckets = hash_params[0];
+  symoffset = hash_params[1];
+  bloom_size = hash_params[2];
+  bloom = (const gsize *) (hash_params + 4);
+  buckets = (const guint32 *) (bloom + bloom_size);
+  chain = buckets + nbuckets;
+
+  chain_offset = (4 * sizeof (guint32)) +
+      ((guint64) bloom_size * sizeof (gsize)) +
+      ((guint64) nbuckets * sizeof (guint32));
+  if (chain_offset > size)
+    return FALSE;
+  chain_length = (size != G_MAXSIZE)
+      ? (size - (gsize) chain_offset) / sizeof (guint32)
+      : G_MAXSIZE;
+
+  highest_index = 0;
+  for (bucket_index = 0; bucket_index != nbuckets; bucket_index++)
+  {
+    highest_index = MAX (buckets[bucket_index], highest_index);
+  }
+
+  if (highest_index >= symoffset)
+  {
+    while (TRUE)
+    {
+      guint32 hash;
+
+      if (highest_index - symoffset >= chain_length)
+        return FALSE;
+
+      hash = chain[highest_index - symoffset];
+      if ((hash & 1) != 0)
+        break;
+
+      highest_index++;
+    }
+  }
+
+  *symbol_count = (gsize) highest_index + 1;
+
+  return TRUE;
+}
+
+static gboolean
+gum_elf_module_measure_sysv_hash (GumElfModule * self,
+                                  const guint32 * hash_params,
+                                  gsize * symbol_count)
+{
+  gsize size;
+  guint32 nbucket, nchain;
+
+  size = gum_elf_module_find_section_size (self, SHT_HASH);
+  if (size < 2 * sizeof (guint32))
+    return FALSE;
+
+  nbucket = hash_params[0];
+  nchain = hash_params[1];
+
+  if ((2 + (guint64) nbucket + (guint64) nchain) * sizeof (guint32) > size)
+    return FALSE;
+
+  *symbol_count = nchain;
+
+  return TRUE;
+}
+
+static gsize
+gum_elf_module_find_section_size (GumElfModule * self,
+                                  GumElfSectionHeaderType type)
+{
+  Elf_Scn * scn;
+  GElf_Shdr shdr;
+
+  if (!gum_elf_module_find_section_header_by_type (self, type, &scn, &shdr))
+    return G_MAXSIZE;
+
+  return shdr.sh_size;
 }
 
 void
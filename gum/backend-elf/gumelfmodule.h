@@ -60,6 +60,13 @@ struct _GumElfModule
   GumElfDynamicAddressState dynamic_address_state;
 
   const gchar * dynamic_strings;
+
+  gpointer dynamic_symbols;
+  gsize dynamic_symbol_size;
+  gsize dynamic_symbol_count;
+  const guint32 * dynamic_gnu_hash;
+  const guint32 * dynamic_sysv_hash;
+  const guint16 * dynamic_versions;
 };
 
 enum _GumElfSource
@@ -121,6 +128,8 @@ GUM_API void gum_elf_module_enumerate_imports (GumElfModule * self,
     GumFoundImportFunc func, gpointer user_data);
 GUM_API void gum_elf_module_enumerate_exports (GumElfModule * self,
     GumFoundExportFunc func, gpointer user_data);
+GUM_API GumAddress gum_elf_module_find_export_by_name (GumElfModule * self,
+    const gchar * name);
 GUM_API void gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
     GumElfFoundSymbolFunc func, gpointer user_data);
 GUM_API void gum_elf_module_enumerate_symbols (GumElfModule * self,
@@ -9,8 +9,12 @@
 
 #include "backend-elf/gumelfmodule.h"
 #include "gum-init.h"
+#include "gummodulemap.h"
+#include "gumprocess-priv.h"
+#ifdef HAVE_LINUX
+# include "backend-linux/gumlinux-priv.h"
+#endif
 
-#include <dlfcn.h>
 #include <dwarf.h>
 #ifdef __clang__
 # pragma clang diagnostic push
@@ -20,11 +24,14 @@
 #ifdef __clang__
 # pragma clang diagnostic pop
 #endif
+#include <string.h>
 #include <strings.h>
 
-#define GUM_MAX_CACHE_AGE (0.5)
+#define GUM_MODULE_ENTRIES_REFRESH_INTERVAL (G_USEC_PER_SEC / 2)
 
 typedef struct _GumModuleEntry GumModuleEntry;
+typedef struct _GumSymbolTable GumSymbolTable;
+typedef struct _GumSymbolEntry GumSymbolEntry;
 
 typedef struct _GumNearestSymbolDetails GumNearestSymbolDetails;
 typedef struct _GumDwarfSymbolDetails GumDwarfSymbolDetails;
@@ -42,9 +49,30 @@ typedef gboolean (* GumFoundDieFunc) (const GumDieDetails * details,
 
 struct _GumModuleEntry
 {
+  gint ref_count;
+
   GumElfModule * module;
+  GumMemoryRange range;
+
+  GMutex dbg_mutex;
   Dwarf_Debug dbg;
-  gboolean collected;
+
+  GumSymbolTable * volatile symbols;
+};
+
+struct _GumSymbolTable
+{
+  GArray * entries;
+  GArray * by_name;
+  GStringChunk * names;
+  GArray * code_ranges;
+};
+
+struct _GumSymbolEntry
+{
+  GumAddress address;
+  gsize size;
+  const gchar * name;
 };
 
 struct _GumNearestSymbolDetails
@@ -94,22 +122,53 @@ struct _GumDieDetails
   Dwarf_Debug dbg;
 };
 
-static gboolean gum_find_nearest_symbol_by_address (gpointer address,
-    GumNearestSymbolDetails * nearest);
-static GumModuleEntry * gum_module_entry_from_address (gpointer address,
-    GumNearestSymbolDetails * nearest);
-static GumModuleEntry * gum_module_entry_from_path_and_base (const gchar * path,
-    GumAddress base_address);
+static gboolean gum_module_entry_resolve_details (GumModuleEntry * self,
+    gpointer address, GumDebugSymbolDetails * details);
+static gchar * gum_module_entry_resolve_name (GumModuleEntry * self,
+    gpointer address);
+static gboolean gum_module_entry_find_nearest_symbol (GumModuleEntry * self,
+    gpointer address, GumNearestSymbolDetails * nearest);
+
+static GumModuleEntry * gum_module_entry_from_address (gpointer address);
+static GumModuleEntry * gum_module_entry_lookup (const gchar * path,
+    const GumMemoryRange * range);
+static GumModuleEntry * gum_module_entry_insert (const gchar * path,
+    const GumMemoryRange * range);
+static GumModuleEntry * gum_module_entry_new (const gchar * path,
+    const GumMemoryRange * range);
+static GumModuleEntry * gum_module_entry_ref (GumModuleEntry * entry);
+static void gum_module_entry_unref (GumModuleEntry * entry);
+static gboolean gum_module_entry_contains (GumModuleEntry * self,
+    gpointer address);
 static Dwarf_Addr gum_module_entry_virtual_address_to_file (
     GumModuleEntry * self, gpointer address);
-
-static GHashTable * gum_get_function_addresses (void);
-static GHashTable * gum_get_address_symbols (void);
-static void gum_maybe_refresh_symbol_caches (void);
-static gboolean gum_collect_module_functions (const GumModuleDetails * details,
+static GumSymbolTable * gum_module_entry_get_symbols (GumModuleEntry * self);
+static guint64 gum_query_loader_generation (void);
+static void gum_prune_module_entries (guint64 generation);
+static gboolean gum_module_entries_need_refresh (guint64 generation);
+static void gum_sync_module_entries (guint64 generation);
+static gboolean gum_module_entry_is_stale (gpointer key, gpointer value,
     gpointer user_data);
+
+static GumSymbolTable * gum_symbol_table_new (GumElfModule * module);
+static void gum_symbol_table_free (GumSymbolTable * table);
 static gboolean gum_collect_symbol_if_function (
     const GumElfSymbolDetails * details, gpointer user_data);
+static gboolean gum_collect_section_if_code (
+    const GumElfSectionDetails * details, gpointer user_data);
+static const GumSymbolEntry * gum_symbol_table_find_nearest (
+    GumSymbolTable * self, GumAddress address);
+static gboolean gum_symbol_table_is_same_code (GumSymbolTable * self,
+    GumAddress a, GumAddress b);
+static void gum_symbol_table_collect_named (GumSymbolTable * self,
+    const gchar * name, GArray * addresses);
+static gint gum_symbol_entry_compare_by_address (const GumSymbolEntry * lhs,
+    const GumSymbolEntry * rhs);
+static gint gum_symbol_entry_index_compare_by_name (const guint * lhs,
+    const guint * rhs, GArray * entries);
+
+static GArray * gum_obtain_loaded_module_entries (void);
+static void gum_module_entries_free (GArray * entries);
 
 static void gum_symbol_util_ensure_initialized (void);
 static void gum_symbol_util_deinitialize (void);
@@ -149,10 +208,11 @@ static gboolean gum_read_attribute_uint (Dwarf_Debug dbg, Dwarf_Die die,
 static gint gum_compare_pointers (gconstpointer a, gconstpointer b);
 
 G_LOCK_DEFINE_STATIC (gum_symbol_util);
+static GRWLock gum_module_entries_lock;
 static GHashTable * gum_module_entries = NULL;
-static GHashTable * gum_function_addresses = NULL;
-static GHashTable * gum_address_symbols = NULL;
-static GTimer * gum_cache_timer = NULL;
+static guint64 gum_module_entries_generation = 0;
+static gint64 gum_module_entries_next_refresh = 0;
+static GumModuleMap * gum_loaded_modules = NULL;
 
 gboolean
 gum_symbol_details_from_address (gpointer address,
@@ -160,6 +220,184 @@ gum_symbol_details_from_address (gpointer address,
 {
   gboolean success;
   GumModuleEntry * entry;
+
+  entry = gum_module_entry_from_address (address);
+  if (entry == NULL)
+    return FALSE;
+
+  success = gum_module_entry_resolve_details (entry, address, details);
+
+  gum_module_entry_unref (entry);
+
+  return success;
+}
+
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details)
+{
+  guint n_resolved, i;
+  GumModuleEntry * entry;
+
+  n_resolved = 0;
+  entry = NULL;
+
+  for (i = 0; i != n_addresses; i++)
+  {
+    gpointer address = addresses[i];
+    GumDebugSymbolDetails * d = &details[i];
+
+    if (entry == NULL || !gum_module_entry_contains (entry, address))
+    {
+      g_clear_pointer (&entry, gum_module_entry_unref);
+      entry = gum_module_entry_from_address (address);
+    }
+
+    if (entry != NULL && gum_module_entry_resolve_details (entry, address, d))
+      n_resolved++;
+    else
+      memset (d, 0, sizeof (GumDebugSymbolDetails));
+  }
+
+  g_clear_pointer (&entry, gum_module_entry_unref);
+
+  return n_resolved;
+}
+
+gchar *
+gum_symbol_name_from_address (gpointer address)
+{
+  gchar * name;
+  GumModuleEntry * entry;
+
+  entry = gum_module_entry_from_address (address);
+  if (entry == NULL)
+    return NULL;
+
+  name = gum_module_entry_resolve_name (entry, address);
+
+  gum_module_entry_unref (entry);
+
+  return name;
+}
+
+gpointer
+gum_find_function (const gchar * name)
+{
+  gpointer address;
+  GArray * entries, * addresses;
+  guint i;
+
+  address = NULL;
+
+  entries = gum_obtain_loaded_module_entries ();
+  addresses = g_array_new (FALSE, FALSE, sizeof (gpointer));
+
+  for (i = 0; i != entries->len && addresses->len == 0; i++)
+  {
+    GumModuleEntry * entry = g_array_index (entries, GumModuleEntry *, i);
+
+    gum_symbol_table_collect_named (gum_module_entry_get_symbols (entry), name,
+        addresses);
+  }
+
+  if (addresses->len != 0)
+    address = g_array_index (addresses, gpointer, 0);
+
+  g_array_free (addresses, TRUE);
+  gum_module_entries_free (entries);
+
+  return address;
+}
+
+GArray *
+gum_find_functions_named (const gchar * name)
+{
+  GArray * result, * entries;
+  guint i;
+
+  result = g_array_new (FALSE, FALSE, sizeof (gpointer));
+
+  entries = gum_obtain_loaded_module_entries ();
+
+  for (i = 0; i != entries->len; i++)
+  {
+    GumModuleEntry * entry = g_array_index (entries, GumModuleEntry *, i);
+
+    gum_symbol_table_collect_named (gum_module_entry_get_symbols (entry), name,
+        result);
+  }
+
+  gum_module_entries_free (entries);
+
+  return result;
+}
+
+GArray *
+gum_find_functions_matching (const gchar * str)
+{
+  GArray * matches, * entries;
+  GHashTable * seen;
+  GPatternSpec * pspec;
+  guint i;
+
+  matches = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  seen = g_hash_table_new (NULL, NULL);
+  pspec = g_pattern_spec_new (str);
+
+  entries = gum_obtain_loaded_module_entries ();
+
+  for (i = 0; i != entries->len; i++)
+  {
+    GumModuleEntry * entry = g_array_index (entries, GumModuleEntry *, i);
+    GumSymbolTable * table;
+    guint j;
+
+    table = gum_module_entry_get_symbols (entry);
+
+    for (j = 0; j != table->entries->len; j++)
+    {
+      const GumSymbolEntry * symbol =
+          &g_array_index (table->entries, GumSymbolEntry, j);
+      gpointer address;
+
+      if (!g_pattern_match_string (pspec, symbol->name))
+        continue;
+
+      address = GSIZE_TO_POINTER (symbol->address);
+
+      if (!g_hash_table_contains (seen, address))
+      {
+        g_array_append_val (matches, address);
+
+        g_hash_table_add (seen, address);
+      }
+    }
+  }
+
+  gum_module_entries_free (entries);
+
+  g_array_sort (matches, gum_compare_pointers);
+
+  g_pattern_spec_free (pspec);
+  g_hash_table_unref (seen);
+
+  return matches;
+}
+
+gboolean
+gum_load_symbols (const gchar * path)
+{
+  return FALSE;
+}
+
+static gboolean
+gum_module_entry_resolve_details (GumModuleEntry * self,
+                                  gpointer address,
+                                  GumDebugSymbolDetails * details)
+{
+  gboolean success;
   GumNearestSymbolDetails nearest;
   Dwarf_Addr file_address;
   Dwarf_Die cu_die;
@@ -168,31 +406,28 @@ gum_symbol_details_from_address (gpointer address,
 
   success = FALSE;
 
-  G_LOCK (gum_symbol_util);
-
-  entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
+  if (self->dbg == NULL)
     goto no_debug_info;
 
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
+  file_address = gum_module_entry_virtual_address_to_file (self, address);
+
+  g_mutex_lock (&self->dbg_mutex);
 
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
+  cu_die = gum_find_cu_die_by_virtual_address (self->dbg, file_address);
   if (cu_die == NULL)
     goto cu_die_not_found;
 
-  if (!gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
+  if (!gum_find_symbol_by_virtual_address (self->dbg, cu_die, file_address,
       &symbol))
     goto symbol_not_found;
 
-  if (!gum_find_line_by_virtual_address (entry->dbg, cu_die, file_address,
+  if (!gum_find_line_by_virtual_address (self->dbg, cu_die, file_address,
       symbol.line_number, &source))
     goto line_not_found;
 
   details->address = GUM_ADDRESS (address);
 
-  g_strlcpy (details->module_name, entry->module->name,
+  g_strlcpy (details->module_name, self->module->name,
       sizeof (details->module_name));
   g_strlcpy (details->symbol_name, symbol.name, sizeof (details->symbol_name));
 
@@ -207,16 +442,13 @@ line_not_found:
   g_free (symbol.name);
 
 symbol_not_found:
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
+  dwarf_dealloc (self->dbg, cu_die, DW_DLA_DIE);
 
 cu_die_not_found:
-  if (!success)
-    goto no_debug_info;
+  g_mutex_unlock (&self->dbg_mutex);
 
-entry_not_found:
-  G_UNLOCK (gum_symbol_util);
-
-  return success;
+  if (success)
+    return TRUE;
 
 no_debug_info:
   {
@@ -224,13 +456,10 @@ no_debug_info:
 
     details->address = GUM_ADDRESS (address);
 
-    g_strlcpy (details->module_name, entry->module->name,
+    g_strlcpy (details->module_name, self->module->name,
         sizeof (details->module_name));
 
-    if (nearest.name == NULL)
-      gum_find_nearest_symbol_by_address (address, &nearest);
-
-    if (nearest.name != NULL)
+    if (gum_module_entry_find_nearest_symbol (self, address, &nearest))
     {
       offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
 
@@ -247,7 +476,7 @@ no_debug_info:
     }
     else
     {
-      offset = details->address - entry->module->base_address;
+      offset = details->address - self->module->base_address;
 
       g_snprintf (details->symbol_name, sizeof (details->symbol_name),
           "0x%" G_GSIZE_MODIFIER "x", offset);
@@ -256,276 +485,195 @@ no_debug_info:
     details->file_name[0] = '\0';
     details->line_number = 0;
 
-    G_UNLOCK (gum_symbol_util);
-
     return TRUE;
   }
 }
 
-gchar *
-gum_symbol_name_from_address (gpointer address)
+static gchar *
+gum_module_entry_resolve_name (GumModuleEntry * self,
+                               gpointer address)
 {
   GumDwarfSymbolDetails symbol;
-  GumModuleEntry * entry;
   GumNearestSymbolDetails nearest;
   Dwarf_Addr file_address;
   Dwarf_Die cu_die;
+  gsize offset;
 
   symbol.name = NULL;
 
-  G_LOCK (gum_symbol_util);
-
-  entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
+  if (self->dbg == NULL)
     goto no_debug_info;
 
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
+  file_address = gum_module_entry_virtual_address_to_file (self, address);
 
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
-  if (cu_die == NULL)
-    goto cu_die_not_found;
+  g_mutex_lock (&self->dbg_mutex);
 
-  gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
-      &symbol);
-
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
-
-cu_die_not_found:
-  if (symbol.name == NULL)
-    goto no_debug_info;
-
-entry_not_found:
-  G_UNLOCK (gum_symbol_util);
-
-  return symbol.name;
-
-no_debug_info:
+  cu_die = gum_find_cu_die_by_virtual_address (self->dbg, file_address);
+  if (cu_die != NULL)
   {
-    gsize offset;
+    gum_find_symbol_by_virtual_address (self->dbg, cu_die, file_address,
+        &symbol);
 
-    if (nearest.name == NULL)
-      gum_find_nearest_symbol_by_address (address, &nearest);
-
-    if (nearest.name != NULL)
-    {
-      offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
-
-      if (offset == 0)
-      {
-        symbol.name = g_strdup (nearest.name);
-      }
-      else
-      {
-        symbol.name = g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x",
-            nearest.name, offset);
-      }
-    }
-    else
-    {
-      offset = GPOINTER_TO_SIZE (address) - entry->module->base_address;
-
-      symbol.name = g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
-    }
-
-    G_UNLOCK (gum_symbol_util);
-
-    return symbol.name;
+    dwarf_dealloc (self->dbg, cu_die, DW_DLA_DIE);
   }
-}
 
-gpointer
-gum_find_function (const gchar * name)
-{
-  gpointer address;
-  GArray * addresses;
+  g_mutex_unlock (&self->dbg_mutex);
 
-  address = NULL;
+  if (symbol.name != NULL)
+    return symbol.name;
 
-  G_LOCK (gum_symbol_util);
+no_debug_info:
+  if (gum_module_entry_find_nearest_symbol (self, address, &nearest))
+  {
+    offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
 
-  addresses = g_hash_table_lookup (gum_get_function_addresses (), name);
+    if (offset == 0)
+      return g_strdup (nearest.name);
 
-  if (addresses != NULL)
-  {
-    address = g_array_index (addresses, gpointer, 0);
+    return g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x", nearest.name,
+        offset);
   }
 
-  G_UNLOCK (gum_symbol_util);
+  offset = GPOINTER_TO_SIZE (address) - self->module->base_address;
 
-  return address;
+  return g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
 }
 
 static gboolean
-gum_find_nearest_symbol_by_address (gpointer address,
-                                    GumNearestSymbolDetails * nearest)
+gum_module_entry_find_nearest_symbol (GumModuleEntry * self,
+                                      gpointer address,
+                                      GumNearestSymbolDetails * nearest)
 {
-  GHashTable * table;
-  GumElfSymbolDetails * details;
-  GHashTableIter iter;
-  GumElfSymbolDetails * current_symbol = NULL;
-
-  table = gum_get_address_symbols ();
+  const GumSymbolEntry * symbol;
 
-  details = g_hash_table_lookup (table, address);
-  if (details != NULL)
-  {
-    nearest->name = details->name;
-    nearest->address = address;
-    return TRUE;
-  }
-
-  g_hash_table_iter_init (&iter, table);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &current_symbol))
-  {
-    if (current_symbol->address > GUM_ADDRESS (address))
-      continue;
-
-    if (current_symbol->address + current_symbol->size <= GUM_ADDRESS (address))
-    {
-      continue;
-    }
+  symbol = gum_symbol_table_find_nearest (gum_module_entry_get_symbols (self),
+      GUM_ADDRESS (address));
+  if (symbol == NULL)
+    return FALSE;
 
-    nearest->address = GSIZE_TO_POINTER (current_symbol->address);
-    nearest->name = current_symbol->name;
-    return TRUE;
-  }
+  nearest->name = symbol->name;
+  nearest->address = GSIZE_TO_POINTER (symbol->address);
 
-  return FALSE;
+  return TRUE;
 }
 
-GArray *
-gum_find_functions_named (const gchar * name)
+/*
+ * Modules are located through an incremental module map, which avoids the
+ * loader lock taken by dladdr(). The entry table is guarded by a reader-writer
+ * lock so concurrent lookups only serialize when a module is first seen or
+ * after the loader has reported a change. The details returned by the map are
+ * only valid until its next update, which happens with the writer side held,
+ * so we never touch them without holding the lock.
+ */
+static GumModuleEntry *
+gum_module_entry_from_address (gpointer address)
 {
-  GArray * result, * addresses;
+  GumModuleEntry * entry;
+  guint64 generation;
+  const GumModuleDetails * details;
+  gchar * path;
+  GumMemoryRange range;
 
-  result = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  gum_symbol_util_ensure_initialized ();
 
-  G_LOCK (gum_symbol_util);
+  generation = gum_query_loader_generation ();
 
-  addresses = g_hash_table_lookup (gum_get_function_addresses (), name);
+  g_rw_lock_reader_lock (&gum_module_entries_lock);
 
-  if (addresses != NULL)
+  if (generation != 0 && generation != gum_module_entries_generation)
   {
-    g_array_append_vals (result, addresses->data, addresses->len);
+    g_rw_lock_reader_unlock (&gum_module_entries_lock);
+    gum_prune_module_entries (generation);
+    g_rw_lock_reader_lock (&gum_module_entries_lock);
   }
 
-  G_UNLOCK (gum_symbol_util);
+  details = gum_module_map_find (gum_loaded_modules, GUM_ADDRESS (address));
+  if (details == NULL && gum_module_entries_need_refresh (generation))
+  {
+    /*
+     * Without a loader generation a miss may just mean that the module was
+     * loaded after our last update. Misses are common for JIT, heap and stack
+     * addresses though, so we only look again every so often.
+     */
+    g_rw_lock_reader_unlock (&gum_module_entries_lock);
+    gum_prune_module_entries (generation);
+    g_rw_lock_reader_lock (&gum_module_entries_lock);
+
+    details = gum_module_map_find (gum_loaded_modules, GUM_ADDRESS (address));
+  }
 
-  return result;
-}
+  if (details == NULL)
+  {
+    g_rw_lock_reader_unlock (&gum_module_entries_lock);
+    return NULL;
+  }
 
-GArray *
-gum_find_functions_matching (const gchar * str)
-{
-  GArray * matches;
-  GHashTable * seen;
-  GPatternSpec * pspec;
-  GHashTableIter iter;
-  const gchar * name;
-  GArray * addresses;
+  entry = gum_module_entry_lookup (details->path, details->range);
 
-  matches = g_array_new (FALSE, FALSE, sizeof (gpointer));
-  seen = g_hash_table_new (NULL, NULL);
-  pspec = g_pattern_spec_new (str);
+  path = (entry == NULL) ? g_strdup (details->path) : NULL;
+  range = *details->range;
 
-  G_LOCK (gum_symbol_util);
+  g_rw_lock_reader_unlock (&gum_module_entries_lock);
 
-  g_hash_table_iter_init (&iter, gum_get_function_addresses ());
-  while (g_hash_table_iter_next (&iter, (gpointer *) &name,
-      (gpointer *) &addresses))
+  if (entry == NULL)
   {
-    if (g_pattern_match_string (pspec, name))
-    {
-      guint i;
-
-      for (i = 0; i != addresses->len; i++)
-      {
-        gpointer address;
+    g_rw_lock_writer_lock (&gum_module_entries_lock);
+    entry = gum_module_entry_insert (path, &range);
+    g_rw_lock_writer_unlock (&gum_module_entries_lock);
 
-        address = g_array_index (addresses, gpointer, i);
-
-        if (!g_hash_table_contains (seen, address))
-        {
-          g_array_append_val (matches, address);
-
-          g_hash_table_add (seen, address);
-        }
-      }
-    }
+    g_free (path);
   }
 
-  G_UNLOCK (gum_symbol_util);
-
-  g_array_sort (matches, gum_compare_pointers);
-
-  g_pattern_spec_free (pspec);
-  g_hash_table_unref (seen);
-
-  return matches;
-}
+  if (entry->module == NULL)
+  {
+    gum_module_entry_unref (entry);
+    return NULL;
+  }
 
-gboolean
-gum_load_symbols (const gchar * path)
-{
-  return FALSE;
+  return entry;
 }
 
+/* Must be called with gum_module_entries_lock held. */
 static GumModuleEntry *
-gum_module_entry_from_address (gpointer address,
-                               GumNearestSymbolDetails * nearest)
+gum_module_entry_lookup (const gchar * path,
+                         const GumMemoryRange * range)
 {
   GumModuleEntry * entry;
-  Dl_info dl_info;
-  const gchar * path;
-  gchar * path_malloc_data;
 
-  if (dladdr (address, &dl_info) == 0)
-  {
-    nearest->name = NULL;
-    nearest->address = NULL;
+  entry = g_hash_table_lookup (gum_module_entries, path);
+  if (entry == NULL || entry->range.base_address != range->base_address)
     return NULL;
-  }
 
-  nearest->name = dl_info.dli_sname;
-  nearest->address = dl_info.dli_saddr;
+  return gum_module_entry_ref (entry);
+}
 
-  path = dl_info.dli_fname;
-  if (!g_path_is_absolute (path))
-  {
-    path_malloc_data = g_canonicalize_filename (path, NULL);
-    path = path_malloc_data;
-  }
-  else
-  {
-    path_malloc_data = NULL;
-  }
+/* Must be called with the writer side of gum_module_entries_lock held. */
+static GumModuleEntry *
+gum_module_entry_insert (const gchar * path,
+                         const GumMemoryRange * range)
+{
+  GumModuleEntry * entry;
 
-  entry = gum_module_entry_from_path_and_base (path,
-      GUM_ADDRESS (dl_info.dli_fbase));
+  entry = gum_module_entry_lookup (path, range);
+  if (entry != NULL)
+    return entry;
 
-  g_free (path_malloc_data);
+  entry = gum_module_entry_new (path, range);
+  g_hash_table_insert (gum_module_entries, g_strdup (path), entry);
 
-  return entry;
+  return gum_module_entry_ref (entry);
 }
 
 static GumModuleEntry *
-gum_module_entry_from_path_and_base (const gchar * path,
-                                     GumAddress base_address)
+gum_module_entry_new (const gchar * path,
+                      const GumMemoryRange * range)
 {
   GumModuleEntry * entry;
   GumElfModule * module;
   Dwarf_Debug dbg = NULL;
   Dwarf_Error error = NULL;
 
-  gum_symbol_util_ensure_initialized ();
-
-  entry = g_hash_table_lookup (gum_module_entries, path);
-  if (entry != NULL)
-    goto have_entry;
-
-  module = gum_elf_module_new_from_memory (path, base_address);
+  module = gum_elf_module_new_from_memory (path, range->base_address);
 
   if (module == NULL ||
       dwarf_elf_init_b (module->elf, DW_DLC_READ, DW_GROUPNUMBER_ANY,
@@ -536,29 +684,36 @@ gum_module_entry_from_path_and_base (const gchar * path,
   }
 
   entry = g_slice_new (GumModuleEntry);
+  entry->ref_count = 1;
   entry->module = module;
+  entry->range = *range;
+  g_mutex_init (&entry->dbg_mutex);
   entry->dbg = dbg;
-  entry->collected = FALSE;
-
-  g_hash_table_insert (gum_module_entries, g_strdup (path), entry);
+  entry->symbols = NULL;
 
-have_entry:
-  return (entry->module != NULL) ? entry : NULL;
+  return entry;
 }
 
-static Dwarf_Addr
-gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
-                                          gpointer address)
+static GumModuleEntry *
+gum_module_entry_ref (GumModuleEntry * entry)
 {
-  return self->module->preferred_address +
-      (GUM_ADDRESS (address) - self->module->base_address);
+  g_atomic_int_inc (&entry->ref_count);
+
+  return entry;
 }
 
 static void
-gum_module_entry_free (GumModuleEntry * entry)
+gum_module_entry_unref (GumModuleEntry * entry)
 {
+  if (!g_atomic_int_dec_and_test (&entry->ref_count))
+    return;
+
+  if (entry->symbols != NULL)
+    gum_symbol_table_free (entry->symbols);
+
   if (entry->dbg != NULL)
     dwarf_finish (entry->dbg, NULL);
+  g_mutex_clear (&entry->dbg_mutex);
 
   if (entry->module != NULL)
     g_object_unref (entry->module);
@@ -566,165 +721,402 @@ gum_module_entry_free (GumModuleEntry * entry)
   g_slice_free (GumModuleEntry, entry);
 }
 
-static GHashTable *
-gum_get_function_addresses (void)
+static gboolean
+gum_module_entry_contains (GumModuleEntry * self,
+                           gpointer address)
 {
-  gum_maybe_refresh_symbol_caches ();
-  return gum_function_addresses;
+  GumAddress a = GUM_ADDRESS (address);
+
+  return a >= self->range.base_address &&
+      a < self->range.base_address + self->range.size;
 }
 
-static GHashTable *
-gum_get_address_symbols (void)
+static Dwarf_Addr
+gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
+                                          gpointer address)
 {
-  gum_maybe_refresh_symbol_caches ();
-  return gum_address_symbols;
+  return self->module->preferred_address +
+      (GUM_ADDRESS (address) - self->module->base_address);
 }
 
-static void
-gum_maybe_refresh_symbol_caches (void)
+static GumSymbolTable *
+gum_module_entry_get_symbols (GumModuleEntry * self)
 {
-  gboolean need_update;
+  if (g_once_init_enter (&self->symbols))
+    g_once_init_leave (&self->symbols, gum_symbol_table_new (self->module));
 
-  gum_symbol_util_ensure_initialized ();
+  return self->symbols;
+}
 
-  if (gum_cache_timer == NULL)
-  {
-    gum_cache_timer = g_timer_new ();
+/*
+ * On glibc the dynamic linker keeps count of loads and unloads, which is cheap
+ * to query and works even when its notification hook could not be attached.
+ */
+static guint64
+gum_query_loader_generation (void)
+{
+#ifdef HAVE_LINUX
+  return gum_linux_query_loader_generation ();
+#else
+  return _gum_process_get_loader_generation ();
+#endif
+}
 
-    need_update = TRUE;
-  }
-  else
-  {
-    need_update = g_timer_elapsed (gum_cache_timer, NULL) >= GUM_MAX_CACHE_AGE;
-  }
+static void
+gum_prune_module_entries (guint64 generation)
+{
+  g_rw_lock_writer_lock (&gum_module_entries_lock);
 
-  if (need_update)
+  if (generation != gum_module_entries_generation ||
+      gum_module_entries_need_refresh (generation))
   {
-    gum_process_enumerate_modules (gum_collect_module_functions, NULL);
+    gum_sync_module_entries (generation);
   }
+
+  g_rw_lock_writer_unlock (&gum_module_entries_lock);
 }
 
+/* Must be called with gum_module_entries_lock held. */
 static gboolean
-gum_collect_module_functions (const GumModuleDetails * details,
-                              gpointer user_data)
+gum_module_entries_need_refresh (guint64 generation)
 {
-  GumModuleEntry * entry;
+  if (generation != 0)
+    return FALSE;
 
-  entry = gum_module_entry_from_path_and_base (details->path,
-      details->range->base_address);
-  if (entry == NULL || entry->collected)
-    return TRUE;
+  return g_get_monotonic_time () >= gum_module_entries_next_refresh;
+}
 
-  gum_elf_module_enumerate_dynamic_symbols (entry->module,
-      gum_collect_symbol_if_function, NULL);
+/* Must be called with the writer side of gum_module_entries_lock held. */
+static void
+gum_sync_module_entries (guint64 generation)
+{
+  gum_module_map_update (gum_loaded_modules);
 
-  gum_elf_module_enumerate_symbols (entry->module,
-      gum_collect_symbol_if_function, NULL);
+  g_hash_table_foreach_remove (gum_module_entries, gum_module_entry_is_stale,
+      NULL);
 
-  entry->collected = TRUE;
+  gum_module_entries_generation = generation;
+  gum_module_entries_next_refresh =
+      g_get_monotonic_time () + GUM_MODULE_ENTRIES_REFRESH_INTERVAL;
+}
 
-  return TRUE;
+static gboolean
+gum_module_entry_is_stale (gpointer key,
+                           gpointer value,
+                           gpointer user_data)
+{
+  const gchar * path = key;
+  GumModuleEntry * entry = value;
+  const GumModuleDetails * details;
+
+  details = gum_module_map_find (gum_loaded_modules,
+      entry->range.base_address);
+
+  return details == NULL ||
+      details->range->base_address != entry->range.base_address ||
+      strcmp (details->path, path) != 0;
+}
+
+static GumSymbolTable *
+gum_symbol_table_new (GumElfModule * module)
+{
+  GumSymbolTable * table;
+  guint i;
+
+  table = g_slice_new (GumSymbolTable);
+  table->entries = g_array_new (FALSE, FALSE, sizeof (GumSymbolEntry));
+  table->names = g_string_chunk_new (4096);
+  table->code_ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+
+  gum_elf_module_enumerate_dynamic_symbols (module,
+      gum_collect_symbol_if_function, table);
+  gum_elf_module_enumerate_symbols (module, gum_collect_symbol_if_function,
+      table);
+  gum_elf_module_enumerate_sections (module, gum_collect_section_if_code,
+      table);
+
+  g_array_sort (table->entries,
+      (GCompareFunc) gum_symbol_entry_compare_by_address);
+
+  table->by_name = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+      table->entries->len);
+  for (i = 0; i != table->entries->len; i++)
+    g_array_append_val (table->by_name, i);
+  g_array_sort_with_data (table->by_name,
+      (GCompareDataFunc) gum_symbol_entry_index_compare_by_name,
+      table->entries);
+
+  return table;
+}
+
+static void
+gum_symbol_table_free (GumSymbolTable * table)
+{
+  g_array_free (table->code_ranges, TRUE);
+  g_string_chunk_free (table->names);
+  g_array_free (table->by_name, TRUE);
+  g_array_free (table->entries, TRUE);
+
+  g_slice_free (GumSymbolTable, table);
 }
 
 static gboolean
 gum_collect_symbol_if_function (const GumElfSymbolDetails * details,
                                 gpointer user_data)
 {
-  const gchar * name;
-  gpointer address;
-  GArray * addresses;
-  gboolean already_collected;
-  GumElfSymbolDetails * address_symbol;
+  GumSymbolTable * table = user_data;
+  GumSymbolEntry entry;
 
   if (details->section_header_index == SHN_UNDEF || details->type != STT_FUNC)
     return TRUE;
 
-  name = details->name;
-  address = GSIZE_TO_POINTER (details->address);
+  entry.address = details->address;
+  entry.size = details->size;
+  entry.name = g_string_chunk_insert_const (table->names, details->name);
+
+  g_array_append_val (table->entries, entry);
+
+  return TRUE;
+}
+
+static gboolean
+gum_collect_section_if_code (const GumElfSectionDetails * details,
+                             gpointer user_data)
+{
+  GumSymbolTable * table = user_data;
+  GumMemoryRange range;
+
+  if ((details->flags & SHF_EXECINSTR) == 0 || details->address == 0)
+    return TRUE;
+
+  range.base_address = details->address;
+  range.size = details->size;
+
+  g_array_append_val (table->code_ranges, range);
+
+  return TRUE;
+}
 
-  already_collected = FALSE;
+static const GumSymbolEntry *
+gum_symbol_table_find_nearest (GumSymbolTable * self,
+                               GumAddress address)
+{
+  const GumSymbolEntry * entries = (const GumSymbolEntry *) self->entries->data;
+  const GumSymbolEntry * preceding;
+  guint lo, hi, i;
 
-  addresses = g_hash_table_lookup (gum_function_addresses, name);
-  if (addresses == NULL)
+  lo = 0;
+  hi = self->entries->len;
+  while (lo != hi)
   {
-    addresses = g_array_sized_new (FALSE, FALSE, sizeof (gpointer), 1);
-    g_hash_table_insert (gum_function_addresses, g_strdup (name), addresses);
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (entries[mid].address <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-  else
+
+  if (lo == 0)
+    return NULL;
+  preceding = &entries[lo - 1];
+
+  for (i = lo; i != 0; i--)
   {
-    guint i;
+    const GumSymbolEntry * candidate = &entries[i - 1];
+
+    if (candidate->address != preceding->address)
+      break;
 
-    for (i = 0; i != addresses->len; i++)
+    if (candidate->address == address ||
+        address < candidate->address + candidate->size)
     {
-      if (g_array_index (addresses, gpointer, i) == address)
+      return candidate;
+    }
+  }
+
+  /*
+   * Like dladdr(), fall back to the closest preceding symbol. This covers
+   * symbols without a size, typically defined in assembly, as well as code
+   * following a nested symbol. Only do so within the same code section so
+   * that data is not attributed to whichever function precedes it.
+   */
+  if (!gum_symbol_table_is_same_code (self, preceding->address, address))
+    return NULL;
+
+  return preceding;
+}
+
+static gboolean
+gum_symbol_table_is_same_code (GumSymbolTable * self,
+                               GumAddress a,
+                               GumAddress b)
+{
+  guint i;
+
+  for (i = 0; i != self->code_ranges->len; i++)
+  {
+    const GumMemoryRange * r =
+        &g_array_index (self->code_ranges, GumMemoryRange, i);
+    GumAddress end = r->base_address + r->size;
+
+    if (a >= r->base_address && a < end)
+      return b >= r->base_address && b < end;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_symbol_table_collect_named (GumSymbolTable * self,
+                                const gchar * name,
+                                GArray * addresses)
+{
+  const guint * indices = (const guint *) self->by_name->data;
+  const GumSymbolEntry * entries = (const GumSymbolEntry *) self->entries->data;
+  guint lo, hi, i;
+
+  lo = 0;
+  hi = self->by_name->len;
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (strcmp (entries[indices[mid]].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (i = lo; i != self->by_name->len; i++)
+  {
+    const GumSymbolEntry * entry = &entries[indices[i]];
+    gpointer address;
+    guint j;
+    gboolean already_collected;
+
+    if (strcmp (entry->name, name) != 0)
+      break;
+
+    address = GSIZE_TO_POINTER (entry->address);
+
+    already_collected = FALSE;
+    for (j = 0; j != addresses->len; j++)
+    {
+      if (g_array_index (addresses, gpointer, j) == address)
       {
         already_collected = TRUE;
         break;
       }
     }
+
+    if (!already_collected)
+      g_array_append_val (addresses, address);
   }
+}
 
-  if (!already_collected)
-    g_array_append_val (addresses, address);
+static gint
+gum_symbol_entry_compare_by_address (const GumSymbolEntry * lhs,
+                                     const GumSymbolEntry * rhs)
+{
+  if (lhs->address < rhs->address)
+    return -1;
 
-  address_symbol = g_hash_table_lookup (gum_address_symbols, address);
-  if (address_symbol == NULL)
-  {
-    address_symbol = g_slice_new (GumElfSymbolDetails);
-    address_symbol->name = g_strdup (name);
-    address_symbol->address = details->address;
-    address_symbol->size = details->size;
-    address_symbol->type = details->type;
-    address_symbol->bind = details->bind;
-    address_symbol->section_header_index = details->section_header_index;
-    g_hash_table_insert (gum_address_symbols, address, address_symbol);
-  }
-    
-  return TRUE;
+  if (lhs->address > rhs->address)
+    return 1;
+
+  return 0;
 }
 
-static void
-gum_function_addresses_free (GArray * addresses)
+static gint
+gum_symbol_entry_index_compare_by_name (const guint * lhs,
+                                        const guint * rhs,
+                                        GArray * entries)
 {
-  g_array_free (addresses, TRUE);
+  return strcmp (g_array_index (entries, GumSymbolEntry, *lhs).name,
+      g_array_index (entries, GumSymbolEntry, *rhs).name);
+}
+
+static GArray *
+gum_obtain_loaded_module_entries (void)
+{
+  GArray * entries, * modules;
+  guint i;
+
+  gum_symbol_util_ensure_initialized ();
+
+  g_rw_lock_writer_lock (&gum_module_entries_lock);
+
+  gum_sync_module_entries (gum_query_loader_generation ());
+  modules = gum_module_map_get_values (gum_loaded_modules);
+
+  entries = g_array_sized_new (FALSE, FALSE, sizeof (GumModuleEntry *),
+      modules->len);
+
+  for (i = 0; i != modules->len; i++)
+  {
+    const GumModuleDetails * details =
+        &g_array_index (modules, GumModuleDetails, i);
+    GumModuleEntry * entry;
+
+    entry = gum_module_entry_insert (details->path, details->range);
+    if (entry->module != NULL)
+      g_array_append_val (entries, entry);
+    else
+      gum_module_entry_unref (entry);
+  }
+
+  g_rw_lock_writer_unlock (&gum_module_entries_lock);
+
+  return entries;
 }
 
 static void
-gum_address_symbols_value_free (GumElfSymbolDetails * details)
+gum_module_entries_free (GArray * entries)
 {
-  g_free ((gpointer) details->name);
-  g_slice_free (GumElfSymbolDetails, details);
+  guint i;
+
+  for (i = 0; i != entries->len; i++)
+    gum_module_entry_unref (g_array_index (entries, GumModuleEntry *, i));
+
+  g_array_free (entries, TRUE);
 }
 
 static void
 gum_symbol_util_ensure_initialized (void)
 {
-  if (gum_module_entries != NULL)
+  if (g_atomic_pointer_get (&gum_loaded_modules) != NULL)
     return;
 
-  gum_module_entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-      (GDestroyNotify) gum_module_entry_free);
-  gum_function_addresses = g_hash_table_new_full (g_str_hash, g_str_equal,
-      g_free, (GDestroyNotify) gum_function_addresses_free);
-  gum_address_symbols = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-      NULL, (GDestroyNotify) gum_address_symbols_value_free);
+  G_LOCK (gum_symbol_util);
+
+  if (gum_loaded_modules == NULL)
+  {
+    GumModuleMap * modules;
+
+    gum_module_entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gum_module_entry_unref);
+
+    modules = gum_module_map_new ();
+    gum_module_map_set_incremental (modules, TRUE);
+    g_atomic_pointer_set (&gum_loaded_modules, modules);
 
-  _gum_register_destructor (gum_symbol_util_deinitialize);
+    _gum_register_destructor (gum_symbol_util_deinitialize);
+  }
+
+  G_UNLOCK (gum_symbol_util);
 }
 
 static void
 gum_symbol_util_deinitialize (void)
 {
-  g_clear_pointer (&gum_cache_timer, g_timer_destroy);
-
-  g_hash_table_unref (gum_address_symbols);
-  gum_address_symbols = NULL;
-
-  g_hash_table_unref (gum_function_addresses);
-  gum_function_addresses = NULL;
+  g_clear_object (&gum_loaded_modules);
 
   g_hash_table_unref (gum_module_entries);
   gum_module_entries = NULL;
+
+  gum_module_entries_generation = 0;
+  gum_module_entries_next_refresh = 0;
 }
 
 static void
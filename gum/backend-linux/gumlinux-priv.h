@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2021 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_LINUX_PRIV_H__
+#define __GUM_LINUX_PRIV_H__
+
+#include "gumlinux.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GumProcMapsIter GumProcMapsIter;
+typedef struct _GumProcMapsEntry GumProcMapsEntry;
+typedef struct _GumProcMapsSnapshot GumProcMapsSnapshot;
+
+struct _GumProcMapsIter
+{
+  gint fd;
+  gchar * buffer;
+  gchar * read_cursor;
+  gchar * write_cursor;
+  gboolean eof;
+
+  GumProcMapsSnapshot * snapshot;
+};
+
+struct _GumProcMapsEntry
+{
+  GumAddress start;
+  GumAddress end;
+  gchar perms[5];
+  guint64 offset;
+  guint64 inode;
+  const gchar * path;
+};
+
+G_GNUC_INTERNAL void gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter);
+G_GNUC_INTERNAL void gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+    pid_t pid);
+G_GNUC_INTERNAL void gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+    const gchar * path);
+G_GNUC_INTERNAL void gum_proc_maps_iter_destroy (GumProcMapsIter * iter);
+G_GNUC_INTERNAL gboolean gum_proc_maps_iter_next (GumProcMapsIter * iter,
+    GumProcMapsEntry * entry);
+
+G_GNUC_INTERNAL GHashTable * gum_linux_obtain_named_ranges (void);
+G_GNUC_INTERNAL guint64 gum_linux_query_loader_generation (void);
+
+G_END_DECLS
+
+#endif
@@ -32,6 +32,8 @@ GUM_API void gum_linux_enumerate_modules_using_proc_maps (
 GUM_API void gum_linux_enumerate_ranges (pid_t pid, GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
 GUM_API GHashTable * gum_linux_collect_named_ranges (void);
+GUM_API void gum_linux_begin_ranges_snapshot (void);
+GUM_API void gum_linux_end_ranges_snapshot (void);
 
 GUM_API gboolean gum_linux_module_path_matches (const gchar * path,
     const gchar * name_or_path);
@@ -6,10 +6,10 @@
 
 #include "gummemory.h"
 
+#include "gumlinux-priv.h"
 #include "gummemory-priv.h"
 #include "valgrind.h"
 
-#include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -127,8 +127,8 @@ gum_memory_get_protection (gconstpointer address,
                            GumPageProtection * prot)
 {
   gboolean success;
-  FILE * fp;
-  gchar line[1024 + 1];
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
 
   if (size == NULL || prot == NULL)
   {
@@ -182,15 +182,12 @@ gum_memory_get_protection (gconstpointer address,
   *size = 0;
   *prot = GUM_PAGE_NO_ACCESS;
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
+  gum_proc_maps_iter_init_for_self (&iter);
 
-  while (fgets (line, sizeof (line), fp) != NULL)
+  while (gum_proc_maps_iter_next (&iter, &entry))
   {
-    gpointer start, end;
-    gchar protection[16];
-
-    sscanf (line, "%p-%p %s ", &start, &end, protection);
+    gpointer start = GSIZE_TO_POINTER (entry.start);
+    gpointer end = GSIZE_TO_POINTER (entry.end);
 
     if (start > address)
       break;
@@ -198,17 +195,17 @@ gum_memory_get_protection (gconstpointer address,
     {
       success = TRUE;
       *size = 1;
-      if (protection[0] == 'r')
+      if (entry.perms[0] == 'r')
         *prot |= GUM_PAGE_READ;
-      if (protection[1] == 'w')
+      if (entry.perms[1] == 'w')
         *prot |= GUM_PAGE_WRITE;
-      if (protection[2] == 'x')
+      if (entry.perms[2] == 'x')
         *prot |= GUM_PAGE_EXECUTE;
       break;
     }
   }
 
-  fclose (fp);
+  gum_proc_maps_iter_destroy (&iter);
 
   return success;
 }
@@ -9,12 +9,13 @@
 #include "backend-elf/gumelfmodule.h"
 #include "gum-init.h"
 #include "gumandroid.h"
-#include "gumlinux.h"
+#include "gumlinux-priv.h"
 #include "gummodulemap.h"
 #include "valgrind.h"
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +42,7 @@
 # include <sys/user.h>
 #endif
 
-#define GUM_MAPS_LINE_SIZE (1024 + PATH_MAX)
+#define GUM_PROC_MAPS_BUFFER_SIZE (64 * 1024)
 #define GUM_PSR_THUMB 0x20
 
 #if defined (HAVE_I386)
@@ -90,10 +91,11 @@ typedef guint8 GumModifyThreadAck;
 typedef struct _GumEnumerateModulesContext GumEnumerateModulesContext;
 typedef struct _GumEmitExecutableModuleContext GumEmitExecutableModuleContext;
 typedef struct _GumEnumerateImportsContext GumEnumerateImportsContext;
-typedef struct _GumDependencyExport GumDependencyExport;
 typedef struct _GumEnumerateModuleSymbolContext GumEnumerateModuleSymbolContext;
 typedef struct _GumEnumerateModuleRangesContext GumEnumerateModuleRangesContext;
 typedef struct _GumResolveModuleNameContext GumResolveModuleNameContext;
+typedef struct _GumExportModule GumExportModule;
+typedef struct _GumRangesSnapshotScope GumRangesSnapshotScope;
 
 typedef gint (* GumFoundDlPhdrFunc) (struct dl_phdr_info * info,
     gsize size, gpointer data);
@@ -150,17 +152,10 @@ struct _GumEnumerateImportsContext
   GumFoundImportFunc func;
   gpointer user_data;
 
-  GHashTable * dependency_exports;
-  GumElfModule * current_dependency;
+  GPtrArray * dependencies;
   GumModuleMap * module_map;
 };
 
-struct _GumDependencyExport
-{
-  gchar * module;
-  GumAddress address;
-};
-
 struct _GumEnumerateModuleSymbolContext
 {
   GumFoundSymbolFunc func;
@@ -183,6 +178,27 @@ struct _GumResolveModuleNameContext
   GumAddress base;
 };
 
+struct _GumExportModule
+{
+  guint64 generation;
+  void * handle;
+  GumElfModule * module;
+};
+
+struct _GumRangesSnapshotScope
+{
+  guint depth;
+  GumProcMapsSnapshot * snapshot;
+};
+
+struct _GumProcMapsSnapshot
+{
+  gint ref_count;
+  guint64 generation;
+  gchar * lines;
+  gsize size;
+};
+
 struct _GumUserDesc
 {
   guint entry_number;
@@ -234,20 +250,20 @@ static gboolean gum_maybe_emit_interpreter (const GumModuleDetails * details,
 static gboolean gum_emit_executable_module_by_name (
     const GumModuleDetails * details, gpointer user_data);
 
+static void gum_deinit_named_ranges (void);
+#ifdef HAVE_GLIBC
+static gint gum_store_loader_generation (struct dl_phdr_info * info,
+    gsize size, gpointer user_data);
+#endif
 static void gum_linux_named_range_free (GumLinuxNamedRange * range);
-static gboolean gum_try_translate_vdso_name (gchar * name);
+static const gchar * gum_translate_vdso_name (const gchar * name);
 static void * gum_module_get_handle (const gchar * module_name);
 static void * gum_module_get_symbol (void * module, const gchar * symbol_name);
 
 static gboolean gum_emit_import (const GumImportDetails * details,
     gpointer user_data);
-static gboolean gum_collect_dependency_exports (
+static gboolean gum_collect_dependency (
     const GumElfDependencyDetails * details, gpointer user_data);
-static gboolean gum_collect_dependency_export (const GumExportDetails * details,
-    gpointer user_data);
-static GumDependencyExport * gum_dependency_export_new (const gchar * module,
-    GumAddress address);
-static void gum_dependency_export_free (GumDependencyExport * export);
 static gboolean gum_emit_symbol (const GumElfSymbolDetails * details,
     gpointer user_data);
 static gboolean gum_append_symbol_section (const GumElfSectionDetails * details,
@@ -261,12 +277,35 @@ static gboolean gum_store_module_path_and_base_if_name_matches (
     const GumModuleDetails * details, gpointer user_data);
 
 static GumElfModule * gum_open_elf_module (const gchar * name);
+static GumElfModule * gum_find_current_export_module (const gchar * name,
+    guint64 generation, void ** handle);
+static GumElfModule * gum_obtain_export_module (const gchar * name,
+    void * handle, guint64 generation);
+static void gum_deinit_export_modules (void);
+static gboolean gum_export_module_is_current (GumExportModule * self,
+    void * handle);
+static void gum_export_module_free (GumExportModule * self);
 
 static gboolean gum_thread_read_state (GumThreadId tid, GumThreadState * state);
 static GumThreadState gum_thread_state_from_proc_status_character (gchar c);
 static GumPageProtection gum_page_protection_from_proc_perms_string (
     const gchar * perms);
 
+static void gum_proc_maps_iter_init_for_ranges (GumProcMapsIter * iter,
+    pid_t pid);
+static gchar * gum_proc_maps_iter_read_line (GumProcMapsIter * iter);
+static gboolean gum_parse_proc_maps_line (const gchar * line,
+    GumProcMapsEntry * entry);
+static gboolean gum_try_parse_hex (const gchar ** cursor, guint64 * value);
+static gboolean gum_try_parse_decimal (const gchar ** cursor,
+    guint64 * value);
+
+static void gum_ranges_snapshot_scope_free (GumRangesSnapshotScope * scope);
+static GumProcMapsSnapshot * gum_proc_maps_snapshot_new (guint64 generation);
+static GumProcMapsSnapshot * gum_proc_maps_snapshot_ref (
+    GumProcMapsSnapshot * snapshot);
+static void gum_proc_maps_snapshot_unref (GumProcMapsSnapshot * snapshot);
+
 static gssize gum_get_regs (pid_t pid, GumRegs * regs);
 static gssize gum_set_regs (pid_t pid, const GumRegs * regs);
 
@@ -288,6 +327,16 @@ static gchar * gum_libc_name;
 
 static gboolean gum_is_regset_supported = TRUE;
 
+G_LOCK_DEFINE_STATIC (gum_named_ranges);
+static GHashTable * gum_named_ranges = NULL;
+static guint64 gum_named_ranges_generation = 0;
+
+static GPrivate gum_ranges_snapshot_scope = G_PRIVATE_INIT (
+    (GDestroyNotify) gum_ranges_snapshot_scope_free);
+
+static GRWLock gum_export_modules_lock;
+static GHashTable * gum_export_modules = NULL;
+
 const gchar *
 gum_process_query_libc_name (void)
 {
@@ -781,7 +830,7 @@ gum_process_enumerate_modules_by_using_libc (GumDlIteratePhdrImpl iterate_phdr,
   ctx.func = func;
   ctx.user_data = user_data;
 
-  ctx.named_ranges = gum_linux_collect_named_ranges ();
+  ctx.named_ranges = gum_linux_obtain_named_ranges ();
 
   ctx.index = 0;
 
@@ -1008,98 +1057,86 @@ void
 gum_linux_enumerate_modules_using_proc_maps (GumFoundModuleFunc func,
                                              gpointer user_data)
 {
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * path, * next_path;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+  gchar * path;
   gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
-
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
+  gboolean got_entry = FALSE;
 
-  line = g_malloc (line_size);
+  gum_proc_maps_iter_init_for_self (&iter);
 
   path = g_malloc (PATH_MAX);
-  next_path = g_malloc (PATH_MAX);
 
   do
   {
     const guint8 elf_magic[] = { 0x7f, 'E', 'L', 'F' };
     GumModuleDetails details;
     GumMemoryRange range;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    gint n;
+    const gchar * entry_path;
     gboolean is_vdso, readable, shared;
     gchar * name;
 
-    if (!got_line)
+    if (!got_entry)
     {
-      if (fgets (line, line_size, fp) == NULL)
+      if (!gum_proc_maps_iter_next (&iter, &entry))
         break;
     }
     else
     {
-      got_line = FALSE;
+      got_entry = FALSE;
     }
 
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%*x %*s %*d "
-        "%[^\n]",
-        &range.base_address, &end,
-        perms,
-        path);
-    if (n == 3)
+    if (entry.path[0] == '\0')
       continue;
-    g_assert (n == 4);
 
-    is_vdso = gum_try_translate_vdso_name (path);
+    entry_path = gum_translate_vdso_name (entry.path);
+    is_vdso = entry_path != entry.path;
 
-    readable = perms[0] == 'r';
-    shared = perms[3] == 's';
+    readable = entry.perms[0] == 'r';
+    shared = entry.perms[3] == 's';
     if (!readable || shared)
       continue;
-    else if ((path[0] != '/' && !is_vdso) || g_str_has_prefix (path, "/dev/"))
+    else if ((entry_path[0] != '/' && !is_vdso) ||
+        g_str_has_prefix (entry_path, "/dev/"))
       continue;
-    else if (RUNNING_ON_VALGRIND && strstr (path, "/valgrind/") != NULL)
+    else if (RUNNING_ON_VALGRIND && strstr (entry_path, "/valgrind/") != NULL)
       continue;
-    else if (memcmp (GSIZE_TO_POINTER (range.base_address), elf_magic,
+    else if (memcmp (GSIZE_TO_POINTER (entry.start), elf_magic,
         sizeof (elf_magic)) != 0)
       continue;
 
+    g_strlcpy (path, entry_path, PATH_MAX);
     name = g_path_get_basename (path);
 
-    range.size = end - range.base_address;
+    range.base_address = entry.start;
+    range.size = entry.end - entry.start;
 
     details.name = name;
     details.range = &range;
     details.path = path;
 
-    while (fgets (line, line_size, fp) != NULL)
+    while (gum_proc_maps_iter_next (&iter, &entry))
     {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %[^\n]",
-          &end,
-          next_path);
-      if (n == 1)
+      const gchar * next_path = entry.path;
+
+      if (next_path[0] == '\0')
       {
         continue;
       }
-      else if (n == 2 && next_path[0] == '[')
+      else if (next_path[0] == '[')
       {
-        if (!gum_try_translate_vdso_name (next_path))
+        next_path = gum_translate_vdso_name (next_path);
+        if (next_path == entry.path)
           continue;
       }
 
-      if (n == 2 && strcmp (next_path, path) == 0)
+      if (strcmp (next_path, path) == 0)
       {
-        range.size = end - range.base_address;
+        range.size = entry.end - range.base_address;
       }
       else
       {
-        got_line = TRUE;
+        got_entry = TRUE;
         break;
       }
     }
@@ -1111,89 +1148,73 @@ gum_linux_enumerate_modules_using_proc_maps (GumFoundModuleFunc func,
   while (carry_on);
 
   g_free (path);
-  g_free (next_path);
-
-  g_free (line);
 
-  fclose (fp);
+  gum_proc_maps_iter_destroy (&iter);
 }
 
 GHashTable *
 gum_linux_collect_named_ranges (void)
 {
   GHashTable * result;
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * name, * next_name;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+  gchar * name;
   gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
+  gboolean got_entry = FALSE;
 
   result = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_linux_named_range_free);
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
-
-  line = g_malloc (line_size);
+  gum_proc_maps_iter_init_for_ranges (&iter, getpid ());
 
   name = g_malloc (PATH_MAX);
-  next_name = g_malloc (PATH_MAX);
 
   do
   {
-    GumAddress start, end;
+    GumAddress start;
     gsize size;
-    gint n;
     GumLinuxNamedRange * range;
 
-    if (!got_line)
+    if (!got_entry)
     {
-      if (fgets (line, line_size, fp) == NULL)
+      if (!gum_proc_maps_iter_next (&iter, &entry))
         break;
     }
     else
     {
-      got_line = FALSE;
+      got_entry = FALSE;
     }
 
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%*4c "
-        "%*x %*s %*d "
-        "%[^\n]",
-        &start, &end,
-        name);
-    if (n == 2)
+    if (entry.path[0] == '\0')
       continue;
-    g_assert (n == 3);
 
-    gum_try_translate_vdso_name (name);
+    g_strlcpy (name, gum_translate_vdso_name (entry.path), PATH_MAX);
 
-    size = end - start;
+    start = entry.start;
+    size = entry.end - start;
 
-    while (fgets (line, line_size, fp) != NULL)
+    while (gum_proc_maps_iter_next (&iter, &entry))
     {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %[^\n]",
-          &end,
-          next_name);
-      if (n == 1)
+      const gchar * next_name = entry.path;
+
+      if (next_name[0] == '\0')
       {
         continue;
       }
-      else if (n == 2 && next_name[0] == '[')
+      else if (next_name[0] == '[')
       {
-        if (!gum_try_translate_vdso_name (next_name))
+        next_name = gum_translate_vdso_name (next_name);
+        if (next_name == entry.path)
           continue;
       }
 
-      if (n == 2 && strcmp (next_name, name) == 0)
+      if (strcmp (next_name, name) == 0)
       {
-        size = end - start;
+        size = entry.end - start;
       }
       else
       {
-        got_line = TRUE;
+        got_entry = TRUE;
         break;
       }
     }
@@ -1209,15 +1230,103 @@ gum_linux_collect_named_ranges (void)
   while (carry_on);
 
   g_free (name);
-  g_free (next_name);
 
-  g_free (line);
+  gum_proc_maps_iter_destroy (&iter);
+
+  return result;
+}
+
+/*
+ * Module enumeration consults the named ranges once per call, so we keep the
+ * last table around for as long as the dynamic linker reports no loads or
+ * unloads. Callers must treat the returned table as read-only.
+ */
+GHashTable *
+gum_linux_obtain_named_ranges (void)
+{
+  GHashTable * result;
+  guint64 generation;
+
+  generation = gum_linux_query_loader_generation ();
+
+  G_LOCK (gum_named_ranges);
+
+  if (generation != 0 && gum_named_ranges != NULL &&
+      generation == gum_named_ranges_generation)
+  {
+    result = g_hash_table_ref (gum_named_ranges);
+
+    G_UNLOCK (gum_named_ranges);
+
+    return result;
+  }
+
+  G_UNLOCK (gum_named_ranges);
+
+  result = gum_linux_collect_named_ranges ();
 
-  fclose (fp);
+  if (generation != 0)
+  {
+    G_LOCK (gum_named_ranges);
+
+    if (gum_named_ranges == NULL)
+      _gum_register_destructor (gum_deinit_named_ranges);
+    else
+      g_hash_table_unref (gum_named_ranges);
+
+    gum_named_ranges = g_hash_table_ref (result);
+    gum_named_ranges_generation = generation;
+
+    G_UNLOCK (gum_named_ranges);
+  }
 
   return result;
 }
 
+static void
+gum_deinit_named_ranges (void)
+{
+  g_clear_pointer (&gum_named_ranges, g_hash_table_unref);
+}
+
+/*
+ * Returns a counter that changes whenever the dynamic linker loads or unloads
+ * something, or 0 if we have no way of knowing.
+ */
+guint64
+gum_linux_query_loader_generation (void)
+{
+#ifdef HAVE_GLIBC
+  guint64 generation = 0;
+
+  dl_iterate_phdr (gum_store_loader_generation, &generation);
+  if (generation != 0)
+    return generation;
+#endif
+
+  return _gum_process_get_loader_generation ();
+}
+
+#ifdef HAVE_GLIBC
+
+static gint
+gum_store_loader_generation (struct dl_phdr_info * info,
+                             gsize size,
+                             gpointer user_data)
+{
+  guint64 * generation = user_data;
+
+  if (size >= G_STRUCT_OFFSET (struct dl_phdr_info, dlpi_subs) +
+      sizeof (info->dlpi_subs))
+  {
+    *generation = info->dlpi_adds + info->dlpi_subs;
+  }
+
+  return 1;
+}
+
+#endif
+
 static void
 gum_linux_named_range_free (GumLinuxNamedRange * range)
 {
@@ -1226,16 +1335,13 @@ gum_linux_named_range_free (GumLinuxNamedRange * range)
   g_slice_free (GumLinuxNamedRange, range);
 }
 
-static gboolean
-gum_try_translate_vdso_name (gchar * name)
+static const gchar *
+gum_translate_vdso_name (const gchar * name)
 {
   if (strcmp (name, "[vdso]") == 0)
-  {
-    strcpy (name, "linux-vdso.so.1");
-    return TRUE;
-  }
+    return "linux-vdso.so.1";
 
-  return FALSE;
+  return name;
 }
 
 void
@@ -1246,57 +1352,51 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   gum_linux_enumerate_ranges (getpid (), prot, func, user_data);
 }
 
+gpointer
+_gum_process_find_loader_notifier (void)
+{
+#ifdef HAVE_LINK_H
+  const struct r_debug * r;
+
+  r = GSIZE_TO_POINTER (gum_module_find_export_by_name (NULL, "_r_debug"));
+  if (r == NULL)
+    return NULL;
+
+  return GSIZE_TO_POINTER (r->r_brk);
+#else
+  return NULL;
+#endif
+}
+
 void
 gum_linux_enumerate_ranges (pid_t pid,
                             GumPageProtection prot,
                             GumFoundRangeFunc func,
                             gpointer user_data)
 {
-  gchar * maps_path;
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
   gboolean carry_on = TRUE;
 
-  maps_path = g_strdup_printf ("/proc/%d/maps", pid);
+  gum_proc_maps_iter_init_for_ranges (&iter, pid);
 
-  fp = fopen (maps_path, "r");
-  g_assert (fp != NULL);
-
-  g_free (maps_path);
-
-  line = g_malloc (line_size);
-
-  while (carry_on && fgets (line, line_size, fp) != NULL)
+  while (carry_on && gum_proc_maps_iter_next (&iter, &entry))
   {
     GumRangeDetails details;
     GumMemoryRange range;
     GumFileMapping file;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    guint64 inode;
-    gint length;
-
-    sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%" G_GINT64_MODIFIER "x %*s %" G_GINT64_MODIFIER "d"
-        "%n",
-        &range.base_address, &end,
-        perms,
-        &file.offset, &inode,
-        &length);
-
-    range.size = end - range.base_address;
+
+    range.base_address = entry.start;
+    range.size = entry.end - entry.start;
 
     details.file = NULL;
-    if (inode != 0)
+    if (entry.inode != 0)
     {
-      file.path = strchr (line + length, '/');
+      file.path = strchr (entry.path, '/');
       if (file.path != NULL)
       {
-        *strchr (file.path, '\n') = '\0';
         details.file = &file;
+        file.offset = entry.offset;
         file.size = 0; /* TODO */
 
         if (RUNNING_ON_VALGRIND && strstr (file.path, "/valgrind/") != NULL)
@@ -1305,7 +1405,8 @@ gum_linux_enumerate_ranges (pid_t pid,
     }
 
     details.range = &range;
-    details.protection = gum_page_protection_from_proc_perms_string (perms);
+    details.protection =
+        gum_page_protection_from_proc_perms_string (entry.perms);
 
     if ((details.protection & prot) == prot)
     {
@@ -1313,9 +1414,352 @@ gum_linux_enumerate_ranges (pid_t pid,
     }
   }
 
-  g_free (line);
+  gum_proc_maps_iter_destroy (&iter);
+}
+
+void
+gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter)
+{
+  gum_proc_maps_iter_init_for_path (iter, "/proc/self/maps");
+}
+
+void
+gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+                                 pid_t pid)
+{
+  gchar path[31 + 1];
+
+  g_snprintf (path, sizeof (path), "/proc/%u/maps", (guint) pid);
+
+  gum_proc_maps_iter_init_for_path (iter, path);
+}
+
+void
+gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+                                  const gchar * path)
+{
+  iter->fd = open (path, O_RDONLY | O_CLOEXEC);
+  g_assert (iter->fd != -1);
+
+  iter->buffer = g_malloc (GUM_PROC_MAPS_BUFFER_SIZE);
+  iter->read_cursor = iter->buffer;
+  iter->write_cursor = iter->buffer;
+  iter->eof = FALSE;
+
+  iter->snapshot = NULL;
+}
+
+static void
+gum_proc_maps_iter_init_for_ranges (GumProcMapsIter * iter,
+                                    pid_t pid)
+{
+  GumRangesSnapshotScope * scope;
+  guint64 generation;
+
+  scope = g_private_get (&gum_ranges_snapshot_scope);
+  if (scope == NULL || scope->depth == 0 || pid != getpid ())
+  {
+    gum_proc_maps_iter_init_for_pid (iter, pid);
+    return;
+  }
+
+  generation = gum_linux_query_loader_generation ();
+
+  if (scope->snapshot != NULL && scope->snapshot->generation != generation)
+  {
+    gum_proc_maps_snapshot_unref (scope->snapshot);
+    scope->snapshot = NULL;
+  }
+
+  if (scope->snapshot == NULL)
+    scope->snapshot = gum_proc_maps_snapshot_new (generation);
+
+  iter->fd = -1;
+  iter->buffer = NULL;
+  iter->read_cursor = scope->snapshot->lines;
+  iter->write_cursor = scope->snapshot->lines + scope->snapshot->size;
+  iter->eof = TRUE;
+
+  iter->snapshot = gum_proc_maps_snapshot_ref (scope->snapshot);
+}
+
+void
+gum_proc_maps_iter_destroy (GumProcMapsIter * iter)
+{
+  if (iter->snapshot != NULL)
+  {
+    gum_proc_maps_snapshot_unref (iter->snapshot);
+    return;
+  }
+
+  g_free (iter->buffer);
+
+  close (iter->fd);
+}
+
+/*
+ * The entry returned points into the iterator's buffer and remains valid
+ * until the next call.
+ */
+gboolean
+gum_proc_maps_iter_next (GumProcMapsIter * iter,
+                         GumProcMapsEntry * entry)
+{
+  gchar * line;
+
+  while ((line = gum_proc_maps_iter_read_line (iter)) != NULL)
+  {
+    if (gum_parse_proc_maps_line (line, entry))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gchar *
+gum_proc_maps_iter_read_line (GumProcMapsIter * iter)
+{
+  if (iter->snapshot != NULL)
+  {
+    gchar * line;
+
+    if (iter->read_cursor == iter->write_cursor)
+      return NULL;
+
+    line = iter->read_cursor;
+    iter->read_cursor += strlen (line) + 1;
+    return line;
+  }
+
+  while (TRUE)
+  {
+    gsize available, capacity;
+    gchar * line, * newline;
+    gssize n;
+
+    available = iter->write_cursor - iter->read_cursor;
+
+    newline = memchr (iter->read_cursor, '\n', available);
+    if (newline != NULL)
+    {
+      line = iter->read_cursor;
+      *newline = '\0';
+      iter->read_cursor = newline + 1;
+      return line;
+    }
+
+    capacity = GUM_PROC_MAPS_BUFFER_SIZE - 1 - available;
+
+    if (iter->eof || capacity == 0)
+    {
+      if (available == 0)
+        return NULL;
+
+      line = iter->read_cursor;
+      *iter->write_cursor = '\0';
+      iter->read_cursor = iter->write_cursor;
+      return line;
+    }
+
+    if (iter->read_cursor != iter->buffer)
+    {
+      memmove (iter->buffer, iter->read_cursor, available);
+      iter->read_cursor = iter->buffer;
+      iter->write_cursor = iter->buffer + available;
+    }
+
+    do
+      n = read (iter->fd, iter->write_cursor, capacity);
+    while (n == -1 && errno == EINTR);
+
+    if (n > 0)
+      iter->write_cursor += n;
+    else
+      iter->eof = TRUE;
+  }
+}
+
+static gboolean
+gum_parse_proc_maps_line (const gchar * line,
+                          GumProcMapsEntry * entry)
+{
+  const gchar * cursor = line;
+  guint i;
+
+  if (!gum_try_parse_hex (&cursor, &entry->start) || *cursor++ != '-')
+    return FALSE;
+  if (!gum_try_parse_hex (&cursor, &entry->end) || *cursor++ != ' ')
+    return FALSE;
+
+  for (i = 0; i != 4; i++)
+  {
+    if (*cursor == '\0')
+      return FALSE;
+    entry->perms[i] = *cursor++;
+  }
+  entry->perms[4] = '\0';
+  if (*cursor++ != ' ')
+    return FALSE;
+
+  if (!gum_try_parse_hex (&cursor, &entry->offset) || *cursor++ != ' ')
+    return FALSE;
+
+  cursor = strchr (cursor, ' ');
+  if (cursor == NULL)
+    return FALSE;
+  cursor++;
+
+  if (!gum_try_parse_decimal (&cursor, &entry->inode))
+    return FALSE;
+
+  while (*cursor == ' ')
+    cursor++;
+  entry->path = cursor;
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_parse_hex (const gchar ** cursor,
+                   guint64 * value)
+{
+  const gchar * p = *cursor;
+  guint64 result = 0;
+  gint digit;
+
+  while ((digit = g_ascii_xdigit_value (*p)) != -1)
+  {
+    result = (result << 4) | digit;
+    p++;
+  }
+
+  if (p == *cursor)
+    return FALSE;
+
+  *cursor = p;
+  *value = result;
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_parse_decimal (const gchar ** cursor,
+                       guint64 * value)
+{
+  const gchar * p = *cursor;
+  guint64 result = 0;
+  gint digit;
+
+  while ((digit = g_ascii_digit_value (*p)) != -1)
+  {
+    result = (result * 10) + digit;
+    p++;
+  }
+
+  if (p == *cursor)
+    return FALSE;
+
+  *cursor = p;
+  *value = result;
+
+  return TRUE;
+}
+
+/*
+ * Until the matching gum_linux_end_ranges_snapshot(), enumerating the ranges
+ * of the current process on the calling thread reuses a single snapshot of
+ * its mappings, only taken again once the dynamic linker has loaded or
+ * unloaded something. Any other change to the mappings, including those made
+ * by Gum itself, goes unnoticed until the outermost scope has ended.
+ */
+void
+gum_linux_begin_ranges_snapshot (void)
+{
+  GumRangesSnapshotScope * scope;
+
+  scope = g_private_get (&gum_ranges_snapshot_scope);
+  if (scope == NULL)
+  {
+    scope = g_slice_new0 (GumRangesSnapshotScope);
+    g_private_set (&gum_ranges_snapshot_scope, scope);
+  }
+
+  scope->depth++;
+}
+
+void
+gum_linux_end_ranges_snapshot (void)
+{
+  GumRangesSnapshotScope * scope;
+
+  scope = g_private_get (&gum_ranges_snapshot_scope);
+  g_return_if_fail (scope != NULL && scope->depth != 0);
 
-  fclose (fp);
+  if (--scope->depth == 0 && scope->snapshot != NULL)
+  {
+    gum_proc_maps_snapshot_unref (scope->snapshot);
+    scope->snapshot = NULL;
+  }
+}
+
+static void
+gum_ranges_snapshot_scope_free (GumRangesSnapshotScope * scope)
+{
+  if (scope->snapshot != NULL)
+    gum_proc_maps_snapshot_unref (scope->snapshot);
+
+  g_slice_free (GumRangesSnapshotScope, scope);
+}
+
+static GumProcMapsSnapshot *
+gum_proc_maps_snapshot_new (guint64 generation)
+{
+  GumProcMapsSnapshot * snapshot;
+  gchar * cursor, * end;
+  gboolean success;
+
+  snapshot = g_slice_new (GumProcMapsSnapshot);
+  snapshot->ref_count = 1;
+  snapshot->generation = generation;
+
+  success = g_file_get_contents ("/proc/self/maps", &snapshot->lines,
+      &snapshot->size, NULL);
+  g_assert (success);
+
+  /*
+   * Lines are stored NUL-terminated, so iterators can hand them out without
+   * modifying the shared buffer.
+   */
+  end = snapshot->lines + snapshot->size;
+  for (cursor = snapshot->lines;
+      (cursor = memchr (cursor, '\n', end - cursor)) != NULL;
+      cursor++)
+  {
+    *cursor = '\0';
+  }
+  if (snapshot->size != 0 && end[-1] != '\0')
+    snapshot->size++;
+
+  return snapshot;
+}
+
+static GumProcMapsSnapshot *
+gum_proc_maps_snapshot_ref (GumProcMapsSnapshot * snapshot)
+{
+  snapshot->ref_count++;
+
+  return snapshot;
+}
+
+static void
+gum_proc_maps_snapshot_unref (GumProcMapsSnapshot * snapshot)
+{
+  if (--snapshot->ref_count != 0)
+    return;
+
+  g_free (snapshot->lines);
+
+  g_slice_free (GumProcMapsSnapshot, snapshot);
 }
 
 void
@@ -1434,19 +1878,16 @@ gum_module_enumerate_imports (const gchar * module_name,
   ctx.func = func;
   ctx.user_data = user_data;
 
-  ctx.dependency_exports = g_hash_table_new_full (g_str_hash, g_str_equal,
-      g_free, (GDestroyNotify) gum_dependency_export_free);
-  ctx.current_dependency = NULL;
+  ctx.dependencies = g_ptr_array_new_with_free_func (g_object_unref);
   ctx.module_map = NULL;
 
-  gum_elf_module_enumerate_dependencies (module, gum_collect_dependency_exports,
-      &ctx);
+  gum_elf_module_enumerate_dependencies (module, gum_collect_dependency, &ctx);
 
   gum_elf_module_enumerate_imports (module, gum_emit_import, &ctx);
 
   if (ctx.module_map != NULL)
     g_object_unref (ctx.module_map);
-  g_hash_table_unref (ctx.dependency_exports);
+  g_ptr_array_unref (ctx.dependencies);
 
   g_object_unref (module);
 }
@@ -1457,21 +1898,25 @@ gum_emit_import (const GumImportDetails * details,
 {
   GumEnumerateImportsContext * ctx = user_data;
   GumImportDetails d;
-  GumDependencyExport * exp;
+  guint i;
 
   d.type = details->type;
   d.name = details->name;
+  d.module = NULL;
+  d.address = 0;
   d.slot = details->slot;
 
-  exp = g_hash_table_lookup (ctx->dependency_exports, details->name);
-  if (exp != NULL)
+  for (i = 0; i != ctx->dependencies->len && d.address == 0; i++)
   {
-    d.module = exp->module;
-    d.address = exp->address;
+    GumElfModule * dependency = g_ptr_array_index (ctx->dependencies, i);
+
+    d.address = gum_elf_module_find_export_by_name (dependency, details->name);
+    if (d.address != 0)
+      d.module = dependency->path;
   }
-  else
+
+  if (d.address == 0)
   {
-    d.module = NULL;
     d.address = GUM_ADDRESS (
         gum_module_get_symbol (RTLD_DEFAULT, details->name));
 
@@ -1491,8 +1936,8 @@ gum_emit_import (const GumImportDetails * details,
 }
 
 static gboolean
-gum_collect_dependency_exports (const GumElfDependencyDetails * details,
-                                gpointer user_data)
+gum_collect_dependency (const GumElfDependencyDetails * details,
+                        gpointer user_data)
 {
   GumEnumerateImportsContext * ctx = user_data;
   GumElfModule * module;
@@ -1500,48 +1945,11 @@ gum_collect_dependency_exports (const GumElfDependencyDetails * details,
   module = gum_open_elf_module (details->name);
   if (module == NULL)
     return TRUE;
-  ctx->current_dependency = module;
-  gum_elf_module_enumerate_exports (module, gum_collect_dependency_export, ctx);
-  ctx->current_dependency = NULL;
-  g_object_unref (module);
-
-  return TRUE;
-}
-
-static gboolean
-gum_collect_dependency_export (const GumExportDetails * details,
-                               gpointer user_data)
-{
-  GumEnumerateImportsContext * ctx = user_data;
-  GumElfModule * module = ctx->current_dependency;
-
-  g_hash_table_insert (ctx->dependency_exports,
-      g_strdup (details->name),
-      gum_dependency_export_new (module->path, details->address));
+  g_ptr_array_add (ctx->dependencies, module);
 
   return TRUE;
 }
 
-static GumDependencyExport *
-gum_dependency_export_new (const gchar * module,
-                           GumAddress address)
-{
-  GumDependencyExport * export;
-
-  export = g_slice_new (GumDependencyExport);
-  export->module = g_strdup (module);
-  export->address = address;
-
-  return export;
-}
-
-static void
-gum_dependency_export_free (GumDependencyExport * export)
-{
-  g_free (export->module);
-  g_slice_free (GumDependencyExport, export);
-}
-
 void
 gum_module_enumerate_exports (const gchar * module_name,
                               GumFoundExportFunc func,
@@ -1698,6 +2106,7 @@ gum_module_find_export_by_name (const gchar * module_name,
 {
   GumAddress result;
   void * module;
+  gboolean opened;
 
 #ifdef HAVE_ANDROID
   if (gum_android_get_linker_flavor () == GUM_ANDROID_LINKER_NATIVE &&
@@ -1705,20 +2114,48 @@ gum_module_find_export_by_name (const gchar * module_name,
     return result;
 #endif
 
+  result = 0;
+  opened = FALSE;
+
   if (module_name != NULL)
   {
-    module = gum_module_get_handle (module_name);
-    if (module == NULL)
-      return 0;
+    guint64 generation;
+    GumElfModule * elf_module;
+
+    generation = gum_linux_query_loader_generation ();
+
+    elf_module = gum_find_current_export_module (module_name, generation,
+        &module);
+    if (elf_module == NULL)
+    {
+      module = gum_module_get_handle (module_name);
+      if (module == NULL)
+        return 0;
+      opened = TRUE;
+
+      elf_module = gum_obtain_export_module (module_name, module, generation);
+    }
+
+    if (elf_module != NULL)
+    {
+      result = gum_elf_module_find_export_by_name (elf_module, symbol_name);
+      g_object_unref (elf_module);
+    }
   }
   else
   {
     module = RTLD_DEFAULT;
   }
 
-  result = GUM_ADDRESS (gum_module_get_symbol (module, symbol_name));
+  /*
+   * The hash tables only cover the module's own definitions, so anything
+   * else, like IFUNCs and symbols provided by its dependencies, is left to
+   * the dynamic linker.
+   */
+  if (result == 0)
+    result = GUM_ADDRESS (gum_module_get_symbol (module, symbol_name));
 
-  if (module != RTLD_DEFAULT)
+  if (opened)
     dlclose (module);
 
   return result;
@@ -2006,6 +2443,123 @@ gum_open_elf_module (const gchar * name)
   return module;
 }
 
+/*
+ * As long as the dynamic linker reports no loads or unloads, a module we
+ * opened before is still loaded at the same address under the same handle,
+ * so lookups can skip dlopen() and dlclose(), which take the loader lock.
+ */
+static GumElfModule *
+gum_find_current_export_module (const gchar * name,
+                                guint64 generation,
+                                void ** handle)
+{
+  GumElfModule * module = NULL;
+  GumExportModule * entry;
+
+  if (generation == 0)
+    return NULL;
+
+  g_rw_lock_reader_lock (&gum_export_modules_lock);
+
+  if (gum_export_modules != NULL)
+  {
+    entry = g_hash_table_lookup (gum_export_modules, name);
+    if (entry != NULL && entry->generation == generation)
+    {
+      *handle = entry->handle;
+      module = g_object_ref (entry->module);
+    }
+  }
+
+  g_rw_lock_reader_unlock (&gum_export_modules_lock);
+
+  return module;
+}
+
+/*
+ * Opening a module means resolving its name through a module enumeration and
+ * mapping its file, so we keep them around for as long as the dynamic linker
+ * hands out the same handle for it, loaded at the same address.
+ */
+static GumElfModule *
+gum_obtain_export_module (const gchar * name,
+                          void * handle,
+                          guint64 generation)
+{
+  GumElfModule * module = NULL;
+  GumExportModule * entry;
+
+  g_rw_lock_writer_lock (&gum_export_modules_lock);
+
+  if (gum_export_modules == NULL)
+  {
+    gum_export_modules = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) gum_export_module_free);
+    _gum_register_destructor (gum_deinit_export_modules);
+  }
+
+  entry = g_hash_table_lookup (gum_export_modules, name);
+  if (entry != NULL && gum_export_module_is_current (entry, handle))
+  {
+    entry->generation = generation;
+    module = g_object_ref (entry->module);
+  }
+
+  g_rw_lock_writer_unlock (&gum_export_modules_lock);
+
+  if (module != NULL)
+    return module;
+
+  module = gum_open_elf_module (name);
+  if (module == NULL)
+    return NULL;
+
+  entry = g_slice_new (GumExportModule);
+  entry->generation = generation;
+  entry->handle = handle;
+  entry->module = g_object_ref (module);
+
+  g_rw_lock_writer_lock (&gum_export_modules_lock);
+  g_hash_table_insert (gum_export_modules, g_strdup (name), entry);
+  g_rw_lock_writer_unlock (&gum_export_modules_lock);
+
+  return module;
+}
+
+static void
+gum_deinit_export_modules (void)
+{
+  g_clear_pointer (&gum_export_modules, g_hash_table_unref);
+}
+
+static gboolean
+gum_export_module_is_current (GumExportModule * self,
+                              void * handle)
+{
+  if (handle != self->handle)
+    return FALSE;
+
+#if defined (HAVE_GLIBC)
+  {
+    struct link_map * map = handle;
+    GumElfModule * module = self->module;
+
+    if (map->l_addr != module->base_address - module->preferred_address)
+      return FALSE;
+  }
+#endif
+
+  return TRUE;
+}
+
+static void
+gum_export_module_free (GumExportModule * self)
+{
+  g_object_unref (self->module);
+
+  g_slice_free (GumExportModule, self);
+}
+
 void
 gum_linux_parse_ucontext (const ucontext_t * uc,
                           GumCpuContext * ctx)
@@ -6,6 +6,8 @@
 
 #include "gumstalker.h"
 
+#include <gio/gio.h>
+
 struct _GumStalker
 {
   GObject parent;
@@ -53,6 +55,36 @@ gum_stalker_set_trust_threshold (GumStalker * self,
 {
 }
 
+void
+gum_stalker_set_superblock_threshold (GumStalker * self,
+                                      guint threshold)
+{
+}
+
+void
+gum_stalker_set_background_compilation_enabled (GumStalker * self,
+                                                gboolean enabled)
+{
+}
+
+gboolean
+gum_stalker_save_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported");
+  return FALSE;
+}
+
+gboolean
+gum_stalker_load_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported");
+  return FALSE;
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -337,6 +337,12 @@ _gum_process_enumerate_ranges (GumPageProtection prot,
   }
 }
 
+gpointer
+_gum_process_find_loader_notifier (void)
+{
+  return NULL;
+}
+
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
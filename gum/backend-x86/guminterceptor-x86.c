@@ -26,6 +26,8 @@
 #define GUM_FRAME_OFFSET_TOP \
     (GUM_FRAME_OFFSET_NEXT_HOP + sizeof (gpointer))
 
+typedef struct _GumX86FunctionContextData GumX86FunctionContextData;
+
 struct _GumInterceptorBackend
 {
   GumCodeAllocator * allocator;
@@ -35,8 +37,24 @@ struct _GumInterceptorBackend
 
   GumCodeSlice * enter_thunk;
   GumCodeSlice * leave_thunk;
+  GumCodeSlice * lightweight_enter_thunk;
+  GSList * lazy_thunks;
+};
+
+struct _GumX86FunctionContextData
+{
+  gpointer fast_enter_trampoline;
 };
 
+G_STATIC_ASSERT (sizeof (GumX86FunctionContextData)
+    <= sizeof (GumFunctionContextBackendData));
+
+static GumCodeSlice * gum_interceptor_backend_alloc_slice_near (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
+static gpointer gum_interceptor_backend_obtain_lazy_thunk (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
+static gboolean gum_interceptor_backend_is_within_jmp_range (
+    GumFunctionContext * ctx, gconstpointer target);
 static void gum_interceptor_backend_create_thunks (
     GumInterceptorBackend * self);
 static void gum_interceptor_backend_destroy_thunks (
@@ -44,10 +62,19 @@ static void gum_interceptor_backend_destroy_thunks (
 
 static void gum_emit_enter_thunk (GumX86Writer * cw);
 static void gum_emit_leave_thunk (GumX86Writer * cw);
+static void gum_emit_lightweight_enter_thunk (GumX86Writer * cw);
+static void gum_emit_lazy_thunk (GumX86Writer * cw,
+    GumInterceptor * interceptor);
+static void gum_emit_probe (GumX86Writer * cw, GumProbe * probe,
+    gpointer exit);
+static void gum_emit_probe_count_call (GumX86Writer * cw, GumProbe * probe);
+static void gum_emit_load_probe_argument (GumX86Writer * cw, guint n,
+    GumCpuReg target);
 
 static void gum_emit_prolog (GumX86Writer * cw,
-    gssize stack_displacement);
-static void gum_emit_epilog (GumX86Writer * cw);
+    gssize stack_displacement, gboolean save_extended_context);
+static void gum_emit_epilog (GumX86Writer * cw,
+    gboolean restore_extended_context);
 
 GumInterceptorBackend *
 _gum_interceptor_backend_create (GRecMutex * mutex,
@@ -61,6 +88,8 @@ _gum_interceptor_backend_create (GRecMutex * mutex,
   gum_x86_writer_init (&backend->writer, NULL);
   gum_x86_relocator_init (&backend->relocator, NULL, &backend->writer);
 
+  backend->lazy_thunks = NULL;
+
   gum_interceptor_backend_create_thunks (backend);
 
   return backend;
@@ -88,21 +117,9 @@ static gboolean
 gum_interceptor_backend_prepare_trampoline (GumInterceptorBackend * self,
                                             GumFunctionContext * ctx)
 {
-#if GLIB_SIZEOF_VOID_P == 4
-  ctx->trampoline_slice = gum_code_allocator_alloc_slice (self->allocator);
-
-  return TRUE;
-#else
-  GumAddressSpec spec;
-  gsize default_alignment = 0;
-
-  spec.near_address = ctx->function_address;
-  spec.max_distance = GUM_X86_JMP_MAX_DISTANCE;
-  ctx->trampoline_slice = gum_code_allocator_try_alloc_slice_near (
-      self->allocator, &spec, default_alignment);
+  ctx->trampoline_slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
 
   return ctx->trampoline_slice != NULL;
-#endif
 }
 
 gboolean
@@ -111,6 +128,8 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
 {
   GumX86Writer * cw = &self->writer;
   GumX86Relocator * rl = &self->relocator;
+  GumX86FunctionContextData * data =
+      (GumX86FunctionContextData *) &ctx->backend_data;
   GumAddress function_ctx_ptr;
   guint reloc_bytes;
 
@@ -136,6 +155,31 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
   gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (self->leave_thunk->data));
 
+  ctx->on_lightweight_enter_trampoline = gum_x86_writer_cur (cw);
+
+  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
+  gum_x86_writer_put_jmp_address (cw,
+      GUM_ADDRESS (self->lightweight_enter_thunk->data));
+
+  /*
+   * Used by fast replacements that are too far away for the prologue to
+   * branch to them directly. The target lives in the slice itself rather
+   * than being loaded from the function context, so it stays valid for as
+   * long as the prologue may still lead here.
+   */
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+  {
+    GumAddress replacement_ptr;
+
+    replacement_ptr = GUM_ADDRESS (gum_x86_writer_cur (cw));
+    gum_x86_writer_put_bytes (cw, (guint8 *) &ctx->replacement_function,
+        sizeof (gpointer));
+
+    data->fast_enter_trampoline = gum_x86_writer_cur (cw);
+
+    gum_x86_writer_put_jmp_near_ptr (cw, replacement_ptr);
+  }
+
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= ctx->trampoline_slice->size);
 
@@ -165,6 +209,29 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   return TRUE;
 }
 
+gboolean
+_gum_interceptor_backend_prepare_lazy_trampoline (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  guint reloc_bytes;
+  gpointer thunk;
+
+  if (!gum_x86_relocator_can_relocate (ctx->function_address,
+      GUM_INTERCEPTOR_REDIRECT_CODE_SIZE, &reloc_bytes))
+    return FALSE;
+
+  thunk = gum_interceptor_backend_obtain_lazy_thunk (self, ctx);
+  if (thunk == NULL)
+    return FALSE;
+
+  ctx->lazy_thunk = thunk;
+
+  ctx->overwritten_prologue_len = reloc_bytes;
+  gum_memcpy (ctx->overwritten_prologue, ctx->function_address, reloc_bytes);
+
+  return TRUE;
+}
+
 void
 _gum_interceptor_backend_destroy_trampoline (GumInterceptorBackend * self,
                                              GumFunctionContext * ctx)
@@ -179,14 +246,45 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
                                               gpointer prologue)
 {
   GumX86Writer * cw = &self->writer;
+  GumX86FunctionContextData * data =
+      (GumX86FunctionContextData *) &ctx->backend_data;
+  gpointer on_enter;
   guint padding;
 
   gum_x86_writer_reset (cw, prologue);
   cw->pc = GPOINTER_TO_SIZE (ctx->function_address);
-  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (ctx->on_enter_trampoline));
+
+  if (ctx->lazy_thunk != NULL)
+  {
+    /*
+     * The thunk is shared, so we use a CALL to let it know which function
+     * it should generate a trampoline for.
+     */
+    gum_x86_writer_put_call_address (cw, GUM_ADDRESS (ctx->lazy_thunk));
+    gum_x86_writer_flush (cw);
+    g_assert (gum_x86_writer_offset (cw) ==
+        GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+    goto pad;
+  }
+
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST &&
+      gum_interceptor_backend_is_within_jmp_range (ctx,
+          ctx->replacement_function))
+    on_enter = ctx->replacement_function;
+  else if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+    on_enter = data->fast_enter_trampoline;
+  else if (ctx->probe != NULL && ctx->probe->code != NULL)
+    on_enter = ctx->probe->code;
+  else if (ctx->lightweight)
+    on_enter = ctx->on_lightweight_enter_trampoline;
+  else
+    on_enter = ctx->on_enter_trampoline;
+
+  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (on_enter));
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
 
+pad:
   padding = ctx->overwritten_prologue_len - gum_x86_writer_offset (cw);
   for (; padding != 0; padding--)
     gum_x86_writer_put_nop (cw);
@@ -202,6 +300,31 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
       ctx->overwritten_prologue_len);
 }
 
+gboolean
+_gum_interceptor_backend_create_probe (GumInterceptorBackend * self,
+                                       GumFunctionContext * ctx,
+                                       GumProbe * probe,
+                                       gpointer exit)
+{
+  GumX86Writer * cw = &self->writer;
+  GumCodeSlice * slice;
+
+  slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
+  if (slice == NULL)
+    return FALSE;
+
+  gum_x86_writer_reset (cw, slice->data);
+  gum_emit_probe (cw, probe, exit);
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <= slice->size);
+
+  probe->slice = slice;
+  probe->code = slice->data;
+  probe->exit = exit;
+
+  return TRUE;
+}
+
 gpointer
 _gum_interceptor_backend_get_function_address (GumFunctionContext * ctx)
 {
@@ -221,6 +344,70 @@ _gum_interceptor_backend_resolve_redirect (GumInterceptorBackend * self,
   return target;
 }
 
+static GumCodeSlice *
+gum_interceptor_backend_alloc_slice_near (GumInterceptorBackend * self,
+                                          GumFunctionContext * ctx)
+{
+#if GLIB_SIZEOF_VOID_P == 4
+  return gum_code_allocator_alloc_slice (self->allocator);
+#else
+  GumAddressSpec spec;
+  gsize default_alignment = 0;
+
+  spec.near_address = ctx->function_address;
+  spec.max_distance = GUM_X86_JMP_MAX_DISTANCE;
+
+  return gum_code_allocator_try_alloc_slice_near (self->allocator, &spec,
+      default_alignment);
+#endif
+}
+
+static gpointer
+gum_interceptor_backend_obtain_lazy_thunk (GumInterceptorBackend * self,
+                                           GumFunctionContext * ctx)
+{
+  GumX86Writer * cw = &self->writer;
+  GumCodeSlice * slice;
+  GSList * cur;
+
+  for (cur = self->lazy_thunks; cur != NULL; cur = cur->next)
+  {
+    slice = cur->data;
+
+    if (gum_interceptor_backend_is_within_jmp_range (ctx, slice->data))
+      return slice->data;
+  }
+
+  slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
+  if (slice == NULL)
+    return NULL;
+
+  gum_x86_writer_reset (cw, slice->data);
+  gum_emit_lazy_thunk (cw, ctx->interceptor);
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <= slice->size);
+
+  self->lazy_thunks = g_slist_prepend (self->lazy_thunks, slice);
+
+  return slice->data;
+}
+
+static gboolean
+gum_interceptor_backend_is_within_jmp_range (GumFunctionContext * ctx,
+                                             gconstpointer target)
+{
+#if GLIB_SIZEOF_VOID_P == 4
+  return TRUE;
+#else
+  gssize distance;
+
+  distance = (gssize) GPOINTER_TO_SIZE (target) -
+      (gssize) GPOINTER_TO_SIZE (ctx->function_address);
+
+  return ABS (distance) < GUM_X86_JMP_MAX_DISTANCE;
+#endif
+}
+
 static void
 gum_interceptor_backend_create_thunks (GumInterceptorBackend * self)
 {
@@ -237,11 +424,23 @@ gum_interceptor_backend_create_thunks (GumInterceptorBackend * self)
   gum_emit_leave_thunk (cw);
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= self->leave_thunk->size);
+
+  self->lightweight_enter_thunk =
+      gum_code_allocator_alloc_slice (self->allocator);
+  gum_x86_writer_reset (cw, self->lightweight_enter_thunk->data);
+  gum_emit_lightweight_enter_thunk (cw);
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <=
+      self->lightweight_enter_thunk->size);
 }
 
 static void
 gum_interceptor_backend_destroy_thunks (GumInterceptorBackend * self)
 {
+  g_slist_free_full (self->lazy_thunks, (GDestroyNotify) gum_code_slice_free);
+
+  gum_code_slice_free (self->lightweight_enter_thunk);
+
   gum_code_slice_free (self->leave_thunk);
 
   gum_code_slice_free (self->enter_thunk);
@@ -252,7 +451,7 @@ gum_emit_enter_thunk (GumX86Writer * cw)
 {
   const gssize return_address_stack_displacement = 0;
 
-  gum_emit_prolog (cw, return_address_stack_displacement);
+  gum_emit_prolog (cw, return_address_stack_displacement, TRUE);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -268,7 +467,7 @@ gum_emit_enter_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XDX,
       GUM_ARG_REGISTER, GUM_REG_XCX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, TRUE);
 }
 
 static void
@@ -276,7 +475,7 @@ gum_emit_leave_thunk (GumX86Writer * cw)
 {
   const gssize next_hop_stack_displacement = -((gssize) sizeof (gpointer));
 
-  gum_emit_prolog (cw, next_hop_stack_displacement);
+  gum_emit_prolog (cw, next_hop_stack_displacement, TRUE);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -289,12 +488,225 @@ gum_emit_leave_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XSI,
       GUM_ARG_REGISTER, GUM_REG_XDX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, TRUE);
+}
+
+static void
+gum_emit_lightweight_enter_thunk (GumX86Writer * cw)
+{
+  const gssize return_address_stack_displacement = 0;
+
+  /*
+   * Only used when every listener promised that the function takes no
+   * floating point arguments, in which case the FPU/SSE state is dead on
+   * entry and we can skip the costly fxsave/fxrstor round-trip.
+   */
+  gum_emit_prolog (cw, return_address_stack_displacement, FALSE);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XDX,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_NEXT_HOP);
+
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (_gum_function_context_begin_lightweight_invocation), 3,
+      GUM_ARG_REGISTER, GUM_REG_XBX,
+      GUM_ARG_REGISTER, GUM_REG_XSI,
+      GUM_ARG_REGISTER, GUM_REG_XDX);
+
+  gum_emit_epilog (cw, FALSE);
+}
+
+static void
+gum_emit_lazy_thunk (GumX86Writer * cw,
+                     GumInterceptor * interceptor)
+{
+  const gssize return_address_stack_displacement = 0;
+
+  /*
+   * Entered through the CALL that the prologue was patched with, so the
+   * return address pushed by it tells us which function was hit. Once the
+   * trampoline has been generated we return to the start of the function,
+   * which then branches to it.
+   */
+  gum_emit_prolog (cw, return_address_stack_displacement, TRUE);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
+      GUM_REG_XBX, -GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XDX,
+      GUM_REG_XBP, GUM_FRAME_OFFSET_NEXT_HOP);
+
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (_gum_interceptor_materialize_trampoline), 3,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (interceptor),
+      GUM_ARG_REGISTER, GUM_REG_XSI,
+      GUM_ARG_REGISTER, GUM_REG_XDX);
+
+  gum_emit_epilog (cw, TRUE);
+}
+
+static void
+gum_emit_probe (GumX86Writer * cw,
+                GumProbe * probe,
+                gpointer exit)
+{
+  const GumProbeProgram * program = &probe->program;
+
+  /*
+   * Runs the probe program without leaving generated code:
+   *
+   * [return_address]
+   * [cpu_flags]
+   * [xax]
+   * [xcx]
+   * [xdx] <-- xsp
+   */
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XDX);
+
+  if (program->count_calls)
+    gum_emit_probe_count_call (cw, probe);
+
+  if (program->n_arguments != 0)
+  {
+    guint i;
+
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&probe->head));
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, 1);
+    gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+
+    gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XDX, GUM_REG_XCX);
+    gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XDX, probe->mask);
+    gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_XDX, probe->record_shift);
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+        GUM_ADDRESS (probe->records));
+    gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XDX, GUM_REG_XAX);
+
+    for (i = 0; i != program->n_arguments; i++)
+    {
+      gum_emit_load_probe_argument (cw, program->arguments[i], GUM_REG_XAX);
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+          GUM_REG_XDX, (1 + i) * sizeof (gpointer),
+          GUM_REG_XAX);
+    }
+
+    /* x86 does not reorder stores, so the stamp is published last. */
+    gum_x86_writer_put_inc_reg (cw, GUM_REG_XCX);
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XDX, 0,
+        GUM_REG_XCX);
+  }
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+
+  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (exit));
+}
+
+static void
+gum_emit_probe_count_call (GumX86Writer * cw,
+                           GumProbe * probe)
+{
+  const guint8 adc_ecx_0[] = { 0x83, 0xd1, 0x00 };
+  const guint8 lock_cmpxchg8b_esi_ptr[] = { 0xf0, 0x0f, 0xc7, 0x0e };
+  gconstpointer retry = cw->code + 1;
+
+  if (cw->target_cpu == GUM_CPU_AMD64)
+  {
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&probe->call_count));
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, 1);
+    gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+    return;
+  }
+
+  /* The counter is 64 bits wide on IA-32 too, so it takes a CAS loop. */
+  gum_x86_writer_put_push_reg (cw, GUM_REG_EBX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_ESI);
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_ESI,
+      GUM_ADDRESS (&probe->call_count));
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_EAX, GUM_REG_ESI, 0);
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_EDX, GUM_REG_ESI, 4);
+
+  gum_x86_writer_put_label (cw, retry);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_EBX, GUM_REG_EAX);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_ECX, GUM_REG_EDX);
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_EBX, 1);
+  gum_x86_writer_put_bytes (cw, adc_ecx_0, sizeof (adc_ecx_0));
+  gum_x86_writer_put_bytes (cw, lock_cmpxchg8b_esi_ptr,
+      sizeof (lock_cmpxchg8b_esi_ptr));
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, retry, GUM_NO_HINT);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_ESI);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_EBX);
+}
+
+static void
+gum_emit_load_probe_argument (GumX86Writer * cw,
+                              guint n,
+                              GumCpuReg target)
+{
+  const guint frame_size = 5;
+  GumCpuReg reg;
+
+  /* On IA-32 it reports fastcall registers, whereas probes assume cdecl. */
+  reg = (cw->target_cpu == GUM_CPU_AMD64)
+      ? gum_x86_writer_get_cpu_register_for_nth_argument (cw, n)
+      : GUM_REG_NONE;
+  switch (reg)
+  {
+    case GUM_REG_RCX:
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, target,
+          GUM_REG_XSP, sizeof (gpointer));
+      break;
+    case GUM_REG_RDX:
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, target,
+          GUM_REG_XSP, 0);
+      break;
+    case GUM_REG_NONE:
+    {
+      guint n_register_arguments, n_shadow_slots;
+
+      if (cw->target_cpu == GUM_CPU_AMD64)
+      {
+        if (cw->target_abi == GUM_ABI_UNIX)
+        {
+          n_register_arguments = 6;
+          n_shadow_slots = 0;
+        }
+        else
+        {
+          n_register_arguments = 4;
+          n_shadow_slots = 4;
+        }
+      }
+      else
+      {
+        n_register_arguments = 0;
+        n_shadow_slots = 0;
+      }
+
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, target, GUM_REG_XSP,
+          (frame_size + n_shadow_slots + n - n_register_arguments) *
+          sizeof (gpointer));
+
+      break;
+    }
+    default:
+      gum_x86_writer_put_mov_reg_reg (cw, target, reg);
+      break;
+  }
 }
 
 static void
 gum_emit_prolog (GumX86Writer * cw,
-                 gssize stack_displacement)
+                 gssize stack_displacement,
+                 gboolean save_extended_context)
 {
   guint8 fxsave[] = {
     0x0f, 0xae, 0x04, 0x24 /* fxsave [esp] */
@@ -326,18 +738,23 @@ gum_emit_prolog (GumX86Writer * cw,
       GUM_FRAME_OFFSET_NEXT_HOP);
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBP, GUM_REG_XSP);
   gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
-  gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
-  gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
+  if (save_extended_context)
+  {
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
+    gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
+  }
 }
 
 static void
-gum_emit_epilog (GumX86Writer * cw)
+gum_emit_epilog (GumX86Writer * cw,
+                 gboolean restore_extended_context)
 {
   guint8 fxrstor[] = {
     0x0f, 0xae, 0x0c, 0x24 /* fxrstor [esp] */
   };
 
-  gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
+  if (restore_extended_context)
+    gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBP);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
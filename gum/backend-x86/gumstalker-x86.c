@@ -9,6 +9,8 @@
 #include "gumstalker.h"
 
 #include "gummetalhash.h"
+#include "gummodulemap.h"
+#include "gumstalker-priv.h"
 #include "gumx86reader.h"
 #include "gumx86writer.h"
 #include "gummemory.h"
@@ -19,8 +21,13 @@
 # include "gumexceptor.h"
 #endif
 
+#include <gio/gio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_LINUX
+# include <elf.h>
+# include <link.h>
+#endif
 #ifdef HAVE_WINDOWS
 # define VC_EXTRALEAN
 # include <windows.h>
@@ -35,6 +42,16 @@
 #define GUM_SCRATCH_SLAB_SIZE       16384
 #define GUM_EXEC_BLOCK_MIN_CAPACITY 1024
 
+#define GUM_BLOCK_CACHE_MAGIC        "GUMSBC"
+#define GUM_BLOCK_CACHE_MAGIC_SIZE   6
+#define GUM_BLOCK_CACHE_VERSION      2
+#define GUM_BLOCK_CACHE_HEADER_SIZE \
+    (GUM_BLOCK_CACHE_MAGIC_SIZE + sizeof (guint16) + (2 * sizeof (guint32)))
+
+#define GUM_MAX_SUCCESSORS           4
+#define GUM_MAX_PENDING_COMPILE_JOBS 1024
+#define GUM_MAX_SUPERBLOCK_SEGMENTS  8
+
 #if GLIB_SIZEOF_VOID_P == 4
 # define GUM_INVALIDATE_TRAMPOLINE_SIZE            16
 # define GUM_STATE_PRESERVE_TOPMOST_REGISTER_INDEX 3
@@ -56,6 +73,9 @@ typedef struct _GumDisinfectContext GumDisinfectContext;
 typedef struct _GumActivation GumActivation;
 typedef struct _GumInvalidateContext GumInvalidateContext;
 typedef struct _GumCallProbe GumCallProbe;
+typedef struct _GumPersistedBlock GumPersistedBlock;
+typedef struct _GumResolveModulesContext GumResolveModulesContext;
+typedef struct _GumCompileJob GumCompileJob;
 
 typedef struct _GumExecCtx GumExecCtx;
 typedef guint GumExecCtxMode;
@@ -65,6 +85,8 @@ typedef gpointer (GUM_THUNK * GumExecCtxReplaceCurrentBlockFunc) (
 
 typedef struct _GumExecBlock GumExecBlock;
 typedef guint GumExecBlockFlags;
+typedef struct _GumSuperblock GumSuperblock;
+typedef struct _GumSuperblockSegment GumSuperblockSegment;
 
 typedef struct _GumExecFrame GumExecFrame;
 
@@ -123,12 +145,24 @@ struct _GumStalker
 
   GArray * exclusions;
   gint trust_threshold;
+  guint superblock_threshold;
   volatile gboolean any_probes_attached;
   volatile gint last_probe_id;
   GumSpinlock probe_lock;
   GHashTable * probe_target_by_id;
   GHashTable * probe_array_by_address;
 
+  GBytes * persisted_data;
+  GArray * persisted_blocks;
+
+  volatile gboolean background_compilation_enabled;
+  GThread * compiler_thread;
+  GMutex compiler_mutex;
+  GCond compiler_cond;
+  GQueue compiler_jobs;
+  GumExecCtx * compiler_ctx;
+  gboolean compiler_stopping;
+
 #ifdef HAVE_WINDOWS
   GumExceptor * exceptor;
 # if GLIB_SIZEOF_VOID_P == 4
@@ -165,6 +199,27 @@ struct _GumInvalidateContext
   gboolean is_executing_target_block;
 };
 
+struct _GumPersistedBlock
+{
+  guint module_index;
+  guint size;
+  guint64 offset;
+  const guint8 * snapshot;
+  gpointer real_address;
+};
+
+struct _GumResolveModulesContext
+{
+  GPtrArray * identities;
+  GumAddress * bases;
+};
+
+struct _GumCompileJob
+{
+  GumExecCtx * ctx;
+  gpointer real_address;
+};
+
 struct _GumCallProbe
 {
   gint ref_count;
@@ -201,6 +256,12 @@ struct _GumExecCtx
   GumEventType sink_mask;
   void (* sink_process_impl) (GumEventSink * self, const GumEvent * event,
       GumCpuContext * cpu_context);
+  void (* sink_process_buffer_impl) (GumEventSink * self,
+      const GumEvent * events, guint n_events);
+  GumEvent * event_buffer;
+  GumEvent * event_buffer_cursor;
+  gsize event_buffer_remaining;
+  guint event_buffer_capacity;
 
   gboolean unfollow_called_while_still_following;
   GumExecBlock * current_block;
@@ -223,7 +284,13 @@ struct _GumExecCtx
   GumCodeSlab * code_slab;
   GumDataSlab * data_slab;
   GumCodeSlab * scratch_slab;
-  GumMetalHashTable * mappings;
+  GumMetalPointerTable * mappings;
+  gpointer successors[GUM_MAX_SUCCESSORS];
+  guint n_successors;
+  gboolean may_speculate;
+  gboolean speculating;
+  GumSuperblock * forming_superblock;
+  GumSuperblock * superblocks;
   gpointer last_prolog_minimal;
   gpointer last_epilog_minimal;
   gpointer last_prolog_full;
@@ -252,6 +319,7 @@ struct _GumExecBlock
   GumExecCtx * ctx;
   GumCodeSlab * code_slab;
   GumExecBlock * storage_block;
+  GumSuperblock * superblock;
 
   guint8 * real_start;
   guint8 * code_start;
@@ -262,11 +330,30 @@ struct _GumExecBlock
 
   GumExecBlockFlags flags;
   gint recycle_count;
+  guint hot_edge_count;
 };
 
 enum _GumExecBlockFlags
 {
   GUM_EXEC_BLOCK_ACTIVATION_TARGET = 1 << 0,
+  GUM_EXEC_BLOCK_SPECULATIVE       = 1 << 1,
+  GUM_EXEC_BLOCK_SUPERBLOCK        = 1 << 2,
+};
+
+struct _GumSuperblockSegment
+{
+  guint8 * real_start;
+  guint real_size;
+  guint8 * snapshot;
+};
+
+struct _GumSuperblock
+{
+  GumExecBlock * block;
+  GumSuperblock * next;
+
+  GumSuperblockSegment segments[GUM_MAX_SUPERBLOCK_SEGMENTS];
+  guint n_segments;
 };
 
 struct _GumExecFrame
@@ -317,6 +404,11 @@ struct _GumGeneratorContext
   gpointer continuation_real_address;
   GumPrologType opened_prolog;
   guint accumulated_stack_delta;
+
+  gpointer inline_target;
+  gpointer segments[GUM_MAX_SUPERBLOCK_SEGMENTS];
+  guint8 * segment_ends[GUM_MAX_SUPERBLOCK_SEGMENTS];
+  guint n_segments;
 };
 
 struct _GumInstruction
@@ -387,6 +479,8 @@ G_GNUC_INTERNAL void _gum_stalker_do_deactivate (GumStalker * self,
     gpointer * ret_addr_ptr);
 static gboolean gum_stalker_do_invalidate (GumExecCtx * ctx,
     gconstpointer address, GumActivation * activation);
+static void gum_stalker_invalidate_block (GumExecCtx * ctx,
+    GumInvalidateContext * ic, GumActivation * activation);
 static void gum_stalker_try_invalidate_block_owned_by_thread (
     GumThreadId thread_id, GumCpuContext * cpu_context, gpointer user_data);
 
@@ -429,6 +523,38 @@ static gpointer GUM_THUNK gum_exec_ctx_switch_block (GumExecCtx * ctx,
 
 static GumExecBlock * gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
     gpointer real_address, gpointer * code_address);
+static void gum_exec_ctx_warm_up (GumExecCtx * ctx);
+static void gum_stalker_collect_persisted_blocks (GumStalker * self,
+    GPtrArray * addresses);
+static void gum_resolve_persisted_blocks (GPtrArray * identities,
+    GArray * blocks);
+static gboolean gum_resolve_persisted_module (const GumModuleDetails * details,
+    gpointer user_data);
+static void gum_exec_ctx_add_successor (GumExecCtx * ctx,
+    gpointer real_address);
+static void gum_stalker_enqueue_compile_jobs (GumStalker * self,
+    GumExecCtx * ctx, gpointer * addresses, guint n);
+static gboolean gum_stalker_claim_compile_job (GumStalker * self,
+    GumExecCtx * ctx, gpointer real_address);
+static void gum_stalker_cancel_compile_jobs (GumStalker * self,
+    GumExecCtx * ctx);
+static void gum_stalker_stop_compiler_thread (GumStalker * self);
+static gpointer gum_stalker_compile_in_background (GumStalker * self);
+static void gum_exec_ctx_speculate_block (GumExecCtx * ctx,
+    gpointer real_address);
+static gboolean gum_parse_block_cache (GBytes * data, GPtrArray * identities,
+    GArray * blocks, GError ** error);
+static void gum_byte_array_append_uint32_le (GByteArray * array,
+    guint32 value);
+static void gum_byte_array_append_uint64_le (GByteArray * array,
+    guint64 value);
+static guint32 gum_read_uint32_le (const guint8 ** cursor);
+static guint64 gum_read_uint64_le (const guint8 ** cursor);
+static void gum_stalker_clear_block_cache (GumStalker * self);
+static gchar * gum_compute_module_identity (const GumModuleDetails * details);
+#ifdef HAVE_LINUX
+static gchar * gum_read_elf_build_id (gconstpointer base);
+#endif
 static void gum_exec_ctx_recompile_block (GumExecCtx * ctx,
     GumExecBlock * block);
 static void gum_exec_ctx_compile_block (GumExecCtx * ctx, GumExecBlock * block,
@@ -436,6 +562,9 @@ static void gum_exec_ctx_compile_block (GumExecCtx * ctx, GumExecBlock * block,
     guint * input_size, guint * output_size);
 static void gum_exec_ctx_maybe_emit_compile_event (GumExecCtx * ctx,
     GumExecBlock * block);
+static void gum_exec_ctx_emit_event (GumExecCtx * ctx, const GumEvent * event,
+    GumCpuContext * cpu_context);
+static void gum_exec_ctx_flush_event_buffer (GumExecCtx * ctx);
 
 static gboolean gum_stalker_iterator_is_out_of_space (
     GumStalkerIterator * self);
@@ -501,7 +630,18 @@ static void gum_exec_block_backpatch_call (GumExecBlock * block,
     gpointer code_start, GumPrologType opened_prolog, gpointer ret_real_address,
     gpointer ret_code_address);
 static void gum_exec_block_backpatch_jmp (GumExecBlock * block,
-    gpointer code_start, GumPrologType opened_prolog);
+    gpointer code_start, GumPrologType opened_prolog, GumExecBlock * from);
+static gboolean gum_exec_ctx_form_superblock (GumExecCtx * ctx,
+    GumExecBlock * from, GumExecBlock * to);
+static gboolean gum_exec_ctx_may_inline (GumExecCtx * ctx,
+    gconstpointer real_address, GumGeneratorContext * gc);
+static void gum_superblock_describe_segments (GumSuperblock * self,
+    GumGeneratorContext * gc);
+static void gum_superblock_take_snapshots (GumSuperblock * self,
+    GumExecBlock * storage_block);
+static gboolean gum_superblock_is_up_to_date (const GumSuperblock * self);
+static gboolean gum_superblock_contains (const GumSuperblock * self,
+    gconstpointer address);
 static void gum_exec_block_backpatch_ret (GumExecBlock * block,
     gpointer code_start);
 
@@ -540,6 +680,8 @@ static void gum_exec_block_write_exec_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 static void gum_exec_block_write_block_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
+static void gum_exec_block_write_buffered_event_code (GumExecBlock * block,
+    GumEventType type, GumGeneratorContext * gc);
 static void gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 
@@ -639,6 +781,10 @@ gum_stalker_init (GumStalker * self)
   self->probe_array_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) g_ptr_array_unref);
 
+  g_mutex_init (&self->compiler_mutex);
+  g_cond_init (&self->compiler_cond);
+  g_queue_init (&self->compiler_jobs);
+
   page_size = gum_query_page_size ();
 
   self->frames_size = page_size;
@@ -766,6 +912,12 @@ gum_stalker_finalize (GObject * object)
   g_array_unref (self->wow_transition_impls);
 #endif
 
+  gum_stalker_stop_compiler_thread (self);
+  g_cond_clear (&self->compiler_cond);
+  g_mutex_clear (&self->compiler_mutex);
+
+  gum_stalker_clear_block_cache (self);
+
   g_hash_table_unref (self->probe_array_by_address);
   g_hash_table_unref (self->probe_target_by_id);
 
@@ -822,6 +974,429 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->trust_threshold = trust_threshold;
 }
 
+void
+gum_stalker_set_superblock_threshold (GumStalker * self,
+                                      guint threshold)
+{
+  self->superblock_threshold = threshold;
+}
+
+void
+gum_stalker_set_background_compilation_enabled (GumStalker * self,
+                                                gboolean enabled)
+{
+  /*
+   * The compiler thread writes into slabs that the followed thread may be
+   * executing from, which is only safe when we do not need to flip page
+   * protections back and forth.
+   */
+  if (enabled && !self->is_rwx_supported)
+    return;
+
+  if (enabled && self->compiler_thread == NULL)
+  {
+    self->compiler_stopping = FALSE;
+    self->compiler_thread = g_thread_new ("gum-stalker-compiler",
+        (GThreadFunc) gum_stalker_compile_in_background, self);
+  }
+
+  self->background_compilation_enabled = enabled;
+
+  if (!enabled)
+    gum_stalker_stop_compiler_thread (self);
+}
+
+gboolean
+gum_stalker_save_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  gboolean success;
+  GumActivation activation;
+  GumModuleMap * modules;
+  GHashTable * module_indices;
+  GPtrArray * identities;
+  GHashTable * seen;
+  GByteArray * blocks;
+  guint32 n_modules, n_blocks;
+  GByteArray * output;
+  guint16 version;
+  GSList * cur;
+  guint32 i;
+
+  gum_stalker_maybe_deactivate (self, &activation);
+
+  modules = gum_module_map_new ();
+  module_indices = g_hash_table_new (NULL, NULL);
+  identities = g_ptr_array_new_with_free_func (g_free);
+  seen = g_hash_table_new (NULL, NULL);
+  blocks = g_byte_array_new ();
+  n_blocks = 0;
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = cur->data;
+    GumMetalPointerTableIter iter;
+    gpointer real_address;
+    GumExecBlock * block;
+
+    gum_spinlock_acquire (&ctx->code_lock);
+
+    gum_metal_pointer_table_iter_init (&iter, ctx->mappings);
+    while (gum_metal_pointer_table_iter_next (&iter, &real_address,
+        (gpointer *) &block))
+    {
+      const GumModuleDetails * details;
+      gpointer index_value;
+      guint32 module_index, size;
+      guint64 offset;
+      gconstpointer snapshot;
+
+      if (!g_hash_table_add (seen, real_address))
+        continue;
+
+      details = gum_module_map_find (modules, GUM_ADDRESS (real_address));
+      if (details == NULL)
+        continue;
+
+      if (g_hash_table_lookup_extended (module_indices, details, NULL,
+          &index_value))
+      {
+        module_index = GPOINTER_TO_UINT (index_value);
+      }
+      else
+      {
+        module_index = identities->len;
+        g_ptr_array_add (identities, gum_compute_module_identity (details));
+        g_hash_table_insert (module_indices, (gpointer) details,
+            GUINT_TO_POINTER (module_index));
+      }
+
+      size = block->real_size;
+      offset = GUM_ADDRESS (real_address) - details->range->base_address;
+      snapshot = (gum_stalker_snapshot_space_needed_for (self, size) != 0)
+          ? gum_exec_block_get_snapshot_start (block)
+          : block->real_start;
+
+      gum_byte_array_append_uint32_le (blocks, module_index);
+      gum_byte_array_append_uint32_le (blocks, size);
+      gum_byte_array_append_uint64_le (blocks, offset);
+      g_byte_array_append (blocks, snapshot, size);
+      n_blocks++;
+    }
+
+    gum_spinlock_release (&ctx->code_lock);
+  }
+
+  GUM_STALKER_UNLOCK (self);
+
+  n_modules = identities->len;
+
+  output = g_byte_array_new ();
+  g_byte_array_append (output, (const guint8 *) GUM_BLOCK_CACHE_MAGIC,
+      GUM_BLOCK_CACHE_MAGIC_SIZE);
+  version = GUINT16_TO_LE (GUM_BLOCK_CACHE_VERSION);
+  g_byte_array_append (output, (const guint8 *) &version, sizeof (version));
+  gum_byte_array_append_uint32_le (output, n_modules);
+  gum_byte_array_append_uint32_le (output, n_blocks);
+  for (i = 0; i != n_modules; i++)
+  {
+    const gchar * identity = g_ptr_array_index (identities, i);
+    guint32 length = strlen (identity);
+
+    gum_byte_array_append_uint32_le (output, length);
+    g_byte_array_append (output, (const guint8 *) identity, length);
+  }
+  g_byte_array_append (output, blocks->data, blocks->len);
+
+  success = g_file_set_contents (path, (const gchar *) output->data,
+      output->len, error);
+
+  g_byte_array_unref (output);
+  g_byte_array_unref (blocks);
+  g_hash_table_unref (seen);
+  g_ptr_array_unref (identities);
+  g_hash_table_unref (module_indices);
+  g_object_unref (modules);
+
+  gum_stalker_maybe_reactivate (self, &activation);
+
+  return success;
+}
+
+/*
+ * The blocks are resolved against the modules loaded at this point, so the
+ * cache should be loaded once the modules of interest have been. Blocks of
+ * modules loaded later on are not warmed up.
+ */
+gboolean
+gum_stalker_load_block_cache (GumStalker * self,
+                              const gchar * path,
+                              GError ** error)
+{
+  gboolean success;
+  gchar * contents;
+  gsize length;
+  GBytes * data;
+  GPtrArray * identities;
+  GArray * blocks;
+
+  if (!g_file_get_contents (path, &contents, &length, error))
+    return FALSE;
+  data = g_bytes_new_take (contents, length);
+
+  identities = g_ptr_array_new_with_free_func (g_free);
+  blocks = g_array_new (FALSE, FALSE, sizeof (GumPersistedBlock));
+
+  success = gum_parse_block_cache (data, identities, blocks, error);
+  if (success)
+    gum_resolve_persisted_blocks (identities, blocks);
+
+  GUM_STALKER_LOCK (self);
+  gum_stalker_clear_block_cache (self);
+  if (success)
+  {
+    self->persisted_data = g_bytes_ref (data);
+    self->persisted_blocks = g_array_ref (blocks);
+  }
+  GUM_STALKER_UNLOCK (self);
+
+  g_array_unref (blocks);
+  g_ptr_array_unref (identities);
+  g_bytes_unref (data);
+
+  return success;
+}
+
+/*
+ * All integers are stored little-endian, whatever the byte order of the
+ * process that saved the cache.
+ */
+static gboolean
+gum_parse_block_cache (GBytes * data,
+                       GPtrArray * identities,
+                       GArray * blocks,
+                       GError ** error)
+{
+  const guint8 * cursor, * end;
+  gsize size;
+  guint16 version;
+  guint32 n_modules, n_blocks, i;
+
+  cursor = g_bytes_get_data (data, &size);
+  end = cursor + size;
+
+  if (size < GUM_BLOCK_CACHE_HEADER_SIZE ||
+      memcmp (cursor, GUM_BLOCK_CACHE_MAGIC, GUM_BLOCK_CACHE_MAGIC_SIZE) != 0)
+    goto invalid_data;
+  cursor += GUM_BLOCK_CACHE_MAGIC_SIZE;
+
+  memcpy (&version, cursor, sizeof (version));
+  cursor += sizeof (version);
+  if (GUINT16_FROM_LE (version) != GUM_BLOCK_CACHE_VERSION)
+    goto unsupported_version;
+
+  n_modules = gum_read_uint32_le (&cursor);
+  n_blocks = gum_read_uint32_le (&cursor);
+
+  for (i = 0; i != n_modules; i++)
+  {
+    guint32 length;
+
+    if ((gsize) (end - cursor) < sizeof (length))
+      goto invalid_data;
+    length = gum_read_uint32_le (&cursor);
+
+    if ((gsize) (end - cursor) < length)
+      goto invalid_data;
+    g_ptr_array_add (identities, g_strndup ((const gchar *) cursor, length));
+    cursor += length;
+  }
+
+  for (i = 0; i != n_blocks; i++)
+  {
+    GumPersistedBlock pb;
+    guint32 module_index, block_size;
+
+    if ((gsize) (end - cursor) <
+        sizeof (module_index) + sizeof (block_size) + sizeof (pb.offset))
+      goto invalid_data;
+    module_index = gum_read_uint32_le (&cursor);
+    block_size = gum_read_uint32_le (&cursor);
+    pb.offset = gum_read_uint64_le (&cursor);
+
+    if (module_index >= n_modules || (gsize) (end - cursor) < block_size)
+      goto invalid_data;
+
+    pb.module_index = module_index;
+    pb.size = block_size;
+    pb.snapshot = cursor;
+    pb.real_address = NULL;
+    cursor += block_size;
+
+    g_array_append_val (blocks, pb);
+  }
+
+  if (cursor != end)
+    goto invalid_data;
+
+  return TRUE;
+
+invalid_data:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Invalid block cache");
+    return FALSE;
+  }
+unsupported_version:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Unsupported block cache version");
+    return FALSE;
+  }
+}
+
+static void
+gum_stalker_clear_block_cache (GumStalker * self)
+{
+  g_clear_pointer (&self->persisted_blocks, g_array_unref);
+  g_clear_pointer (&self->persisted_data, g_bytes_unref);
+}
+
+static void
+gum_byte_array_append_uint32_le (GByteArray * array,
+                                 guint32 value)
+{
+  guint32 le_value = GUINT32_TO_LE (value);
+
+  g_byte_array_append (array, (const guint8 *) &le_value, sizeof (le_value));
+}
+
+static void
+gum_byte_array_append_uint64_le (GByteArray * array,
+                                 guint64 value)
+{
+  guint64 le_value = GUINT64_TO_LE (value);
+
+  g_byte_array_append (array, (const guint8 *) &le_value, sizeof (le_value));
+}
+
+static guint32
+gum_read_uint32_le (const guint8 ** cursor)
+{
+  guint32 value;
+
+  memcpy (&value, *cursor, sizeof (value));
+  *cursor += sizeof (value);
+
+  return GUINT32_FROM_LE (value);
+}
+
+static guint64
+gum_read_uint64_le (const guint8 ** cursor)
+{
+  guint64 value;
+
+  memcpy (&value, *cursor, sizeof (value));
+  *cursor += sizeof (value);
+
+  return GUINT64_FROM_LE (value);
+}
+
+static gchar *
+gum_compute_module_identity (const GumModuleDetails * details)
+{
+#ifdef HAVE_LINUX
+  gchar * build_id;
+
+  build_id = gum_read_elf_build_id (
+      GSIZE_TO_POINTER (details->range->base_address));
+  if (build_id != NULL)
+    return build_id;
+#endif
+
+  return g_strdup_printf ("%s:%" G_GSIZE_FORMAT, details->name,
+      details->range->size);
+}
+
+#ifdef HAVE_LINUX
+
+static gchar *
+gum_read_elf_build_id (gconstpointer base)
+{
+  const ElfW(Ehdr) * ehdr = base;
+  const ElfW(Phdr) * phdrs;
+  GumAddress bias;
+  guint i;
+
+  if (!gum_memory_is_readable (base, sizeof (ElfW(Ehdr))) ||
+      memcmp (ehdr->e_ident, ELFMAG, SELFMAG) != 0)
+    return NULL;
+
+  phdrs = (const ElfW(Phdr) *) ((const guint8 *) base + ehdr->e_phoff);
+  if (!gum_memory_is_readable (phdrs, ehdr->e_phnum * sizeof (ElfW(Phdr))))
+    return NULL;
+
+  bias = GUM_ADDRESS (base);
+  for (i = 0; i != ehdr->e_phnum; i++)
+  {
+    const ElfW(Phdr) * phdr = &phdrs[i];
+
+    if (phdr->p_type == PT_LOAD)
+    {
+      bias = GUM_ADDRESS (base) -
+          (phdr->p_vaddr & ~((GumAddress) gum_query_page_size () - 1));
+      break;
+    }
+  }
+
+  for (i = 0; i != ehdr->e_phnum; i++)
+  {
+    const ElfW(Phdr) * phdr = &phdrs[i];
+    const guint8 * note, * end;
+
+    if (phdr->p_type != PT_NOTE)
+      continue;
+
+    note = GSIZE_TO_POINTER (bias + phdr->p_vaddr);
+    end = note + phdr->p_memsz;
+    if (!gum_memory_is_readable (note, phdr->p_memsz))
+      continue;
+
+    while (note + sizeof (ElfW(Nhdr)) <= end)
+    {
+      const ElfW(Nhdr) * nhdr = (const ElfW(Nhdr) *) note;
+      const guint8 * name, * desc;
+
+      name = note + sizeof (ElfW(Nhdr));
+      desc = name + GUM_ALIGN_SIZE (nhdr->n_namesz, 4);
+      note = desc + GUM_ALIGN_SIZE (nhdr->n_descsz, 4);
+      if (note > end)
+        break;
+
+      if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+          memcmp (name, "GNU", 4) == 0)
+      {
+        GString * id;
+        guint j;
+
+        id = g_string_sized_new (9 + (2 * nhdr->n_descsz));
+        g_string_append (id, "build-id:");
+        for (j = 0; j != nhdr->n_descsz; j++)
+          g_string_append_printf (id, "%02x", desc[j]);
+
+        return g_string_free (id, FALSE);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+#endif
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -926,6 +1501,52 @@ rescan:
   return have_pending_garbage;
 }
 
+/*
+ * Reports how many blocks the followed threads have compiled between them,
+ * and how many bytes of code and data slabs they have touched so far,
+ * rounded up to whole pages.
+ */
+void
+_gum_stalker_query_footprint (GumStalker * self,
+                              guint * num_blocks,
+                              gsize * slab_size)
+{
+  GSList * cur;
+
+  *num_blocks = 0;
+  *slab_size = 0;
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = cur->data;
+    GumSlab * slab;
+
+    gum_spinlock_acquire (&ctx->code_lock);
+
+    *num_blocks += gum_metal_pointer_table_size (ctx->mappings);
+
+    for (slab = &ctx->code_slab->slab; slab != NULL; slab = slab->next)
+    {
+      *slab_size += GUM_ALIGN_SIZE (
+          (guint8 *) gum_slab_cursor (slab) - (guint8 *) slab,
+          self->page_size);
+    }
+
+    for (slab = &ctx->data_slab->slab; slab != NULL; slab = slab->next)
+    {
+      *slab_size += GUM_ALIGN_SIZE (
+          (guint8 *) gum_slab_cursor (slab) - (guint8 *) slab,
+          self->page_size);
+    }
+
+    gum_spinlock_release (&ctx->code_lock);
+  }
+
+  GUM_STALKER_UNLOCK (self);
+}
+
 #ifdef _MSC_VER
 
 #define RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT(arg)   \
@@ -967,6 +1588,8 @@ _gum_stalker_do_follow_me (GumStalker * self,
     return;
   }
 
+  gum_exec_ctx_warm_up (ctx);
+
   gum_event_sink_start (ctx->sink);
   ctx->sink_started = TRUE;
 
@@ -1099,6 +1722,9 @@ gum_stalker_infect (GumThreadId thread_id,
       GUM_ADDRESS (gum_tls_key_set_value), 2,
       GUM_ARG_ADDRESS, GUM_ADDRESS (self->exec_ctx),
       GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (gum_exec_ctx_warm_up), 1,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
   gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_MINIMAL, cw);
 
   gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (code_address));
@@ -1404,22 +2030,34 @@ gum_stalker_do_invalidate (GumExecCtx * ctx,
                            GumActivation * activation)
 {
   GumInvalidateContext ic;
+  GumExecBlock * block;
+  GumSuperblock * superblock;
 
   ic.is_executing_target_block = FALSE;
 
   gum_spinlock_acquire (&ctx->code_lock);
 
-  if ((ic.block = gum_metal_hash_table_lookup (ctx->mappings, address)) != NULL)
+  block = gum_metal_pointer_table_lookup (ctx->mappings, address);
+  if (block != NULL)
   {
-    if (ctx == activation->ctx)
-    {
-      gum_exec_block_invalidate (ic.block);
-    }
-    else
-    {
-      gum_process_modify_thread (ctx->thread_id,
-          gum_stalker_try_invalidate_block_owned_by_thread, &ic);
-    }
+    ic.block = block;
+    gum_stalker_invalidate_block (ctx, &ic, activation);
+  }
+
+  /*
+   * Code inlined into a superblock is not mapped under its own address, so
+   * any superblock that has a segment covering it must be invalidated too.
+   */
+  for (superblock = ctx->superblocks;
+      superblock != NULL && !ic.is_executing_target_block;
+      superblock = superblock->next)
+  {
+    if (superblock->block == block ||
+        !gum_superblock_contains (superblock, address))
+      continue;
+
+    ic.block = superblock->block;
+    gum_stalker_invalidate_block (ctx, &ic, activation);
   }
 
   gum_spinlock_release (&ctx->code_lock);
@@ -1427,6 +2065,22 @@ gum_stalker_do_invalidate (GumExecCtx * ctx,
   return !ic.is_executing_target_block;
 }
 
+static void
+gum_stalker_invalidate_block (GumExecCtx * ctx,
+                              GumInvalidateContext * ic,
+                              GumActivation * activation)
+{
+  if (ctx == activation->ctx)
+  {
+    gum_exec_block_invalidate (ic->block);
+  }
+  else
+  {
+    gum_process_modify_thread (ctx->thread_id,
+        gum_stalker_try_invalidate_block_owned_by_thread, ic);
+  }
+}
+
 static void
 gum_stalker_try_invalidate_block_owned_by_thread (GumThreadId thread_id,
                                                   GumCpuContext * cpu_context,
@@ -1613,10 +2267,13 @@ gum_stalker_destroy_exec_ctx (GumStalker * self,
   if (entry == NULL)
     return;
 
+  gum_stalker_cancel_compile_jobs (self, ctx);
+
   gum_exec_ctx_dispose (ctx);
 
   if (ctx->sink_started)
   {
+    gum_exec_ctx_flush_event_buffer (ctx);
     gum_event_sink_stop (ctx->sink);
 
     ctx->sink_started = FALSE;
@@ -1714,6 +2371,12 @@ gum_exec_ctx_new (GumStalker * stalker,
     ctx->transformer = gum_stalker_transformer_make_default ();
   ctx->transform_block_impl =
       GUM_STALKER_TRANSFORMER_GET_IFACE (ctx->transformer)->transform_block;
+  /*
+   * A custom transformer expects to be called on the followed thread, once
+   * for each block that is about to run, so we only compile ahead of time
+   * with the default one.
+   */
+  ctx->may_speculate = GUM_IS_DEFAULT_STALKER_TRANSFORMER (ctx->transformer);
 
   if (sink != NULL)
     ctx->sink = g_object_ref (sink);
@@ -1722,6 +2385,16 @@ gum_exec_ctx_new (GumStalker * stalker,
 
   ctx->sink_mask = gum_event_sink_query_mask (ctx->sink);
   ctx->sink_process_impl = GUM_EVENT_SINK_GET_IFACE (ctx->sink)->process;
+  ctx->sink_process_buffer_impl =
+      GUM_EVENT_SINK_GET_IFACE (ctx->sink)->process_buffer;
+
+  ctx->event_buffer_capacity =
+      gum_event_sink_query_buffer_capacity (ctx->sink);
+  ctx->event_buffer = (ctx->event_buffer_capacity != 0)
+      ? g_new (GumEvent, ctx->event_buffer_capacity)
+      : NULL;
+  ctx->event_buffer_cursor = ctx->event_buffer;
+  ctx->event_buffer_remaining = ctx->event_buffer_capacity;
 
   ctx->frames = (GumExecFrame *) (base + stalker->frames_offset);
   ctx->first_frame =
@@ -1745,7 +2418,7 @@ gum_exec_ctx_new (GumStalker * stalker,
   ctx->scratch_slab = (GumCodeSlab *) (base + stalker->scratch_slab_offset);
   gum_scratch_slab_init (ctx->scratch_slab, stalker->scratch_slab_size);
 
-  ctx->mappings = gum_metal_hash_table_new (NULL, NULL);
+  ctx->mappings = gum_metal_pointer_table_new ();
 
   gum_exec_ctx_ensure_inline_helpers_reachable (ctx);
 
@@ -1761,7 +2434,7 @@ gum_exec_ctx_free (GumExecCtx * ctx)
   GumDataSlab * data_slab;
   GumCodeSlab * code_slab;
 
-  gum_metal_hash_table_unref (ctx->mappings);
+  gum_metal_pointer_table_free (ctx->mappings);
 
   data_slab = ctx->data_slab;
   while (TRUE)
@@ -1793,6 +2466,7 @@ gum_exec_ctx_free (GumExecCtx * ctx)
     code_slab = next;
   }
 
+  g_free (ctx->event_buffer);
   g_object_unref (ctx->sink);
   g_object_unref (ctx->transformer);
 
@@ -1900,6 +2574,8 @@ gum_exec_ctx_unfollow (GumExecCtx * ctx,
 
   gum_tls_key_set_value (ctx->stalker->exec_ctx, NULL);
 
+  gum_exec_ctx_flush_event_buffer (ctx);
+
   ctx->destroy_pending_since = g_get_monotonic_time ();
   g_atomic_int_set (&ctx->state, GUM_EXEC_CTX_DESTROY_PENDING);
 }
@@ -1945,9 +2621,6 @@ gum_exec_ctx_may_now_backpatch (GumExecCtx * ctx,
   return TRUE;
 }
 
-static gboolean counters_enabled = FALSE;
-static guint total_transitions = 0;
-
 #define GUM_ENTRYGATE(name) \
     gum_exec_ctx_replace_current_block_from_##name
 #define GUM_DEFINE_ENTRYGATE(name) \
@@ -2030,83 +2703,461 @@ gum_exec_ctx_switch_block (GumExecCtx * ctx,
   return ctx->resume_at;
 }
 
-static void
-gum_exec_ctx_recompile_and_switch_block (GumExecCtx * ctx,
-                                         gint32 * distance_to_data)
+static void
+gum_exec_ctx_recompile_and_switch_block (GumExecCtx * ctx,
+                                         gint32 * distance_to_data)
+{
+  GumExecBlock * block;
+  gpointer start_address;
+
+  block = (GumExecBlock *) ((guint8 *) distance_to_data + *distance_to_data);
+  start_address = block->real_start;
+
+  if (gum_exec_ctx_maybe_unfollow (ctx, start_address))
+    return;
+
+  gum_exec_ctx_recompile_block (ctx, block);
+
+  ctx->current_block = block;
+  ctx->resume_at = block->code_start;
+
+  if (start_address == ctx->activation_target)
+  {
+    ctx->activation_target = NULL;
+    ctx->current_block->flags |= GUM_EXEC_BLOCK_ACTIVATION_TARGET;
+  }
+
+  gum_exec_ctx_maybe_unfollow (ctx, start_address);
+}
+
+static gboolean counters_enabled = FALSE;
+static guint total_transitions = 0;
+static guint total_speculative_hits = 0;
+static guint total_speculative_misses = 0;
+
+static GumExecBlock *
+gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
+                               gpointer real_address,
+                               gpointer * code_address)
+{
+  GumStalker * stalker = ctx->stalker;
+  const gint trust_threshold = stalker->trust_threshold;
+  GumExecBlock * block;
+
+  /*
+   * Fast path: a trusted block needs neither its snapshot compared nor any
+   * of its state updated, so we can hand it out without taking the lock
+   * that background compilation and invalidation contend on.
+   */
+  block = gum_metal_pointer_table_lookup (ctx->mappings, real_address);
+  if (block != NULL &&
+      trust_threshold >= 0 && block->recycle_count >= trust_threshold &&
+      (block->flags & GUM_EXEC_BLOCK_SPECULATIVE) == 0)
+  {
+    if (trust_threshold > 0)
+      block->recycle_count++;
+
+    *code_address = block->code_start;
+
+    return block;
+  }
+
+  gum_spinlock_acquire (&ctx->code_lock);
+
+  block = gum_metal_pointer_table_lookup (ctx->mappings, real_address);
+  if (block != NULL)
+  {
+    gboolean still_up_to_date, was_speculative;
+
+    still_up_to_date =
+        (trust_threshold >= 0 && block->recycle_count >= trust_threshold) ||
+        (memcmp (block->real_start, gum_exec_block_get_snapshot_start (block),
+            block->real_size) == 0 &&
+         (block->superblock == NULL ||
+          gum_superblock_is_up_to_date (block->superblock)));
+
+    was_speculative = (block->flags & GUM_EXEC_BLOCK_SPECULATIVE) != 0;
+    block->flags &= ~GUM_EXEC_BLOCK_SPECULATIVE;
+
+    gum_spinlock_release (&ctx->code_lock);
+
+    if (was_speculative)
+    {
+      if (counters_enabled)
+        total_speculative_hits++;
+
+      gum_exec_ctx_maybe_emit_compile_event (ctx, block);
+    }
+
+    if (still_up_to_date)
+    {
+      if (trust_threshold > 0)
+        block->recycle_count++;
+    }
+    else
+    {
+      gum_exec_ctx_recompile_block (ctx, block);
+    }
+  }
+  else
+  {
+    gpointer successors[GUM_MAX_SUCCESSORS];
+    guint n_successors;
+
+    ctx->n_successors = 0;
+
+    block = gum_exec_block_new (ctx);
+    block->real_start = real_address;
+    gum_exec_ctx_compile_block (ctx, block, real_address, block->code_start,
+        GUM_ADDRESS (block->code_start), &block->real_size, &block->code_size);
+    gum_exec_block_commit (block);
+
+    gum_metal_pointer_table_insert (ctx->mappings, real_address, block);
+
+    n_successors = ctx->n_successors;
+    memcpy (successors, ctx->successors, n_successors * sizeof (gpointer));
+
+    gum_spinlock_release (&ctx->code_lock);
+
+    if (stalker->background_compilation_enabled && ctx->may_speculate)
+    {
+      if (gum_stalker_claim_compile_job (stalker, ctx, real_address) &&
+          counters_enabled)
+      {
+        total_speculative_misses++;
+      }
+
+      gum_stalker_enqueue_compile_jobs (stalker, ctx, successors,
+          n_successors);
+    }
+
+    gum_exec_ctx_maybe_emit_compile_event (ctx, block);
+  }
+
+  *code_address = block->code_start;
+
+  return block;
+}
+
+static void
+gum_exec_ctx_warm_up (GumExecCtx * ctx)
+{
+  GPtrArray * addresses;
+  guint i;
+
+  addresses = g_ptr_array_new ();
+
+  gum_stalker_collect_persisted_blocks (ctx->stalker, addresses);
+
+  for (i = 0; i != addresses->len; i++)
+  {
+    gpointer real_address = g_ptr_array_index (addresses, i);
+    gpointer code_address;
+
+    if (gum_metal_pointer_table_lookup (ctx->mappings, real_address) != NULL)
+      continue;
+
+    if (!gum_memory_is_readable (real_address, 1))
+      continue;
+
+    gum_exec_ctx_obtain_block_for (ctx, real_address, &code_address);
+  }
+
+  g_ptr_array_unref (addresses);
+}
+
+static void
+gum_stalker_collect_persisted_blocks (GumStalker * self,
+                                      GPtrArray * addresses)
+{
+  GBytes * data;
+  GArray * blocks;
+  guint i;
+
+  GUM_STALKER_LOCK (self);
+  data = (self->persisted_data != NULL)
+      ? g_bytes_ref (self->persisted_data)
+      : NULL;
+  blocks = (self->persisted_blocks != NULL)
+      ? g_array_ref (self->persisted_blocks)
+      : NULL;
+  GUM_STALKER_UNLOCK (self);
+
+  if (blocks == NULL)
+    return;
+
+  for (i = 0; i != blocks->len; i++)
+  {
+    GumPersistedBlock * pb = &g_array_index (blocks, GumPersistedBlock, i);
+
+    if (!gum_memory_is_readable (pb->real_address, pb->size))
+      continue;
+
+    if (memcmp (pb->real_address, pb->snapshot, pb->size) != 0)
+      continue;
+
+    g_ptr_array_add (addresses, pb->real_address);
+  }
+
+  g_array_unref (blocks);
+  g_bytes_unref (data);
+}
+
+/*
+ * Works out where each block lives among the modules loaded right now, and
+ * drops those whose module is not loaded.
+ */
+static void
+gum_resolve_persisted_blocks (GPtrArray * identities,
+                              GArray * blocks)
+{
+  GumResolveModulesContext rc;
+  guint i;
+
+  rc.identities = identities;
+  rc.bases = g_new0 (GumAddress, identities->len);
+  gum_process_enumerate_modules (gum_resolve_persisted_module, &rc);
+
+  for (i = 0; i != blocks->len;)
+  {
+    GumPersistedBlock * pb = &g_array_index (blocks, GumPersistedBlock, i);
+    GumAddress base;
+
+    base = rc.bases[pb->module_index];
+    if (base == 0)
+    {
+      g_array_remove_index_fast (blocks, i);
+      continue;
+    }
+
+    pb->real_address = GSIZE_TO_POINTER (base + pb->offset);
+    i++;
+  }
+
+  g_free (rc.bases);
+}
+
+static gboolean
+gum_resolve_persisted_module (const GumModuleDetails * details,
+                              gpointer user_data)
+{
+  GumResolveModulesContext * rc = user_data;
+  gchar * identity;
+  guint i;
+
+  identity = gum_compute_module_identity (details);
+
+  for (i = 0; i != rc->identities->len; i++)
+  {
+    if (strcmp (g_ptr_array_index (rc->identities, i), identity) == 0)
+    {
+      rc->bases[i] = details->range->base_address;
+      break;
+    }
+  }
+
+  g_free (identity);
+
+  return TRUE;
+}
+
+static void
+gum_exec_ctx_add_successor (GumExecCtx * ctx,
+                            gpointer real_address)
+{
+  if (!ctx->stalker->background_compilation_enabled || !ctx->may_speculate)
+    return;
+
+  if (ctx->n_successors == GUM_MAX_SUCCESSORS)
+    return;
+
+  ctx->successors[ctx->n_successors++] = real_address;
+}
+
+static void
+gum_stalker_enqueue_compile_jobs (GumStalker * self,
+                                  GumExecCtx * ctx,
+                                  gpointer * addresses,
+                                  guint n)
+{
+  guint i;
+
+  if (n == 0)
+    return;
+
+  g_mutex_lock (&self->compiler_mutex);
+
+  for (i = 0; i != n; i++)
+  {
+    GumCompileJob * job;
+
+    if (self->compiler_jobs.length == GUM_MAX_PENDING_COMPILE_JOBS)
+      break;
+
+    job = g_slice_new (GumCompileJob);
+    job->ctx = ctx;
+    job->real_address = addresses[i];
+
+    g_queue_push_tail (&self->compiler_jobs, job);
+  }
+
+  g_cond_signal (&self->compiler_cond);
+
+  g_mutex_unlock (&self->compiler_mutex);
+}
+
+/*
+ * Removes the pending job for a block that the followed thread ended up
+ * compiling itself, i.e. one that was speculated but not ready in time.
+ */
+static gboolean
+gum_stalker_claim_compile_job (GumStalker * self,
+                               GumExecCtx * ctx,
+                               gpointer real_address)
+{
+  gboolean found = FALSE;
+  GList * cur;
+
+  g_mutex_lock (&self->compiler_mutex);
+
+  for (cur = self->compiler_jobs.head; cur != NULL; cur = cur->next)
+  {
+    GumCompileJob * job = cur->data;
+
+    if (job->ctx == ctx && job->real_address == real_address)
+    {
+      g_slice_free (GumCompileJob, job);
+      g_queue_delete_link (&self->compiler_jobs, cur);
+      found = TRUE;
+      break;
+    }
+  }
+
+  g_mutex_unlock (&self->compiler_mutex);
+
+  return found;
+}
+
+static void
+gum_stalker_cancel_compile_jobs (GumStalker * self,
+                                 GumExecCtx * ctx)
+{
+  GList * cur, * next;
+
+  g_mutex_lock (&self->compiler_mutex);
+
+  for (cur = self->compiler_jobs.head; cur != NULL; cur = next)
+  {
+    GumCompileJob * job = cur->data;
+
+    next = cur->next;
+
+    if (job->ctx == ctx)
+    {
+      g_slice_free (GumCompileJob, job);
+      g_queue_delete_link (&self->compiler_jobs, cur);
+    }
+  }
+
+  while (self->compiler_ctx == ctx)
+    g_cond_wait (&self->compiler_cond, &self->compiler_mutex);
+
+  g_mutex_unlock (&self->compiler_mutex);
+}
+
+static void
+gum_stalker_stop_compiler_thread (GumStalker * self)
+{
+  GumCompileJob * job;
+
+  if (self->compiler_thread == NULL)
+    return;
+
+  g_mutex_lock (&self->compiler_mutex);
+  self->compiler_stopping = TRUE;
+  g_cond_broadcast (&self->compiler_cond);
+  g_mutex_unlock (&self->compiler_mutex);
+
+  g_thread_join (self->compiler_thread);
+  self->compiler_thread = NULL;
+
+  while ((job = g_queue_pop_head (&self->compiler_jobs)) != NULL)
+    g_slice_free (GumCompileJob, job);
+}
+
+static gpointer
+gum_stalker_compile_in_background (GumStalker * self)
 {
-  GumExecBlock * block;
-  gpointer start_address;
+  g_mutex_lock (&self->compiler_mutex);
 
-  block = (GumExecBlock *) ((guint8 *) distance_to_data + *distance_to_data);
-  start_address = block->real_start;
+  while (TRUE)
+  {
+    GumCompileJob * job;
 
-  if (gum_exec_ctx_maybe_unfollow (ctx, start_address))
-    return;
+    while (!self->compiler_stopping &&
+        g_queue_is_empty (&self->compiler_jobs))
+    {
+      g_cond_wait (&self->compiler_cond, &self->compiler_mutex);
+    }
 
-  gum_exec_ctx_recompile_block (ctx, block);
+    if (self->compiler_stopping)
+      break;
 
-  ctx->current_block = block;
-  ctx->resume_at = block->code_start;
+    job = g_queue_pop_head (&self->compiler_jobs);
+    self->compiler_ctx = job->ctx;
 
-  if (start_address == ctx->activation_target)
-  {
-    ctx->activation_target = NULL;
-    ctx->current_block->flags |= GUM_EXEC_BLOCK_ACTIVATION_TARGET;
+    g_mutex_unlock (&self->compiler_mutex);
+
+    gum_exec_ctx_speculate_block (job->ctx, job->real_address);
+    g_slice_free (GumCompileJob, job);
+
+    g_mutex_lock (&self->compiler_mutex);
+
+    self->compiler_ctx = NULL;
+    g_cond_broadcast (&self->compiler_cond);
   }
 
-  gum_exec_ctx_maybe_unfollow (ctx, start_address);
+  g_mutex_unlock (&self->compiler_mutex);
+
+  return NULL;
 }
 
-static GumExecBlock *
-gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
-                               gpointer real_address,
-                               gpointer * code_address)
+static void
+gum_exec_ctx_speculate_block (GumExecCtx * ctx,
+                              gpointer real_address)
 {
   GumExecBlock * block;
 
-  gum_spinlock_acquire (&ctx->code_lock);
-
-  block = gum_metal_hash_table_lookup (ctx->mappings, real_address);
-  if (block != NULL)
-  {
-    const gint trust_threshold = ctx->stalker->trust_threshold;
-    gboolean still_up_to_date;
+  if (!ctx->may_speculate ||
+      g_atomic_int_get (&ctx->state) != GUM_EXEC_CTX_ACTIVE)
+    return;
 
-    still_up_to_date =
-        (trust_threshold >= 0 && block->recycle_count >= trust_threshold) ||
-        memcmp (block->real_start, gum_exec_block_get_snapshot_start (block),
-            block->real_size) == 0;
+  if (real_address == ctx->activation_target ||
+      gum_stalker_is_excluding (ctx->stalker, real_address) ||
+      !gum_memory_is_readable (real_address, 16))
+    return;
 
-    gum_spinlock_release (&ctx->code_lock);
+  gum_spinlock_acquire (&ctx->code_lock);
 
-    if (still_up_to_date)
-    {
-      if (trust_threshold > 0)
-        block->recycle_count++;
-    }
-    else
-    {
-      gum_exec_ctx_recompile_block (ctx, block);
-    }
-  }
-  else
+  if (gum_metal_pointer_table_lookup (ctx->mappings, real_address) == NULL)
   {
+    ctx->speculating = TRUE;
+
     block = gum_exec_block_new (ctx);
     block->real_start = real_address;
     gum_exec_ctx_compile_block (ctx, block, real_address, block->code_start,
         GUM_ADDRESS (block->code_start), &block->real_size, &block->code_size);
     gum_exec_block_commit (block);
 
-    gum_metal_hash_table_insert (ctx->mappings, real_address, block);
+    ctx->speculating = FALSE;
 
-    gum_spinlock_release (&ctx->code_lock);
+    /* Compile event is emitted by the followed thread upon first use. */
+    block->flags |= GUM_EXEC_BLOCK_SPECULATIVE;
 
-    gum_exec_ctx_maybe_emit_compile_event (ctx, block);
+    gum_metal_pointer_table_insert (ctx->mappings, real_address, block);
   }
 
-  *code_address = block->code_start;
-
-  return block;
+  gum_spinlock_release (&ctx->code_lock);
 }
 
 static void
@@ -2210,6 +3261,10 @@ gum_exec_ctx_compile_block (GumExecCtx * ctx,
   gc.continuation_real_address = NULL;
   gc.opened_prolog = GUM_PROLOG_NONE;
   gc.accumulated_stack_delta = 0;
+  gc.inline_target = NULL;
+  gc.segments[0] = (gpointer) input_code;
+  gc.segment_ends[0] = NULL;
+  gc.n_segments = 1;
 
   iterator.exec_context = ctx;
   iterator.exec_block = block;
@@ -2225,9 +3280,17 @@ gum_exec_ctx_compile_block (GumExecCtx * ctx,
 
   gum_exec_block_maybe_write_call_probe_code (block, &gc);
 
-  ctx->pending_calls++;
-  ctx->transform_block_impl (ctx->transformer, &iterator, &output);
-  ctx->pending_calls--;
+  /* pending_calls belongs to the followed thread. */
+  if (ctx->speculating)
+  {
+    ctx->transform_block_impl (ctx->transformer, &iterator, &output);
+  }
+  else
+  {
+    ctx->pending_calls++;
+    ctx->transform_block_impl (ctx->transformer, &iterator, &output);
+    ctx->pending_calls--;
+  }
 
   if (gc.continuation_real_address != NULL)
   {
@@ -2246,7 +3309,14 @@ gum_exec_ctx_compile_block (GumExecCtx * ctx,
   if (!all_labels_resolved)
     g_error ("Failed to resolve labels");
 
-  *input_size = rl->input_cur - rl->input_start;
+  if (gc.inline_target != NULL)
+    gc.n_segments--;
+  gc.segment_ends[gc.n_segments - 1] = (guint8 *) rl->input_cur;
+
+  if (ctx->forming_superblock != NULL)
+    gum_superblock_describe_segments (ctx->forming_superblock, &gc);
+
+  *input_size = gc.segment_ends[0] - (const guint8 *) input_code;
   *output_size = gum_x86_writer_offset (cw);
 }
 
@@ -2262,8 +3332,41 @@ gum_exec_ctx_maybe_emit_compile_event (GumExecCtx * ctx,
     ev.compile.start = block->real_start;
     ev.compile.end = block->real_start + block->real_size;
 
-    ctx->sink_process_impl (ctx->sink, &ev, NULL);
+    gum_exec_ctx_emit_event (ctx, &ev, NULL);
+  }
+}
+
+static void
+gum_exec_ctx_emit_event (GumExecCtx * ctx,
+                         const GumEvent * event,
+                         GumCpuContext * cpu_context)
+{
+  if (ctx->event_buffer == NULL)
+  {
+    ctx->sink_process_impl (ctx->sink, event, cpu_context);
+    return;
   }
+
+  if (ctx->event_buffer_remaining == 0)
+    gum_exec_ctx_flush_event_buffer (ctx);
+
+  *ctx->event_buffer_cursor++ = *event;
+  ctx->event_buffer_remaining--;
+}
+
+static void
+gum_exec_ctx_flush_event_buffer (GumExecCtx * ctx)
+{
+  guint n_events;
+
+  n_events = ctx->event_buffer_capacity - ctx->event_buffer_remaining;
+  if (n_events == 0)
+    return;
+
+  ctx->sink_process_buffer_impl (ctx->sink, ctx->event_buffer, n_events);
+
+  ctx->event_buffer_cursor = ctx->event_buffer;
+  ctx->event_buffer_remaining = ctx->event_buffer_capacity;
 }
 
 gboolean
@@ -2291,12 +3394,18 @@ gum_stalker_iterator_next (GumStalkerIterator * self,
 
     if (gum_stalker_iterator_is_out_of_space (self))
     {
-      gc->continuation_real_address = instruction->end;
+      gc->continuation_real_address = (gc->inline_target != NULL)
+          ? gc->inline_target
+          : instruction->end;
       return FALSE;
     }
     else if (gum_x86_relocator_eob (rl))
     {
-      return FALSE;
+      if (gc->inline_target == NULL)
+        return FALSE;
+
+      gum_x86_relocator_reset (rl, gc->inline_target, gc->code_writer);
+      gc->inline_target = NULL;
     }
   }
 
@@ -2327,15 +3436,23 @@ static gboolean
 gum_stalker_iterator_is_out_of_space (GumStalkerIterator * self)
 {
   GumExecBlock * block = self->exec_block;
+  GumGeneratorContext * gc = self->generator_context;
   GumSlab * slab = &block->code_slab->slab;
-  gsize capacity, snapshot_size;
+  gsize capacity, real_size, snapshot_size;
+  guint last, i;
 
   capacity = (guint8 *) gum_slab_end (slab) -
-      (guint8 *) gum_x86_writer_cur (self->generator_context->code_writer);
-
+      (guint8 *) gum_x86_writer_cur (gc->code_writer);
+
+  /* Every segment of a superblock gets its own snapshot. */
+  last = gc->n_segments - 1;
+  real_size = 0;
+  for (i = 0; i != last; i++)
+    real_size += gc->segment_ends[i] - (guint8 *) gc->segments[i];
+  if (gc->inline_target == NULL)
+    real_size += gc->instruction->end - (guint8 *) gc->segments[last];
   snapshot_size = gum_stalker_snapshot_space_needed_for (
-      self->exec_context->stalker,
-      self->generator_context->instruction->end - block->real_start);
+      self->exec_context->stalker, real_size);
 
   return capacity < GUM_EXEC_BLOCK_MIN_CAPACITY + snapshot_size;
 }
@@ -2408,7 +3525,7 @@ gum_exec_ctx_emit_call_event (GumExecCtx * ctx,
 
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (location);
 
-  ctx->sink_process_impl (ctx->sink, &ev, cpu_context);
+  gum_exec_ctx_emit_event (ctx, &ev, cpu_context);
 }
 
 static void
@@ -2427,7 +3544,7 @@ gum_exec_ctx_emit_ret_event (GumExecCtx * ctx,
 
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (location);
 
-  ctx->sink_process_impl (ctx->sink, &ev, cpu_context);
+  gum_exec_ctx_emit_event (ctx, &ev, cpu_context);
 }
 
 static void
@@ -2444,7 +3561,7 @@ gum_exec_ctx_emit_exec_event (GumExecCtx * ctx,
 
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (location);
 
-  ctx->sink_process_impl (ctx->sink, &ev, cpu_context);
+  gum_exec_ctx_emit_event (ctx, &ev, cpu_context);
 }
 
 static void
@@ -2462,7 +3579,7 @@ gum_exec_ctx_emit_block_event (GumExecCtx * ctx,
 
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (block->real_start);
 
-  ctx->sink_process_impl (ctx->sink, &ev, cpu_context);
+  gum_exec_ctx_emit_event (ctx, &ev, cpu_context);
 }
 
 void
@@ -3342,6 +4459,7 @@ gum_exec_block_clear (GumExecBlock * block)
   block->last_callout_offset = 0;
 
   block->storage_block = NULL;
+  block->superblock = NULL;
 }
 
 static void
@@ -3484,7 +4602,8 @@ gum_exec_block_backpatch_call (GumExecBlock * block,
 static void
 gum_exec_block_backpatch_jmp (GumExecBlock * block,
                               gpointer code_start,
-                              GumPrologType opened_prolog)
+                              GumPrologType opened_prolog,
+                              GumExecBlock * from)
 {
   gboolean just_unfollowed;
   GumExecCtx * ctx;
@@ -3501,6 +4620,17 @@ gum_exec_block_backpatch_jmp (GumExecBlock * block,
     GumX86Writer * cw = &ctx->code_writer;
     const gsize code_max_size = 128;
 
+    if (from != NULL && stalker->superblock_threshold != 0 &&
+        (from->flags & GUM_EXEC_BLOCK_SUPERBLOCK) == 0)
+    {
+      /* Keep the edge on the slow path until it has proven to be hot. */
+      if (++from->hot_edge_count < stalker->superblock_threshold)
+        return;
+
+      if (gum_exec_ctx_form_superblock (ctx, from, block))
+        return;
+    }
+
     gum_spinlock_acquire (&ctx->code_lock);
 
     gum_stalker_thaw (stalker, code_start, code_max_size);
@@ -3520,6 +4650,192 @@ gum_exec_block_backpatch_jmp (GumExecBlock * block,
   }
 }
 
+static gboolean
+gum_exec_ctx_form_superblock (GumExecCtx * ctx,
+                              GumExecBlock * from,
+                              GumExecBlock * to)
+{
+  GumStalker * stalker = ctx->stalker;
+  GumX86Writer * cw = &ctx->code_writer;
+  GumExecBlock * storage_block;
+  GumSuperblock * superblock;
+  GumCodeSlab * slab;
+
+  from->flags |= GUM_EXEC_BLOCK_SUPERBLOCK;
+
+  if (from->storage_block != NULL || (ctx->sink_mask & GUM_BLOCK) != 0 ||
+      stalker->any_probes_attached || to->real_start == from->real_start)
+    return FALSE;
+
+  gum_spinlock_acquire (&ctx->code_lock);
+
+  /*
+   * Recompile the source block into fresh storage, following unconditional
+   * jumps inline, then redirect its entry point there. We are still executing
+   * the old copy, so it is left intact apart from its first instruction.
+   */
+  storage_block = gum_exec_block_new (ctx);
+  storage_block->real_start = from->real_start;
+
+  superblock = gum_slab_try_reserve (&ctx->data_slab->slab,
+      sizeof (GumSuperblock));
+  if (superblock == NULL)
+  {
+    GumDataSlab * data_slab;
+
+    data_slab = gum_exec_ctx_add_data_slab (ctx, gum_data_slab_new (ctx));
+    superblock = gum_slab_reserve (&data_slab->slab, sizeof (GumSuperblock));
+  }
+  superblock->block = from;
+
+  slab = from->code_slab;
+  from->code_slab = storage_block->code_slab;
+  ctx->forming_superblock = superblock;
+
+  gum_exec_ctx_compile_block (ctx, from, from->real_start,
+      storage_block->code_start, GUM_ADDRESS (storage_block->code_start),
+      &storage_block->real_size, &storage_block->code_size);
+
+  ctx->forming_superblock = NULL;
+  from->code_slab = slab;
+
+  gum_exec_block_commit (storage_block);
+  gum_superblock_take_snapshots (superblock, storage_block);
+
+  superblock->next = ctx->superblocks;
+  ctx->superblocks = superblock;
+
+  /*
+   * The inlined segments have never been validated, so the superblock has to
+   * earn trust from scratch, checking every segment against its snapshot.
+   */
+  from->storage_block = storage_block;
+  from->superblock = superblock;
+  from->recycle_count = 0;
+
+  gum_stalker_thaw (stalker, from->code_start, from->capacity);
+  gum_x86_writer_reset (cw, from->code_start);
+  gum_x86_writer_put_jmp_address (cw,
+      GUM_ADDRESS (storage_block->code_start));
+  gum_x86_writer_flush (cw);
+  gum_stalker_freeze (stalker, from->code_start, from->capacity);
+
+  gum_spinlock_release (&ctx->code_lock);
+
+  return TRUE;
+}
+
+static gboolean
+gum_exec_ctx_may_inline (GumExecCtx * ctx,
+                         gconstpointer real_address,
+                         GumGeneratorContext * gc)
+{
+  guint i;
+
+  if (ctx->forming_superblock == NULL)
+    return FALSE;
+
+  if (gc->n_segments == GUM_MAX_SUPERBLOCK_SEGMENTS)
+    return FALSE;
+
+  if (real_address == ctx->activation_target ||
+      gum_stalker_is_excluding (ctx->stalker, real_address) ||
+      gum_exec_ctx_contains (ctx, real_address))
+    return FALSE;
+
+  for (i = 0; i != gc->n_segments; i++)
+  {
+    if (gc->segments[i] == real_address)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gum_superblock_describe_segments (GumSuperblock * self,
+                                  GumGeneratorContext * gc)
+{
+  guint i;
+
+  for (i = 0; i != gc->n_segments; i++)
+  {
+    GumSuperblockSegment * segment = &self->segments[i];
+
+    segment->real_start = gc->segments[i];
+    segment->real_size = gc->segment_ends[i] - (guint8 *) gc->segments[i];
+    segment->snapshot = NULL;
+  }
+  self->n_segments = gc->n_segments;
+}
+
+static void
+gum_superblock_take_snapshots (GumSuperblock * self,
+                               GumExecBlock * storage_block)
+{
+  GumStalker * stalker = storage_block->ctx->stalker;
+  guint i;
+
+  /* The first segment is covered by the storage block's own snapshot. */
+  self->segments[0].snapshot =
+      gum_exec_block_get_snapshot_start (storage_block);
+
+  for (i = 1; i != self->n_segments; i++)
+  {
+    GumSuperblockSegment * segment = &self->segments[i];
+    gsize snapshot_size;
+
+    snapshot_size = gum_stalker_snapshot_space_needed_for (stalker,
+        segment->real_size);
+
+    segment->snapshot =
+        gum_slab_reserve (&storage_block->code_slab->slab, snapshot_size);
+    memcpy (segment->snapshot, segment->real_start, snapshot_size);
+
+    storage_block->capacity += snapshot_size;
+  }
+}
+
+static gboolean
+gum_superblock_is_up_to_date (const GumSuperblock * self)
+{
+  guint i;
+
+  for (i = 0; i != self->n_segments; i++)
+  {
+    const GumSuperblockSegment * segment = &self->segments[i];
+
+    if (memcmp (segment->real_start, segment->snapshot,
+        segment->real_size) != 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gum_superblock_contains (const GumSuperblock * self,
+                         gconstpointer address)
+{
+  const guint8 * p = address;
+  guint i;
+
+  /* Superblocks that have since been recompiled are no longer live. */
+  if (self->block->superblock != self)
+    return FALSE;
+
+  for (i = 0; i != self->n_segments; i++)
+  {
+    const GumSuperblockSegment * segment = &self->segments[i];
+
+    if (p >= segment->real_start &&
+        p < segment->real_start + segment->real_size)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 static void
 gum_exec_block_backpatch_ret (GumExecBlock * block,
                               gpointer code_start)
@@ -3713,6 +5029,10 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
       return GUM_REQUIRE_NOTHING;
     }
 
+    if (!target.is_indirect && target.base == X86_REG_INVALID)
+      gum_exec_ctx_add_successor (ctx, target.absolute_address);
+    gum_exec_ctx_add_successor (ctx, insn->end);
+
     gum_x86_relocator_skip_one_no_label (gc->relocator);
     gum_exec_block_write_call_invoke_code (block, &target, gc);
   }
@@ -3728,6 +5048,9 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
     is_false =
         GUINT_TO_POINTER ((GPOINTER_TO_UINT (insn->start) << 16) | 0xbabe);
 
+    gum_exec_ctx_add_successor (ctx, target.absolute_address);
+    gum_exec_ctx_add_successor (ctx, insn->end);
+
     gum_exec_block_close_prolog (block, gc);
 
     gum_x86_writer_put_jcc_short_label (cw, X86_INS_JCXZ, is_true, GUM_NO_HINT);
@@ -3750,13 +5073,29 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
 
     gum_x86_relocator_skip_one_no_label (gc->relocator);
 
+    if (!is_conditional && !target.is_indirect &&
+        target.base == X86_REG_INVALID &&
+        gum_exec_ctx_may_inline (ctx, target.absolute_address, gc))
+    {
+      gc->segment_ends[gc->n_segments - 1] = insn->end;
+      gc->segments[gc->n_segments++] = target.absolute_address;
+      gc->inline_target = target.absolute_address;
+
+      return GUM_REQUIRE_NOTHING;
+    }
+
     is_false =
         GUINT_TO_POINTER ((GPOINTER_TO_UINT (insn->start) << 16) | 0xbeef);
 
+    if (!target.is_indirect && target.base == X86_REG_INVALID)
+      gum_exec_ctx_add_successor (ctx, target.absolute_address);
+
     if (is_conditional)
     {
       g_assert (!target.is_indirect);
 
+      gum_exec_ctx_add_successor (ctx, insn->end);
+
       gum_exec_block_close_prolog (block, gc);
 
       gum_x86_writer_put_jcc_near_label (cw, gum_negate_jcc (insn->ci->id),
@@ -4225,11 +5564,14 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
 
   if (can_backpatch_statically)
   {
+    GumExecBlock * from = (func == GUM_ENTRYGATE (jmp_imm)) ? block : NULL;
+
     gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
-        GUM_ADDRESS (gum_exec_block_backpatch_jmp), 3,
+        GUM_ADDRESS (gum_exec_block_backpatch_jmp), 4,
         GUM_ARG_REGISTER, GUM_REG_XAX,
         GUM_ARG_ADDRESS, code_start,
-        GUM_ARG_ADDRESS, GUM_ADDRESS (opened_prolog));
+        GUM_ARG_ADDRESS, GUM_ADDRESS (opened_prolog),
+        GUM_ARG_ADDRESS, GUM_ADDRESS (from));
   }
 
   if (ic_entries != NULL)
@@ -4411,6 +5753,12 @@ gum_exec_block_write_exec_event_code (GumExecBlock * block,
                                       GumGeneratorContext * gc,
                                       GumCodeContext cc)
 {
+  if (block->ctx->event_buffer != NULL)
+  {
+    gum_exec_block_write_buffered_event_code (block, GUM_EXEC, gc);
+    return;
+  }
+
   gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
 
   gum_x86_writer_put_call_address_with_aligned_arguments (gc->code_writer,
@@ -4427,6 +5775,12 @@ gum_exec_block_write_block_event_code (GumExecBlock * block,
                                        GumGeneratorContext * gc,
                                        GumCodeContext cc)
 {
+  if (block->ctx->event_buffer != NULL)
+  {
+    gum_exec_block_write_buffered_event_code (block, GUM_BLOCK, gc);
+    return;
+  }
+
   gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
 
   gum_x86_writer_put_call_address_with_aligned_arguments (gc->code_writer,
@@ -4438,6 +5792,99 @@ gum_exec_block_write_block_event_code (GumExecBlock * block,
   gum_exec_block_write_unfollow_check_code (block, gc, cc);
 }
 
+/*
+ * Records the event straight into the thread's event buffer. Only XAX, XCX
+ * and XDX are touched, and none of the instructions on the fast path modify
+ * the flags, so we can skip the prolog entirely and only call out when the
+ * buffer is full. The unfollow check is left to the next block transition.
+ */
+static void
+gum_exec_block_write_buffered_event_code (GumExecBlock * block,
+                                          GumEventType type,
+                                          GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer flush = cw->code + 1;
+  gconstpointer have_room = cw->code + 2;
+  const guint8 lea_xcx_xcx_plus_xdx[] = {
+#if GLIB_SIZEOF_VOID_P == 8
+    0x48,
+#endif
+    0x8d, 0x0c, 0x11 /* lea xcx, [xcx + xdx] */
+  };
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XDX);
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XDX, GUM_ADDRESS (ctx));
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX, GUM_REG_XDX,
+      G_STRUCT_OFFSET (GumExecCtx, event_buffer_remaining));
+#if GLIB_SIZEOF_VOID_P == 8
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JRCXZ, flush, GUM_NO_HINT);
+#else
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JECXZ, flush, GUM_NO_HINT);
+#endif
+  gum_x86_writer_put_jmp_near_label (cw, have_room);
+
+  gum_x86_writer_put_label (cw, flush);
+  gum_exec_ctx_write_prolog (ctx, GUM_PROLOG_MINIMAL, cw);
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (gum_exec_ctx_flush_event_buffer), 1,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
+  gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_MINIMAL, cw);
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX, GUM_REG_XDX,
+      G_STRUCT_OFFSET (GumExecCtx, event_buffer_remaining));
+
+  gum_x86_writer_put_label (cw, have_room);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XCX, GUM_REG_XCX, -1);
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XDX,
+      G_STRUCT_OFFSET (GumExecCtx, event_buffer_remaining), GUM_REG_XCX);
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX, GUM_REG_XDX,
+      G_STRUCT_OFFSET (GumExecCtx, event_buffer_cursor));
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XCX, GUM_REG_XAX,
+      sizeof (GumEvent));
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XDX,
+      G_STRUCT_OFFSET (GumExecCtx, event_buffer_cursor), GUM_REG_XCX);
+
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumAnyEvent, type), type);
+
+  if (type == GUM_EXEC)
+  {
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
+        GUM_ADDRESS (gc->instruction->start));
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumExecEvent, location), GUM_REG_XCX);
+  }
+  else /* GUM_BLOCK */
+  {
+    /* The block's size is only known once it has been compiled. */
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
+        GUM_ADDRESS (block->real_start));
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumBlockEvent, start), GUM_REG_XCX);
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XDX,
+        GUM_ADDRESS (&block->real_size));
+    gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_EDX, GUM_REG_XDX);
+    gum_x86_writer_put_bytes (cw, lea_xcx_xcx_plus_xdx,
+        sizeof (lea_xcx_xcx_plus_xdx));
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumBlockEvent, end), GUM_REG_XCX);
+  }
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+}
+
 static void
 gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
                                           GumGeneratorContext * gc,
@@ -5127,6 +6574,11 @@ gum_stalker_dump_counters (void)
   g_printerr ("\n");
 
   GUM_PRINT_ENTRYGATE_COUNTER (jmp_continuation);
+
+  g_printerr ("\n");
+
+  g_printerr ("\tspeculative_hits: %u\n", total_speculative_hits);
+  g_printerr ("\tspeculative_misses: %u\n", total_speculative_misses);
 }
 
 static gpointer
@@ -104,6 +104,41 @@ gum_event_sink_stop (GumEventSink * self)
     iface->stop (self);
 }
 
+/*
+ * Sinks that implement process_buffer() may ask for events to be recorded
+ * into a per-thread buffer of the returned capacity. Such events are then
+ * delivered in batches, without a GumCpuContext, whenever the buffer fills
+ * up or the thread stops being followed.
+ */
+guint
+gum_event_sink_query_buffer_capacity (GumEventSink * self)
+{
+  GumEventSinkInterface * iface = GUM_EVENT_SINK_GET_IFACE (self);
+
+  if (iface->query_buffer_capacity == NULL || iface->process_buffer == NULL)
+    return 0;
+
+  return iface->query_buffer_capacity (self);
+}
+
+void
+gum_event_sink_process_buffer (GumEventSink * self,
+                               const GumEvent * events,
+                               guint n_events)
+{
+  GumEventSinkInterface * iface = GUM_EVENT_SINK_GET_IFACE (self);
+  guint i;
+
+  if (iface->process_buffer != NULL)
+  {
+    iface->process_buffer (self, events, n_events);
+    return;
+  }
+
+  for (i = 0; i != n_events; i++)
+    gum_event_sink_process (self, &events[i], NULL);
+}
+
 GumEventSink *
 gum_event_sink_make_default (void)
 {
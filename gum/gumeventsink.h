@@ -37,6 +37,10 @@ struct _GumEventSinkInterface
       GumCpuContext * cpu_context);
   void (* flush) (GumEventSink * self);
   void (* stop) (GumEventSink * self);
+
+  guint (* query_buffer_capacity) (GumEventSink * self);
+  void (* process_buffer) (GumEventSink * self, const GumEvent * events,
+      guint n_events);
 };
 
 GUM_API GumEventType gum_event_sink_query_mask (GumEventSink * self);
@@ -45,6 +49,9 @@ GUM_API void gum_event_sink_process (GumEventSink * self,
     const GumEvent * event, GumCpuContext * cpu_context);
 GUM_API void gum_event_sink_flush (GumEventSink * self);
 GUM_API void gum_event_sink_stop (GumEventSink * self);
+GUM_API guint gum_event_sink_query_buffer_capacity (GumEventSink * self);
+GUM_API void gum_event_sink_process_buffer (GumEventSink * self,
+    const GumEvent * events, guint n_events);
 
 GUM_API GumEventSink * gum_event_sink_make_default (void);
 GUM_API GumEventSink * gum_event_sink_make_from_callback (GumEventType mask,
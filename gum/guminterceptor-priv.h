@@ -17,6 +17,32 @@
 typedef struct _GumInterceptorBackend GumInterceptorBackend;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumFunctionContextBackendData GumFunctionContextBackendData;
+typedef struct _GumFunctionStatistics GumFunctionStatistics;
+
+typedef enum
+{
+  GUM_INTERCEPTOR_TYPE_DEFAULT,
+  GUM_INTERCEPTOR_TYPE_FAST
+} GumInterceptorType;
+
+struct _GumProbe
+{
+  /* First, so that it is naturally aligned on 32-bit targets too. */
+  volatile guint64 call_count;
+
+  GumFunctionContext * function_ctx;
+  GumProbeProgram program;
+
+  volatile gsize head;
+  gsize tail;
+  gsize mask;
+  guint record_shift;
+  guint8 * records;
+
+  GumCodeSlice * slice;
+  gpointer code;
+  gpointer exit;
+};
 
 struct _GumFunctionContextBackendData
 {
@@ -26,9 +52,11 @@ struct _GumFunctionContextBackendData
 struct _GumFunctionContext
 {
   gpointer function_address;
+  GumInterceptorType type;
 
   gboolean destroyed;
   gboolean activated;
+  gboolean published;
   gboolean has_on_leave_listener;
 
   gpointer grafted_hook;
@@ -46,6 +74,15 @@ struct _GumFunctionContext
 
   gpointer on_leave_trampoline;
 
+  gpointer on_lightweight_enter_trampoline;
+  gboolean lightweight;
+
+  gpointer lazy_thunk;
+  gboolean materialization_pending;
+
+  GumProbe * probe;
+  GumFunctionStatistics * statistics;
+
   volatile GPtrArray * listener_entries;
 
   gpointer replacement_function;
@@ -62,9 +99,14 @@ G_GNUC_INTERNAL void _gum_interceptor_deinit (void);
 G_GNUC_INTERNAL void _gum_function_context_begin_invocation (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
     gpointer * caller_ret_addr, gpointer * next_hop);
+G_GNUC_INTERNAL void _gum_function_context_begin_lightweight_invocation (
+    GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
+    gpointer * next_hop);
 G_GNUC_INTERNAL void _gum_function_context_end_invocation (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
     gpointer * next_hop);
+G_GNUC_INTERNAL void _gum_interceptor_materialize_trampoline (
+    GumInterceptor * self, gpointer function_address, gpointer * next_hop);
 
 G_GNUC_INTERNAL GumInterceptorBackend * _gum_interceptor_backend_create (
     GRecMutex * mutex, GumCodeAllocator * allocator);
@@ -74,12 +116,17 @@ G_GNUC_INTERNAL gboolean _gum_interceptor_backend_claim_grafted_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
 G_GNUC_INTERNAL gboolean _gum_interceptor_backend_create_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
+G_GNUC_INTERNAL gboolean _gum_interceptor_backend_prepare_lazy_trampoline (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
 G_GNUC_INTERNAL void _gum_interceptor_backend_destroy_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
 G_GNUC_INTERNAL void _gum_interceptor_backend_activate_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx, gpointer prologue);
 G_GNUC_INTERNAL void _gum_interceptor_backend_deactivate_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx, gpointer prologue);
+G_GNUC_INTERNAL gboolean _gum_interceptor_backend_create_probe (
+    GumInterceptorBackend * self, GumFunctionContext * ctx, GumProbe * probe,
+    gpointer exit);
 
 G_GNUC_INTERNAL gpointer _gum_interceptor_backend_get_function_address (
     GumFunctionContext * ctx);
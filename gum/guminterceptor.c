@@ -14,7 +14,11 @@
 #include "gumprocess.h"
 #include "gumtls.h"
 
+#include <stdlib.h>
 #include <string.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
 
 #ifdef HAVE_MIPS
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 1024
@@ -22,6 +26,19 @@
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 256
 #endif
 
+#define GUM_INVOCATION_DATA_ALIGNMENT 16
+#define GUM_INVOCATION_DATA_MIN_ARENA_SIZE 4096
+#define GUM_INVOCATION_DATA_CHUNK_HEADER_SIZE \
+    GUM_ALIGN_SIZE (sizeof (InvocationDataChunk), \
+        GUM_INVOCATION_DATA_ALIGNMENT)
+
+#define GUM_PROBE_DEFAULT_CAPACITY 4096
+#define GUM_PROBE_MAX_CAPACITY     (1 << 24)
+
+#define GUM_MAX_CACHED_THREAD_STATISTICS 256
+
+#define GUM_INTERCEPTOR_THREAD_CONTEXT_BEING_CREATED 1
+
 #define GUM_INTERCEPTOR_LOCK(o) g_rec_mutex_lock (&(o)->mutex)
 #define GUM_INTERCEPTOR_UNLOCK(o) g_rec_mutex_unlock (&(o)->mutex)
 
@@ -29,11 +46,15 @@ typedef struct _GumInterceptorTransaction GumInterceptorTransaction;
 typedef guint GumInstrumentationError;
 typedef struct _GumDestroyTask GumDestroyTask;
 typedef struct _GumUpdateTask GumUpdateTask;
+typedef struct _GumPatchPlan GumPatchPlan;
+typedef struct _GumThreadStatistics GumThreadStatistics;
 typedef struct _ListenerEntry ListenerEntry;
 typedef struct _InterceptorThreadContext InterceptorThreadContext;
 typedef struct _GumInvocationStackEntry GumInvocationStackEntry;
 typedef struct _ListenerDataSlot ListenerDataSlot;
 typedef struct _ListenerInvocationState ListenerInvocationState;
+typedef struct _InvocationDataChunk InvocationDataChunk;
+typedef struct _GumDependencyRangeCollector GumDependencyRangeCollector;
 
 typedef void (* GumUpdateTaskFunc) (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
@@ -61,6 +82,12 @@ struct _GumInterceptor
 
   volatile guint selected_thread_id;
 
+  gboolean lazy_trampolines;
+  GQueue * pending_materializations;
+  GArray * dependency_ranges;
+
+  gboolean stop_the_world;
+
   GumInterceptorTransaction current_transaction;
 };
 
@@ -84,21 +111,65 @@ struct _GumUpdateTask
   GumUpdateTaskFunc func;
 };
 
+struct _GumPatchPlan
+{
+  GumInterceptorTransaction * transaction;
+  GArray * ranges;
+  gboolean rwx_supported;
+
+  guint8 * scratch;
+  GArray * thread_ids;
+  guint next_thread_index;
+  gboolean copied;
+};
+
+struct _GumFunctionStatistics
+{
+  guint id;
+  GumThreadStatistics * volatile threads;
+};
+
+struct _GumThreadStatistics
+{
+  GumThreadStatistics * next;
+
+  guint64 calls;
+  guint64 total_ticks;
+  guint64 min_ticks;
+  guint64 max_ticks;
+};
+
 struct _ListenerEntry
 {
   GumInvocationListenerInterface * listener_interface;
   GumInvocationListener * listener_instance;
   gpointer function_data;
+  GumListenerProfile profile;
+  gsize invocation_data_size;
+
+  volatile gint ref_count;
+  volatile gint detached;
 };
 
 struct _InterceptorThreadContext
 {
+  GumInterceptor * guard;
+  gint ignore_level;
+
+  guint last_statistics_id;
+  GumThreadStatistics * last_thread_statistics;
+  GHashTable * thread_statistics;
+
   GumInvocationBackend listener_backend;
   GumInvocationBackend replacement_backend;
 
-  gint ignore_level;
-
   GumInvocationStack * stack;
+  guint8 * invocation_data;
+  gsize invocation_data_capacity;
+  gsize invocation_data_used;
+
+  GPtrArray * replacement_cpu_contexts;
+  guint replacement_depth;
 
   GArray * listener_data_slots;
 };
@@ -108,11 +179,12 @@ struct _GumInvocationStackEntry
   GumFunctionContext * function_ctx;
   gpointer caller_ret_addr;
   GumInvocationContext invocation_context;
-  GumCpuContext cpu_context;
-  guint8 listener_invocation_data[GUM_MAX_LISTENERS_PER_FUNCTION]
-      [GUM_MAX_LISTENER_DATA];
+  GPtrArray * listener_entries;
+  gsize invocation_data_offset;
   gboolean calling_replacement;
   gint original_system_error;
+  GumFunctionStatistics * statistics;
+  guint64 start_ticks;
 };
 
 struct _ListenerDataSlot
@@ -126,7 +198,19 @@ struct _ListenerInvocationState
   GumPointCut point_cut;
   ListenerEntry * entry;
   InterceptorThreadContext * interceptor_ctx;
-  guint8 * invocation_data;
+  gsize invocation_data_offset;
+};
+
+struct _InvocationDataChunk
+{
+  ListenerEntry * owner;
+  gsize size;
+};
+
+struct _GumDependencyRangeCollector
+{
+  GArray * addresses;
+  GArray * ranges;
 };
 
 static void gum_interceptor_dispose (GObject * object);
@@ -135,12 +219,31 @@ static void gum_interceptor_finalize (GObject * object);
 static void the_interceptor_weak_notify (gpointer data,
     GObject * where_the_object_was);
 
+static GumAttachReturn gum_interceptor_attach_unlocked (GumInterceptor * self,
+    gpointer function_address, GumInvocationListener * listener,
+    gpointer listener_function_data, GumListenerProfile profile,
+    gsize invocation_data_size);
 static GumFunctionContext * gum_interceptor_instrument (GumInterceptor * self,
-    gpointer function_address, GumInstrumentationError * error);
+    gpointer function_address, GumInterceptorType type,
+    gpointer replacement_function, GumInstrumentationError * error);
 static void gum_interceptor_activate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
 static void gum_interceptor_deactivate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
+static gboolean gum_interceptor_materialize (GumInterceptor * self,
+    GumFunctionContext * ctx);
+static void gum_interceptor_defer_materialization (GumInterceptor * self,
+    GumFunctionContext * ctx);
+static void gum_interceptor_materialize_pending (GumInterceptor * self);
+static void gum_interceptor_collect_dependency_ranges (GumInterceptor * self);
+static gboolean gum_collect_dependency_range (
+    const GumModuleDetails * details, gpointer user_data);
+static gboolean gum_interceptor_is_dependency (GumInterceptor * self,
+    gpointer function_address);
+static void gum_interceptor_restore_prologue (gpointer prologue,
+    GumFunctionContext * ctx);
+static void gum_interceptor_reactivate (GumInterceptor * self,
+    GumFunctionContext * ctx, gpointer prologue);
 
 static void gum_interceptor_transaction_init (
     GumInterceptorTransaction * transaction, GumInterceptor * interceptor);
@@ -155,6 +258,19 @@ static void gum_interceptor_transaction_schedule_destroy (
 static void gum_interceptor_transaction_schedule_update (
     GumInterceptorTransaction * self, GumFunctionContext * ctx,
     GumUpdateTaskFunc func);
+static void gum_interceptor_transaction_run_updates (
+    GumInterceptorTransaction * self, guint8 * target_page,
+    guint8 * source_page);
+
+static void gum_patch_plan_apply (GumPatchPlan * plan);
+static void gum_patch_plan_apply_in_place (GumPatchPlan * plan);
+static void gum_patch_plan_apply_with_world_stopped (GumPatchPlan * plan);
+static gboolean gum_patch_plan_collect_thread (
+    const GumThreadDetails * details, gpointer user_data);
+static void gum_patch_plan_suspend_remaining_threads (GumPatchPlan * plan);
+static void gum_patch_plan_on_thread_suspended (GumThreadId thread_id,
+    GumCpuContext * cpu_context, gpointer user_data);
+static void gum_patch_plan_copy (GumPatchPlan * plan);
 
 static GumFunctionContext * gum_function_context_new (
     GumInterceptor * interceptor, gpointer function_address);
@@ -166,20 +282,48 @@ static gboolean gum_function_context_is_empty (
     GumFunctionContext * function_ctx);
 static void gum_function_context_add_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener,
-    gpointer function_data);
+    gpointer function_data, GumListenerProfile profile,
+    gsize invocation_data_size);
 static void gum_function_context_remove_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
-static void listener_entry_free (ListenerEntry * entry);
+static ListenerEntry * listener_entry_ref (ListenerEntry * entry);
+static void listener_entry_unref (ListenerEntry * entry);
 static gboolean gum_function_context_has_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_taken_listener_slot (
     GumFunctionContext * function_ctx);
+static void gum_function_context_update_has_on_leave_listener (
+    GumFunctionContext * function_ctx);
+static gboolean gum_function_context_wants_lightweight (
+    GumFunctionContext * function_ctx);
+static void gum_function_context_sync_flavor (
+    GumFunctionContext * function_ctx);
+static GumFunctionStatistics * gum_function_statistics_new (void);
+static void gum_function_statistics_free (GumFunctionStatistics * self);
+static void gum_function_statistics_add (GumFunctionStatistics * self,
+    InterceptorThreadContext * context, guint64 ticks);
+static GumThreadStatistics * gum_function_statistics_get_thread_statistics (
+    GumFunctionStatistics * self, InterceptorThreadContext * context);
+static void gum_function_statistics_sum (GumFunctionStatistics * self,
+    GumInvocationStatistics * result);
+static guint64 gum_interceptor_read_ticks (void);
+static gpointer gum_function_context_get_probe_exit (
+    GumFunctionContext * function_ctx);
+static void gum_function_context_compile_probe (
+    GumFunctionContext * function_ctx, GumProbe * probe);
 static void gum_function_context_fixup_cpu_context (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context);
 
+static GumProbe * gum_probe_new (GumFunctionContext * function_ctx,
+    const GumProbeProgram * program);
+static void gum_probe_free (GumProbe * probe);
+static void gum_probe_fire (GumProbe * self, GumCpuContext * cpu_context);
+static void gum_probe_count_call (GumProbe * self);
+
 static InterceptorThreadContext * get_interceptor_thread_context (void);
+static InterceptorThreadContext * create_interceptor_thread_context (void);
 static void release_interceptor_thread_context (
     InterceptorThreadContext * context);
 static InterceptorThreadContext * interceptor_thread_context_new (void);
@@ -190,6 +334,19 @@ static gpointer interceptor_thread_context_get_listener_data (
     gsize required_size);
 static void interceptor_thread_context_forget_listener_data (
     InterceptorThreadContext * self, GumInvocationListener * listener);
+static gsize interceptor_thread_context_reserve_invocation_data (
+    InterceptorThreadContext * self);
+static gpointer interceptor_thread_context_get_invocation_data (
+    InterceptorThreadContext * self, gsize frame_offset, ListenerEntry * entry,
+    gsize required_size);
+static void interceptor_thread_context_ensure_invocation_data_capacity (
+    InterceptorThreadContext * self, gsize required_capacity);
+static void interceptor_thread_context_release_invocation_data (
+    InterceptorThreadContext * self, gsize offset);
+static GumCpuContext * interceptor_thread_context_push_replacement_cpu_context (
+    InterceptorThreadContext * self);
+static void interceptor_thread_context_pop_replacement_cpu_context (
+    InterceptorThreadContext * self);
 static GumInvocationStackEntry * gum_invocation_stack_push (
     GumInvocationStack * stack, GumFunctionContext * function_ctx,
     gpointer caller_ret_addr);
@@ -204,6 +361,7 @@ static gboolean gum_interceptor_has (GumInterceptor * self,
 
 static gpointer gum_page_address_from_pointer (gpointer ptr);
 static gint gum_page_address_compare (gconstpointer a, gconstpointer b);
+static GArray * gum_page_ranges_from_sorted_pages (GList * pages);
 
 G_DEFINE_TYPE (GumInterceptor, gum_interceptor, G_TYPE_OBJECT)
 
@@ -211,10 +369,16 @@ static GMutex _gum_interceptor_lock;
 static GumInterceptor * _the_interceptor = NULL;
 
 static GumSpinlock gum_interceptor_thread_context_lock = GUM_SPINLOCK_INIT;
+#if GLIB_SIZEOF_VOID_P == 4 && !defined (_MSC_VER) && \
+    !defined (__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+# define GUM_PROBE_CALL_COUNT_NEEDS_LOCK 1
+static GumSpinlock gum_probe_call_count_lock = GUM_SPINLOCK_INIT;
+#endif
 static GHashTable * gum_interceptor_thread_contexts;
 static GPrivate gum_interceptor_context_private =
     G_PRIVATE_INIT ((GDestroyNotify) release_interceptor_thread_context);
-static GumTlsKey gum_interceptor_guard_key;
+static GumTlsKey gum_interceptor_context_key;
+static volatile gint gum_interceptor_next_statistics_id = 1;
 
 static GumInvocationStack _gum_interceptor_empty_stack = { NULL, 0 };
 
@@ -233,13 +397,13 @@ _gum_interceptor_init (void)
   gum_interceptor_thread_contexts = g_hash_table_new_full (NULL, NULL,
       (GDestroyNotify) interceptor_thread_context_destroy, NULL);
 
-  gum_interceptor_guard_key = gum_tls_key_new ();
+  gum_interceptor_context_key = gum_tls_key_new ();
 }
 
 void
 _gum_interceptor_deinit (void)
 {
-  gum_tls_key_free (gum_interceptor_guard_key);
+  gum_tls_key_free (gum_interceptor_context_key);
 
   g_hash_table_unref (gum_interceptor_thread_contexts);
   gum_interceptor_thread_contexts = NULL;
@@ -255,6 +419,12 @@ gum_interceptor_init (GumInterceptor * self)
 
   gum_code_allocator_init (&self->allocator, GUM_INTERCEPTOR_CODE_SLICE_SIZE);
 
+  self->lazy_trampolines = FALSE;
+  self->pending_materializations = g_queue_new ();
+  self->dependency_ranges = NULL;
+
+  self->stop_the_world = FALSE;
+
   gum_interceptor_transaction_init (&self->current_transaction, self);
 }
 
@@ -289,6 +459,9 @@ gum_interceptor_finalize (GObject * object)
 
   g_hash_table_unref (self->function_by_address);
 
+  g_queue_free (self->pending_materializations);
+  g_clear_pointer (&self->dependency_ranges, g_array_unref);
+
   gum_code_allocator_free (&self->allocator);
 
   G_OBJECT_CLASS (gum_interceptor_parent_class)->finalize (object);
@@ -337,26 +510,79 @@ gum_interceptor_attach (GumInterceptor * self,
                         GumInvocationListener * listener,
                         gpointer listener_function_data)
 {
-  GumAttachReturn result = GUM_ATTACH_OK;
-  GumFunctionContext * function_ctx;
-  GumInstrumentationError error;
+  return gum_interceptor_attach_with_profile (self, function_address, listener,
+      listener_function_data, GUM_LISTENER_PROFILE_FULL);
+}
+
+GumAttachReturn
+gum_interceptor_attach_with_profile (GumInterceptor * self,
+                                     gpointer function_address,
+                                     GumInvocationListener * listener,
+                                     gpointer listener_function_data,
+                                     GumListenerProfile profile)
+{
+  return gum_interceptor_attach_full (self, function_address, listener,
+      listener_function_data, profile, GUM_MAX_LISTENER_DATA);
+}
+
+/*
+ * The invocation data size is the most the listener will ask for through
+ * GUM_IC_GET_INVOCATION_DATA(). Calls only pay for what the listener actually
+ * asks for, and only while the call is in flight.
+ */
+GumAttachReturn
+gum_interceptor_attach_full (GumInterceptor * self,
+                             gpointer function_address,
+                             GumInvocationListener * listener,
+                             gpointer listener_function_data,
+                             GumListenerProfile profile,
+                             gsize invocation_data_size)
+{
+  GumAttachReturn result;
 
   gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK (self);
   gum_interceptor_transaction_begin (&self->current_transaction);
   self->current_transaction.is_dirty = TRUE;
 
+  result = gum_interceptor_attach_unlocked (self, function_address, listener,
+      listener_function_data, profile, invocation_data_size);
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  return result;
+}
+
+static GumAttachReturn
+gum_interceptor_attach_unlocked (GumInterceptor * self,
+                                 gpointer function_address,
+                                 GumInvocationListener * listener,
+                                 gpointer listener_function_data,
+                                 GumListenerProfile profile,
+                                 gsize invocation_data_size)
+{
+  GumAttachReturn result = GUM_ATTACH_OK;
+  GumFunctionContext * function_ctx;
+  GumInstrumentationError error;
+
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address, &error);
+  function_ctx = gum_interceptor_instrument (self, function_address,
+      GUM_INTERCEPTOR_TYPE_DEFAULT, NULL, &error);
   if (function_ctx == NULL)
     goto instrumentation_error;
 
+  if (function_ctx->type != GUM_INTERCEPTOR_TYPE_DEFAULT)
+    goto wrong_type;
+
   if (gum_function_context_has_listener (function_ctx, listener))
     goto already_attached;
 
   gum_function_context_add_listener (function_ctx, listener,
-      listener_function_data);
+      listener_function_data, profile, invocation_data_size);
+  gum_function_context_sync_flavor (function_ctx);
 
   goto beach;
 
@@ -375,6 +601,11 @@ instrumentation_error:
     }
     goto beach;
   }
+wrong_type:
+  {
+    result = GUM_ATTACH_WRONG_TYPE;
+    goto beach;
+  }
 already_attached:
   {
     result = GUM_ATTACH_ALREADY_ATTACHED;
@@ -382,10 +613,6 @@ already_attached:
   }
 beach:
   {
-    gum_interceptor_transaction_end (&self->current_transaction);
-    GUM_INTERCEPTOR_UNLOCK (self);
-    gum_interceptor_unignore_current_thread (self);
-
     return result;
   }
 }
@@ -417,6 +644,10 @@ gum_interceptor_detach (GumInterceptor * self,
       {
         g_hash_table_iter_remove (&iter);
       }
+      else
+      {
+        gum_function_context_sync_flavor (function_ctx);
+      }
     }
   }
 
@@ -447,7 +678,8 @@ gum_interceptor_replace (GumInterceptor * self,
 
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address, &error);
+  function_ctx = gum_interceptor_instrument (self, function_address,
+      GUM_INTERCEPTOR_TYPE_DEFAULT, NULL, &error);
   if (function_ctx == NULL)
     goto instrumentation_error;
 
@@ -456,6 +688,88 @@ gum_interceptor_replace (GumInterceptor * self,
 
   function_ctx->replacement_data = replacement_data;
   function_ctx->replacement_function = replacement_function;
+  gum_function_context_sync_flavor (function_ctx);
+
+  goto beach;
+
+instrumentation_error:
+  {
+    switch (error)
+    {
+      case GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE:
+        result = GUM_REPLACE_WRONG_SIGNATURE;
+        break;
+      case GUM_INSTRUMENTATION_ERROR_POLICY_VIOLATION:
+        result = GUM_REPLACE_POLICY_VIOLATION;
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+    goto beach;
+  }
+already_replaced:
+  {
+    result = GUM_REPLACE_ALREADY_REPLACED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
+
+    return result;
+  }
+}
+
+/*
+ * Patches the function to branch straight to the replacement, without going
+ * through the enter thunk, so no invocation context is set up for it. The
+ * original implementation is handed back through original_function.
+ *
+ * Such a function cannot also have listeners or probes attached, and the
+ * caller must make sure no thread is still inside the replacement when
+ * reverting it, as nothing keeps track of those calls.
+ */
+GumReplaceReturn
+gum_interceptor_replace_fast (GumInterceptor * self,
+                              gpointer function_address,
+                              gpointer replacement_function,
+                              gpointer * original_function)
+{
+  GumReplaceReturn result = GUM_REPLACE_OK;
+  GumFunctionContext * function_ctx;
+  GumInstrumentationError error;
+
+  *original_function = NULL;
+
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx != NULL)
+  {
+    if (function_ctx->replacement_function != NULL)
+      goto already_replaced;
+    goto wrong_type;
+  }
+
+  function_ctx = gum_interceptor_instrument (self, function_address,
+      GUM_INTERCEPTOR_TYPE_FAST, replacement_function, &error);
+  if (function_ctx == NULL)
+    goto instrumentation_error;
+
+  if (!gum_interceptor_materialize (self, function_ctx))
+  {
+    g_hash_table_remove (self->function_by_address, function_address);
+    error = GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE;
+    goto instrumentation_error;
+  }
+
+  *original_function = function_ctx->on_invoke_trampoline;
 
   goto beach;
 
@@ -474,6 +788,11 @@ instrumentation_error:
     }
     goto beach;
   }
+wrong_type:
+  {
+    result = GUM_REPLACE_WRONG_TYPE;
+    goto beach;
+  }
 already_replaced:
   {
     result = GUM_REPLACE_ALREADY_REPLACED;
@@ -505,6 +824,17 @@ gum_interceptor_revert (GumInterceptor * self,
   if (function_ctx == NULL)
     goto beach;
 
+  /*
+   * A fast replacement keeps jumping straight to replacement_function until
+   * the deactivation of its prologue has been committed, so the destroy task
+   * is what finally clears it.
+   */
+  if (function_ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+  {
+    g_hash_table_remove (self->function_by_address, function_address);
+    goto beach;
+  }
+
   function_ctx->replacement_function = NULL;
   function_ctx->replacement_data = NULL;
 
@@ -512,90 +842,421 @@ gum_interceptor_revert (GumInterceptor * self,
   {
     g_hash_table_remove (self->function_by_address, function_address);
   }
+  else
+  {
+    gum_function_context_sync_flavor (function_ctx);
+  }
 
 beach:
   gum_interceptor_transaction_end (&self->current_transaction);
   GUM_INTERCEPTOR_UNLOCK (self);
 }
 
-void
-gum_interceptor_begin_transaction (GumInterceptor * self)
+GumAttachReturn
+gum_interceptor_attach_probe (GumInterceptor * self,
+                              gpointer function_address,
+                              const GumProbeProgram * program,
+                              GumProbe ** probe)
 {
-  GUM_INTERCEPTOR_LOCK (self);
-  gum_interceptor_transaction_begin (&self->current_transaction);
-  GUM_INTERCEPTOR_UNLOCK (self);
-}
+  GumAttachReturn result = GUM_ATTACH_OK;
+  GumFunctionContext * function_ctx;
+  GumInstrumentationError error;
 
-void
-gum_interceptor_end_transaction (GumInterceptor * self)
-{
-  GUM_INTERCEPTOR_LOCK (self);
-  gum_interceptor_transaction_end (&self->current_transaction);
-  GUM_INTERCEPTOR_UNLOCK (self);
-}
+  g_return_val_if_fail (program->n_arguments <= GUM_PROBE_MAX_ARGUMENTS,
+      GUM_ATTACH_WRONG_SIGNATURE);
 
-gboolean
-gum_interceptor_flush (GumInterceptor * self)
-{
-  gboolean flushed = FALSE;
+  *probe = NULL;
 
+  gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
 
-  if (self->current_transaction.level == 0)
-  {
-    gum_interceptor_transaction_begin (&self->current_transaction);
-    gum_interceptor_transaction_end (&self->current_transaction);
-
-    flushed =
-        g_queue_is_empty (self->current_transaction.pending_destroy_tasks);
-  }
+  function_address = gum_interceptor_resolve (self, function_address);
 
-  GUM_INTERCEPTOR_UNLOCK (self);
+  function_ctx = gum_interceptor_instrument (self, function_address,
+      GUM_INTERCEPTOR_TYPE_DEFAULT, NULL, &error);
+  if (function_ctx == NULL)
+    goto instrumentation_error;
 
-  return flushed;
-}
+  if (function_ctx->type != GUM_INTERCEPTOR_TYPE_DEFAULT)
+    goto wrong_type;
 
-GumInvocationContext *
-gum_interceptor_get_current_invocation (void)
-{
-  InterceptorThreadContext * interceptor_ctx;
-  GumInvocationStackEntry * entry;
+  if (function_ctx->probe != NULL)
+    goto already_attached;
 
-  interceptor_ctx = get_interceptor_thread_context ();
-  entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
-  if (entry == NULL)
-    return NULL;
+  if (!gum_interceptor_materialize (self, function_ctx))
+  {
+    error = GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE;
+    goto instrumentation_error;
+  }
 
-  return &entry->invocation_context;
-}
+  function_ctx->probe = gum_probe_new (function_ctx, program);
+  gum_function_context_compile_probe (function_ctx, function_ctx->probe);
 
-GumInvocationStack *
-gum_interceptor_get_current_stack (void)
-{
-  InterceptorThreadContext * context;
+  if (function_ctx->activated)
+  {
+    gum_interceptor_transaction_schedule_update (&self->current_transaction,
+        function_ctx, gum_interceptor_reactivate);
+  }
 
-  context = g_private_get (&gum_interceptor_context_private);
-  if (context == NULL)
-    return &_gum_interceptor_empty_stack;
+  *probe = function_ctx->probe;
 
-  return context->stack;
-}
+  goto beach;
 
-void
-gum_interceptor_ignore_current_thread (GumInterceptor * self)
-{
-  InterceptorThreadContext * interceptor_ctx;
+instrumentation_error:
+  {
+    switch (error)
+    {
+      case GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE:
+        result = GUM_ATTACH_WRONG_SIGNATURE;
+        break;
+      case GUM_INSTRUMENTATION_ERROR_POLICY_VIOLATION:
+        result = GUM_ATTACH_POLICY_VIOLATION;
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+    goto beach;
+  }
+wrong_type:
+  {
+    result = GUM_ATTACH_WRONG_TYPE;
+    goto beach;
+  }
+already_attached:
+  {
+    result = GUM_ATTACH_ALREADY_ATTACHED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
+    gum_interceptor_unignore_current_thread (self);
 
-  interceptor_ctx = get_interceptor_thread_context ();
-  interceptor_ctx->ignore_level++;
+    return result;
+  }
 }
 
 void
-gum_interceptor_unignore_current_thread (GumInterceptor * self)
+gum_interceptor_detach_probe (GumInterceptor * self,
+                              GumProbe * probe)
 {
-  InterceptorThreadContext * interceptor_ctx;
+  GumFunctionContext * function_ctx = probe->function_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  g_assert (function_ctx->probe == probe);
+  function_ctx->probe = NULL;
+
+  gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+      function_ctx, (GDestroyNotify) gum_probe_free, probe);
+
+  if (gum_function_context_is_empty (function_ctx))
+  {
+    g_hash_table_remove (self->function_by_address,
+        function_ctx->function_address);
+  }
+  else if (function_ctx->activated)
+  {
+    gum_interceptor_transaction_schedule_update (&self->current_transaction,
+        function_ctx, gum_interceptor_reactivate);
+  }
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
+/*
+ * Keeps track of how many times the function returns and how long each call
+ * takes, without needing a listener. Durations are measured in ticks of the
+ * cheapest monotonic counter the CPU offers, e.g. the TSC on x86, and in
+ * microseconds where no such counter is available.
+ *
+ * Each thread keeps its own counters, updated without any locking or atomics,
+ * so that hot functions called from many cores do not keep bouncing a shared
+ * cache line around. They only get summed up when read through
+ * gum_interceptor_get_statistics().
+ */
+GumAttachReturn
+gum_interceptor_enable_statistics (GumInterceptor * self,
+                                   gpointer function_address)
+{
+  GumAttachReturn result = GUM_ATTACH_OK;
+  GumFunctionContext * function_ctx;
+  GumInstrumentationError error;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address,
+      GUM_INTERCEPTOR_TYPE_DEFAULT, NULL, &error);
+  if (function_ctx == NULL)
+    goto instrumentation_error;
+
+  if (function_ctx->type != GUM_INTERCEPTOR_TYPE_DEFAULT)
+    goto wrong_type;
+
+  if (function_ctx->statistics != NULL)
+    goto already_attached;
+
+  if (!gum_interceptor_materialize (self, function_ctx))
+  {
+    error = GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE;
+    goto instrumentation_error;
+  }
+
+  function_ctx->statistics = gum_function_statistics_new ();
+
+  gum_function_context_sync_flavor (function_ctx);
+
+  goto beach;
+
+instrumentation_error:
+  {
+    switch (error)
+    {
+      case GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE:
+        result = GUM_ATTACH_WRONG_SIGNATURE;
+        break;
+      case GUM_INSTRUMENTATION_ERROR_POLICY_VIOLATION:
+        result = GUM_ATTACH_POLICY_VIOLATION;
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+    goto beach;
+  }
+wrong_type:
+  {
+    result = GUM_ATTACH_WRONG_TYPE;
+    goto beach;
+  }
+already_attached:
+  {
+    result = GUM_ATTACH_ALREADY_ATTACHED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
+    gum_interceptor_unignore_current_thread (self);
+
+    return result;
+  }
+}
+
+void
+gum_interceptor_disable_statistics (GumInterceptor * self,
+                                    gpointer function_address)
+{
+  GumFunctionContext * function_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx == NULL || function_ctx->statistics == NULL)
+    goto beach;
+
+  gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+      function_ctx, (GDestroyNotify) gum_function_statistics_free,
+      function_ctx->statistics);
+  function_ctx->statistics = NULL;
+
+  if (gum_function_context_is_empty (function_ctx))
+  {
+    g_hash_table_remove (self->function_by_address, function_address);
+  }
+  else
+  {
+    gum_function_context_sync_flavor (function_ctx);
+  }
+
+beach:
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
+gboolean
+gum_interceptor_get_statistics (GumInterceptor * self,
+                                gpointer function_address,
+                                GumInvocationStatistics * statistics)
+{
+  gboolean found = FALSE;
+  GumFunctionContext * function_ctx;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx != NULL && function_ctx->statistics != NULL)
+  {
+    gum_function_statistics_sum (function_ctx->statistics, statistics);
+    found = TRUE;
+  }
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+
+  return found;
+}
+
+/*
+ * When enabled, functions instrumented from here on only get their prologue
+ * redirected to a thunk shared with other functions nearby. Their trampoline
+ * is generated the first time they get called, which saves both code memory
+ * and attach latency when hooking a lot of functions that are rarely called.
+ *
+ * The original prologue is put back while the trampoline is being generated,
+ * so calls made by other threads during that short window go unnoticed.
+ * Backends without support for this keep generating trampolines up front.
+ *
+ * That first call takes the Interceptor's lock, allocates memory and patches
+ * code on the calling thread. Functions in the modules that doing so depends
+ * on, i.e. Gum itself, GLib, the C runtime and the threading and memory
+ * protection APIs, are therefore always given their trampoline up front.
+ *
+ * This is off by default, and must still only be enabled for functions that
+ * are never called in a context where doing all of that is unsafe, such as
+ * signal handlers and code that runs with allocator or dynamic linker locks
+ * held, where the first call may deadlock.
+ */
+void
+gum_interceptor_set_lazy_trampolines (GumInterceptor * self,
+                                      gboolean enabled)
+{
+  GUM_INTERCEPTOR_LOCK (self);
+
+  self->lazy_trampolines = enabled;
+
+  if (enabled && self->dependency_ranges == NULL)
+    gum_interceptor_collect_dependency_ranges (self);
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+/*
+ * Only matters where code pages cannot be made RWX and have to be patched in
+ * place. By default each page is then made non-executable for just as long
+ * as it takes to patch it, so threads running code on the same page may
+ * fault. When enabled, the changes are instead prepared off to the side, and
+ * all other threads are suspended for only as long as it takes to copy them
+ * into place. Suspending is costly with many threads, so this is best
+ * combined with batching changes in a single transaction. Threads created
+ * while the copy is in progress are not suspended.
+ */
+void
+gum_interceptor_set_stop_the_world (GumInterceptor * self,
+                                    gboolean enabled)
+{
+  GUM_INTERCEPTOR_LOCK (self);
+  self->stop_the_world = enabled;
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+void
+gum_interceptor_begin_transaction (GumInterceptor * self)
+{
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+void
+gum_interceptor_end_transaction (GumInterceptor * self)
+{
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+gboolean
+gum_interceptor_flush (GumInterceptor * self)
+{
+  gboolean flushed = FALSE;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  if (self->current_transaction.level == 0)
+  {
+    gum_interceptor_transaction_begin (&self->current_transaction);
+    gum_interceptor_transaction_end (&self->current_transaction);
+
+    flushed =
+        g_queue_is_empty (self->current_transaction.pending_destroy_tasks);
+  }
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+
+  return flushed;
+}
+
+GumInvocationContext *
+gum_interceptor_get_current_invocation (void)
+{
+  InterceptorThreadContext * interceptor_ctx;
+  GumInvocationStackEntry * entry;
 
   interceptor_ctx = get_interceptor_thread_context ();
+  entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
+  if (entry == NULL)
+    return NULL;
+
+  return &entry->invocation_context;
+}
+
+GumInvocationStack *
+gum_interceptor_get_current_stack (void)
+{
+  InterceptorThreadContext * context;
+
+  context = gum_tls_key_get_value (gum_interceptor_context_key);
+  if (GPOINTER_TO_SIZE (context) <=
+      GUM_INTERCEPTOR_THREAD_CONTEXT_BEING_CREATED)
+    return &_gum_interceptor_empty_stack;
+
+  return context->stack;
+}
+
+void
+gum_interceptor_ignore_current_thread (GumInterceptor * self)
+{
+  InterceptorThreadContext * interceptor_ctx;
+
+  interceptor_ctx = get_interceptor_thread_context ();
+  if (interceptor_ctx == NULL)
+    return;
+
+  interceptor_ctx->ignore_level++;
+}
+
+void
+gum_interceptor_unignore_current_thread (GumInterceptor * self)
+{
+  InterceptorThreadContext * interceptor_ctx;
+
+  interceptor_ctx = get_interceptor_thread_context ();
+  if (interceptor_ctx == NULL)
+    return;
+
   interceptor_ctx->ignore_level--;
 }
 
@@ -640,6 +1301,7 @@ void
 gum_interceptor_restore (GumInvocationState * state)
 {
   GumInvocationStack * stack;
+  InterceptorThreadContext * interceptor_ctx;
   guint old_depth, new_depth, i;
 
   stack = gum_interceptor_get_current_stack ();
@@ -649,15 +1311,24 @@ gum_interceptor_restore (GumInvocationState * state)
   if (new_depth == old_depth)
     return;
 
+  interceptor_ctx = get_interceptor_thread_context ();
+
   for (i = old_depth; i != new_depth; i++)
   {
     GumInvocationStackEntry * entry;
 
     entry = &g_array_index (stack, GumInvocationStackEntry, i);
 
+    if (entry->calling_replacement)
+      interceptor_thread_context_pop_replacement_cpu_context (interceptor_ctx);
+
     g_atomic_int_dec_and_test (&entry->function_ctx->trampoline_usage_counter);
   }
 
+  interceptor_thread_context_release_invocation_data (interceptor_ctx,
+      g_array_index (stack, GumInvocationStackEntry,
+          old_depth).invocation_data_offset);
+
   g_array_set_size (stack, old_depth);
 }
 
@@ -692,94 +1363,326 @@ _gum_interceptor_translate_top_return_address (gpointer return_address)
 
   return entry->caller_ret_addr;
 
-fallback:
-  return return_address;
+fallback:
+  return return_address;
+}
+
+/*
+ * Called by the lazy thunk on the thread that made the first call, in
+ * whatever context that happens to be. See
+ * gum_interceptor_set_lazy_trampolines() for why that has to be opt-in.
+ */
+void
+_gum_interceptor_materialize_trampoline (GumInterceptor * self,
+                                         gpointer function_address,
+                                         gpointer * next_hop)
+{
+  gint system_error;
+  GumFunctionContext * function_ctx;
+
+  system_error = gum_thread_get_system_error ();
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+
+  function_ctx = g_hash_table_lookup (self->function_by_address,
+      function_address);
+  if (function_ctx != NULL && function_ctx->lazy_thunk != NULL &&
+      function_ctx->activated)
+  {
+    gum_interceptor_defer_materialization (self, function_ctx);
+    self->current_transaction.is_dirty = TRUE;
+  }
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  gum_thread_set_system_error (system_error);
+
+  /*
+   * Whether we materialized it, some other thread beat us to it, or it got
+   * detached in the meantime, the prologue no longer leads here.
+   */
+  *next_hop = function_address;
+}
+
+static GumFunctionContext *
+gum_interceptor_instrument (GumInterceptor * self,
+                            gpointer function_address,
+                            GumInterceptorType type,
+                            gpointer replacement_function,
+                            GumInstrumentationError * error)
+{
+  GumFunctionContext * ctx;
+
+  *error = GUM_INSTRUMENTATION_ERROR_NONE;
+
+  ctx = (GumFunctionContext *) g_hash_table_lookup (self->function_by_address,
+      function_address);
+  if (ctx != NULL)
+    return ctx;
+
+  if (self->backend == NULL)
+  {
+    self->backend =
+        _gum_interceptor_backend_create (&self->mutex, &self->allocator);
+  }
+
+  ctx = gum_function_context_new (self, function_address);
+  ctx->type = type;
+  ctx->replacement_function = replacement_function;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+  {
+    if (!_gum_interceptor_backend_claim_grafted_trampoline (self->backend, ctx))
+      goto policy_violation;
+  }
+  else
+  {
+    gboolean prepared_lazily;
+
+    prepared_lazily = self->lazy_trampolines &&
+        !gum_interceptor_is_dependency (self, function_address) &&
+        _gum_interceptor_backend_prepare_lazy_trampoline (self->backend, ctx);
+
+    if (!prepared_lazily &&
+        !_gum_interceptor_backend_create_trampoline (self->backend, ctx))
+      goto wrong_signature;
+  }
+
+  g_hash_table_insert (self->function_by_address, function_address, ctx);
+
+  gum_interceptor_transaction_schedule_update (&self->current_transaction, ctx,
+      gum_interceptor_activate);
+
+  return ctx;
+
+policy_violation:
+  {
+    *error = GUM_INSTRUMENTATION_ERROR_POLICY_VIOLATION;
+    goto propagate_error;
+  }
+wrong_signature:
+  {
+    *error = GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE;
+    goto propagate_error;
+  }
+propagate_error:
+  {
+    gum_function_context_finalize (ctx);
+
+    return NULL;
+  }
+}
+
+static void
+gum_interceptor_activate (GumInterceptor * self,
+                          GumFunctionContext * ctx,
+                          gpointer prologue)
+{
+  if (ctx->destroyed)
+    return;
+
+  g_assert (!ctx->activated);
+  ctx->activated = TRUE;
+  ctx->published = TRUE;
+
+  ctx->lightweight = gum_function_context_wants_lightweight (ctx);
+
+  _gum_interceptor_backend_activate_trampoline (self->backend, ctx,
+      prologue);
+}
+
+static void
+gum_interceptor_deactivate (GumInterceptor * self,
+                            GumFunctionContext * ctx,
+                            gpointer prologue)
+{
+  GumInterceptorBackend * backend = self->backend;
+
+  g_assert (ctx->activated);
+  ctx->activated = FALSE;
+
+  _gum_interceptor_backend_deactivate_trampoline (backend, ctx, prologue);
+}
+
+/*
+ * Generates the trampoline of a lazily instrumented function, unless it has
+ * one already, and activates it as part of the current transaction.
+ */
+static gboolean
+gum_interceptor_materialize (GumInterceptor * self,
+                             GumFunctionContext * ctx)
+{
+  gboolean was_live;
+
+  if (ctx->lazy_thunk == NULL)
+    return TRUE;
+
+  if (ctx->activated)
+    gum_interceptor_defer_materialization (self, ctx);
+
+  was_live = ctx->materialization_pending;
+  if (was_live)
+  {
+    g_queue_remove (self->pending_materializations, ctx);
+    ctx->materialization_pending = FALSE;
+  }
+
+  if (!_gum_interceptor_backend_create_trampoline (self->backend, ctx))
+    return FALSE;
+  ctx->lazy_thunk = NULL;
+
+  if (was_live)
+  {
+    gum_interceptor_transaction_schedule_update (&self->current_transaction,
+        ctx, gum_interceptor_activate);
+    self->current_transaction.is_dirty = TRUE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Puts the original prologue back right away, so the function is safe to
+ * call while its trampoline is being generated. This also takes care of
+ * recursion, e.g. when the function is one that the code generation itself
+ * depends on.
+ */
+static void
+gum_interceptor_defer_materialization (GumInterceptor * self,
+                                       GumFunctionContext * ctx)
+{
+  gum_memory_patch_code (_gum_interceptor_backend_get_function_address (ctx),
+      ctx->overwritten_prologue_len,
+      (GumMemoryPatchApplyFunc) gum_interceptor_restore_prologue, ctx);
+  ctx->activated = FALSE;
+
+  ctx->materialization_pending = TRUE;
+  g_queue_push_tail (self->pending_materializations, ctx);
 }
 
-static GumFunctionContext *
-gum_interceptor_instrument (GumInterceptor * self,
-                            gpointer function_address,
-                            GumInstrumentationError * error)
+static void
+gum_interceptor_materialize_pending (GumInterceptor * self)
 {
   GumFunctionContext * ctx;
 
-  *error = GUM_INSTRUMENTATION_ERROR_NONE;
-
-  ctx = (GumFunctionContext *) g_hash_table_lookup (self->function_by_address,
-      function_address);
-  if (ctx != NULL)
-    return ctx;
+  while ((ctx = g_queue_peek_head (self->pending_materializations)) != NULL)
+    gum_interceptor_materialize (self, ctx);
+}
 
-  if (self->backend == NULL)
-  {
-    self->backend =
-        _gum_interceptor_backend_create (&self->mutex, &self->allocator);
-  }
+static void
+gum_interceptor_collect_dependency_ranges (GumInterceptor * self)
+{
+  const gchar * dependency_exports[] = {
+    "pthread_mutex_lock",
+    "mprotect",
+    "VirtualProtect",
+    "NtProtectVirtualMemory",
+  };
+  gpointer dependency_functions[] = {
+    GUM_FUNCPTR_TO_POINTER (gum_interceptor_attach),
+    GUM_FUNCPTR_TO_POINTER (g_rec_mutex_lock),
+    GUM_FUNCPTR_TO_POINTER (g_malloc),
+    GUM_FUNCPTR_TO_POINTER (malloc),
+    GUM_FUNCPTR_TO_POINTER (memcpy),
+  };
+  GumDependencyRangeCollector collector;
+  guint i;
 
-  ctx = gum_function_context_new (self, function_address);
+  collector.addresses = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  collector.ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
 
-  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+  for (i = 0; i != G_N_ELEMENTS (dependency_functions); i++)
   {
-    if (!_gum_interceptor_backend_claim_grafted_trampoline (self->backend, ctx))
-      goto policy_violation;
+    gpointer address;
+
+    address = gum_interceptor_resolve (self, dependency_functions[i]);
+    g_array_append_val (collector.addresses, address);
   }
-  else
+
+  for (i = 0; i != G_N_ELEMENTS (dependency_exports); i++)
   {
-    if (!_gum_interceptor_backend_create_trampoline (self->backend, ctx))
-      goto wrong_signature;
+    gpointer address;
+
+    address = GSIZE_TO_POINTER (
+        gum_module_find_export_by_name (NULL, dependency_exports[i]));
+    if (address != NULL)
+    {
+      address = gum_interceptor_resolve (self, address);
+      g_array_append_val (collector.addresses, address);
+    }
   }
 
-  g_hash_table_insert (self->function_by_address, function_address, ctx);
+  gum_process_enumerate_modules (gum_collect_dependency_range, &collector);
 
-  gum_interceptor_transaction_schedule_update (&self->current_transaction, ctx,
-      gum_interceptor_activate);
+  g_array_free (collector.addresses, TRUE);
 
-  return ctx;
+  self->dependency_ranges = collector.ranges;
+}
 
-policy_violation:
+static gboolean
+gum_collect_dependency_range (const GumModuleDetails * details,
+                              gpointer user_data)
+{
+  GumDependencyRangeCollector * collector = user_data;
+  const GumMemoryRange * range = details->range;
+  guint i;
+
+  for (i = 0; i != collector->addresses->len; i++)
   {
-    *error = GUM_INSTRUMENTATION_ERROR_POLICY_VIOLATION;
-    goto propagate_error;
+    GumAddress address = GUM_ADDRESS (
+        g_array_index (collector->addresses, gpointer, i));
+
+    if (GUM_MEMORY_RANGE_INCLUDES (range, address))
+    {
+      g_array_append_val (collector->ranges, *range);
+      break;
+    }
   }
-wrong_signature:
+
+  return TRUE;
+}
+
+static gboolean
+gum_interceptor_is_dependency (GumInterceptor * self,
+                               gpointer function_address)
+{
+  GumAddress address = GUM_ADDRESS (function_address);
+  guint i;
+
+  for (i = 0; i != self->dependency_ranges->len; i++)
   {
-    *error = GUM_INSTRUMENTATION_ERROR_WRONG_SIGNATURE;
-    goto propagate_error;
+    if (GUM_MEMORY_RANGE_INCLUDES (
+        &g_array_index (self->dependency_ranges, GumMemoryRange, i), address))
+      return TRUE;
   }
-propagate_error:
-  {
-    gum_function_context_finalize (ctx);
 
-    return NULL;
-  }
+  return FALSE;
 }
 
 static void
-gum_interceptor_activate (GumInterceptor * self,
-                          GumFunctionContext * ctx,
-                          gpointer prologue)
+gum_interceptor_restore_prologue (gpointer prologue,
+                                  GumFunctionContext * ctx)
 {
-  if (ctx->destroyed)
-    return;
-
-  g_assert (!ctx->activated);
-  ctx->activated = TRUE;
-
-  _gum_interceptor_backend_activate_trampoline (self->backend, ctx,
-      prologue);
+  _gum_interceptor_backend_deactivate_trampoline (ctx->interceptor->backend,
+      ctx, prologue);
 }
 
 static void
-gum_interceptor_deactivate (GumInterceptor * self,
+gum_interceptor_reactivate (GumInterceptor * self,
                             GumFunctionContext * ctx,
                             gpointer prologue)
 {
-  GumInterceptorBackend * backend = self->backend;
+  if (ctx->destroyed || !ctx->activated)
+    return;
 
-  g_assert (ctx->activated);
-  ctx->activated = FALSE;
+  ctx->lightweight = gum_function_context_wants_lightweight (ctx);
 
-  _gum_interceptor_backend_deactivate_trampoline (backend, ctx, prologue);
+  _gum_interceptor_backend_activate_trampoline (self->backend, ctx,
+      prologue);
 }
 
 static void
@@ -822,12 +1725,25 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 {
   GumInterceptor * interceptor = self->interceptor;
   GumInterceptorTransaction transaction_copy;
-  GList * addresses, * cur;
+  GList * addresses;
+  GumPatchPlan plan;
 
   self->level--;
   if (self->level > 0)
     return;
 
+  if (!g_queue_is_empty (interceptor->pending_materializations))
+  {
+    /*
+     * Code generation may recurse into functions that are yet to be
+     * materialized, so we keep their transactions from committing the
+     * code allocator while we are still writing to it.
+     */
+    self->level++;
+    gum_interceptor_materialize_pending (interceptor);
+    self->level--;
+  }
+
   if (!self->is_dirty)
     return;
 
@@ -850,235 +1766,394 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
   addresses = g_hash_table_get_keys (self->pending_update_tasks);
   addresses = g_list_sort (addresses, gum_page_address_compare);
 
-  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
-  {
-    for (cur = addresses; cur != NULL; cur = cur->next)
-    {
-      gpointer target_page = cur->data;
-      GArray * pending;
-      guint i;
+  plan.transaction = self;
+  plan.ranges = gum_page_ranges_from_sorted_pages (addresses);
+  plan.rwx_supported = FALSE;
+  plan.scratch = NULL;
+  plan.thread_ids = NULL;
+  plan.next_thread_index = 0;
+  plan.copied = FALSE;
+
+  g_list_free (addresses);
 
-      pending = g_hash_table_lookup (self->pending_update_tasks, target_page);
-      g_assert (pending != NULL);
+  if (plan.ranges->len != 0)
+    gum_patch_plan_apply (&plan);
 
-      for (i = 0; i != pending->len; i++)
-      {
-        GumUpdateTask * update;
+  g_array_unref (plan.ranges);
 
-        update = &g_array_index (pending, GumUpdateTask, i);
+  {
+    GumDestroyTask * task;
+
+    while ((task = g_queue_pop_head (self->pending_destroy_tasks)) != NULL)
+    {
+      if (task->ctx->trampoline_usage_counter == 0)
+      {
+        GUM_INTERCEPTOR_UNLOCK (interceptor);
+        task->notify (task->data);
+        GUM_INTERCEPTOR_LOCK (interceptor);
 
-        update->func (interceptor, update->ctx,
-            _gum_interceptor_backend_get_function_address (update->ctx));
+        g_slice_free (GumDestroyTask, task);
+      }
+      else
+      {
+        interceptor->current_transaction.is_dirty = TRUE;
+        g_queue_push_tail (
+            interceptor->current_transaction.pending_destroy_tasks, task);
       }
     }
   }
-  else
-  {
-    guint page_size;
-    gboolean rwx_supported, code_segment_supported;
 
-    page_size = gum_query_page_size ();
+  gum_interceptor_transaction_destroy (self);
 
-    rwx_supported = gum_query_is_rwx_supported ();
-    code_segment_supported = gum_code_segment_is_supported ();
+no_changes:
+  gum_interceptor_unignore_current_thread (interceptor);
+}
 
-    if (rwx_supported || !code_segment_supported)
+static void
+gum_interceptor_transaction_schedule_destroy (GumInterceptorTransaction * self,
+                                              GumFunctionContext * ctx,
+                                              GDestroyNotify notify,
+                                              gpointer data)
+{
+  GumDestroyTask * task;
+
+  task = g_slice_new (GumDestroyTask);
+  task->ctx = ctx;
+  task->notify = notify;
+  task->data = data;
+
+  g_queue_push_tail (self->pending_destroy_tasks, task);
+}
+
+static void
+gum_interceptor_transaction_schedule_update (GumInterceptorTransaction * self,
+                                             GumFunctionContext * ctx,
+                                             GumUpdateTaskFunc func)
+{
+  guint8 * function_address;
+  gpointer start_page, end_page;
+  GArray * pending;
+  GumUpdateTask update;
+
+  function_address = _gum_interceptor_backend_get_function_address (ctx);
+
+  start_page = gum_page_address_from_pointer (function_address);
+  end_page = gum_page_address_from_pointer (function_address +
+      ctx->overwritten_prologue_len - 1);
+
+  pending = g_hash_table_lookup (self->pending_update_tasks, start_page);
+  if (pending == NULL)
+  {
+    pending = g_array_new (FALSE, FALSE, sizeof (GumUpdateTask));
+    g_hash_table_insert (self->pending_update_tasks, start_page, pending);
+  }
+
+  update.ctx = ctx;
+  update.func = func;
+  g_array_append_val (pending, update);
+
+  if (end_page != start_page)
+  {
+    pending = g_hash_table_lookup (self->pending_update_tasks, end_page);
+    if (pending == NULL)
     {
-      GumPageProtection protection;
+      pending = g_array_new (FALSE, FALSE, sizeof (GumUpdateTask));
+      g_hash_table_insert (self->pending_update_tasks, end_page, pending);
+    }
+  }
+}
 
-      protection = rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW;
+static void
+gum_interceptor_transaction_run_updates (GumInterceptorTransaction * self,
+                                         guint8 * target_page,
+                                         guint8 * source_page)
+{
+  GArray * pending;
+  guint i;
 
-      for (cur = addresses; cur != NULL; cur = cur->next)
-      {
-        gpointer target_page = cur->data;
+  pending = g_hash_table_lookup (self->pending_update_tasks, target_page);
+  g_assert (pending != NULL);
 
-        gum_mprotect (target_page, page_size, protection);
-      }
+  for (i = 0; i != pending->len; i++)
+  {
+    GumUpdateTask * update;
 
-      for (cur = addresses; cur != NULL; cur = cur->next)
-      {
-        gpointer target_page = cur->data;
-        GArray * pending;
-        guint i;
+    update = &g_array_index (pending, GumUpdateTask, i);
 
-        pending = g_hash_table_lookup (self->pending_update_tasks,
-            target_page);
-        g_assert (pending != NULL);
+    update->func (self->interceptor, update->ctx, source_page +
+        ((guint8 *) _gum_interceptor_backend_get_function_address (
+            update->ctx) - target_page));
+  }
+}
 
-        for (i = 0; i != pending->len; i++)
-        {
-          GumUpdateTask * update;
+static void
+gum_patch_plan_apply (GumPatchPlan * plan)
+{
+  GumInterceptorTransaction * transaction = plan->transaction;
+  GumInterceptor * interceptor = transaction->interceptor;
+  GArray * ranges = plan->ranges;
+  guint page_size, i;
+  guint8 * page;
 
-          update = &g_array_index (pending, GumUpdateTask, i);
+  page_size = gum_query_page_size ();
 
-          update->func (interceptor, update->ctx,
-              _gum_interceptor_backend_get_function_address (update->ctx));
-        }
-      }
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+  {
+    for (i = 0; i != ranges->len; i++)
+    {
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+      guint8 * end = GSIZE_TO_POINTER (r->base_address + r->size);
 
-      if (!rwx_supported)
+      for (page = GSIZE_TO_POINTER (r->base_address); page != end;
+          page += page_size)
       {
-        for (cur = addresses; cur != NULL; cur = cur->next)
-        {
-          gpointer target_page = cur->data;
-
-          gum_mprotect (target_page, page_size, GUM_PAGE_RX);
-        }
+        gum_interceptor_transaction_run_updates (transaction, page, page);
       }
+    }
+  }
+  else
+  {
+    gboolean rwx_supported, code_segment_supported;
 
-      for (cur = addresses; cur != NULL; cur = cur->next)
-      {
-        gpointer target_page = cur->data;
+    rwx_supported = gum_query_is_rwx_supported ();
+    code_segment_supported = gum_code_segment_is_supported ();
 
-        gum_clear_cache (target_page, page_size);
-      }
+    if (rwx_supported || !code_segment_supported)
+    {
+      plan->rwx_supported = rwx_supported;
+
+      if (interceptor->stop_the_world)
+        gum_patch_plan_apply_with_world_stopped (plan);
+      else
+        gum_patch_plan_apply_in_place (plan);
     }
     else
     {
-      guint num_pages;
+      gsize total_size;
       GumCodeSegment * segment;
-      guint8 * source_page, * current_page;
-      gsize source_offset;
-
-      num_pages = g_hash_table_size (self->pending_update_tasks);
-      segment = gum_code_segment_new (num_pages * page_size, NULL);
-
-      source_page = gum_code_segment_get_address (segment);
-
-      current_page = source_page;
-      for (cur = addresses; cur != NULL; cur = cur->next)
-      {
-        guint8 * target_page = cur->data;
+      guint8 * scratch;
+      gsize offset;
 
-        memcpy (current_page, target_page, page_size);
+      total_size = 0;
+      for (i = 0; i != ranges->len; i++)
+        total_size += g_array_index (ranges, GumMemoryRange, i).size;
 
-        current_page += page_size;
-      }
+      segment = gum_code_segment_new (total_size, NULL);
+      scratch = gum_code_segment_get_address (segment);
 
-      for (cur = addresses; cur != NULL; cur = cur->next)
+      offset = 0;
+      for (i = 0; i != ranges->len; i++)
       {
-        guint8 * target_page = cur->data;
-        GArray * pending;
-        guint i;
+        GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+        guint8 * start = GSIZE_TO_POINTER (r->base_address);
 
-        pending = g_hash_table_lookup (self->pending_update_tasks,
-            target_page);
-        g_assert (pending != NULL);
+        memcpy (scratch + offset, start, r->size);
 
-        for (i = 0; i != pending->len; i++)
+        for (page = start; page != start + r->size; page += page_size)
         {
-          GumUpdateTask * update;
-
-          update = &g_array_index (pending, GumUpdateTask, i);
-
-          update->func (interceptor, update->ctx, source_page +
-              ((guint8 *) _gum_interceptor_backend_get_function_address (
-                  update->ctx) - target_page));
+          gum_interceptor_transaction_run_updates (transaction, page,
+              scratch + offset + (page - start));
         }
 
-        source_page += page_size;
+        offset += r->size;
       }
 
       gum_code_segment_realize (segment);
 
-      source_offset = 0;
-      for (cur = addresses; cur != NULL; cur = cur->next)
+      offset = 0;
+      for (i = 0; i != ranges->len; i++)
       {
-        gpointer target_page = cur->data;
+        GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
 
-        gum_code_segment_map (segment, source_offset, page_size, target_page);
+        gum_code_segment_map (segment, offset, r->size,
+            GSIZE_TO_POINTER (r->base_address));
 
-        gum_clear_cache (target_page, page_size);
+        gum_clear_cache (GSIZE_TO_POINTER (r->base_address), r->size);
 
-        source_offset += page_size;
+        offset += r->size;
       }
 
       gum_code_segment_free (segment);
     }
   }
+}
 
-  g_list_free (addresses);
+/*
+ * With RWX pages nothing ever becomes non-executable, so each range is
+ * patched in one go. Otherwise each page is only made writable while it is
+ * being patched, together with the next page of the range in case a prologue
+ * spills into it.
+ */
+static void
+gum_patch_plan_apply_in_place (GumPatchPlan * plan)
+{
+  GumInterceptorTransaction * transaction = plan->transaction;
+  GArray * ranges = plan->ranges;
+  guint page_size, i;
+  guint8 * page;
 
-  {
-    GumDestroyTask * task;
+  page_size = gum_query_page_size ();
 
-    while ((task = g_queue_pop_head (self->pending_destroy_tasks)) != NULL)
+  if (plan->rwx_supported)
+  {
+    for (i = 0; i != ranges->len; i++)
     {
-      if (task->ctx->trampoline_usage_counter == 0)
-      {
-        GUM_INTERCEPTOR_UNLOCK (interceptor);
-        task->notify (task->data);
-        GUM_INTERCEPTOR_LOCK (interceptor);
+      GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+      guint8 * end = GSIZE_TO_POINTER (r->base_address + r->size);
 
-        g_slice_free (GumDestroyTask, task);
-      }
-      else
+      gum_mprotect (GSIZE_TO_POINTER (r->base_address), r->size,
+          GUM_PAGE_RWX);
+
+      for (page = GSIZE_TO_POINTER (r->base_address); page != end;
+          page += page_size)
       {
-        interceptor->current_transaction.is_dirty = TRUE;
-        g_queue_push_tail (
-            interceptor->current_transaction.pending_destroy_tasks, task);
+        gum_interceptor_transaction_run_updates (transaction, page, page);
       }
+
+      gum_clear_cache (GSIZE_TO_POINTER (r->base_address), r->size);
+    }
+
+    return;
+  }
+
+  for (i = 0; i != ranges->len; i++)
+  {
+    GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+    guint8 * end = GSIZE_TO_POINTER (r->base_address + r->size);
+
+    for (page = GSIZE_TO_POINTER (r->base_address); page != end;
+        page += page_size)
+    {
+      gsize window_size;
+
+      window_size = (page + page_size != end) ? 2 * page_size : page_size;
+
+      gum_mprotect (page, window_size, GUM_PAGE_RW);
+      gum_interceptor_transaction_run_updates (transaction, page, page);
+      gum_mprotect (page, window_size, GUM_PAGE_RX);
+
+      gum_clear_cache (page, window_size);
+    }
+  }
+}
+
+static void
+gum_patch_plan_apply_with_world_stopped (GumPatchPlan * plan)
+{
+  GumInterceptorTransaction * transaction = plan->transaction;
+  GArray * ranges = plan->ranges;
+  gsize total_size, offset;
+  guint page_size, i;
+  guint8 * page;
+
+  page_size = gum_query_page_size ();
+
+  total_size = 0;
+  for (i = 0; i != ranges->len; i++)
+    total_size += g_array_index (ranges, GumMemoryRange, i).size;
+
+  plan->scratch = g_malloc (total_size);
+
+  offset = 0;
+  for (i = 0; i != ranges->len; i++)
+  {
+    GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+    guint8 * start = GSIZE_TO_POINTER (r->base_address);
+
+    memcpy (plan->scratch + offset, start, r->size);
+
+    for (page = start; page != start + r->size; page += page_size)
+    {
+      gum_interceptor_transaction_run_updates (transaction, page,
+          plan->scratch + offset + (page - start));
     }
+
+    offset += r->size;
   }
 
-  gum_interceptor_transaction_destroy (self);
+  plan->thread_ids = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+  plan->next_thread_index = 0;
+  plan->copied = FALSE;
+  gum_process_enumerate_threads (gum_patch_plan_collect_thread, plan);
 
-no_changes:
-  gum_interceptor_unignore_current_thread (interceptor);
+  /*
+   * Each thread is suspended by a nested gum_process_modify_thread() call,
+   * so that all of them are held at once while the innermost one copies the
+   * prepared pages into place, and resumed as the calls unwind. Nothing
+   * gets allocated while the last thread is held.
+   */
+  gum_patch_plan_suspend_remaining_threads (plan);
+
+  g_array_free (plan->thread_ids, TRUE);
+  plan->thread_ids = NULL;
+
+  g_free (plan->scratch);
+  plan->scratch = NULL;
 }
 
-static void
-gum_interceptor_transaction_schedule_destroy (GumInterceptorTransaction * self,
-                                              GumFunctionContext * ctx,
-                                              GDestroyNotify notify,
-                                              gpointer data)
+static gboolean
+gum_patch_plan_collect_thread (const GumThreadDetails * details,
+                               gpointer user_data)
 {
-  GumDestroyTask * task;
+  GumPatchPlan * plan = user_data;
 
-  task = g_slice_new (GumDestroyTask);
-  task->ctx = ctx;
-  task->notify = notify;
-  task->data = data;
+  if (details->id != gum_process_get_current_thread_id ())
+    g_array_append_val (plan->thread_ids, details->id);
 
-  g_queue_push_tail (self->pending_destroy_tasks, task);
+  return TRUE;
 }
 
 static void
-gum_interceptor_transaction_schedule_update (GumInterceptorTransaction * self,
-                                             GumFunctionContext * ctx,
-                                             GumUpdateTaskFunc func)
+gum_patch_plan_suspend_remaining_threads (GumPatchPlan * plan)
 {
-  guint8 * function_address;
-  gpointer start_page, end_page;
-  GArray * pending;
-  GumUpdateTask update;
-
-  function_address = _gum_interceptor_backend_get_function_address (ctx);
+  while (!plan->copied && plan->next_thread_index != plan->thread_ids->len)
+  {
+    GumThreadId thread_id;
 
-  start_page = gum_page_address_from_pointer (function_address);
-  end_page = gum_page_address_from_pointer (function_address +
-      ctx->overwritten_prologue_len - 1);
+    thread_id = g_array_index (plan->thread_ids, GumThreadId,
+        plan->next_thread_index++);
 
-  pending = g_hash_table_lookup (self->pending_update_tasks, start_page);
-  if (pending == NULL)
-  {
-    pending = g_array_new (FALSE, FALSE, sizeof (GumUpdateTask));
-    g_hash_table_insert (self->pending_update_tasks, start_page, pending);
+    gum_process_modify_thread (thread_id, gum_patch_plan_on_thread_suspended,
+        plan);
   }
 
-  update.ctx = ctx;
-  update.func = func;
-  g_array_append_val (pending, update);
+  if (!plan->copied)
+    gum_patch_plan_copy (plan);
+}
 
-  if (end_page != start_page)
+static void
+gum_patch_plan_on_thread_suspended (GumThreadId thread_id,
+                                    GumCpuContext * cpu_context,
+                                    gpointer user_data)
+{
+  gum_patch_plan_suspend_remaining_threads (user_data);
+}
+
+static void
+gum_patch_plan_copy (GumPatchPlan * plan)
+{
+  GArray * ranges = plan->ranges;
+  gsize offset;
+  guint i;
+
+  offset = 0;
+  for (i = 0; i != ranges->len; i++)
   {
-    pending = g_hash_table_lookup (self->pending_update_tasks, end_page);
-    if (pending == NULL)
-    {
-      pending = g_array_new (FALSE, FALSE, sizeof (GumUpdateTask));
-      g_hash_table_insert (self->pending_update_tasks, end_page, pending);
-    }
+    GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+    gpointer start = GSIZE_TO_POINTER (r->base_address);
+
+    gum_mprotect (start, r->size,
+        plan->rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW);
+    memcpy (start, plan->scratch + offset, r->size);
+    if (!plan->rwx_supported)
+      gum_mprotect (start, r->size, GUM_PAGE_RX);
+
+    gum_clear_cache (start, r->size);
+
+    offset += r->size;
   }
+
+  plan->copied = TRUE;
 }
 
 static GumFunctionContext *
@@ -1091,7 +2166,7 @@ gum_function_context_new (GumInterceptor * interceptor,
   ctx->function_address = function_address;
 
   ctx->listener_entries =
-      g_ptr_array_new_full (1, (GDestroyNotify) listener_entry_free);
+      g_ptr_array_new_full (1, (GDestroyNotify) listener_entry_unref);
 
   ctx->interceptor = interceptor;
 
@@ -1118,6 +2193,28 @@ gum_function_context_destroy (GumFunctionContext * function_ctx)
   g_assert (!function_ctx->destroyed);
   function_ctx->destroyed = TRUE;
 
+  if (function_ctx->materialization_pending)
+  {
+    g_queue_remove (function_ctx->interceptor->pending_materializations,
+        function_ctx);
+    function_ctx->materialization_pending = FALSE;
+  }
+
+  if (function_ctx->probe != NULL)
+  {
+    gum_interceptor_transaction_schedule_destroy (transaction, function_ctx,
+        (GDestroyNotify) gum_probe_free, function_ctx->probe);
+    function_ctx->probe = NULL;
+  }
+
+  if (function_ctx->statistics != NULL)
+  {
+    gum_interceptor_transaction_schedule_destroy (transaction, function_ctx,
+        (GDestroyNotify) gum_function_statistics_free,
+        function_ctx->statistics);
+    function_ctx->statistics = NULL;
+  }
+
   if (function_ctx->activated)
   {
     gum_interceptor_transaction_schedule_update (transaction, function_ctx,
@@ -1131,8 +2228,13 @@ gum_function_context_destroy (GumFunctionContext * function_ctx)
 static void
 gum_function_context_perform_destroy (GumFunctionContext * function_ctx)
 {
-  _gum_interceptor_backend_destroy_trampoline (
-      function_ctx->interceptor->backend, function_ctx);
+  function_ctx->replacement_function = NULL;
+
+  if (function_ctx->lazy_thunk == NULL)
+  {
+    _gum_interceptor_backend_destroy_trampoline (
+        function_ctx->interceptor->backend, function_ctx);
+  }
 
   gum_function_context_finalize (function_ctx);
 }
@@ -1143,13 +2245,21 @@ gum_function_context_is_empty (GumFunctionContext * function_ctx)
   if (function_ctx->replacement_function != NULL)
     return FALSE;
 
+  if (function_ctx->probe != NULL)
+    return FALSE;
+
+  if (function_ctx->statistics != NULL)
+    return FALSE;
+
   return gum_function_context_find_taken_listener_slot (function_ctx) == NULL;
 }
 
 static void
 gum_function_context_add_listener (GumFunctionContext * function_ctx,
                                    GumInvocationListener * listener,
-                                   gpointer function_data)
+                                   gpointer function_data,
+                                   GumListenerProfile profile,
+                                   gsize invocation_data_size)
 {
   ListenerEntry * entry;
   GPtrArray * old_entries, * new_entries;
@@ -1159,16 +2269,29 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
   entry->listener_interface = GUM_INVOCATION_LISTENER_GET_IFACE (listener);
   entry->listener_instance = listener;
   entry->function_data = function_data;
+  entry->profile = profile;
+  entry->invocation_data_size =
+      GUM_ALIGN_SIZE (invocation_data_size, GUM_INVOCATION_DATA_ALIGNMENT);
+  entry->ref_count = 1;
+  entry->detached = FALSE;
 
   old_entries =
       (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+
+  if (!function_ctx->published)
+  {
+    /* Never reachable from any thread yet, so no need to copy-on-write. */
+    g_ptr_array_add (old_entries, entry);
+    gum_function_context_update_has_on_leave_listener (function_ctx);
+    return;
+  }
   new_entries = g_ptr_array_new_full (old_entries->len + 1,
-      (GDestroyNotify) listener_entry_free);
+      (GDestroyNotify) listener_entry_unref);
   for (i = 0; i != old_entries->len; i++)
   {
     ListenerEntry * old_entry = g_ptr_array_index (old_entries, i);
     if (old_entry != NULL)
-      g_ptr_array_add (new_entries, g_slice_dup (ListenerEntry, old_entry));
+      g_ptr_array_add (new_entries, listener_entry_ref (old_entry));
   }
   g_ptr_array_add (new_entries, entry);
 
@@ -1177,16 +2300,22 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
       &function_ctx->interceptor->current_transaction, function_ctx,
       (GDestroyNotify) g_ptr_array_unref, old_entries);
 
-  if (entry->listener_interface->on_leave != NULL)
-  {
-    function_ctx->has_on_leave_listener = TRUE;
-  }
+  gum_function_context_update_has_on_leave_listener (function_ctx);
+}
+
+static ListenerEntry *
+listener_entry_ref (ListenerEntry * entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+
+  return entry;
 }
 
 static void
-listener_entry_free (ListenerEntry * entry)
+listener_entry_unref (ListenerEntry * entry)
 {
-  g_slice_free (ListenerEntry, entry);
+  if (g_atomic_int_dec_and_test (&entry->ref_count))
+    g_slice_free (ListenerEntry, entry);
 }
 
 static void
@@ -1194,28 +2323,38 @@ gum_function_context_remove_listener (GumFunctionContext * function_ctx,
                                       GumInvocationListener * listener)
 {
   ListenerEntry ** slot;
-  gboolean has_on_leave_listener;
-  GPtrArray * listener_entries;
+  GPtrArray * old_entries, * new_entries;
   guint i;
 
   slot = gum_function_context_find_listener (function_ctx, listener);
   g_assert (slot != NULL);
-  listener_entry_free (*slot);
-  *slot = NULL;
 
-  has_on_leave_listener = FALSE;
-  listener_entries =
+  /*
+   * In-flight invocations keep using the array they started out with, and
+   * rely on it not changing under them, so we never modify it in place.
+   * The entries are shared between arrays though, so flagging this one as
+   * detached keeps it from being called again, while the invocation data
+   * offsets of those invocations stay the same.
+   */
+  g_atomic_int_set (&(*slot)->detached, TRUE);
+
+  old_entries =
       (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
-  for (i = 0; i != listener_entries->len; i++)
+  new_entries = g_ptr_array_new_full (old_entries->len,
+      (GDestroyNotify) listener_entry_unref);
+  for (i = 0; i != old_entries->len; i++)
   {
-    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
-    if (entry != NULL && entry->listener_interface->on_leave != NULL)
-    {
-      has_on_leave_listener = TRUE;
-      break;
-    }
+    ListenerEntry * old_entry = g_ptr_array_index (old_entries, i);
+    if (old_entry != NULL && old_entry != *slot)
+      g_ptr_array_add (new_entries, listener_entry_ref (old_entry));
   }
-  function_ctx->has_on_leave_listener = has_on_leave_listener;
+
+  g_atomic_pointer_set (&function_ctx->listener_entries, new_entries);
+  gum_interceptor_transaction_schedule_destroy (
+      &function_ctx->interceptor->current_transaction, function_ctx,
+      (GDestroyNotify) g_ptr_array_unref, old_entries);
+
+  gum_function_context_update_has_on_leave_listener (function_ctx);
 }
 
 static gboolean
@@ -1265,6 +2404,279 @@ gum_function_context_find_taken_listener_slot (
   return NULL;
 }
 
+static void
+gum_function_context_update_has_on_leave_listener (
+    GumFunctionContext * function_ctx)
+{
+  gboolean has_on_leave_listener;
+  GPtrArray * listener_entries;
+  guint i;
+
+  has_on_leave_listener = FALSE;
+  listener_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  for (i = 0; i != listener_entries->len; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+    if (entry != NULL &&
+        entry->listener_interface->on_leave != NULL &&
+        (entry->profile & GUM_LISTENER_PROFILE_ENTER_ONLY) == 0)
+    {
+      has_on_leave_listener = TRUE;
+      break;
+    }
+  }
+  function_ctx->has_on_leave_listener = has_on_leave_listener;
+}
+
+static gboolean
+gum_function_context_wants_lightweight (GumFunctionContext * function_ctx)
+{
+  GPtrArray * listener_entries;
+  guint i;
+
+  if (function_ctx->on_lightweight_enter_trampoline == NULL)
+    return FALSE;
+
+  if (function_ctx->replacement_function != NULL)
+    return FALSE;
+
+  if (function_ctx->statistics != NULL)
+    return FALSE;
+
+  listener_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  for (i = 0; i != listener_entries->len; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+    if (entry != NULL &&
+        (entry->profile & GUM_LISTENER_PROFILE_LIGHTWEIGHT) !=
+            GUM_LISTENER_PROFILE_LIGHTWEIGHT)
+    {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+gum_function_context_sync_flavor (GumFunctionContext * function_ctx)
+{
+  gboolean needs_update;
+  GumProbe * probe;
+
+  if (function_ctx->destroyed)
+    return;
+
+  needs_update = gum_function_context_wants_lightweight (function_ctx) !=
+      function_ctx->lightweight;
+
+  /*
+   * The probe's code jumps straight to wherever the listeners are served, so
+   * it has to be regenerated now, before the code allocator gets committed.
+   */
+  probe = function_ctx->probe;
+  if (probe != NULL && probe->code != NULL &&
+      probe->exit != gum_function_context_get_probe_exit (function_ctx))
+  {
+    gum_function_context_compile_probe (function_ctx, probe);
+    needs_update = TRUE;
+  }
+
+  /*
+   * A context that is yet to be activated picks its flavor upon activation,
+   * so we only need to repatch the ones that are already live.
+   */
+  if (!needs_update || !function_ctx->activated)
+    return;
+
+  gum_interceptor_transaction_schedule_update (
+      &function_ctx->interceptor->current_transaction, function_ctx,
+      gum_interceptor_reactivate);
+}
+
+static GumFunctionStatistics *
+gum_function_statistics_new (void)
+{
+  GumFunctionStatistics * statistics;
+
+  statistics = g_slice_new (GumFunctionStatistics);
+  statistics->id =
+      (guint) g_atomic_int_add (&gum_interceptor_next_statistics_id, 1);
+  statistics->threads = NULL;
+
+  return statistics;
+}
+
+static void
+gum_function_statistics_free (GumFunctionStatistics * self)
+{
+  GumThreadStatistics * thread, * next;
+
+  for (thread = self->threads; thread != NULL; thread = next)
+  {
+    next = thread->next;
+
+    g_slice_free (GumThreadStatistics, thread);
+  }
+
+  g_slice_free (GumFunctionStatistics, self);
+}
+
+static void
+gum_function_statistics_add (GumFunctionStatistics * self,
+                             InterceptorThreadContext * context,
+                             guint64 ticks)
+{
+  GumThreadStatistics * thread;
+
+  thread = gum_function_statistics_get_thread_statistics (self, context);
+
+  thread->calls++;
+  thread->total_ticks += ticks;
+  if (ticks < thread->min_ticks)
+    thread->min_ticks = ticks;
+  if (ticks > thread->max_ticks)
+    thread->max_ticks = ticks;
+}
+
+/*
+ * Threads look up their counters by the statistics' id, which is never
+ * reused, so entries left behind by disabled statistics can never match
+ * again. Once too many have piled up the cache is simply dropped, at worst
+ * giving a thread a second set of counters, which still sum up correctly.
+ */
+static GumThreadStatistics *
+gum_function_statistics_get_thread_statistics (
+    GumFunctionStatistics * self,
+    InterceptorThreadContext * context)
+{
+  GumThreadStatistics * thread, * head;
+
+  if (context->last_statistics_id == self->id)
+    return context->last_thread_statistics;
+
+  if (context->thread_statistics == NULL)
+    context->thread_statistics = g_hash_table_new (NULL, NULL);
+
+  thread = g_hash_table_lookup (context->thread_statistics,
+      GUINT_TO_POINTER (self->id));
+  if (thread == NULL)
+  {
+    thread = g_slice_new0 (GumThreadStatistics);
+    thread->min_ticks = G_MAXUINT64;
+
+    do
+    {
+      head = g_atomic_pointer_get (&self->threads);
+      thread->next = head;
+    }
+    while (!g_atomic_pointer_compare_and_exchange (&self->threads, head,
+        thread));
+
+    if (g_hash_table_size (context->thread_statistics) >=
+        GUM_MAX_CACHED_THREAD_STATISTICS)
+    {
+      g_hash_table_remove_all (context->thread_statistics);
+    }
+    g_hash_table_insert (context->thread_statistics,
+        GUINT_TO_POINTER (self->id), thread);
+  }
+
+  context->last_statistics_id = self->id;
+  context->last_thread_statistics = thread;
+
+  return thread;
+}
+
+/*
+ * The counters are read while their threads may be updating them, so a sum
+ * taken during a call may be off by that call, which is fine for statistics.
+ */
+static void
+gum_function_statistics_sum (GumFunctionStatistics * self,
+                             GumInvocationStatistics * result)
+{
+  GumThreadStatistics * thread;
+
+  result->calls = 0;
+  result->total_ticks = 0;
+  result->min_ticks = G_MAXUINT64;
+  result->max_ticks = 0;
+
+  for (thread = g_atomic_pointer_get (&self->threads);
+      thread != NULL;
+      thread = thread->next)
+  {
+    result->calls += thread->calls;
+    result->total_ticks += thread->total_ticks;
+    result->min_ticks = MIN (result->min_ticks, thread->min_ticks);
+    result->max_ticks = MAX (result->max_ticks, thread->max_ticks);
+  }
+
+  if (result->calls == 0)
+    result->min_ticks = 0;
+}
+
+static guint64
+gum_interceptor_read_ticks (void)
+{
+#if defined (HAVE_I386) && defined (_MSC_VER)
+  return __rdtsc ();
+#elif defined (HAVE_I386)
+  return __builtin_ia32_rdtsc ();
+#elif defined (HAVE_ARM64) && !defined (_MSC_VER)
+  guint64 ticks;
+
+  asm volatile ("mrs %0, cntvct_el0" : "=r" (ticks));
+
+  return ticks;
+#else
+  return g_get_monotonic_time ();
+#endif
+}
+
+static gpointer
+gum_function_context_get_probe_exit (GumFunctionContext * function_ctx)
+{
+  if (function_ctx->replacement_function == NULL &&
+      function_ctx->statistics == NULL &&
+      gum_function_context_find_taken_listener_slot (function_ctx) == NULL)
+  {
+    return function_ctx->on_invoke_trampoline;
+  }
+
+  return gum_function_context_wants_lightweight (function_ctx)
+      ? function_ctx->on_lightweight_enter_trampoline
+      : function_ctx->on_enter_trampoline;
+}
+
+static void
+gum_function_context_compile_probe (GumFunctionContext * function_ctx,
+                                    GumProbe * probe)
+{
+  GumInterceptor * interceptor = function_ctx->interceptor;
+  GumCodeSlice * old_slice;
+
+  old_slice = probe->slice;
+
+  if (!_gum_interceptor_backend_create_probe (interceptor->backend,
+      function_ctx, probe, gum_function_context_get_probe_exit (function_ctx)))
+  {
+    probe->slice = NULL;
+    probe->code = NULL;
+    probe->exit = NULL;
+  }
+
+  if (old_slice != NULL)
+  {
+    gum_interceptor_transaction_schedule_destroy (
+        &interceptor->current_transaction, function_ctx,
+        (GDestroyNotify) gum_code_slice_free, old_slice);
+  }
+}
+
 void
 _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
                                         GumCpuContext * cpu_context,
@@ -1279,23 +2691,28 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   gint system_error;
   gboolean invoke_listeners = TRUE;
   gboolean will_trap_on_leave;
+  GumProbe * probe;
 
   g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
 
   interceptor = function_ctx->interceptor;
 
+  probe = function_ctx->probe;
+  if (probe != NULL && probe->code == NULL)
+    gum_probe_fire (probe, cpu_context);
+
 #ifdef HAVE_WINDOWS
   system_error = gum_thread_get_system_error ();
 #endif
 
-  if (gum_tls_key_get_value (gum_interceptor_guard_key) == interceptor)
+  interceptor_ctx = get_interceptor_thread_context ();
+  if (interceptor_ctx == NULL || interceptor_ctx->guard == interceptor)
   {
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
-  gum_tls_key_set_value (gum_interceptor_guard_key, interceptor);
+  interceptor_ctx->guard = interceptor;
 
-  interceptor_ctx = get_interceptor_thread_context ();
   stack = interceptor_ctx->stack;
 
   stack_entry = gum_invocation_stack_peek_top (stack);
@@ -1305,7 +2722,7 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
           stack_entry->invocation_context.function)) ==
           function_ctx->function_address)
   {
-    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+    interceptor_ctx->guard = NULL;
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
@@ -1326,7 +2743,8 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   }
 
   will_trap_on_leave = function_ctx->replacement_function != NULL ||
-      (invoke_listeners && function_ctx->has_on_leave_listener);
+      (invoke_listeners && (function_ctx->has_on_leave_listener ||
+          function_ctx->statistics != NULL));
   if (will_trap_on_leave)
   {
     stack_entry = gum_invocation_stack_push (stack, function_ctx,
@@ -1341,8 +2759,15 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   }
 
   if (invocation_ctx != NULL)
+  {
     invocation_ctx->system_error = system_error;
 
+    stack_entry->listener_entries =
+        (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+    stack_entry->invocation_data_offset =
+        interceptor_thread_context_reserve_invocation_data (interceptor_ctx);
+  }
+
   gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
   if (invoke_listeners)
@@ -1353,8 +2778,7 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
     invocation_ctx->cpu_context = cpu_context;
     invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
-    listener_entries =
-        (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+    listener_entries = stack_entry->listener_entries;
     for (i = 0; i != listener_entries->len; i++)
     {
       ListenerEntry * listener_entry;
@@ -1367,9 +2791,12 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
       state.point_cut = GUM_POINT_ENTER;
       state.entry = listener_entry;
       state.interceptor_ctx = interceptor_ctx;
-      state.invocation_data = stack_entry->listener_invocation_data[i];
+      state.invocation_data_offset = stack_entry->invocation_data_offset;
       invocation_ctx->backend->data = &state;
 
+      if (g_atomic_int_get (&listener_entry->detached))
+        continue;
+
       if (listener_entry->listener_interface->on_enter != NULL)
       {
         listener_entry->listener_interface->on_enter (
@@ -1382,24 +2809,38 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 
   if (!will_trap_on_leave && invoke_listeners)
   {
+    interceptor_thread_context_release_invocation_data (interceptor_ctx,
+        stack_entry->invocation_data_offset);
     gum_invocation_stack_pop (interceptor_ctx->stack);
   }
 
   gum_thread_set_system_error (system_error);
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  interceptor_ctx->guard = NULL;
 
   if (will_trap_on_leave)
   {
     *caller_ret_addr = function_ctx->on_leave_trampoline;
+
+    if (invoke_listeners && function_ctx->statistics != NULL)
+    {
+      stack_entry->statistics = function_ctx->statistics;
+      stack_entry->start_ticks = gum_interceptor_read_ticks ();
+    }
   }
 
   if (function_ctx->replacement_function != NULL)
   {
+    GumCpuContext * replacement_cpu_context;
+
+    replacement_cpu_context =
+        interceptor_thread_context_push_replacement_cpu_context (
+            interceptor_ctx);
+    *replacement_cpu_context = *cpu_context;
+
     stack_entry->calling_replacement = TRUE;
-    stack_entry->cpu_context = *cpu_context;
     stack_entry->original_system_error = system_error;
-    invocation_ctx->cpu_context = &stack_entry->cpu_context;
+    invocation_ctx->cpu_context = replacement_cpu_context;
     invocation_ctx->backend = &interceptor_ctx->replacement_backend;
     invocation_ctx->backend->data = function_ctx->replacement_data;
 
@@ -1421,6 +2862,116 @@ bypass:
   g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
 }
 
+/*
+ * Entered through the backend's lightweight thunk, which only gets used when
+ * every listener is enter-only and there is no replacement. There is thus no
+ * leave trap to arm, and the stack entry only lives for as long as the
+ * listeners run, so that gum_interceptor_get_current_invocation() works the
+ * same as for full listeners.
+ */
+void
+_gum_function_context_begin_lightweight_invocation (
+    GumFunctionContext * function_ctx,
+    GumCpuContext * cpu_context,
+    gpointer * next_hop)
+{
+  GumInterceptor * interceptor;
+  InterceptorThreadContext * interceptor_ctx;
+  GumInvocationStackEntry * stack_entry;
+  GumInvocationContext * invocation_ctx;
+  GPtrArray * listener_entries;
+  GumProbe * probe;
+  gint system_error;
+  guint i;
+
+  g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
+
+  *next_hop = function_ctx->on_invoke_trampoline;
+
+  interceptor = function_ctx->interceptor;
+
+  probe = function_ctx->probe;
+  if (probe != NULL && probe->code == NULL)
+    gum_probe_fire (probe, cpu_context);
+
+#ifdef HAVE_WINDOWS
+  system_error = gum_thread_get_system_error ();
+#endif
+
+  interceptor_ctx = get_interceptor_thread_context ();
+  if (interceptor_ctx == NULL || interceptor_ctx->guard == interceptor)
+    goto bypass;
+  interceptor_ctx->guard = interceptor;
+
+#ifndef HAVE_WINDOWS
+  system_error = gum_thread_get_system_error ();
+#endif
+
+  if (interceptor_ctx->ignore_level > 0 ||
+      (interceptor->selected_thread_id != 0 &&
+       gum_process_get_current_thread_id () != interceptor->selected_thread_id))
+  {
+    goto unguard;
+  }
+
+  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+
+  stack_entry = gum_invocation_stack_push (interceptor_ctx->stack,
+      function_ctx, function_ctx->function_address);
+
+  invocation_ctx = &stack_entry->invocation_context;
+  invocation_ctx->cpu_context = cpu_context;
+  invocation_ctx->system_error = system_error;
+  invocation_ctx->backend = &interceptor_ctx->listener_backend;
+
+  listener_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  stack_entry->listener_entries = listener_entries;
+  stack_entry->invocation_data_offset =
+      interceptor_thread_context_reserve_invocation_data (interceptor_ctx);
+  for (i = 0; i != listener_entries->len; i++)
+  {
+    ListenerEntry * listener_entry;
+    ListenerInvocationState state;
+
+    listener_entry = g_ptr_array_index (listener_entries, i);
+    if (listener_entry == NULL)
+      continue;
+
+    if (g_atomic_int_get (&listener_entry->detached) ||
+        listener_entry->listener_interface->on_enter == NULL)
+      continue;
+
+    /* Listeners attached while the flavor is being switched wait for it. */
+    if ((listener_entry->profile & GUM_LISTENER_PROFILE_LIGHTWEIGHT) !=
+        GUM_LISTENER_PROFILE_LIGHTWEIGHT)
+      continue;
+
+    state.point_cut = GUM_POINT_ENTER;
+    state.entry = listener_entry;
+    state.interceptor_ctx = interceptor_ctx;
+    state.invocation_data_offset = stack_entry->invocation_data_offset;
+    invocation_ctx->backend->data = &state;
+
+    listener_entry->listener_interface->on_enter (
+        listener_entry->listener_instance, invocation_ctx);
+  }
+
+  system_error = invocation_ctx->system_error;
+
+  interceptor_thread_context_release_invocation_data (interceptor_ctx,
+      stack_entry->invocation_data_offset);
+  gum_invocation_stack_pop (interceptor_ctx->stack);
+
+unguard:
+  gum_thread_set_system_error (system_error);
+
+  interceptor_ctx->guard = NULL;
+
+bypass:
+  g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
+}
+
 void
 _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
                                       GumCpuContext * cpu_context,
@@ -1437,17 +2988,23 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   system_error = gum_thread_get_system_error ();
 #endif
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, function_ctx->interceptor);
+  interceptor_ctx = get_interceptor_thread_context ();
+  interceptor_ctx->guard = function_ctx->interceptor;
 
 #ifndef HAVE_WINDOWS
   system_error = gum_thread_get_system_error ();
 #endif
 
-  interceptor_ctx = get_interceptor_thread_context ();
-
   stack_entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
   *next_hop = gum_sign_code_pointer (stack_entry->caller_ret_addr);
 
+  if (stack_entry->statistics != NULL)
+  {
+    gum_function_statistics_add (stack_entry->statistics,
+        interceptor_ctx,
+        gum_interceptor_read_ticks () - stack_entry->start_ticks);
+  }
+
   invocation_ctx = &stack_entry->invocation_context;
   invocation_ctx->cpu_context = cpu_context;
   if (stack_entry->calling_replacement &&
@@ -1463,8 +3020,7 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
-  listener_entries =
-      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  listener_entries = stack_entry->listener_entries;
   for (i = 0; i != listener_entries->len; i++)
   {
     ListenerEntry * listener_entry;
@@ -1477,10 +3033,14 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
     state.point_cut = GUM_POINT_LEAVE;
     state.entry = listener_entry;
     state.interceptor_ctx = interceptor_ctx;
-    state.invocation_data = stack_entry->listener_invocation_data[i];
+    state.invocation_data_offset = stack_entry->invocation_data_offset;
     invocation_ctx->backend->data = &state;
 
-    if (listener_entry->listener_interface->on_leave != NULL)
+    if (g_atomic_int_get (&listener_entry->detached))
+      continue;
+
+    if (listener_entry->listener_interface->on_leave != NULL &&
+        (listener_entry->profile & GUM_LISTENER_PROFILE_ENTER_ONLY) == 0)
     {
       listener_entry->listener_interface->on_leave (
           listener_entry->listener_instance, invocation_ctx);
@@ -1489,9 +3049,13 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   gum_thread_set_system_error (invocation_ctx->system_error);
 
+  if (stack_entry->calling_replacement)
+    interceptor_thread_context_pop_replacement_cpu_context (interceptor_ctx);
+  interceptor_thread_context_release_invocation_data (interceptor_ctx,
+      stack_entry->invocation_data_offset);
   gum_invocation_stack_pop (interceptor_ctx->stack);
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  interceptor_ctx->guard = NULL;
 
   g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
 }
@@ -1524,22 +3088,240 @@ gum_function_context_fixup_cpu_context (GumFunctionContext * function_ctx,
 #endif
 }
 
+guint64
+gum_probe_get_call_count (GumProbe * self)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  return GPOINTER_TO_SIZE (
+      g_atomic_pointer_get ((gpointer *) &self->call_count));
+#elif defined (_MSC_VER)
+  return _InterlockedCompareExchange64 (
+      (volatile __int64 *) &self->call_count, 0, 0);
+#elif defined (GUM_PROBE_CALL_COUNT_NEEDS_LOCK)
+  guint64 count;
+
+  gum_spinlock_acquire (&gum_probe_call_count_lock);
+  count = self->call_count;
+  gum_spinlock_release (&gum_probe_call_count_lock);
+
+  return count;
+#else
+  return __sync_val_compare_and_swap (&self->call_count, 0, 0);
+#endif
+}
+
+/*
+ * Records are claimed by writers through an atomic increment of the head, and
+ * each one is stamped with its sequence number plus one once its arguments
+ * have been stored. Only one thread may drain a given probe at a time.
+ */
+guint
+gum_probe_drain (GumProbe * self,
+                 GumProbeRecord * records,
+                 guint n_records,
+                 guint64 * n_dropped)
+{
+  guint n_arguments = self->program.n_arguments;
+  gsize head, tail, capacity;
+  guint n = 0;
+  guint64 dropped = 0;
+
+  if (n_arguments == 0)
+    goto beach;
+
+  head = GPOINTER_TO_SIZE (g_atomic_pointer_get ((gpointer *) &self->head));
+  tail = self->tail;
+  capacity = self->mask + 1;
+
+  if (head - tail > capacity)
+  {
+    dropped += head - tail - capacity;
+    tail = head - capacity;
+  }
+
+  while (tail != head && n != n_records)
+  {
+    guint8 * slot;
+    gpointer * stamp, * arguments;
+    gsize expected, actual;
+
+    slot = self->records + ((tail & self->mask) << self->record_shift);
+    stamp = (gpointer *) slot;
+    arguments = stamp + 1;
+    expected = tail + 1;
+
+    actual = GPOINTER_TO_SIZE (g_atomic_pointer_get (stamp));
+    if (actual == expected)
+    {
+      gum_memcpy (records[n].arguments, arguments,
+          n_arguments * sizeof (gpointer));
+
+      if (GPOINTER_TO_SIZE (g_atomic_pointer_get (stamp)) == expected)
+        n++;
+      else
+        dropped++;
+    }
+    else if ((gssize) (actual - expected) > 0)
+    {
+      dropped++;
+    }
+    else
+    {
+      break;
+    }
+
+    tail++;
+  }
+
+  self->tail = tail;
+
+beach:
+  if (n_dropped != NULL)
+    *n_dropped = dropped;
+
+  return n;
+}
+
+static GumProbe *
+gum_probe_new (GumFunctionContext * function_ctx,
+               const GumProbeProgram * program)
+{
+  GumProbe * probe;
+
+  probe = g_slice_new0 (GumProbe);
+  probe->function_ctx = function_ctx;
+  probe->program = *program;
+
+  if (program->n_arguments != 0)
+  {
+    guint requested, capacity;
+    gsize record_size;
+
+    requested = (program->capacity != 0)
+        ? MIN (program->capacity, GUM_PROBE_MAX_CAPACITY)
+        : GUM_PROBE_DEFAULT_CAPACITY;
+    for (capacity = 1; capacity < requested; capacity <<= 1)
+      ;
+    probe->mask = capacity - 1;
+
+    record_size = (1 + program->n_arguments) * sizeof (gpointer);
+    while (((gsize) 1 << probe->record_shift) < record_size)
+      probe->record_shift++;
+
+    probe->records = g_malloc0 ((gsize) capacity << probe->record_shift);
+  }
+
+  return probe;
+}
+
+static void
+gum_probe_free (GumProbe * probe)
+{
+  if (probe->slice != NULL)
+    gum_code_slice_free (probe->slice);
+
+  g_free (probe->records);
+
+  g_slice_free (GumProbe, probe);
+}
+
+/*
+ * Used when the backend could not generate code for the probe, and mirrors
+ * what that code would have done.
+ */
+static void
+gum_probe_fire (GumProbe * self,
+                GumCpuContext * cpu_context)
+{
+  const GumProbeProgram * program = &self->program;
+  gsize index;
+  gpointer * stamp;
+  guint i;
+
+  if (program->count_calls)
+    gum_probe_count_call (self);
+
+  if (program->n_arguments == 0)
+    return;
+
+  index = (gsize) g_atomic_pointer_add (&self->head, 1);
+
+  stamp = (gpointer *) (self->records +
+      ((index & self->mask) << self->record_shift));
+  for (i = 0; i != program->n_arguments; i++)
+  {
+    stamp[1 + i] = gum_cpu_context_get_nth_argument (cpu_context,
+        program->arguments[i]);
+  }
+
+  g_atomic_pointer_set (stamp, GSIZE_TO_POINTER (index + 1));
+}
+
+static void
+gum_probe_count_call (GumProbe * self)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  g_atomic_pointer_add ((volatile gsize *) &self->call_count, 1);
+#elif defined (_MSC_VER)
+  __int64 count;
+
+  do
+  {
+    count = self->call_count;
+  }
+  while (_InterlockedCompareExchange64 ((volatile __int64 *) &self->call_count,
+      count + 1, count) != count);
+#elif defined (GUM_PROBE_CALL_COUNT_NEEDS_LOCK)
+  /* Only reached on targets where probes never run generated code. */
+  gum_spinlock_acquire (&gum_probe_call_count_lock);
+  self->call_count++;
+  gum_spinlock_release (&gum_probe_call_count_lock);
+#else
+  __sync_fetch_and_add (&self->call_count, 1);
+#endif
+}
+
+/*
+ * The guard, the ignore level and the invocation stack are all reached
+ * through this one TLS slot, so the hot path only does a single lookup. The
+ * GPrivate is only there to get notified when the thread goes away.
+ *
+ * Returns NULL while the context is being created further up the stack,
+ * which callers in the invocation path treat as being guarded.
+ */
 static InterceptorThreadContext *
 get_interceptor_thread_context (void)
 {
   InterceptorThreadContext * context;
 
-  context = g_private_get (&gum_interceptor_context_private);
-  if (context == NULL)
-  {
-    context = interceptor_thread_context_new ();
+  context = gum_tls_key_get_value (gum_interceptor_context_key);
+  if (G_LIKELY (GPOINTER_TO_SIZE (context) >
+      GUM_INTERCEPTOR_THREAD_CONTEXT_BEING_CREATED))
+    return context;
 
-    gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
-    g_hash_table_add (gum_interceptor_thread_contexts, context);
-    gum_spinlock_release (&gum_interceptor_thread_context_lock);
+  if (context != NULL)
+    return NULL;
 
-    g_private_set (&gum_interceptor_context_private, context);
-  }
+  return create_interceptor_thread_context ();
+}
+
+static InterceptorThreadContext *
+create_interceptor_thread_context (void)
+{
+  InterceptorThreadContext * context;
+
+  gum_tls_key_set_value (gum_interceptor_context_key,
+      GSIZE_TO_POINTER (GUM_INTERCEPTOR_THREAD_CONTEXT_BEING_CREATED));
+
+  context = interceptor_thread_context_new ();
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  g_hash_table_add (gum_interceptor_thread_contexts, context);
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  g_private_set (&gum_interceptor_context_private, context);
+
+  gum_tls_key_set_value (gum_interceptor_context_key, context);
 
   return context;
 }
@@ -1547,6 +3329,8 @@ get_interceptor_thread_context (void)
 static void
 release_interceptor_thread_context (InterceptorThreadContext * context)
 {
+  gum_tls_key_set_value (gum_interceptor_context_key, NULL);
+
   if (gum_interceptor_thread_contexts == NULL)
     return;
 
@@ -1613,10 +3397,11 @@ gum_interceptor_invocation_get_listener_invocation_data (
 
   data = (ListenerInvocationState *) context->backend->data;
 
-  if (required_size > GUM_MAX_LISTENER_DATA)
+  if (required_size > data->entry->invocation_data_size)
     return NULL;
 
-  return data->invocation_data;
+  return interceptor_thread_context_get_invocation_data (data->interceptor_ctx,
+      data->invocation_data_offset, data->entry, required_size);
 }
 
 static gpointer
@@ -1682,6 +3467,9 @@ interceptor_thread_context_new (void)
   context->stack = g_array_sized_new (FALSE, TRUE,
       sizeof (GumInvocationStackEntry), GUM_MAX_CALL_DEPTH);
 
+  context->replacement_cpu_contexts =
+      g_ptr_array_new_with_free_func (g_free);
+
   context->listener_data_slots = g_array_sized_new (FALSE, TRUE,
       sizeof (ListenerDataSlot), GUM_MAX_LISTENERS_PER_FUNCTION);
 
@@ -1691,8 +3479,14 @@ interceptor_thread_context_new (void)
 static void
 interceptor_thread_context_destroy (InterceptorThreadContext * context)
 {
+  g_clear_pointer (&context->thread_statistics, g_hash_table_unref);
+
   g_array_free (context->listener_data_slots, TRUE);
 
+  g_ptr_array_free (context->replacement_cpu_contexts, TRUE);
+
+  g_free (context->invocation_data);
+
   g_array_free (context->stack, TRUE);
 
   g_slice_free (InterceptorThreadContext, context);
@@ -1757,6 +3551,141 @@ interceptor_thread_context_forget_listener_data (
   }
 }
 
+/*
+ * Invocation data lives in a per-thread arena that grows and shrinks along
+ * with the invocation stack. Frames are referred to by offset, as the arena
+ * may move when it grows.
+ *
+ * A frame starts out empty, and each listener gets a chunk of exactly the
+ * size it asks for the first time it asks. Listener callbacks only ever run
+ * while their frame is the topmost one, so the chunks of a frame are always
+ * the ones between its offset and the end of the arena.
+ */
+static gsize
+interceptor_thread_context_reserve_invocation_data (
+    InterceptorThreadContext * self)
+{
+  return self->invocation_data_used;
+}
+
+static gpointer
+interceptor_thread_context_get_invocation_data (
+    InterceptorThreadContext * self,
+    gsize frame_offset,
+    ListenerEntry * entry,
+    gsize required_size)
+{
+  const gsize header_size = GUM_INVOCATION_DATA_CHUNK_HEADER_SIZE;
+  InvocationDataChunk * chunk;
+  gsize offset, size;
+  gsize previous_offset = 0;
+  gsize previous_size = 0;
+
+  size = GUM_ALIGN_SIZE (MAX (required_size, 1),
+      GUM_INVOCATION_DATA_ALIGNMENT);
+
+  for (offset = frame_offset;
+      offset != self->invocation_data_used;
+      offset += header_size + chunk->size)
+  {
+    chunk = (InvocationDataChunk *) (self->invocation_data + offset);
+    if (chunk->owner != entry)
+      continue;
+
+    if (required_size <= chunk->size)
+      return (guint8 *) chunk + header_size;
+
+    if (offset + header_size + chunk->size == self->invocation_data_used)
+    {
+      gsize old_size = chunk->size;
+
+      interceptor_thread_context_ensure_invocation_data_capacity (self,
+          offset + header_size + size);
+      chunk = (InvocationDataChunk *) (self->invocation_data + offset);
+
+      gum_memset ((guint8 *) chunk + header_size + old_size, 0,
+          size - old_size);
+      chunk->size = size;
+      self->invocation_data_used = offset + header_size + size;
+
+      return (guint8 *) chunk + header_size;
+    }
+
+    chunk->owner = NULL;
+    previous_offset = offset;
+    previous_size = chunk->size;
+    break;
+  }
+
+  offset = self->invocation_data_used;
+  interceptor_thread_context_ensure_invocation_data_capacity (self,
+      offset + header_size + size);
+
+  chunk = (InvocationDataChunk *) (self->invocation_data + offset);
+  chunk->owner = entry;
+  chunk->size = size;
+  gum_memset ((guint8 *) chunk + header_size, 0, size);
+  if (previous_size != 0)
+  {
+    gum_memcpy ((guint8 *) chunk + header_size,
+        self->invocation_data + previous_offset + header_size, previous_size);
+  }
+  self->invocation_data_used = offset + header_size + size;
+
+  return (guint8 *) chunk + header_size;
+}
+
+static void
+interceptor_thread_context_ensure_invocation_data_capacity (
+    InterceptorThreadContext * self,
+    gsize required_capacity)
+{
+  gsize capacity;
+
+  if (required_capacity <= self->invocation_data_capacity)
+    return;
+
+  capacity = MAX (self->invocation_data_capacity,
+      GUM_INVOCATION_DATA_MIN_ARENA_SIZE);
+  while (capacity < required_capacity)
+    capacity *= 2;
+
+  self->invocation_data = g_realloc (self->invocation_data, capacity);
+  self->invocation_data_capacity = capacity;
+}
+
+static void
+interceptor_thread_context_release_invocation_data (
+    InterceptorThreadContext * self,
+    gsize offset)
+{
+  self->invocation_data_used = offset;
+}
+
+/*
+ * Replacement functions may look at the CPU context long after the trampoline
+ * has discarded its own copy, so it is kept in a per-thread pool whose blocks
+ * never move. Replacement calls nest in stack order.
+ */
+static GumCpuContext *
+interceptor_thread_context_push_replacement_cpu_context (
+    InterceptorThreadContext * self)
+{
+  GPtrArray * contexts = self->replacement_cpu_contexts;
+
+  if (self->replacement_depth == contexts->len)
+    g_ptr_array_add (contexts, g_new (GumCpuContext, 1));
+
+  return g_ptr_array_index (contexts, self->replacement_depth++);
+}
+
+static void
+interceptor_thread_context_pop_replacement_cpu_context (
+    InterceptorThreadContext * self)
+{
+  self->replacement_depth--;
+}
+
 static GumInvocationStackEntry *
 gum_invocation_stack_push (GumInvocationStack * stack,
                            GumFunctionContext * function_ctx,
@@ -1850,3 +3779,38 @@ gum_page_address_compare (gconstpointer a,
 {
   return GPOINTER_TO_SIZE (a) - GPOINTER_TO_SIZE (b);
 }
+
+static GArray *
+gum_page_ranges_from_sorted_pages (GList * pages)
+{
+  GArray * ranges;
+  guint page_size;
+  GList * cur;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  page_size = gum_query_page_size ();
+
+  for (cur = pages; cur != NULL; cur = cur->next)
+  {
+    GumAddress page = GUM_ADDRESS (cur->data);
+    GumMemoryRange * last = NULL;
+
+    if (ranges->len != 0)
+      last = &g_array_index (ranges, GumMemoryRange, ranges->len - 1);
+
+    if (last != NULL && last->base_address + last->size == page)
+    {
+      last->size += page_size;
+    }
+    else
+    {
+      GumMemoryRange r;
+
+      r.base_address = page;
+      r.size = page_size;
+      g_array_append_val (ranges, r);
+    }
+  }
+
+  return ranges;
+}
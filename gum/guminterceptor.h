@@ -18,39 +18,107 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (GumInterceptor, gum_interceptor, GUM, INTERCEPTOR,
     GObject)
 
+#define GUM_PROBE_MAX_ARGUMENTS 4
+
 typedef GArray GumInvocationStack;
 typedef guint GumInvocationState;
+typedef struct _GumProbe GumProbe;
+typedef struct _GumProbeProgram GumProbeProgram;
+typedef struct _GumProbeRecord GumProbeRecord;
+typedef struct _GumInvocationStatistics GumInvocationStatistics;
 
 typedef enum
 {
   GUM_ATTACH_OK               =  0,
   GUM_ATTACH_WRONG_SIGNATURE  = -1,
   GUM_ATTACH_ALREADY_ATTACHED = -2,
-  GUM_ATTACH_POLICY_VIOLATION = -3
+  GUM_ATTACH_POLICY_VIOLATION = -3,
+  GUM_ATTACH_WRONG_TYPE       = -4
 } GumAttachReturn;
 
+typedef enum
+{
+  GUM_LISTENER_PROFILE_FULL              = 0,
+  GUM_LISTENER_PROFILE_ENTER_ONLY        = (1 << 0),
+  GUM_LISTENER_PROFILE_INTEGER_ARGS_ONLY = (1 << 1),
+  GUM_LISTENER_PROFILE_LIGHTWEIGHT       = (1 << 0) | (1 << 1)
+} GumListenerProfile;
+
 typedef enum
 {
   GUM_REPLACE_OK               =  0,
   GUM_REPLACE_WRONG_SIGNATURE  = -1,
   GUM_REPLACE_ALREADY_REPLACED = -2,
-  GUM_REPLACE_POLICY_VIOLATION = -3
+  GUM_REPLACE_POLICY_VIOLATION = -3,
+  GUM_REPLACE_WRONG_TYPE       = -4
 } GumReplaceReturn;
 
+struct _GumProbeProgram
+{
+  gboolean count_calls;
+
+  guint n_arguments;
+  guint arguments[GUM_PROBE_MAX_ARGUMENTS];
+
+  guint capacity;
+};
+
+struct _GumProbeRecord
+{
+  gpointer arguments[GUM_PROBE_MAX_ARGUMENTS];
+};
+
+struct _GumInvocationStatistics
+{
+  guint64 calls;
+  guint64 total_ticks;
+  guint64 min_ticks;
+  guint64 max_ticks;
+};
+
 GUM_API GumInterceptor * gum_interceptor_obtain (void);
 
 GUM_API GumAttachReturn gum_interceptor_attach (GumInterceptor * self,
     gpointer function_address, GumInvocationListener * listener,
     gpointer listener_function_data);
+GUM_API GumAttachReturn gum_interceptor_attach_with_profile (
+    GumInterceptor * self, gpointer function_address,
+    GumInvocationListener * listener, gpointer listener_function_data,
+    GumListenerProfile profile);
+GUM_API GumAttachReturn gum_interceptor_attach_full (GumInterceptor * self,
+    gpointer function_address, GumInvocationListener * listener,
+    gpointer listener_function_data, GumListenerProfile profile,
+    gsize invocation_data_size);
 GUM_API void gum_interceptor_detach (GumInterceptor * self,
     GumInvocationListener * listener);
 
 GUM_API GumReplaceReturn gum_interceptor_replace (GumInterceptor * self,
     gpointer function_address, gpointer replacement_function,
     gpointer replacement_data);
+GUM_API GumReplaceReturn gum_interceptor_replace_fast (GumInterceptor * self,
+    gpointer function_address, gpointer replacement_function,
+    gpointer * original_function);
 GUM_API void gum_interceptor_revert (GumInterceptor * self,
     gpointer function_address);
 
+GUM_API GumAttachReturn gum_interceptor_attach_probe (GumInterceptor * self,
+    gpointer function_address, const GumProbeProgram * program,
+    GumProbe ** probe);
+GUM_API void gum_interceptor_detach_probe (GumInterceptor * self,
+    GumProbe * probe);
+
+GUM_API GumAttachReturn gum_interceptor_enable_statistics (
+    GumInterceptor * self, gpointer function_address);
+GUM_API void gum_interceptor_disable_statistics (GumInterceptor * self,
+    gpointer function_address);
+GUM_API gboolean gum_interceptor_get_statistics (GumInterceptor * self,
+    gpointer function_address, GumInvocationStatistics * statistics);
+
+GUM_API void gum_interceptor_set_lazy_trampolines (GumInterceptor * self,
+    gboolean enabled);
+GUM_API void gum_interceptor_set_stop_the_world (GumInterceptor * self,
+    gboolean enabled);
+
 GUM_API void gum_interceptor_begin_transaction (GumInterceptor * self);
 GUM_API void gum_interceptor_end_transaction (GumInterceptor * self);
 GUM_API gboolean gum_interceptor_flush (GumInterceptor * self);
@@ -67,6 +135,10 @@ GUM_API void gum_interceptor_unignore_other_threads (GumInterceptor * self);
 GUM_API gpointer gum_invocation_stack_translate (GumInvocationStack * self,
     gpointer return_address);
 
+GUM_API guint64 gum_probe_get_call_count (GumProbe * self);
+GUM_API guint gum_probe_drain (GumProbe * self, GumProbeRecord * records,
+    guint n_records, guint64 * n_dropped);
+
 GUM_API void gum_interceptor_save (GumInvocationState * state);
 GUM_API void gum_interceptor_restore (GumInvocationState * state);
 
@@ -15,6 +15,22 @@
 # include <ptrauth.h>
 #endif
 #include <string.h>
+#if defined (__SSE2__) || defined (_M_X64) || \
+    (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# define GUM_SCAN_USE_SSE2 1
+# include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+# define GUM_SCAN_USE_AVX2 1
+# include <immintrin.h>
+#endif
+#if defined (__aarch64__) && defined (__ARM_NEON) && defined (__GNUC__)
+# define GUM_SCAN_USE_NEON 1
+# include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
 
 #if defined (HAVE_IOS) && !defined (HAVE_I386)
 # include "backend-darwin/gumdarwin.h"
@@ -48,6 +64,88 @@
 # pragma warning (pop)
 #endif
 
+#define GUM_SCAN_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct _GumScanNeedle GumScanNeedle;
+typedef struct _GumScanCursor GumScanCursor;
+typedef struct _GumParallelScan GumParallelScan;
+typedef struct _GumScanChunk GumScanChunk;
+typedef struct _GumScanResync GumScanResync;
+
+struct _GumScanNeedle
+{
+  const guint8 * data;
+  const guint8 * mask;
+  guint len;
+
+  guint8 first_value;
+  guint8 first_mask;
+  guint8 last_value;
+  guint8 last_mask;
+};
+
+struct _GumScanCursor
+{
+  const GumMatchPattern * pattern;
+  GumScanNeedle needle;
+  guint needle_offset;
+
+  guint8 * cur;
+  guint8 * end;
+  guint8 * match;
+};
+
+struct _GumParallelScan
+{
+  const GumMatchPattern * pattern;
+
+  GumScanChunk * chunks;
+  guint n_chunks;
+  volatile gint next_chunk;
+  volatile gint cancelled;
+
+  GMutex mutex;
+  GCond cond;
+};
+
+struct _GumScanChunk
+{
+  GumParallelScan * scan;
+  guint range_index;
+  GumMemoryRange range;
+  GumAddress limit;
+
+  GArray * matches;
+  gboolean finished;
+};
+
+struct _GumScanResync
+{
+  GumScanChunk * chunk;
+  GArray * matches;
+  guint next_index;
+  guint sync_index;
+};
+
+static void gum_scan_needle_init (GumScanNeedle * self,
+    const GumMatchToken * token);
+static guint8 * gum_scan_needle_find (const GumScanNeedle * self, guint8 * cur,
+    guint8 * end);
+static gboolean gum_scan_needle_matches_at (const GumScanNeedle * self,
+    const guint8 * bytes);
+static void gum_scan_cursor_init (GumScanCursor * self,
+    const GumMemoryRange * range, const GumMatchPattern * pattern);
+static gboolean gum_scan_cursor_next (GumScanCursor * self);
+static gpointer gum_parallel_scan_process_chunks (GumParallelScan * self);
+static void gum_scan_chunk_process (GumScanChunk * self);
+static gboolean gum_scan_chunk_add_match (GumAddress address, gsize size,
+    GumScanChunk * self);
+static void gum_scan_chunk_resume_from (GumScanChunk * self,
+    GumAddress address);
+static gboolean gum_scan_resync_add_match (GumAddress address, gsize size,
+    GumScanResync * self);
+static guint gum_count_trailing_zeros (guint32 value);
+
 static GumMatchPattern * gum_match_pattern_new (void);
 static void gum_match_pattern_update_computed_size (GumMatchPattern * self);
 static GumMatchToken * gum_match_pattern_get_longest_token (
@@ -346,56 +444,576 @@ gum_memory_scan (const GumMemoryRange * range,
                  GumMemoryScanMatchFunc func,
                  gpointer user_data)
 {
+  GumScanCursor cursor;
+
+  gum_scan_cursor_init (&cursor, range, pattern);
+
+  while (gum_scan_cursor_next (&cursor))
+  {
+    if (!func (GUM_ADDRESS (cursor.match), pattern->size, user_data))
+      return;
+  }
+}
+
+/*
+ * Scans the range for all of the given patterns, reporting their matches in
+ * address order, with matches at the same address in pattern order. Each
+ * pattern is searched for with the same vectorized needle search as
+ * gum_memory_scan(), and yields exactly the matches that gum_memory_scan()
+ * would, so they may overlap in the same way.
+ */
+void
+gum_memory_scan_multi (const GumMemoryRange * range,
+                       const GumMatchPattern * const * patterns,
+                       guint n_patterns,
+                       GumMemoryScanMultiMatchFunc func,
+                       gpointer user_data)
+{
+  GumScanCursor * cursors;
+  guint i;
+
+  if (n_patterns == 0)
+    return;
+
+  cursors = g_new (GumScanCursor, n_patterns);
+  for (i = 0; i != n_patterns; i++)
+  {
+    gum_scan_cursor_init (&cursors[i], range, patterns[i]);
+    gum_scan_cursor_next (&cursors[i]);
+  }
+
+  while (TRUE)
+  {
+    GumScanCursor * next = NULL;
+    guint next_index = 0;
+
+    for (i = 0; i != n_patterns; i++)
+    {
+      GumScanCursor * cursor = &cursors[i];
+
+      if (cursor->match != NULL &&
+          (next == NULL || cursor->match < next->match))
+      {
+        next = cursor;
+        next_index = i;
+      }
+    }
+
+    if (next == NULL)
+      break;
+
+    if (!func (next_index, GUM_ADDRESS (next->match), next->pattern->size,
+        user_data))
+    {
+      break;
+    }
+
+    gum_scan_cursor_next (next);
+  }
+
+  g_free (cursors);
+}
+
+/*
+ * Scans the ranges using a pool of n_threads worker threads, or one per CPU
+ * if n_threads is 0. Each range is split into chunks that overlap by the
+ * pattern's size minus one, so that matches straddling a chunk boundary are
+ * still found, and matches are delivered on the calling thread in the order
+ * of the ranges, each range in address order. Where the previous chunk's last
+ * match extends into a chunk, the start of that chunk is rescanned on the
+ * calling thread until it lines up with the chunk's own matches again, so the
+ * matches are the same as those of gum_memory_scan() on each range.
+ *
+ * Unlike gum_memory_scan(), the ranges are scanned on other threads, so they
+ * must remain readable for the duration of the call.
+ */
+void
+gum_memory_scan_ranges (const GumMemoryRange * ranges,
+                        guint n_ranges,
+                        const GumMatchPattern * pattern,
+                        guint n_threads,
+                        GumMemoryScanMatchFunc func,
+                        gpointer user_data)
+{
+  GumParallelScan scan;
+  GArray * chunks;
+  GThread ** workers;
   GumMatchToken * needle;
-  guint8 * needle_data, * mask_data = NULL;
-  guint needle_len;
-  guint8 * cur, * end_address;
+  guint range_index, chunk_index, i;
+  guint current_range_index;
+  GumAddress resume_at;
 
   needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
   if (needle == NULL)
-  {
     needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
-    mask_data = (guint8 *) needle->masks->data;
+
+  chunks = g_array_new (FALSE, FALSE, sizeof (GumScanChunk));
+
+  for (range_index = 0; range_index != n_ranges; range_index++)
+  {
+    const GumMemoryRange * range = &ranges[range_index];
+    gsize offset;
+
+    if (range->size < pattern->size)
+      continue;
+
+    for (offset = 0; offset < range->size; offset += GUM_SCAN_CHUNK_SIZE)
+    {
+      GumScanChunk chunk;
+      gsize remaining;
+      gboolean is_last;
+
+      remaining = range->size - offset;
+      is_last = remaining <= GUM_SCAN_CHUNK_SIZE + pattern->size - 1;
+
+      chunk.scan = &scan;
+      chunk.range_index = range_index;
+      chunk.range.base_address = range->base_address + offset;
+      chunk.range.size = is_last
+          ? remaining
+          : GUM_SCAN_CHUNK_SIZE + pattern->size - 1;
+      chunk.limit = chunk.range.base_address +
+          (is_last ? remaining : GUM_SCAN_CHUNK_SIZE);
+      chunk.matches = NULL;
+      chunk.finished = FALSE;
+
+      g_array_append_val (chunks, chunk);
+
+      if (is_last)
+        break;
+    }
   }
 
-  needle_data = (guint8 *) needle->bytes->data;
-  needle_len = needle->bytes->len;
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  if (n_threads > chunks->len)
+    n_threads = chunks->len;
+  if (n_threads == 1)
+    n_threads = 0;
+
+  scan.pattern = pattern;
+  scan.chunks = (GumScanChunk *) chunks->data;
+  scan.n_chunks = chunks->len;
+  scan.next_chunk = 0;
+  scan.cancelled = FALSE;
+  g_mutex_init (&scan.mutex);
+  g_cond_init (&scan.cond);
+
+  workers = g_new (GThread *, n_threads);
+  for (i = 0; i != n_threads; i++)
+  {
+    workers[i] = g_thread_new ("gum-memory-scan",
+        (GThreadFunc) gum_parallel_scan_process_chunks, &scan);
+  }
 
-  cur = GSIZE_TO_POINTER (range->base_address);
-  end_address = cur + range->size - (pattern->size - needle->offset) + 1;
+  current_range_index = G_MAXUINT;
+  resume_at = 0;
 
-  for (; cur < end_address; cur++)
+  for (chunk_index = 0;
+      chunk_index != scan.n_chunks && !g_atomic_int_get (&scan.cancelled);
+      chunk_index++)
   {
-    guint8 * start;
+    GumScanChunk * chunk = &scan.chunks[chunk_index];
 
-    if (mask_data == NULL)
+    if (n_threads != 0)
     {
-      if (cur[0] != needle_data[0] ||
-          memcmp (cur, needle_data, needle_len) != 0)
+      g_mutex_lock (&scan.mutex);
+      while (!chunk->finished)
+        g_cond_wait (&scan.cond, &scan.mutex);
+      g_mutex_unlock (&scan.mutex);
+    }
+    else
+    {
+      gum_scan_chunk_process (chunk);
+    }
+
+    if (chunk->range_index != current_range_index)
+    {
+      current_range_index = chunk->range_index;
+      resume_at = 0;
+    }
+
+    if (chunk->matches == NULL)
+      continue;
+
+    /*
+     * The previous chunk's last match may extend into this one, in which case
+     * the sequential scan would have resumed past the chunk's start, and may
+     * find matches that this chunk's scan skipped over.
+     */
+    if (resume_at > chunk->range.base_address)
+      gum_scan_chunk_resume_from (chunk, resume_at);
+
+    for (i = 0; i != chunk->matches->len; i++)
+    {
+      GumAddress address = g_array_index (chunk->matches, GumAddress, i);
+
+      if (!func (address, pattern->size, user_data))
       {
-        continue;
+        g_atomic_int_set (&scan.cancelled, TRUE);
+        break;
       }
+
+      resume_at = address + pattern->size - needle->offset;
     }
-    else
+  }
+
+  for (i = 0; i != n_threads; i++)
+    g_thread_join (workers[i]);
+  g_free (workers);
+
+  for (chunk_index = 0; chunk_index != scan.n_chunks; chunk_index++)
+  {
+    GumScanChunk * chunk = &scan.chunks[chunk_index];
+
+    if (chunk->matches != NULL)
+      g_array_free (chunk->matches, TRUE);
+  }
+
+  g_cond_clear (&scan.cond);
+  g_mutex_clear (&scan.mutex);
+
+  g_array_free (chunks, TRUE);
+}
+
+static gpointer
+gum_parallel_scan_process_chunks (GumParallelScan * self)
+{
+  while (!g_atomic_int_get (&self->cancelled))
+  {
+    guint chunk_index;
+    GumScanChunk * chunk;
+
+    chunk_index = (guint) g_atomic_int_add (&self->next_chunk, 1);
+    if (chunk_index >= self->n_chunks)
+      break;
+
+    chunk = &self->chunks[chunk_index];
+
+    gum_scan_chunk_process (chunk);
+
+    g_mutex_lock (&self->mutex);
+    chunk->finished = TRUE;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->mutex);
+  }
+
+  return NULL;
+}
+
+static void
+gum_scan_chunk_process (GumScanChunk * self)
+{
+  gum_memory_scan (&self->range, self->scan->pattern,
+      (GumMemoryScanMatchFunc) gum_scan_chunk_add_match, self);
+}
+
+static gboolean
+gum_scan_chunk_add_match (GumAddress address,
+                          gsize size,
+                          GumScanChunk * self)
+{
+  if (address >= self->limit)
+    return FALSE;
+
+  if (self->matches == NULL)
+    self->matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  g_array_append_val (self->matches, address);
+
+  return !g_atomic_int_get (&self->scan->cancelled);
+}
+
+static void
+gum_scan_chunk_resume_from (GumScanChunk * self,
+                            GumAddress address)
+{
+  GumScanResync resync;
+  GumMemoryRange range;
+  GArray * old_matches = self->matches;
+
+  resync.chunk = self;
+  resync.matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  resync.next_index = 0;
+  resync.sync_index = G_MAXUINT;
+
+  range.base_address = address;
+  range.size = self->range.base_address + self->range.size - address;
+
+  if (address < self->limit && range.size >= self->scan->pattern->size)
+  {
+    gum_memory_scan (&range, self->scan->pattern,
+        (GumMemoryScanMatchFunc) gum_scan_resync_add_match, &resync);
+  }
+
+  /*
+   * Once both scans agree on a match they proceed identically, so the rest of
+   * the chunk's own matches are still valid.
+   */
+  if (resync.sync_index != G_MAXUINT)
+  {
+    g_array_append_vals (resync.matches,
+        &g_array_index (old_matches, GumAddress, resync.sync_index + 1),
+        old_matches->len - resync.sync_index - 1);
+  }
+
+  self->matches = resync.matches;
+  g_array_free (old_matches, TRUE);
+}
+
+static gboolean
+gum_scan_resync_add_match (GumAddress address,
+                           gsize size,
+                           GumScanResync * self)
+{
+  GArray * chunk_matches = self->chunk->matches;
+
+  if (address >= self->chunk->limit)
+    return FALSE;
+
+  g_array_append_val (self->matches, address);
+
+  while (self->next_index != chunk_matches->len &&
+      g_array_index (chunk_matches, GumAddress, self->next_index) < address)
+  {
+    self->next_index++;
+  }
+
+  if (self->next_index != chunk_matches->len &&
+      g_array_index (chunk_matches, GumAddress, self->next_index) == address)
+  {
+    self->sync_index = self->next_index;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gum_scan_needle_init (GumScanNeedle * self,
+                      const GumMatchToken * token)
+{
+  guint last = token->bytes->len - 1;
+
+  self->data = (const guint8 *) token->bytes->data;
+  self->mask = (token->masks != NULL)
+      ? (const guint8 *) token->masks->data
+      : NULL;
+  self->len = token->bytes->len;
+
+  self->first_mask = (self->mask != NULL) ? self->mask[0] : 0xff;
+  self->first_value = self->data[0] & self->first_mask;
+  self->last_mask = (self->mask != NULL) ? self->mask[last] : 0xff;
+  self->last_value = self->data[last] & self->last_mask;
+}
+
+/*
+ * Finds the first position in [cur, end) where the needle matches. The
+ * vectorized paths compare the needle's first and last byte against a whole
+ * vector of positions at once, and only verify the full needle where both
+ * line up. The caller guarantees that needle->len - 1 bytes past `end` are
+ * readable.
+ */
+static guint8 *
+gum_scan_needle_find (const GumScanNeedle * self,
+                      guint8 * cur,
+                      guint8 * end)
+{
+  const guint last = self->len - 1;
+
+#ifdef GUM_SCAN_USE_AVX2
+  {
+    const __m256i first_value = _mm256_set1_epi8 ((char) self->first_value);
+    const __m256i first_mask = _mm256_set1_epi8 ((char) self->first_mask);
+    const __m256i last_value = _mm256_set1_epi8 ((char) self->last_value);
+    const __m256i last_mask = _mm256_set1_epi8 ((char) self->last_mask);
+
+    for (; end - cur >= 32; cur += 32)
     {
-      if ((cur[0] & mask_data[0]) != (needle_data[0] & mask_data[0]) ||
-          gum_memcmp_mask ((guint8 *) cur, (guint8 *) needle_data,
-              (guint8 *) mask_data, needle_len) != 0)
+      __m256i head, tail;
+      guint32 hits;
+
+      head = _mm256_loadu_si256 ((const __m256i *) cur);
+      tail = _mm256_loadu_si256 ((const __m256i *) (cur + last));
+
+      hits = (guint32) _mm256_movemask_epi8 (_mm256_and_si256 (
+          _mm256_cmpeq_epi8 (_mm256_and_si256 (head, first_mask),
+              first_value),
+          _mm256_cmpeq_epi8 (_mm256_and_si256 (tail, last_mask),
+              last_value)));
+
+      while (hits != 0)
       {
-        continue;
+        guint8 * candidate = cur + gum_count_trailing_zeros (hits);
+
+        if (gum_scan_needle_matches_at (self, candidate))
+          return candidate;
+
+        hits &= hits - 1;
       }
     }
+  }
+#endif
 
-    start = cur - needle->offset;
+#ifdef GUM_SCAN_USE_SSE2
+  {
+    const __m128i first_value = _mm_set1_epi8 ((char) self->first_value);
+    const __m128i first_mask = _mm_set1_epi8 ((char) self->first_mask);
+    const __m128i last_value = _mm_set1_epi8 ((char) self->last_value);
+    const __m128i last_mask = _mm_set1_epi8 ((char) self->last_mask);
 
-    if (gum_match_pattern_try_match_on (pattern, start))
+    for (; end - cur >= 16; cur += 16)
     {
-      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
-        return;
+      __m128i head, tail;
+      guint32 hits;
+
+      head = _mm_loadu_si128 ((const __m128i *) cur);
+      tail = _mm_loadu_si128 ((const __m128i *) (cur + last));
 
-      cur = start + pattern->size - 1;
+      hits = (guint32) _mm_movemask_epi8 (_mm_and_si128 (
+          _mm_cmpeq_epi8 (_mm_and_si128 (head, first_mask), first_value),
+          _mm_cmpeq_epi8 (_mm_and_si128 (tail, last_mask), last_value)));
+
+      while (hits != 0)
+      {
+        guint8 * candidate = cur + gum_count_trailing_zeros (hits);
+
+        if (gum_scan_needle_matches_at (self, candidate))
+          return candidate;
+
+        hits &= hits - 1;
+      }
     }
   }
+#endif
+
+#ifdef GUM_SCAN_USE_NEON
+  {
+    const uint8x16_t first_value = vdupq_n_u8 (self->first_value);
+    const uint8x16_t first_mask = vdupq_n_u8 (self->first_mask);
+    const uint8x16_t last_value = vdupq_n_u8 (self->last_value);
+    const uint8x16_t last_mask = vdupq_n_u8 (self->last_mask);
+
+    for (; end - cur >= 16; cur += 16)
+    {
+      uint8x16_t head, tail, eq;
+      guint64 hits;
+
+      head = vld1q_u8 (cur);
+      tail = vld1q_u8 (cur + last);
+
+      eq = vandq_u8 (
+          vceqq_u8 (vandq_u8 (head, first_mask), first_value),
+          vceqq_u8 (vandq_u8 (tail, last_mask), last_value));
+
+      /* Narrow to four bits per lane, as there is no movemask on NEON. */
+      hits = vget_lane_u64 (vreinterpret_u64_u8 (
+          vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+
+      while (hits != 0)
+      {
+        guint bit = __builtin_ctzll (hits);
+        guint8 * candidate = cur + (bit >> 2);
+
+        if (gum_scan_needle_matches_at (self, candidate))
+          return candidate;
+
+        hits &= ~(G_GUINT64_CONSTANT (0xf) << (bit & ~3U));
+      }
+    }
+  }
+#endif
+
+  for (; cur < end; cur++)
+  {
+    if ((cur[0] & self->first_mask) == self->first_value &&
+        gum_scan_needle_matches_at (self, cur))
+    {
+      return cur;
+    }
+  }
+
+  return NULL;
+}
+
+static gboolean
+gum_scan_needle_matches_at (const GumScanNeedle * self,
+                            const guint8 * bytes)
+{
+  if (self->mask == NULL)
+    return memcmp (bytes, self->data, self->len) == 0;
+  else
+    return gum_memcmp_mask (bytes, self->data, self->mask, self->len) == 0;
+}
+
+static void
+gum_scan_cursor_init (GumScanCursor * self,
+                      const GumMemoryRange * range,
+                      const GumMatchPattern * pattern)
+{
+  GumMatchToken * needle_token;
+
+  needle_token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
+  if (needle_token == NULL)
+  {
+    needle_token =
+        gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
+  }
+
+  self->pattern = pattern;
+  gum_scan_needle_init (&self->needle, needle_token);
+  self->needle_offset = needle_token->offset;
+
+  self->cur = (guint8 *) GSIZE_TO_POINTER (range->base_address) +
+      needle_token->offset;
+  self->end = self->cur + range->size - pattern->size + 1;
+  self->match = NULL;
+}
+
+/*
+ * Advances to the next match. The needle search resumes right past the end
+ * of the previous match, so consecutive matches may overlap by as much as
+ * the needle's offset into the pattern.
+ */
+static gboolean
+gum_scan_cursor_next (GumScanCursor * self)
+{
+  while (self->cur < self->end)
+  {
+    guint8 * candidate, * start;
+
+    candidate = gum_scan_needle_find (&self->needle, self->cur, self->end);
+    if (candidate == NULL)
+      break;
+
+    start = candidate - self->needle_offset;
+
+    if (gum_match_pattern_try_match_on (self->pattern, start))
+    {
+      self->cur = start + self->pattern->size;
+      self->match = start;
+      return TRUE;
+    }
+
+    self->cur = candidate + 1;
+  }
+
+  self->cur = self->end;
+  self->match = NULL;
+  return FALSE;
+}
+
+static guint
+gum_count_trailing_zeros (guint32 value)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+
+  _BitScanForward (&index, value);
+
+  return index;
+#else
+  return __builtin_ctz (value);
+#endif
 }
 
 GumMatchPattern *
@@ -77,6 +77,8 @@ struct _GumMemoryRange
 typedef void (* GumMemoryPatchApplyFunc) (gpointer mem, gpointer user_data);
 typedef gboolean (* GumMemoryScanMatchFunc) (GumAddress address, gsize size,
     gpointer user_data);
+typedef gboolean (* GumMemoryScanMultiMatchFunc) (guint pattern_index,
+    GumAddress address, gsize size, gpointer user_data);
 
 GUM_API void gum_internal_heap_ref (void);
 GUM_API void gum_internal_heap_unref (void);
@@ -101,6 +103,12 @@ GUM_API gboolean gum_memory_mark_code (gpointer address, gsize size);
 GUM_API void gum_memory_scan (const GumMemoryRange * range,
     const GumMatchPattern * pattern, GumMemoryScanMatchFunc func,
     gpointer user_data);
+GUM_API void gum_memory_scan_multi (const GumMemoryRange * range,
+    const GumMatchPattern * const * patterns, guint n_patterns,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data);
+GUM_API void gum_memory_scan_ranges (const GumMemoryRange * ranges,
+    guint n_ranges, const GumMatchPattern * pattern, guint n_threads,
+    GumMemoryScanMatchFunc func, gpointer user_data);
 
 GUM_API GumMatchPattern * gum_match_pattern_new_from_string (
     const gchar * match_combined_str);
@@ -824,3 +824,272 @@ gum_metal_hash_table_size (GumMetalHashTable *hash_table)
   return hash_table->nnodes;
 }
 
+/*
+ * GumMetalPointerTable: an open-addressing table keyed by pointer identity,
+ * tuned for the case where one thread does nearly all the lookups while
+ * other threads occasionally insert.
+ *
+ * Lookups take no locks. Writers must be serialized by the caller. A slot
+ * keeps its key for the lifetime of the bucket array it lives in, and its
+ * value is published before its key, so a reader racing with an insert sees
+ * either nothing or the complete entry. Removal clears the value in place.
+ *
+ * Growing copies the live entries into a new bucket array and publishes it
+ * with a single pointer store. Readers may still be walking the previous
+ * array, so it is retired rather than freed, and only reclaimed once the
+ * table itself is destroyed. The retired arrays add up to less than the
+ * current one, as each generation at least doubles.
+ */
+
+#define POINTER_TABLE_MIN_CAPACITY 16
+
+typedef struct _GumMetalPointerBuckets GumMetalPointerBuckets;
+typedef struct _GumMetalPointerEntry GumMetalPointerEntry;
+
+struct _GumMetalPointerEntry
+{
+  gpointer key;
+  gpointer value;
+};
+
+struct _GumMetalPointerBuckets
+{
+  GumMetalPointerBuckets *retired_next;
+  gsize                   mask;
+  GumMetalPointerEntry    entries[1];
+};
+
+struct _GumMetalPointerTable
+{
+  GumMetalPointerBuckets *buckets;
+  GumMetalPointerBuckets *retired;
+  guint                   nnodes;
+  guint                   noccupied;
+};
+
+typedef struct
+{
+  GumMetalPointerBuckets *buckets;
+  gsize                   position;
+} RealPointerIter;
+
+static inline gsize
+gum_metal_pointer_hash (gconstpointer key)
+{
+  guint64 h = GPOINTER_TO_SIZE (key);
+
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  h ^= h >> 33;
+
+  return (gsize) h;
+}
+
+static GumMetalPointerBuckets *
+gum_metal_pointer_buckets_new (gsize capacity)
+{
+  GumMetalPointerBuckets *buckets;
+
+  buckets = gum_internal_calloc (1, G_STRUCT_OFFSET (GumMetalPointerBuckets,
+      entries) + capacity * sizeof (GumMetalPointerEntry));
+  buckets->mask = capacity - 1;
+
+  return buckets;
+}
+
+GumMetalPointerTable *
+gum_metal_pointer_table_new (void)
+{
+  GumMetalPointerTable *table;
+
+  table = gum_metal_new0 (GumMetalPointerTable, 1);
+  table->buckets = gum_metal_pointer_buckets_new (POINTER_TABLE_MIN_CAPACITY);
+
+  return table;
+}
+
+void
+gum_metal_pointer_table_free (GumMetalPointerTable *table)
+{
+  GumMetalPointerBuckets *cur, *next;
+
+  if (table == NULL)
+    return;
+
+  for (cur = table->retired; cur != NULL; cur = next)
+    {
+      next = cur->retired_next;
+      gum_internal_free (cur);
+    }
+
+  gum_internal_free (table->buckets);
+  gum_internal_free (table);
+}
+
+gpointer
+gum_metal_pointer_table_lookup (GumMetalPointerTable *table,
+                                gconstpointer         key)
+{
+  GumMetalPointerBuckets *buckets;
+  gsize mask, i;
+
+  buckets = g_atomic_pointer_get (&table->buckets);
+  mask = buckets->mask;
+
+  for (i = gum_metal_pointer_hash (key) & mask; ; i = (i + 1) & mask)
+    {
+      GumMetalPointerEntry *entry = &buckets->entries[i];
+      gpointer entry_key;
+
+      entry_key = g_atomic_pointer_get (&entry->key);
+      if (entry_key == key)
+        return g_atomic_pointer_get (&entry->value);
+      if (entry_key == NULL)
+        return NULL;
+    }
+}
+
+static GumMetalPointerEntry *
+gum_metal_pointer_buckets_probe (GumMetalPointerBuckets *buckets,
+                                 gconstpointer           key)
+{
+  gsize mask = buckets->mask;
+  gsize i;
+
+  for (i = gum_metal_pointer_hash (key) & mask; ; i = (i + 1) & mask)
+    {
+      GumMetalPointerEntry *entry = &buckets->entries[i];
+
+      if (entry->key == key || entry->key == NULL)
+        return entry;
+    }
+}
+
+static void
+gum_metal_pointer_table_resize (GumMetalPointerTable *table)
+{
+  GumMetalPointerBuckets *old_buckets = table->buckets;
+  GumMetalPointerBuckets *new_buckets;
+  gsize capacity, i;
+
+  capacity = (old_buckets->mask + 1) * 2;
+  while ((table->nnodes + 1) * 2 > capacity)
+    capacity *= 2;
+
+  new_buckets = gum_metal_pointer_buckets_new (capacity);
+
+  for (i = 0; i <= old_buckets->mask; i++)
+    {
+      GumMetalPointerEntry *old_entry = &old_buckets->entries[i];
+      GumMetalPointerEntry *new_entry;
+
+      if (old_entry->value == NULL)
+        continue;
+
+      new_entry = gum_metal_pointer_buckets_probe (new_buckets,
+          old_entry->key);
+      new_entry->key = old_entry->key;
+      new_entry->value = old_entry->value;
+    }
+
+  g_atomic_pointer_set (&table->buckets, new_buckets);
+
+  old_buckets->retired_next = table->retired;
+  table->retired = old_buckets;
+
+  table->noccupied = table->nnodes;
+}
+
+gboolean
+gum_metal_pointer_table_insert (GumMetalPointerTable *table,
+                                gpointer              key,
+                                gpointer              value)
+{
+  GumMetalPointerEntry *entry;
+  gboolean is_new;
+
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  entry = gum_metal_pointer_buckets_probe (table->buckets, key);
+
+  if (entry->key == NULL &&
+      (table->noccupied + 1) * 4 > (table->buckets->mask + 1) * 3)
+    {
+      gum_metal_pointer_table_resize (table);
+      entry = gum_metal_pointer_buckets_probe (table->buckets, key);
+    }
+
+  is_new = entry->value == NULL;
+
+  g_atomic_pointer_set (&entry->value, value);
+
+  if (entry->key == NULL)
+    {
+      g_atomic_pointer_set (&entry->key, key);
+      table->noccupied++;
+    }
+
+  if (is_new)
+    table->nnodes++;
+
+  return is_new;
+}
+
+gboolean
+gum_metal_pointer_table_remove (GumMetalPointerTable *table,
+                                gconstpointer         key)
+{
+  GumMetalPointerEntry *entry;
+
+  entry = gum_metal_pointer_buckets_probe (table->buckets, key);
+  if (entry->key == NULL || entry->value == NULL)
+    return FALSE;
+
+  g_atomic_pointer_set (&entry->value, NULL);
+  table->nnodes--;
+
+  return TRUE;
+}
+
+guint
+gum_metal_pointer_table_size (GumMetalPointerTable *table)
+{
+  return table->nnodes;
+}
+
+void
+gum_metal_pointer_table_iter_init (GumMetalPointerTableIter *iter,
+                                   GumMetalPointerTable     *table)
+{
+  RealPointerIter *ri = (RealPointerIter *) iter;
+
+  ri->buckets = table->buckets;
+  ri->position = 0;
+}
+
+gboolean
+gum_metal_pointer_table_iter_next (GumMetalPointerTableIter *iter,
+                                   gpointer                 *key,
+                                   gpointer                 *value)
+{
+  RealPointerIter *ri = (RealPointerIter *) iter;
+  GumMetalPointerBuckets *buckets = ri->buckets;
+
+  while (ri->position <= buckets->mask)
+    {
+      GumMetalPointerEntry *entry = &buckets->entries[ri->position++];
+
+      if (entry->value == NULL)
+        continue;
+
+      if (key != NULL)
+        *key = entry->key;
+      if (value != NULL)
+        *value = entry->value;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
@@ -31,6 +31,8 @@ G_BEGIN_DECLS
 
 typedef struct _GumMetalHashTable GumMetalHashTable;
 typedef struct _GumMetalHashTableIter GumMetalHashTableIter;
+typedef struct _GumMetalPointerTable GumMetalPointerTable;
+typedef struct _GumMetalPointerTableIter GumMetalPointerTableIter;
 
 struct _GumMetalHashTableIter
 {
@@ -42,6 +44,12 @@ struct _GumMetalHashTableIter
   gpointer dummy6;
 };
 
+struct _GumMetalPointerTableIter
+{
+  gpointer dummy1;
+  gsize dummy2;
+};
+
 GUM_API GumMetalHashTable * gum_metal_hash_table_new (GHashFunc hash_func,
     GEqualFunc key_equal_func);
 GUM_API GumMetalHashTable * gum_metal_hash_table_new_full (GHashFunc hash_func,
@@ -92,6 +100,21 @@ GUM_API GumMetalHashTable * gum_metal_hash_table_ref (
     GumMetalHashTable * hash_table);
 GUM_API void gum_metal_hash_table_unref (GumMetalHashTable * hash_table);
 
+GUM_API GumMetalPointerTable * gum_metal_pointer_table_new (void);
+GUM_API void gum_metal_pointer_table_free (GumMetalPointerTable * table);
+GUM_API gpointer gum_metal_pointer_table_lookup (GumMetalPointerTable * table,
+    gconstpointer key);
+GUM_API gboolean gum_metal_pointer_table_insert (GumMetalPointerTable * table,
+    gpointer key, gpointer value);
+GUM_API gboolean gum_metal_pointer_table_remove (GumMetalPointerTable * table,
+    gconstpointer key);
+GUM_API guint gum_metal_pointer_table_size (GumMetalPointerTable * table);
+
+GUM_API void gum_metal_pointer_table_iter_init (
+    GumMetalPointerTableIter * iter, GumMetalPointerTable * table);
+GUM_API gboolean gum_metal_pointer_table_iter_next (
+    GumMetalPointerTableIter * iter, gpointer * key, gpointer * value);
+
 G_END_DECLS
 
 #endif
@@ -13,8 +13,17 @@
 #include <string.h>
 #include <gio/gio.h>
 
+#define GUM_TRIGRAM(s) \
+    (((guint32) (guint8) (s)[0] << 16) | \
+     ((guint32) (guint8) (s)[1] <<  8) | \
+     ((guint32) (guint8) (s)[2]))
+
 typedef struct _GumModuleMetadata GumModuleMetadata;
+typedef struct _GumFunctionIndex GumFunctionIndex;
+typedef struct _GumNameIndex GumNameIndex;
+typedef struct _GumNameIndexIter GumNameIndexIter;
 typedef struct _GumFunctionMetadata GumFunctionMetadata;
+typedef struct _GumFunctionPattern GumFunctionPattern;
 
 struct _GumModuleApiResolver
 {
@@ -32,18 +41,54 @@ struct _GumModuleMetadata
 
   const gchar * name;
   const gchar * path;
+  gchar * folded_name;
+  gchar * folded_path;
+
+  GumFunctionIndex * imports;
+  GumFunctionIndex * exports;
+};
 
-  GHashTable * import_by_name;
-  GHashTable * export_by_name;
+struct _GumFunctionIndex
+{
+  GHashTable * function_by_name;
+
+  GumNameIndex * names;
+  GumNameIndex * folded_names;
+};
+
+struct _GumNameIndex
+{
+  gboolean folded;
+  GPtrArray * functions;
+  GHashTable * postings_by_trigram;
+};
+
+struct _GumNameIndexIter
+{
+  GumNameIndex * index;
+  const GumFunctionPattern * pattern;
+  GArray * postings;
+  guint position;
+  guint end;
 };
 
 struct _GumFunctionMetadata
 {
   gchar * name;
+  gchar * folded_name;
   GumAddress address;
   gchar * module;
 };
 
+struct _GumFunctionPattern
+{
+  GPatternSpec * spec;
+  gchar * prefix;
+  gsize prefix_length;
+  gchar * infix;
+  gsize infix_length;
+};
+
 static void gum_module_api_resolver_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_module_api_resolver_finalize (GObject * object);
@@ -52,16 +97,46 @@ static void gum_module_api_resolver_enumerate_matches (
     gpointer user_data, GError ** error);
 
 static void gum_module_metadata_unref (GumModuleMetadata * module);
-static GHashTable * gum_module_metadata_get_imports (GumModuleMetadata * self);
-static GHashTable * gum_module_metadata_get_exports (GumModuleMetadata * self);
+static GumFunctionIndex * gum_module_metadata_get_imports (
+    GumModuleMetadata * self);
+static GumFunctionIndex * gum_module_metadata_get_exports (
+    GumModuleMetadata * self);
 static gboolean gum_module_metadata_collect_import (
     const GumImportDetails * details, gpointer user_data);
 static gboolean gum_module_metadata_collect_export (
     const GumExportDetails * details, gpointer user_data);
 
+static GumFunctionIndex * gum_function_index_new (void);
+static void gum_function_index_free (GumFunctionIndex * index);
+static GumNameIndex * gum_function_index_get_names (GumFunctionIndex * self,
+    gboolean folded);
+
+static GumNameIndex * gum_name_index_new (GHashTable * function_by_name,
+    gboolean folded);
+static void gum_name_index_free (GumNameIndex * index);
+static GArray * gum_name_index_find_rarest_postings (GumNameIndex * self,
+    const gchar * infix, gsize infix_length);
+static void gum_name_index_build_postings (GumNameIndex * self);
+static guint gum_name_index_find_first (GumNameIndex * self,
+    const gchar * prefix);
+static void gum_name_index_iter_init (GumNameIndexIter * iter,
+    GumNameIndex * index, const GumFunctionPattern * pattern);
+static gboolean gum_name_index_iter_next (GumNameIndexIter * self,
+    GumFunctionMetadata ** function);
+
 static GumFunctionMetadata * gum_function_metadata_new (const gchar * name,
     GumAddress address, const gchar * module);
 static void gum_function_metadata_free (GumFunctionMetadata * function);
+static const gchar * gum_function_metadata_get_key (
+    GumFunctionMetadata * self, gboolean folded);
+static gint gum_function_metadata_compare_names (gconstpointer a,
+    gconstpointer b);
+static gint gum_function_metadata_compare_folded_names (gconstpointer a,
+    gconstpointer b);
+
+static void gum_function_pattern_init (GumFunctionPattern * pattern,
+    const gchar * str);
+static void gum_function_pattern_destroy (GumFunctionPattern * pattern);
 
 G_DEFINE_TYPE_EXTENDED (GumModuleApiResolver,
                         gum_module_api_resolver,
@@ -109,8 +184,10 @@ gum_module_api_resolver_init (GumModuleApiResolver * self)
     module->ref_count = 2;
     module->name = d->name;
     module->path = d->path;
-    module->import_by_name = NULL;
-    module->export_by_name = NULL;
+    module->folded_name = NULL;
+    module->folded_path = NULL;
+    module->imports = NULL;
+    module->exports = NULL;
 
     g_hash_table_insert (self->module_by_name, g_strdup (module->name), module);
     g_hash_table_insert (self->module_by_name, g_strdup (module->path), module);
@@ -148,7 +225,8 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
   gboolean ignore_case;
   gchar * collection, * module_query, * function_query;
   gboolean no_wildcards_in_function_query;
-  GPatternSpec * module_spec, * function_spec;
+  GPatternSpec * module_spec;
+  GumFunctionPattern function_pattern;
   GHashTableIter module_iter;
   GHashTable * seen_modules;
   gboolean carry_on;
@@ -185,7 +263,7 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
       strchr (function_query, '?') == NULL;
 
   module_spec = g_pattern_spec_new (module_query);
-  function_spec = g_pattern_spec_new (function_query);
+  gum_function_pattern_init (&function_pattern, function_query);
 
   g_hash_table_iter_init (&module_iter, self->module_by_name);
   seen_modules = g_hash_table_new (NULL, NULL);
@@ -196,8 +274,6 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
   {
     const gchar * module_name = module->name;
     const gchar * module_path = module->path;
-    gchar * module_name_copy = NULL;
-    gchar * module_path_copy = NULL;
 
     if (g_hash_table_contains (seen_modules, module))
       continue;
@@ -205,18 +281,21 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
 
     if (ignore_case)
     {
-      module_name_copy = g_utf8_strdown (module_name, -1);
-      module_name = module_name_copy;
+      if (module->folded_name == NULL)
+      {
+        module->folded_name = g_utf8_strdown (module->name, -1);
+        module->folded_path = g_utf8_strdown (module->path, -1);
+      }
 
-      module_path_copy = g_utf8_strdown (module_path, -1);
-      module_path = module_path_copy;
+      module_name = module->folded_name;
+      module_path = module->folded_path;
     }
 
     if (g_pattern_match_string (module_spec, module_name) ||
         g_pattern_match_string (module_spec, module_path))
     {
-      GHashTable * functions;
-      GHashTableIter function_iter;
+      GumFunctionIndex * functions;
+      GumNameIndexIter function_iter;
       GumFunctionMetadata * function;
 
       if (collection[0] == 'e' && no_wildcards_in_function_query)
@@ -253,8 +332,6 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
           g_free ((gpointer) details.name);
         }
 
-        g_assert (module_name_copy == NULL && module_path_copy == NULL);
-
         continue;
       }
 
@@ -262,46 +339,30 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
           ? gum_module_metadata_get_imports (module)
           : gum_module_metadata_get_exports (module);
 
-      g_hash_table_iter_init (&function_iter, functions);
-      while (carry_on &&
-          g_hash_table_iter_next (&function_iter, NULL, (gpointer *) &function))
+      gum_name_index_iter_init (&function_iter,
+          gum_function_index_get_names (functions, ignore_case),
+          &function_pattern);
+      while (carry_on && gum_name_index_iter_next (&function_iter, &function))
       {
-        const gchar * function_name = function->name;
-        gchar * function_name_copy = NULL;
-
-        if (ignore_case)
-        {
-          function_name_copy = g_utf8_strdown (function_name, -1);
-          function_name = function_name_copy;
-        }
-
-        if (g_pattern_match_string (function_spec, function_name))
-        {
-          GumApiDetails details;
+        GumApiDetails details;
 
-          details.name = g_strconcat (
-              (function->module != NULL) ? function->module : module->path,
-              "!",
-              function->name,
-              NULL);
-          details.address = function->address;
+        details.name = g_strconcat (
+            (function->module != NULL) ? function->module : module->path,
+            "!",
+            function->name,
+            NULL);
+        details.address = function->address;
 
-          carry_on = func (&details, user_data);
+        carry_on = func (&details, user_data);
 
-          g_free ((gpointer) details.name);
-        }
-
-        g_free (function_name_copy);
+        g_free ((gpointer) details.name);
       }
     }
-
-    g_free (module_path_copy);
-    g_free (module_name_copy);
   }
 
   g_hash_table_unref (seen_modules);
 
-  g_pattern_spec_free (function_spec);
+  gum_function_pattern_destroy (&function_pattern);
   g_pattern_spec_free (module_spec);
 
   g_free (function_query);
@@ -324,42 +385,43 @@ gum_module_metadata_unref (GumModuleMetadata * module)
   module->ref_count--;
   if (module->ref_count == 0)
   {
-    if (module->export_by_name != NULL)
-      g_hash_table_unref (module->export_by_name);
+    if (module->exports != NULL)
+      gum_function_index_free (module->exports);
 
-    if (module->import_by_name != NULL)
-      g_hash_table_unref (module->import_by_name);
+    if (module->imports != NULL)
+      gum_function_index_free (module->imports);
+
+    g_free (module->folded_path);
+    g_free (module->folded_name);
 
     g_slice_free (GumModuleMetadata, module);
   }
 }
 
-static GHashTable *
+static GumFunctionIndex *
 gum_module_metadata_get_imports (GumModuleMetadata * self)
 {
-  if (self->import_by_name == NULL)
+  if (self->imports == NULL)
   {
-    self->import_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    self->imports = gum_function_index_new ();
     gum_module_enumerate_imports (self->path,
-        gum_module_metadata_collect_import, self->import_by_name);
+        gum_module_metadata_collect_import, self->imports->function_by_name);
   }
 
-  return self->import_by_name;
+  return self->imports;
 }
 
-static GHashTable *
+static GumFunctionIndex *
 gum_module_metadata_get_exports (GumModuleMetadata * self)
 {
-  if (self->export_by_name == NULL)
+  if (self->exports == NULL)
   {
-    self->export_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    self->exports = gum_function_index_new ();
     gum_module_enumerate_exports (self->path,
-        gum_module_metadata_collect_export, self->export_by_name);
+        gum_module_metadata_collect_export, self->exports->function_by_name);
   }
 
-  return self->export_by_name;
+  return self->exports;
 }
 
 static gboolean
@@ -398,6 +460,251 @@ gum_module_metadata_collect_export (const GumExportDetails * details,
   return TRUE;
 }
 
+static GumFunctionIndex *
+gum_function_index_new (void)
+{
+  GumFunctionIndex * index;
+
+  index = g_slice_new (GumFunctionIndex);
+  index->function_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) gum_function_metadata_free);
+  index->names = NULL;
+  index->folded_names = NULL;
+
+  return index;
+}
+
+static void
+gum_function_index_free (GumFunctionIndex * index)
+{
+  if (index->folded_names != NULL)
+    gum_name_index_free (index->folded_names);
+
+  if (index->names != NULL)
+    gum_name_index_free (index->names);
+
+  g_hash_table_unref (index->function_by_name);
+
+  g_slice_free (GumFunctionIndex, index);
+}
+
+static GumNameIndex *
+gum_function_index_get_names (GumFunctionIndex * self,
+                              gboolean folded)
+{
+  GumNameIndex ** names = folded ? &self->folded_names : &self->names;
+
+  if (*names == NULL)
+    *names = gum_name_index_new (self->function_by_name, folded);
+
+  return *names;
+}
+
+/*
+ * Keeps the functions sorted by name, or by their lowercase name for
+ * case-insensitive queries, so that queries with a literal prefix only need
+ * to look at the functions sharing that prefix. Queries that only have an
+ * infix, like *alloc*, go through a trigram index instead, which is built
+ * the first time such a query hits this module.
+ */
+static GumNameIndex *
+gum_name_index_new (GHashTable * function_by_name,
+                    gboolean folded)
+{
+  GumNameIndex * index;
+  GHashTableIter iter;
+  GumFunctionMetadata * function;
+
+  index = g_slice_new (GumNameIndex);
+  index->folded = folded;
+  index->functions =
+      g_ptr_array_sized_new (g_hash_table_size (function_by_name));
+  index->postings_by_trigram = NULL;
+
+  g_hash_table_iter_init (&iter, function_by_name);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function))
+  {
+    if (folded && function->folded_name == NULL)
+      function->folded_name = g_utf8_strdown (function->name, -1);
+
+    g_ptr_array_add (index->functions, function);
+  }
+
+  g_ptr_array_sort (index->functions, folded
+      ? gum_function_metadata_compare_folded_names
+      : gum_function_metadata_compare_names);
+
+  return index;
+}
+
+static void
+gum_name_index_free (GumNameIndex * index)
+{
+  if (index->postings_by_trigram != NULL)
+    g_hash_table_unref (index->postings_by_trigram);
+
+  g_ptr_array_unref (index->functions);
+
+  g_slice_free (GumNameIndex, index);
+}
+
+static GArray *
+gum_name_index_find_rarest_postings (GumNameIndex * self,
+                                     const gchar * infix,
+                                     gsize infix_length)
+{
+  GArray * rarest = NULL;
+  gsize i;
+
+  if (self->postings_by_trigram == NULL)
+    gum_name_index_build_postings (self);
+
+  for (i = 0; i + 3 <= infix_length; i++)
+  {
+    GArray * postings;
+
+    postings = g_hash_table_lookup (self->postings_by_trigram,
+        GUINT_TO_POINTER (GUM_TRIGRAM (infix + i)));
+    if (postings == NULL)
+      return NULL;
+
+    if (rarest == NULL || postings->len < rarest->len)
+      rarest = postings;
+  }
+
+  return rarest;
+}
+
+static void
+gum_name_index_build_postings (GumNameIndex * self)
+{
+  guint i;
+
+  self->postings_by_trigram = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_array_unref);
+
+  for (i = 0; i != self->functions->len; i++)
+  {
+    const gchar * key;
+    gsize length, j;
+
+    key = gum_function_metadata_get_key (
+        g_ptr_array_index (self->functions, i), self->folded);
+    length = strlen (key);
+
+    for (j = 0; j + 3 <= length; j++)
+    {
+      gpointer trigram = GUINT_TO_POINTER (GUM_TRIGRAM (key + j));
+      GArray * postings;
+
+      postings = g_hash_table_lookup (self->postings_by_trigram, trigram);
+      if (postings == NULL)
+      {
+        postings = g_array_new (FALSE, FALSE, sizeof (guint));
+        g_hash_table_insert (self->postings_by_trigram, trigram, postings);
+      }
+
+      if (postings->len == 0 ||
+          g_array_index (postings, guint, postings->len - 1) != i)
+      {
+        g_array_append_val (postings, i);
+      }
+    }
+  }
+}
+
+static guint
+gum_name_index_find_first (GumNameIndex * self,
+                           const gchar * prefix)
+{
+  guint lower, upper;
+
+  lower = 0;
+  upper = self->functions->len;
+
+  while (lower != upper)
+  {
+    guint mid;
+    const gchar * key;
+
+    mid = lower + ((upper - lower) / 2);
+    key = gum_function_metadata_get_key (
+        g_ptr_array_index (self->functions, mid), self->folded);
+
+    if (strcmp (key, prefix) < 0)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  return lower;
+}
+
+static void
+gum_name_index_iter_init (GumNameIndexIter * iter,
+                          GumNameIndex * index,
+                          const GumFunctionPattern * pattern)
+{
+  iter->index = index;
+  iter->pattern = pattern;
+  iter->postings = NULL;
+  iter->position = 0;
+  iter->end = index->functions->len;
+
+  if (pattern->prefix_length != 0)
+  {
+    iter->position = gum_name_index_find_first (index, pattern->prefix);
+  }
+  else if (pattern->infix_length >= 3)
+  {
+    iter->postings = gum_name_index_find_rarest_postings (index,
+        pattern->infix, pattern->infix_length);
+    iter->end = (iter->postings != NULL) ? iter->postings->len : 0;
+  }
+}
+
+static gboolean
+gum_name_index_iter_next (GumNameIndexIter * self,
+                          GumFunctionMetadata ** function)
+{
+  GPtrArray * functions = self->index->functions;
+  const GumFunctionPattern * pattern = self->pattern;
+
+  while (self->position != self->end)
+  {
+    GumFunctionMetadata * candidate;
+    const gchar * key;
+
+    if (self->postings != NULL)
+    {
+      candidate = g_ptr_array_index (functions,
+          g_array_index (self->postings, guint, self->position));
+    }
+    else
+    {
+      candidate = g_ptr_array_index (functions, self->position);
+    }
+    self->position++;
+
+    key = gum_function_metadata_get_key (candidate, self->index->folded);
+
+    if (pattern->prefix_length != 0 &&
+        strncmp (key, pattern->prefix, pattern->prefix_length) != 0)
+    {
+      self->position = self->end;
+      break;
+    }
+
+    if (g_pattern_match_string (pattern->spec, key))
+    {
+      *function = candidate;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
 static GumFunctionMetadata *
 gum_function_metadata_new (const gchar * name,
                            GumAddress address,
@@ -407,6 +714,7 @@ gum_function_metadata_new (const gchar * name,
 
   function = g_slice_new (GumFunctionMetadata);
   function->name = g_strdup (name);
+  function->folded_name = NULL;
   function->address = address;
   function->module = g_strdup (module);
 
@@ -417,7 +725,80 @@ static void
 gum_function_metadata_free (GumFunctionMetadata * function)
 {
   g_free (function->module);
+  g_free (function->folded_name);
   g_free (function->name);
 
   g_slice_free (GumFunctionMetadata, function);
 }
+
+static const gchar *
+gum_function_metadata_get_key (GumFunctionMetadata * self,
+                               gboolean folded)
+{
+  return folded ? self->folded_name : self->name;
+}
+
+static gint
+gum_function_metadata_compare_names (gconstpointer a,
+                                     gconstpointer b)
+{
+  const GumFunctionMetadata * lhs = *((const GumFunctionMetadata **) a);
+  const GumFunctionMetadata * rhs = *((const GumFunctionMetadata **) b);
+
+  return strcmp (lhs->name, rhs->name);
+}
+
+static gint
+gum_function_metadata_compare_folded_names (gconstpointer a,
+                                            gconstpointer b)
+{
+  const GumFunctionMetadata * lhs = *((const GumFunctionMetadata **) a);
+  const GumFunctionMetadata * rhs = *((const GumFunctionMetadata **) b);
+
+  return strcmp (lhs->folded_name, rhs->folded_name);
+}
+
+static void
+gum_function_pattern_init (GumFunctionPattern * pattern,
+                           const gchar * str)
+{
+  const gchar * run_start, * longest_run;
+  gsize longest_run_length;
+  const gchar * cur;
+
+  pattern->spec = g_pattern_spec_new (str);
+
+  pattern->prefix_length = strcspn (str, "*?");
+  pattern->prefix = g_strndup (str, pattern->prefix_length);
+
+  run_start = str;
+  longest_run = str;
+  longest_run_length = 0;
+  for (cur = str; ; cur++)
+  {
+    if (*cur == '*' || *cur == '?' || *cur == '\0')
+    {
+      if ((gsize) (cur - run_start) > longest_run_length)
+      {
+        longest_run = run_start;
+        longest_run_length = cur - run_start;
+      }
+
+      if (*cur == '\0')
+        break;
+
+      run_start = cur + 1;
+    }
+  }
+
+  pattern->infix = g_strndup (longest_run, longest_run_length);
+  pattern->infix_length = longest_run_length;
+}
+
+static void
+gum_function_pattern_destroy (GumFunctionPattern * pattern)
+{
+  g_free (pattern->infix);
+  g_free (pattern->prefix);
+  g_pattern_spec_free (pattern->spec);
+}
@@ -6,25 +6,80 @@
 
 #include "gummodulemap.h"
 
+#include "gumprocess-priv.h"
+
 #include <stdlib.h>
+#include <string.h>
+
+typedef struct _GumModuleMapEntry GumModuleMapEntry;
+typedef struct _GumModuleMapSnapshot GumModuleMapSnapshot;
+typedef struct _GumUpdateModulesContext GumUpdateModulesContext;
 
 struct _GumModuleMap
 {
   GObject parent;
 
-  GArray * modules;
+  GMutex mutex;
+
+  GumModuleMapSnapshot * volatile snapshot;
+  GPtrArray * superseded_snapshots;
+
+  GArray * values;
+  GumModuleMapSnapshot * values_snapshot;
+
+  gboolean incremental;
+  guint generation;
 
   GumModuleMapFilterFunc filter_func;
   gpointer filter_data;
   GDestroyNotify filter_data_destroy;
 };
 
+struct _GumModuleMapEntry
+{
+  GumMemoryRange range;
+  gint ref_count;
+  gchar * name;
+  gchar * path;
+};
+
+struct _GumModuleMapSnapshot
+{
+  gint ref_count;
+  GArray * modules;
+  GPtrArray * entries;
+};
+
+struct _GumUpdateModulesContext
+{
+  GumModuleMap * map;
+  GumModuleMapSnapshot * previous;
+  GumModuleMapSnapshot * snapshot;
+};
+
 static void gum_module_map_dispose (GObject * object);
 static void gum_module_map_finalize (GObject * object);
 
-static void gum_module_map_clear (GumModuleMap * self);
+static void gum_module_map_refresh (GumModuleMap * self);
+static void gum_module_map_sync_values (GumModuleMap * self);
+static gboolean gum_module_map_is_stale (GumModuleMap * self);
+static const GumModuleDetails * gum_module_map_snapshot_find (
+    GumModuleMapSnapshot * self, GumAddress address);
 static gboolean gum_add_module (const GumModuleDetails * details,
     gpointer user_data);
+static GumModuleMapEntry * gum_module_map_snapshot_find_entry (
+    GumModuleMapSnapshot * self, const GumModuleDetails * details);
+
+static GumModuleMapSnapshot * gum_module_map_snapshot_new (void);
+static GumModuleMapSnapshot * gum_module_map_snapshot_ref (
+    GumModuleMapSnapshot * snapshot);
+static void gum_module_map_snapshot_unref (GumModuleMapSnapshot * snapshot);
+
+static GumModuleMapEntry * gum_module_map_entry_new (
+    const GumModuleDetails * details);
+static GumModuleMapEntry * gum_module_map_entry_ref (
+    GumModuleMapEntry * entry);
+static void gum_module_map_entry_unref (GumModuleMapEntry * entry);
 
 static gint gum_module_details_compare_base (
     const GumModuleDetails * lhs_module, const GumModuleDetails * rhs_module);
@@ -45,7 +100,13 @@ gum_module_map_class_init (GumModuleMapClass * klass)
 static void
 gum_module_map_init (GumModuleMap * self)
 {
-  self->modules = g_array_new (FALSE, FALSE, sizeof (GumModuleDetails));
+  g_mutex_init (&self->mutex);
+
+  self->snapshot = gum_module_map_snapshot_new ();
+  self->superseded_snapshots = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_module_map_snapshot_unref);
+
+  self->values = g_array_new (FALSE, FALSE, sizeof (GumModuleDetails));
 }
 
 static void
@@ -68,8 +129,14 @@ gum_module_map_finalize (GObject * object)
 {
   GumModuleMap * self = GUM_MODULE_MAP (object);
 
-  gum_module_map_clear (self);
-  g_array_free (self->modules, TRUE);
+  g_array_free (self->values, TRUE);
+  if (self->values_snapshot != NULL)
+    gum_module_map_snapshot_unref (self->values_snapshot);
+
+  g_ptr_array_unref (self->superseded_snapshots);
+  gum_module_map_snapshot_unref (self->snapshot);
+
+  g_mutex_clear (&self->mutex);
 
   G_OBJECT_CLASS (gum_module_map_parent_class)->finalize (object);
 }
@@ -103,50 +170,156 @@ gum_module_map_new_filtered (GumModuleMapFilterFunc func,
   return map;
 }
 
+/*
+ * In incremental mode the map watches the dynamic linker's notification hook
+ * and only re-enumerates modules when something was actually loaded or
+ * unloaded. Lookups that miss while such a change is pending refresh the map
+ * on demand. Without a loader hook on this platform, or while it is not being
+ * observed, the map behaves as if it was not incremental.
+ */
+void
+gum_module_map_set_incremental (GumModuleMap * self,
+                                gboolean incremental)
+{
+  g_mutex_lock (&self->mutex);
+
+  self->incremental = incremental;
+  g_atomic_int_set (&self->generation, 0);
+
+  g_mutex_unlock (&self->mutex);
+
+  if (incremental)
+    _gum_process_observe_loader ();
+}
+
+/*
+ * Lookups search the snapshot published by the most recent refresh without
+ * taking any locks. A lookup that refreshes the map on demand keeps the
+ * snapshots it replaces alive until the next explicit update, so concurrent
+ * readers never see one go away, and the details returned remain valid until
+ * gum_module_map_update() is called, just like in non-incremental mode.
+ */
 const GumModuleDetails *
 gum_module_map_find (GumModuleMap * self,
                      GumAddress address)
 {
-  return bsearch (&address, self->modules->data, self->modules->len,
-      sizeof (GumModuleDetails),
-      (GCompareFunc) gum_module_details_compare_to_key);
+  const GumModuleDetails * details;
+
+  details = gum_module_map_snapshot_find (
+      g_atomic_pointer_get (&self->snapshot), address);
+
+  if (details == NULL && self->incremental && gum_module_map_is_stale (self))
+  {
+    g_mutex_lock (&self->mutex);
+    gum_module_map_refresh (self);
+    g_mutex_unlock (&self->mutex);
+
+    details = gum_module_map_snapshot_find (
+        g_atomic_pointer_get (&self->snapshot), address);
+  }
+
+  return details;
 }
 
 void
 gum_module_map_update (GumModuleMap * self)
 {
-  gum_module_map_clear (self);
-  gum_process_enumerate_modules (gum_add_module, self);
-  g_array_sort (self->modules, (GCompareFunc) gum_module_details_compare_base);
+  g_mutex_lock (&self->mutex);
+
+  gum_module_map_refresh (self);
+  gum_module_map_sync_values (self);
+
+  g_ptr_array_set_size (self->superseded_snapshots, 0);
+
+  g_mutex_unlock (&self->mutex);
 }
 
+/*
+ * The array returned stays the same for the lifetime of the map, and its
+ * contents are only replaced by gum_module_map_update().
+ */
 GArray *
 gum_module_map_get_values (GumModuleMap * self)
 {
-  return self->modules;
+  return self->values;
 }
 
 static void
-gum_module_map_clear (GumModuleMap * self)
+gum_module_map_refresh (GumModuleMap * self)
 {
-  guint i;
+  guint generation;
+  GumUpdateModulesContext ctx;
 
-  for (i = 0; i < self->modules->len; i++)
-  {
-    GumModuleDetails * d = &g_array_index (self->modules, GumModuleDetails, i);
-    g_free ((gchar *) d->name);
-    g_slice_free (GumMemoryRange, (GumMemoryRange *) d->range);
-    g_free ((gchar *) d->path);
-  }
-  g_array_set_size (self->modules, 0);
+  generation = self->incremental
+      ? _gum_process_get_loader_generation ()
+      : 0;
+  if (generation != 0 && generation == self->generation)
+    return;
+
+  ctx.map = self;
+  ctx.previous = self->snapshot;
+  ctx.snapshot = gum_module_map_snapshot_new ();
+
+  gum_process_enumerate_modules (gum_add_module, &ctx);
+  g_array_sort (ctx.snapshot->modules,
+      (GCompareFunc) gum_module_details_compare_base);
+
+  g_atomic_pointer_set (&self->snapshot, ctx.snapshot);
+
+  g_ptr_array_add (self->superseded_snapshots, ctx.previous);
+
+  g_atomic_int_set (&self->generation, generation);
+}
+
+static void
+gum_module_map_sync_values (GumModuleMap * self)
+{
+  GumModuleMapSnapshot * snapshot = self->snapshot;
+
+  if (snapshot == self->values_snapshot)
+    return;
+
+  g_array_set_size (self->values, 0);
+  g_array_append_vals (self->values, snapshot->modules->data,
+      snapshot->modules->len);
+
+  if (self->values_snapshot != NULL)
+    gum_module_map_snapshot_unref (self->values_snapshot);
+  self->values_snapshot = gum_module_map_snapshot_ref (snapshot);
+}
+
+/*
+ * A loader generation of zero means that the loader is not being observed,
+ * in which case only explicit updates refresh the map.
+ */
+static gboolean
+gum_module_map_is_stale (GumModuleMap * self)
+{
+  guint generation;
+
+  generation = _gum_process_get_loader_generation ();
+
+  return generation != 0 &&
+      generation != (guint) g_atomic_int_get (&self->generation);
+}
+
+static const GumModuleDetails *
+gum_module_map_snapshot_find (GumModuleMapSnapshot * self,
+                              GumAddress address)
+{
+  return bsearch (&address, self->modules->data, self->modules->len,
+      sizeof (GumModuleDetails),
+      (GCompareFunc) gum_module_details_compare_to_key);
 }
 
 static gboolean
 gum_add_module (const GumModuleDetails * details,
                 gpointer user_data)
 {
-  GumModuleMap * self = user_data;
-  GumModuleDetails copy;
+  GumUpdateModulesContext * ctx = user_data;
+  GumModuleMap * self = ctx->map;
+  GumModuleMapEntry * entry;
+  GumModuleDetails d;
 
   if (self->filter_func != NULL)
   {
@@ -154,15 +327,113 @@ gum_add_module (const GumModuleDetails * details,
       return TRUE;
   }
 
-  copy.name = g_strdup (details->name);
-  copy.range = g_slice_dup (GumMemoryRange, details->range);
-  copy.path = g_strdup (details->path);
+  entry = gum_module_map_snapshot_find_entry (ctx->previous, details);
+  if (entry != NULL)
+    gum_module_map_entry_ref (entry);
+  else
+    entry = gum_module_map_entry_new (details);
+  g_ptr_array_add (ctx->snapshot->entries, entry);
 
-  g_array_append_val (self->modules, copy);
+  d.name = entry->name;
+  d.range = &entry->range;
+  d.path = entry->path;
+  g_array_append_val (ctx->snapshot->modules, d);
 
   return TRUE;
 }
 
+static GumModuleMapEntry *
+gum_module_map_snapshot_find_entry (GumModuleMapSnapshot * self,
+                                    const GumModuleDetails * details)
+{
+  const GumModuleDetails * existing;
+  GumModuleMapEntry * entry;
+
+  existing = gum_module_map_snapshot_find (self,
+      details->range->base_address);
+  if (existing == NULL)
+    return NULL;
+
+  entry = (GumModuleMapEntry *) existing->range;
+
+  if (entry->range.base_address != details->range->base_address ||
+      entry->range.size != details->range->size ||
+      strcmp (entry->path, details->path) != 0)
+  {
+    return NULL;
+  }
+
+  return entry;
+}
+
+static GumModuleMapSnapshot *
+gum_module_map_snapshot_new (void)
+{
+  GumModuleMapSnapshot * snapshot;
+
+  snapshot = g_slice_new (GumModuleMapSnapshot);
+  snapshot->ref_count = 1;
+  snapshot->modules = g_array_new (FALSE, FALSE, sizeof (GumModuleDetails));
+  snapshot->entries = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_module_map_entry_unref);
+
+  return snapshot;
+}
+
+static GumModuleMapSnapshot *
+gum_module_map_snapshot_ref (GumModuleMapSnapshot * snapshot)
+{
+  g_atomic_int_inc (&snapshot->ref_count);
+
+  return snapshot;
+}
+
+static void
+gum_module_map_snapshot_unref (GumModuleMapSnapshot * snapshot)
+{
+  if (!g_atomic_int_dec_and_test (&snapshot->ref_count))
+    return;
+
+  g_ptr_array_unref (snapshot->entries);
+  g_array_free (snapshot->modules, TRUE);
+
+  g_slice_free (GumModuleMapSnapshot, snapshot);
+}
+
+static GumModuleMapEntry *
+gum_module_map_entry_new (const GumModuleDetails * details)
+{
+  GumModuleMapEntry * entry;
+
+  entry = g_slice_new (GumModuleMapEntry);
+  entry->range = *details->range;
+  entry->ref_count = 1;
+  entry->name = g_strdup (details->name);
+  entry->path = g_strdup (details->path);
+
+  return entry;
+}
+
+static GumModuleMapEntry *
+gum_module_map_entry_ref (GumModuleMapEntry * entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+
+  return entry;
+}
+
+static void
+gum_module_map_entry_unref (GumModuleMapEntry * entry)
+{
+  if (!g_atomic_int_dec_and_test (&entry->ref_count))
+    return;
+
+  g_free (entry->path);
+  g_free (entry->name);
+
+  g_slice_free (GumModuleMapEntry, entry);
+}
+
 static gint
 gum_module_details_compare_base (const GumModuleDetails * lhs_module,
                                  const GumModuleDetails * rhs_module)
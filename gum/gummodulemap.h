@@ -22,6 +22,9 @@ GUM_API GumModuleMap * gum_module_map_new (void);
 GUM_API GumModuleMap * gum_module_map_new_filtered (GumModuleMapFilterFunc func,
     gpointer data, GDestroyNotify data_destroy);
 
+GUM_API void gum_module_map_set_incremental (GumModuleMap * self,
+    gboolean incremental);
+
 GUM_API const GumModuleDetails * gum_module_map_find (GumModuleMap * self,
     GumAddress address);
 
@@ -15,6 +15,9 @@ G_GNUC_INTERNAL void _gum_process_enumerate_threads (GumFoundThreadFunc func,
     gpointer user_data);
 G_GNUC_INTERNAL void _gum_process_enumerate_ranges (GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
+G_GNUC_INTERNAL gpointer _gum_process_find_loader_notifier (void);
+G_GNUC_INTERNAL void _gum_process_observe_loader (void);
+G_GNUC_INTERNAL guint _gum_process_get_loader_generation (void);
 
 G_END_DECLS
 
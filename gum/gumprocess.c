@@ -6,7 +6,13 @@
 
 #include "gumprocess-priv.h"
 
+#include "gum-init.h"
 #include "gumcloak.h"
+#include "guminterceptor.h"
+
+#define GUM_TYPE_LOADER_WATCHER (gum_loader_watcher_get_type ())
+G_DECLARE_FINAL_TYPE (GumLoaderWatcher, gum_loader_watcher, GUM,
+    LOADER_WATCHER, GObject)
 
 typedef struct _GumEmitThreadsContext GumEmitThreadsContext;
 typedef struct _GumEmitRangesContext GumEmitRangesContext;
@@ -30,6 +36,14 @@ struct _GumResolveSymbolContext
   GumAddress result;
 };
 
+struct _GumLoaderWatcher
+{
+  GObject parent;
+
+  GumInterceptor * interceptor;
+  gboolean attached;
+};
+
 static gboolean gum_emit_thread_if_not_cloaked (
     const GumThreadDetails * details, gpointer user_data);
 static gboolean gum_emit_range_if_not_cloaked (const GumRangeDetails * details,
@@ -37,11 +51,30 @@ static gboolean gum_emit_range_if_not_cloaked (const GumRangeDetails * details,
 static gboolean gum_store_address_if_name_matches (
     const GumSymbolDetails * details, gpointer user_data);
 
+static void gum_loader_watcher_deinit (void);
+static void gum_loader_watcher_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_loader_watcher_dispose (GObject * object);
+static void gum_loader_watcher_stop (GumLoaderWatcher * self);
+static void gum_loader_watcher_on_notification (
+    GumInvocationListener * listener, GumInvocationContext * context);
+
 static GumCodeSigningPolicy gum_code_signing_policy = GUM_CODE_SIGNING_OPTIONAL;
 
 G_DEFINE_BOXED_TYPE (GumModuleDetails, gum_module_details,
     gum_module_details_copy, gum_module_details_free)
 
+G_DEFINE_TYPE_EXTENDED (GumLoaderWatcher,
+                        gum_loader_watcher,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_INVOCATION_LISTENER,
+                            gum_loader_watcher_iface_init))
+
+G_LOCK_DEFINE_STATIC (gum_loader_watcher);
+static GumLoaderWatcher * gum_loader_watcher = NULL;
+static volatile gint gum_loader_generation = 0;
+
 GumOS
 gum_process_get_native_os (void)
 {
@@ -141,6 +174,36 @@ gum_emit_range_if_not_cloaked (const GumRangeDetails * details,
   return ctx->func (details, ctx->user_data);
 }
 
+/*
+ * Starts observing the dynamic linker's notification hook, after which
+ * _gum_process_get_loader_generation() returns a counter that is bumped every
+ * time the set of loaded modules changes.
+ */
+void
+_gum_process_observe_loader (void)
+{
+  G_LOCK (gum_loader_watcher);
+
+  if (gum_loader_watcher == NULL)
+  {
+    gum_loader_watcher = g_object_new (GUM_TYPE_LOADER_WATCHER, NULL);
+
+    _gum_register_early_destructor (gum_loader_watcher_deinit);
+  }
+
+  G_UNLOCK (gum_loader_watcher);
+}
+
+/*
+ * Returns 0 if the loader is not being observed, in which case callers must
+ * assume that anything may have changed.
+ */
+guint
+_gum_process_get_loader_generation (void)
+{
+  return g_atomic_int_get (&gum_loader_generation);
+}
+
 GumAddress
 gum_module_find_symbol_by_name (const gchar * module_name,
                                 const gchar * symbol_name)
@@ -238,3 +301,83 @@ gum_symbol_type_to_string (GumSymbolType type)
   g_assert_not_reached ();
   return NULL;
 }
+
+static void
+gum_loader_watcher_deinit (void)
+{
+  G_LOCK (gum_loader_watcher);
+
+  gum_loader_watcher_stop (gum_loader_watcher);
+  g_clear_object (&gum_loader_watcher);
+
+  G_UNLOCK (gum_loader_watcher);
+}
+
+static void
+gum_loader_watcher_class_init (GumLoaderWatcherClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_loader_watcher_dispose;
+
+  (void) GUM_IS_LOADER_WATCHER;
+  (void) GUM_LOADER_WATCHER;
+  (void) glib_autoptr_cleanup_GumLoaderWatcher;
+}
+
+static void
+gum_loader_watcher_iface_init (gpointer g_iface,
+                               gpointer iface_data)
+{
+  GumInvocationListenerInterface * iface = g_iface;
+
+  iface->on_enter = gum_loader_watcher_on_notification;
+}
+
+static void
+gum_loader_watcher_init (GumLoaderWatcher * self)
+{
+  gpointer notifier;
+
+  self->interceptor = gum_interceptor_obtain ();
+
+  notifier = _gum_process_find_loader_notifier ();
+  if (notifier != NULL)
+  {
+    self->attached = gum_interceptor_attach (self->interceptor, notifier,
+        GUM_INVOCATION_LISTENER (self), NULL) == GUM_ATTACH_OK;
+  }
+
+  if (self->attached)
+    g_atomic_int_set (&gum_loader_generation, 1);
+}
+
+static void
+gum_loader_watcher_dispose (GObject * object)
+{
+  GumLoaderWatcher * self = GUM_LOADER_WATCHER (object);
+
+  g_clear_object (&self->interceptor);
+
+  G_OBJECT_CLASS (gum_loader_watcher_parent_class)->dispose (object);
+}
+
+static void
+gum_loader_watcher_stop (GumLoaderWatcher * self)
+{
+  if (!self->attached)
+    return;
+
+  gum_interceptor_detach (self->interceptor, GUM_INVOCATION_LISTENER (self));
+  self->attached = FALSE;
+
+  g_atomic_int_set (&gum_loader_generation, 0);
+}
+
+static void
+gum_loader_watcher_on_notification (GumInvocationListener * listener,
+                                    GumInvocationContext * context)
+{
+  if (g_atomic_int_add (&gum_loader_generation, 1) == -1)
+    g_atomic_int_set (&gum_loader_generation, 1);
+}
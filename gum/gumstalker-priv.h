@@ -0,0 +1,19 @@
+/*
+ * Copyright (C) 2021 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_STALKER_PRIV_H__
+#define __GUM_STALKER_PRIV_H__
+
+#include "gumstalker.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL void _gum_stalker_query_footprint (GumStalker * self,
+    guint * num_blocks, gsize * slab_size);
+
+G_END_DECLS
+
+#endif
@@ -95,6 +95,14 @@ GUM_API void gum_stalker_exclude (GumStalker * self,
 GUM_API gint gum_stalker_get_trust_threshold (GumStalker * self);
 GUM_API void gum_stalker_set_trust_threshold (GumStalker * self,
     gint trust_threshold);
+GUM_API void gum_stalker_set_superblock_threshold (GumStalker * self,
+    guint threshold);
+GUM_API void gum_stalker_set_background_compilation_enabled (
+    GumStalker * self, gboolean enabled);
+GUM_API gboolean gum_stalker_save_block_cache (GumStalker * self,
+    const gchar * path, GError ** error);
+GUM_API gboolean gum_stalker_load_block_cache (GumStalker * self,
+    const gchar * path, GError ** error);
 
 GUM_API void gum_stalker_flush (GumStalker * self);
 GUM_API void gum_stalker_stop (GumStalker * self);
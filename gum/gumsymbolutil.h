@@ -26,6 +26,8 @@ G_BEGIN_DECLS
 
 GUM_API gboolean gum_symbol_details_from_address (gpointer address,
     GumDebugSymbolDetails * details);
+GUM_API guint gum_symbol_details_from_addresses (const gpointer * addresses,
+    guint n_addresses, GumDebugSymbolDetails * details);
 GUM_API gchar * gum_symbol_name_from_address (gpointer address);
 
 GUM_API gpointer gum_find_function (const gchar * name);
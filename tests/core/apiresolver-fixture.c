@@ -52,5 +52,7 @@ test_api_resolver_fixture_teardown (TestApiResolverFixture * fixture,
 
 static gboolean check_module_import (const GumApiDetails * details,
     gpointer user_data);
+static gboolean check_infix_match (const GumApiDetails * details,
+    gpointer user_data);
 static gboolean match_found_cb (const GumApiDetails * details,
     gpointer user_data);
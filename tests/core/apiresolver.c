@@ -9,6 +9,7 @@
 TESTLIST_BEGIN (api_resolver)
   TESTENTRY (module_exports_can_be_resolved_case_sensitively)
   TESTENTRY (module_exports_can_be_resolved_case_insensitively)
+  TESTENTRY (module_exports_can_be_resolved_by_infix)
   TESTENTRY (module_imports_can_be_resolved)
   TESTENTRY (objc_methods_can_be_resolved_case_sensitively)
   TESTENTRY (objc_methods_can_be_resolved_case_insensitively)
@@ -70,6 +71,44 @@ TESTCASE (module_exports_can_be_resolved_case_insensitively)
   g_assert_cmpuint (ctx.number_of_calls, >, 1);
 }
 
+TESTCASE (module_exports_can_be_resolved_by_infix)
+{
+  GError * error = NULL;
+  guint number_of_matches, number_of_matches_ignoring_case;
+
+  fixture->resolver = gum_api_resolver_make ("module");
+  g_assert_nonnull (fixture->resolver);
+
+  number_of_matches = 0;
+  gum_api_resolver_enumerate_matches (fixture->resolver, "exports:*!*alloc*",
+      check_infix_match, &number_of_matches, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (number_of_matches, >=, 1);
+
+  number_of_matches_ignoring_case = 0;
+  gum_api_resolver_enumerate_matches (fixture->resolver,
+      "exports:*!*ALLOC*/i", check_infix_match,
+      &number_of_matches_ignoring_case, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (number_of_matches_ignoring_case, >=, number_of_matches);
+}
+
+static gboolean
+check_infix_match (const GumApiDetails * details,
+                   gpointer user_data)
+{
+  guint * number_of_matches = user_data;
+  gchar * function_name;
+
+  function_name = g_utf8_strdown (strrchr (details->name, '!') + 1, -1);
+  g_assert_nonnull (strstr (function_name, "alloc"));
+  g_free (function_name);
+
+  (*number_of_matches)++;
+
+  return TRUE;
+}
+
 TESTCASE (module_imports_can_be_resolved)
 {
 #ifdef HAVE_DARWIN
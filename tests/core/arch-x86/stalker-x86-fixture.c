@@ -5,7 +5,7 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
 
 #include "fakeeventsink.h"
 #include "gumx86writer.h"
@@ -13,6 +13,8 @@
 #include "stalkerdummychannel.h"
 #include "testutil.h"
 
+#include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_WINDOWS
@@ -215,6 +217,8 @@ typedef struct _PatchCodeContext PatchCodeContext;
 typedef struct _UnfollowTransformContext UnfollowTransformContext;
 typedef struct _InvalidationTransformContext InvalidationTransformContext;
 typedef struct _InvalidationTarget InvalidationTarget;
+typedef struct _CodeFootprintRun CodeFootprintRun;
+typedef struct _TransformThreadContext TransformThreadContext;
 
 struct _PatchCodeContext
 {
@@ -247,3 +251,20 @@ struct _InvalidationTarget
   StalkerDummyChannel channel;
   volatile gboolean finished;
 };
+
+struct _CodeFootprintRun
+{
+  GumStalker * stalker;
+
+  GMutex mutex;
+  GCond cond;
+  guint n_done;
+  gboolean may_unfollow;
+};
+
+struct _TransformThreadContext
+{
+  GumThreadId thread_id;
+  guint n_transformed;
+  guint n_foreign;
+};
@@ -23,6 +23,15 @@ TESTLIST_BEGIN (stalker)
   TESTENTRY (call)
   TESTENTRY (ret)
   TESTENTRY (exec)
+  TESTENTRY (exec_events_can_be_buffered)
+  TESTENTRY (block_events_can_be_buffered)
+  TESTENTRY (block_cache_should_prefetch_on_follow)
+  TESTENTRY (block_cache_should_reject_invalid_data)
+  TESTENTRY (block_cache_should_reject_other_versions)
+  TESTENTRY (background_compilation_should_not_affect_events)
+  TESTENTRY (background_compilation_should_not_speculate_custom_transforms)
+  TESTENTRY (superblocks_should_preserve_semantics)
+  TESTENTRY (superblocks_should_be_invalidated_through_inner_segments)
   TESTENTRY (call_depth)
   TESTENTRY (call_probe)
   TESTENTRY (custom_transformer)
@@ -95,6 +104,7 @@ TESTLIST_BEGIN (stalker)
 
 #ifdef HAVE_LINUX
   TESTENTRY (prefetch)
+  TESTENTRY (code_footprint_per_thread)
 #endif
 TESTLIST_END ()
 
@@ -110,6 +120,8 @@ static void pretend_workload (GumMemoryRange * runner_range);
 static void insert_extra_increment_after_xor (GumStalkerIterator * iterator,
     GumStalkerOutput * output, gpointer user_data);
 static void store_xax (GumCpuContext * cpu_context, gpointer user_data);
+static void record_transform_thread (GumStalkerIterator * iterator,
+    GumStalkerOutput * output, gpointer user_data);
 static void unfollow_during_transform (GumStalkerIterator * iterator,
     GumStalkerOutput * output, gpointer user_data);
 static void modify_to_return_true_after_three_calls (
@@ -127,6 +139,10 @@ static void modify_to_return_true_on_subsequent_transform (
 static void add_n_return_value_increments (GumStalkerIterator * iterator,
     GumStalkerOutput * output, gpointer user_data);
 static void invoke_follow_return_code (TestStalkerFixture * fixture);
+static gchar * make_block_cache_path (void);
+static gint block_cache_target (gint value);
+static gboolean block_cache_was_compiled (TestStalkerFixture * fixture,
+    gconstpointer address);
 static void invoke_unfollow_deep_code (TestStalkerFixture * fixture);
 
 #ifdef HAVE_LINUX
@@ -140,6 +156,10 @@ static void prefetch_read_blocks (int fd, GHashTable * table);
 
 static GHashTable * prefetch_compiled = NULL;
 static GHashTable * prefetch_executed = NULL;
+
+static void code_footprint_measure (GumStalker * stalker, guint n_threads);
+static gpointer code_footprint_run_worker (gpointer data);
+static void code_footprint_workload (void);
 #endif
 
 static const guint8 flat_code[] = {
@@ -588,6 +608,310 @@ TESTCASE (exec)
   GUM_ASSERT_CMPADDR (ev->location, ==, func);
 }
 
+TESTCASE (exec_events_can_be_buffered)
+{
+  StalkerTestFunc func;
+
+  fixture->sink->buffer_capacity = 4;
+  func = invoke_flat (fixture, GUM_EXEC);
+
+  g_assert_cmpuint (fixture->sink->events->len, ==, INVOKER_INSN_COUNT + 4);
+  g_assert_cmpuint (fixture->sink->n_buffers, >, 1);
+  GUM_ASSERT_CMPADDR (NTH_EXEC_EVENT_LOCATION (INVOKER_IMPL_OFFSET), ==, func);
+}
+
+TESTCASE (block_events_can_be_buffered)
+{
+  GArray * events;
+  guint n_blocks, i, j;
+
+  fixture->sink->buffer_capacity = 3;
+  invoke_flat (fixture, GUM_BLOCK | GUM_COMPILE);
+
+  events = fixture->sink->events;
+  n_blocks = 0;
+
+  for (i = 0; i != events->len; i++)
+  {
+    const GumEvent * ev = &g_array_index (events, GumEvent, i);
+    gboolean compiled = FALSE;
+
+    if (ev->type != GUM_BLOCK)
+      continue;
+    n_blocks++;
+
+    for (j = 0; j != i && !compiled; j++)
+    {
+      const GumEvent * other = &g_array_index (events, GumEvent, j);
+
+      compiled = other->type == GUM_COMPILE &&
+          other->compile.start == ev->block.start &&
+          other->compile.end == ev->block.end;
+    }
+
+    g_assert_true (compiled);
+  }
+
+  g_assert_cmpuint (n_blocks, >, 1);
+  g_assert_cmpuint (fixture->sink->n_buffers, >, 0);
+}
+
+TESTCASE (block_cache_should_prefetch_on_follow)
+{
+  gchar * path;
+  GError * error = NULL;
+  gpointer target;
+
+  path = make_block_cache_path ();
+
+  target = GUM_FUNCPTR_TO_POINTER (block_cache_target);
+
+  fixture->sink->mask = GUM_COMPILE;
+  gum_stalker_follow_me (fixture->stalker, NULL,
+      GUM_EVENT_SINK (fixture->sink));
+  g_assert_cmpint (block_cache_target (42), ==, 43);
+  g_assert_true (gum_stalker_save_block_cache (fixture->stalker, path, &error));
+  g_assert_no_error (error);
+  gum_stalker_unfollow_me (fixture->stalker);
+  g_assert_true (block_cache_was_compiled (fixture, target));
+
+  gum_fake_event_sink_reset (fixture->sink);
+  g_assert_true (gum_stalker_load_block_cache (fixture->stalker, path, &error));
+  g_assert_no_error (error);
+
+  gum_stalker_follow_me (fixture->stalker, NULL,
+      GUM_EVENT_SINK (fixture->sink));
+  g_assert_true (block_cache_was_compiled (fixture, target));
+  gum_fake_event_sink_reset (fixture->sink);
+  g_assert_cmpint (block_cache_target (1), ==, 2);
+  gum_stalker_unfollow_me (fixture->stalker);
+  g_assert_false (block_cache_was_compiled (fixture, target));
+
+  g_unlink (path);
+  g_free (path);
+}
+
+TESTCASE (block_cache_should_reject_invalid_data)
+{
+  const gchar junk[] = "GUMSBC\2\0\xff";
+  gchar * path;
+  GError * error = NULL;
+
+  path = make_block_cache_path ();
+
+  g_assert_true (g_file_set_contents (path, junk, sizeof (junk), NULL));
+  g_assert_false (gum_stalker_load_block_cache (fixture->stalker, path,
+      &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_error_free (error);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+TESTCASE (block_cache_should_reject_other_versions)
+{
+  const gchar previous_version[] = "GUMSBC\1\0\0\0\0\0\0\0\0\0";
+  gchar * path;
+  GError * error = NULL;
+
+  path = make_block_cache_path ();
+
+  g_assert_true (g_file_set_contents (path, previous_version,
+      sizeof (previous_version) - 1, NULL));
+  g_assert_false (gum_stalker_load_block_cache (fixture->stalker, path,
+      &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_cmpstr (error->message, ==, "Unsupported block cache version");
+  g_error_free (error);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+TESTCASE (background_compilation_should_not_affect_events)
+{
+  GArray * events;
+  guint n_compiles, i, j;
+
+  gum_stalker_set_background_compilation_enabled (fixture->stalker, TRUE);
+
+  invoke_flat (fixture, GUM_EXEC | GUM_COMPILE);
+
+  events = fixture->sink->events;
+  n_compiles = 0;
+  for (i = 0; i != events->len; i++)
+  {
+    const GumEvent * ev = &g_array_index (events, GumEvent, i);
+
+    if (ev->type != GUM_COMPILE)
+      continue;
+    n_compiles++;
+
+    for (j = i + 1; j != events->len; j++)
+    {
+      const GumEvent * other = &g_array_index (events, GumEvent, j);
+
+      g_assert_false (other->type == GUM_COMPILE &&
+          other->compile.start == ev->compile.start);
+    }
+  }
+  g_assert_cmpuint (n_compiles, >, 0);
+  g_assert_cmpuint (events->len - n_compiles, ==, INVOKER_INSN_COUNT + 4);
+
+  gum_stalker_set_background_compilation_enabled (fixture->stalker, FALSE);
+}
+
+TESTCASE (background_compilation_should_not_speculate_custom_transforms)
+{
+  TransformThreadContext ctx;
+  GArray * events;
+  guint n_compiles, i;
+
+  ctx.thread_id = gum_process_get_current_thread_id ();
+  ctx.n_transformed = 0;
+  ctx.n_foreign = 0;
+
+  fixture->transformer = gum_stalker_transformer_make_from_callback (
+      record_transform_thread, &ctx, NULL);
+  gum_stalker_set_background_compilation_enabled (fixture->stalker, TRUE);
+
+  invoke_flat (fixture, GUM_COMPILE);
+
+  gum_stalker_set_background_compilation_enabled (fixture->stalker, FALSE);
+
+  events = fixture->sink->events;
+  n_compiles = 0;
+  for (i = 0; i != events->len; i++)
+  {
+    if (g_array_index (events, GumEvent, i).type == GUM_COMPILE)
+      n_compiles++;
+  }
+
+  g_assert_cmpuint (ctx.n_foreign, ==, 0);
+  g_assert_cmpuint (ctx.n_transformed, ==, n_compiles);
+}
+
+static void
+record_transform_thread (GumStalkerIterator * iterator,
+                         GumStalkerOutput * output,
+                         gpointer user_data)
+{
+  TransformThreadContext * ctx = user_data;
+
+  ctx->n_transformed++;
+  if (gum_process_get_current_thread_id () != ctx->thread_id)
+    ctx->n_foreign++;
+
+  while (gum_stalker_iterator_next (iterator, NULL))
+    gum_stalker_iterator_keep (iterator);
+}
+
+TESTCASE (superblocks_should_preserve_semantics)
+{
+  const guint8 code[] =
+  {
+    0x31, 0xc0,                   /* xor eax, eax */
+    0xb9, 0x0a, 0x00, 0x00, 0x00, /* mov ecx, 10  */
+    0xeb, 0x07,                   /* jmp +7       */
+    0xcc, 0xcc, 0xcc, 0xcc,       /* int3 * 7     */
+    0xcc, 0xcc, 0xcc,
+    0xff, 0xc0,                   /* inc eax      */
+    0xff, 0xc9,                   /* dec ecx      */
+    0x75, 0xf1,                   /* jnz -15      */
+    0xc3,                         /* ret          */
+  };
+  StalkerTestFunc func;
+  gint ret;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code, sizeof (code)));
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_set_superblock_threshold (fixture->stalker, 3);
+
+  fixture->sink->mask = GUM_EXEC;
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, 0);
+
+  g_assert_cmpint (ret, ==, 10);
+  g_assert_cmpuint (fixture->sink->events->len, ==,
+      INVOKER_INSN_COUNT + 3 + (10 * 3) + 9 + 1);
+}
+
+TESTCASE (superblocks_should_be_invalidated_through_inner_segments)
+{
+  const guint8 code[] =
+  {
+    0x31, 0xc0,                   /* xor eax, eax */
+    0xb9, 0x0a, 0x00, 0x00, 0x00, /* mov ecx, 10  */
+    0xeb, 0x07,                   /* jmp +7       */
+    0xcc, 0xcc, 0xcc, 0xcc,       /* int3 * 7     */
+    0xcc, 0xcc, 0xcc,
+    0xff, 0xc0,                   /* inc eax      */
+    0xff, 0xc9,                   /* dec ecx      */
+    0x75, 0xf1,                   /* jnz -15      */
+    0xc3,                         /* ret          */
+  };
+  const guint8 dec_eax[] = { 0xff, 0xc8 };
+  guint8 * inner_segment;
+  StalkerTestFunc func;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code, sizeof (code)));
+  inner_segment = (guint8 *) fixture->code + 16;
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_set_superblock_threshold (fixture->stalker, 3);
+
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer, NULL);
+
+  g_assert_cmpint (func (0), ==, 10);
+
+  patch_code (inner_segment, dec_eax, sizeof (dec_eax));
+  gum_stalker_invalidate (fixture->stalker, inner_segment);
+
+  g_assert_cmpint (func (0), ==, -10);
+
+  gum_stalker_unfollow_me (fixture->stalker);
+}
+
+static gchar *
+make_block_cache_path (void)
+{
+  gchar * name, * path;
+
+  name = g_strdup_printf ("frida-gum-stalker-block-cache-%u",
+      (guint) gum_process_get_id ());
+  path = g_build_filename (g_get_tmp_dir (), name, NULL);
+  g_free (name);
+
+  return path;
+}
+
+GUM_NOINLINE static gint
+block_cache_target (gint value)
+{
+  return value + 1;
+}
+
+static gboolean
+block_cache_was_compiled (TestStalkerFixture * fixture,
+                          gconstpointer address)
+{
+  GArray * events = fixture->sink->events;
+  guint i;
+
+  for (i = 0; i != events->len; i++)
+  {
+    const GumEvent * ev = &g_array_index (events, GumEvent, i);
+
+    if (ev->type == GUM_COMPILE && ev->compile.start == address)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 TESTCASE (call_depth)
 {
   const guint8 code[] =
@@ -2843,4 +3167,114 @@ prefetch_read_blocks (int fd,
   }
 }
 
+TESTCASE (code_footprint_per_thread)
+{
+  const guint thread_counts[] = { 1, 8, 64 };
+  guint i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (thread_counts); i++)
+    code_footprint_measure (fixture->stalker, thread_counts[i]);
+}
+
+static void
+code_footprint_measure (GumStalker * stalker,
+                        guint n_threads)
+{
+  CodeFootprintRun run;
+  GThread ** threads;
+  GTimer * timer;
+  gdouble duration;
+  guint n_compiled, i;
+  gsize slab_size;
+
+  run.stalker = stalker;
+  g_mutex_init (&run.mutex);
+  g_cond_init (&run.cond);
+  run.n_done = 0;
+  run.may_unfollow = FALSE;
+
+  threads = g_new (GThread *, n_threads);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i != n_threads; i++)
+  {
+    threads[i] = g_thread_new ("stalker-code-footprint",
+        code_footprint_run_worker, &run);
+  }
+
+  g_mutex_lock (&run.mutex);
+  while (run.n_done != n_threads)
+    g_cond_wait (&run.cond, &run.mutex);
+  duration = g_timer_elapsed (timer, NULL);
+  _gum_stalker_query_footprint (stalker, &n_compiled, &slab_size);
+  run.may_unfollow = TRUE;
+  g_cond_broadcast (&run.cond);
+  g_mutex_unlock (&run.mutex);
+
+  for (i = 0; i != n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_print ("<threads=%u duration=%f compiled=%u slabs=%" G_GSIZE_FORMAT
+      " KB> ", n_threads, duration, n_compiled, slab_size / 1024);
+
+  g_assert_cmpuint (n_compiled, >=, n_threads);
+
+  g_timer_destroy (timer);
+  g_free (threads);
+  g_cond_clear (&run.cond);
+  g_mutex_clear (&run.mutex);
+
+  while (gum_stalker_garbage_collect (stalker))
+    g_usleep (10000);
+}
+
+static gpointer
+code_footprint_run_worker (gpointer data)
+{
+  CodeFootprintRun * run = data;
+
+  gum_stalker_follow_me (run->stalker, NULL, NULL);
+
+  code_footprint_workload ();
+
+  g_mutex_lock (&run->mutex);
+  run->n_done++;
+  g_cond_broadcast (&run->cond);
+  while (!run->may_unfollow)
+    g_cond_wait (&run->cond, &run->mutex);
+  g_mutex_unlock (&run->mutex);
+
+  gum_stalker_unfollow_me (run->stalker);
+
+  return NULL;
+}
+
+static void
+code_footprint_workload (void)
+{
+  GChecksum * checksum;
+  guint i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  for (i = 0; i != 1000; i++)
+  {
+    gchar * str;
+
+    str = g_strdup_printf ("%u:%s", i, g_checksum_get_string (checksum));
+    g_checksum_reset (checksum);
+    g_checksum_update (checksum, (const guchar *) str, -1);
+    g_free (str);
+  }
+
+  g_checksum_free (checksum);
+}
+
 #endif
@@ -205,11 +205,12 @@ test_interceptor_fixture_teardown (TestInterceptorFixture * fixture,
 }
 
 static GumAttachReturn
-interceptor_fixture_try_attach (TestInterceptorFixture * h,
-                                guint listener_index,
-                                gpointer test_func,
-                                gchar enter_char,
-                                gchar leave_char)
+interceptor_fixture_try_attach_with_profile (TestInterceptorFixture * h,
+                                             guint listener_index,
+                                             gpointer test_func,
+                                             gchar enter_char,
+                                             gchar leave_char,
+                                             GumListenerProfile profile)
 {
   GumAttachReturn result;
   ListenerContext * ctx;
@@ -234,8 +235,8 @@ interceptor_fixture_try_attach (TestInterceptorFixture * h,
   ctx->enter_char = enter_char;
   ctx->leave_char = leave_char;
 
-  result = gum_interceptor_attach (h->interceptor, test_func,
-      GUM_INVOCATION_LISTENER (ctx->listener), NULL);
+  result = gum_interceptor_attach_with_profile (h->interceptor, test_func,
+      GUM_INVOCATION_LISTENER (ctx->listener), NULL, profile);
   if (result == GUM_ATTACH_OK)
   {
     h->listener_context[listener_index] = ctx;
@@ -248,6 +249,17 @@ interceptor_fixture_try_attach (TestInterceptorFixture * h,
   return result;
 }
 
+static GumAttachReturn
+interceptor_fixture_try_attach (TestInterceptorFixture * h,
+                                guint listener_index,
+                                gpointer test_func,
+                                gchar enter_char,
+                                gchar leave_char)
+{
+  return interceptor_fixture_try_attach_with_profile (h, listener_index,
+      test_func, enter_char, leave_char, GUM_LISTENER_PROFILE_FULL);
+}
+
 static void
 interceptor_fixture_attach (TestInterceptorFixture * h,
                             guint listener_index,
@@ -259,6 +271,19 @@ interceptor_fixture_attach (TestInterceptorFixture * h,
       enter_char, leave_char), ==, GUM_ATTACH_OK);
 }
 
+static void
+interceptor_fixture_attach_with_profile (TestInterceptorFixture * h,
+                                         guint listener_index,
+                                         gpointer test_func,
+                                         gchar enter_char,
+                                         gchar leave_char,
+                                         GumListenerProfile profile)
+{
+  g_assert_cmpint (interceptor_fixture_try_attach_with_profile (h,
+      listener_index, test_func, enter_char, leave_char, profile), ==,
+      GUM_ATTACH_OK);
+}
+
 static void
 interceptor_fixture_detach (TestInterceptorFixture * h,
                             guint listener_index)
@@ -27,6 +27,11 @@ TESTLIST_BEGIN (interceptor)
 
   TESTENTRY (attach_one)
   TESTENTRY (attach_two)
+  TESTENTRY (lazy_trampoline_should_be_materialized_on_first_call)
+  TESTENTRY (lazy_trampoline_should_support_detach_before_first_call)
+  TESTENTRY (lazy_trampoline_should_support_concurrent_first_calls)
+  TESTENTRY (batched_transaction_should_not_disturb_other_threads)
+  TESTENTRY (stop_the_world_should_not_disturb_other_threads)
   TESTENTRY (attach_to_recursive_function)
   TESTENTRY (attach_to_special_function)
 #ifdef G_OS_UNIX
@@ -54,8 +59,25 @@ TESTLIST_BEGIN (interceptor)
   TESTENTRY (ignore_current_thread_nested)
   TESTENTRY (ignore_other_threads)
   TESTENTRY (detach)
+  TESTENTRY (detach_should_stop_leave_of_in_flight_call)
   TESTENTRY (listener_ref_count)
   TESTENTRY (function_data)
+  TESTENTRY (invocation_data_should_be_sized_at_attach_time)
+  TESTENTRY (invocation_data_should_grow_on_demand)
+  TESTENTRY (lightweight_listener_should_only_see_enter)
+  TESTENTRY (lightweight_listener_should_coexist_with_full_listener)
+  TESTENTRY (lightweight_listener_should_see_arguments)
+  TESTENTRY (lightweight_listener_should_respect_ignore_current_thread)
+  TESTENTRY (lightweight_listener_should_see_current_invocation)
+  TESTENTRY (lightweight_listener_performance)
+  TESTENTRY (probe_should_count_calls)
+  TESTENTRY (probe_should_record_arguments)
+  TESTENTRY (probe_should_report_dropped_records)
+  TESTENTRY (probe_should_coexist_with_listener)
+  TESTENTRY (probe_performance)
+  TESTENTRY (statistics_should_count_calls)
+  TESTENTRY (statistics_should_coexist_with_lightweight_listener)
+  TESTENTRY (statistics_should_not_count_ignored_threads)
 
   TESTENTRY (i_can_has_replaceability)
   TESTENTRY (already_replaced)
@@ -66,12 +88,39 @@ TESTLIST_BEGIN (interceptor)
 # endif
 #endif
   TESTENTRY (replace_then_attach)
+  TESTENTRY (replace_fast)
+  TESTENTRY (replace_fast_should_not_coexist_with_listeners)
 
 #ifdef HAVE_QNX
   TESTENTRY (intercept_malloc_and_create_thread)
 #endif
+
+  TESTGROUP_BEGIN ("Performance")
+  TESTENTRY (call_to_unhooked_function)
+  TESTENTRY (call_to_replaced_function)
+  TESTENTRY (call_to_fast_replaced_function)
+  TESTENTRY (call_with_enter_only_listener)
+  TESTENTRY (call_with_enter_and_leave_listener)
+  TESTENTRY (call_with_two_listeners)
+  TESTENTRY (recursive_call_with_listener)
+  TESTENTRY (call_from_ignored_thread)
+  TESTGROUP_END ()
 TESTLIST_END ()
 
+typedef struct _InterceptorBenchmark InterceptorBenchmark;
+
+struct _InterceptorBenchmark
+{
+  GumInterceptor * interceptor;
+  gpointer (* target) (gpointer data);
+  guint recursion_depth;
+  gboolean ignore_current_thread;
+
+  volatile gint n_ready;
+  volatile gint n_done;
+  volatile gint started;
+};
+
 #ifdef HAVE_QNX
 static gpointer thread_doing_nothing (gpointer data);
 static gpointer thread_calling_pthread_setspecific (gpointer data);
@@ -79,8 +128,36 @@ static gpointer thread_calling_pthread_setspecific (gpointer data);
 #ifdef HAVE_WINDOWS
 static gpointer hit_target_function_repeatedly (gpointer data);
 #endif
+static gpointer call_nop_function_once_started (gpointer data);
+static void patch_functions_while_other_thread_calls_them (
+    TestInterceptorFixture * fixture);
+static gpointer call_nop_functions_until_done (gpointer data);
 static gpointer replacement_malloc (gsize size);
 static gpointer replacement_target_function (GString * str);
+static gpointer fast_replacement_nop_function (gpointer data);
+static void count_on_enter (guint * count, GumInvocationContext * context);
+static void count_on_enter_atomically (volatile gint * count,
+    GumInvocationContext * context);
+static void check_current_invocation_on_enter (guint * count,
+    GumInvocationContext * context);
+static void detach_first_listener_on_enter (TestInterceptorFixture * fixture,
+    GumInvocationContext * context);
+static void store_small_invocation_data_on_enter (guint * count,
+    GumInvocationContext * context);
+static void check_large_invocation_data_on_leave (guint * count,
+    GumInvocationContext * context);
+static void interceptor_benchmark_run (InterceptorBenchmark * self,
+    const gchar * scenario);
+static gpointer interceptor_benchmark_contend (gpointer data);
+static gpointer interceptor_benchmark_call_repeatedly (gpointer data);
+static TestCallbackListener * interceptor_benchmark_attach (
+    InterceptorBenchmark * self, GumListenerProfile profile);
+static void interceptor_benchmark_detach (InterceptorBenchmark * self,
+    TestCallbackListener * listener);
+static void do_nothing_on_invocation (gpointer user_data,
+    GumInvocationContext * context);
+static gpointer replacement_nop_function (gpointer data);
+static gpointer recursive_nop_function (gpointer data);
 
 TESTCASE (attach_one)
 {
@@ -97,6 +174,178 @@ TESTCASE (attach_two)
   g_assert_cmpstr (fixture->result->str, ==, "ac|bd");
 }
 
+TESTCASE (lazy_trampoline_should_be_materialized_on_first_call)
+{
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, TRUE);
+  interceptor_fixture_attach (fixture, 0, target_function, 'a', 'b');
+  interceptor_fixture_attach (fixture, 1, target_function, 'c', 'd');
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, FALSE);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "ac|bd");
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "ac|bdac|bd");
+
+  interceptor_fixture_detach (fixture, 0);
+  g_string_truncate (fixture->result, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "c|d");
+}
+
+TESTCASE (lazy_trampoline_should_support_detach_before_first_call)
+{
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, TRUE);
+  interceptor_fixture_attach (fixture, 0, target_function, '>', '<');
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, FALSE);
+
+  interceptor_fixture_detach (fixture, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+
+  interceptor_fixture_attach (fixture, 0, target_function, '>', '<');
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|>|<");
+}
+
+TESTCASE (lazy_trampoline_should_support_concurrent_first_calls)
+{
+  TestCallbackListener * listener;
+  volatile gint count = 0;
+  volatile gint started = FALSE;
+  GThread * threads[8];
+  guint i;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_on_enter_atomically;
+  listener->user_data = (gpointer) &count;
+
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, TRUE);
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_OK);
+  gum_interceptor_set_lazy_trampolines (fixture->interceptor, FALSE);
+
+  for (i = 0; i != G_N_ELEMENTS (threads); i++)
+  {
+    threads[i] = g_thread_new ("interceptor-test-lazy-caller",
+        call_nop_function_once_started, (gpointer) &started);
+  }
+
+  g_atomic_int_set (&started, TRUE);
+
+  for (i = 0; i != G_N_ELEMENTS (threads); i++)
+    g_thread_join (threads[i]);
+
+  /*
+   * Calls that raced with the materialization may go unnoticed, but once it
+   * is done every call must be seen.
+   */
+  g_assert_cmpint (count, <=, G_N_ELEMENTS (threads) * 100);
+
+  count = 0;
+  target_nop_function_a (NULL);
+  g_assert_cmpint (count, ==, 1);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static gpointer
+call_nop_function_once_started (gpointer data)
+{
+  volatile gint * started = data;
+  guint i;
+
+  while (!g_atomic_int_get (started))
+    g_thread_yield ();
+
+  for (i = 0; i != 100; i++)
+    target_nop_function_a (NULL);
+
+  return NULL;
+}
+
+TESTCASE (batched_transaction_should_not_disturb_other_threads)
+{
+  patch_functions_while_other_thread_calls_them (fixture);
+}
+
+TESTCASE (stop_the_world_should_not_disturb_other_threads)
+{
+  gum_interceptor_set_stop_the_world (fixture->interceptor, TRUE);
+  patch_functions_while_other_thread_calls_them (fixture);
+  gum_interceptor_set_stop_the_world (fixture->interceptor, FALSE);
+}
+
+static void
+patch_functions_while_other_thread_calls_them (TestInterceptorFixture * fixture)
+{
+  TestCallbackListener * listener;
+  guint count;
+  volatile gboolean done = FALSE;
+  GThread * th;
+  guint i;
+
+  count = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_on_enter;
+  listener->user_data = &count;
+
+  th = g_thread_new ("interceptor-test-patching",
+      call_nop_functions_until_done, (gpointer) &done);
+
+  for (i = 0; i != 10; i++)
+  {
+    gum_interceptor_begin_transaction (fixture->interceptor);
+    gum_interceptor_attach (fixture->interceptor, target_nop_function_a,
+        GUM_INVOCATION_LISTENER (listener), NULL);
+    gum_interceptor_attach (fixture->interceptor, target_nop_function_b,
+        GUM_INVOCATION_LISTENER (listener), NULL);
+    gum_interceptor_end_transaction (fixture->interceptor);
+
+    gum_interceptor_detach (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (listener));
+  }
+
+  done = TRUE;
+  g_thread_join (th);
+
+  count = 0;
+  gum_interceptor_begin_transaction (fixture->interceptor);
+  gum_interceptor_attach (fixture->interceptor, target_nop_function_a,
+      GUM_INVOCATION_LISTENER (listener), NULL);
+  gum_interceptor_attach (fixture->interceptor, target_nop_function_b,
+      GUM_INVOCATION_LISTENER (listener), NULL);
+  gum_interceptor_end_transaction (fixture->interceptor);
+
+  target_nop_function_a (NULL);
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (count, ==, 2);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static gpointer
+call_nop_functions_until_done (gpointer data)
+{
+  volatile gboolean * done = data;
+
+  while (!*done)
+  {
+    target_nop_function_a (NULL);
+    target_nop_function_b (NULL);
+  }
+
+  return NULL;
+}
+
 void GUM_NOINLINE
 recursive_function (GString * str,
                     gint count)
@@ -357,6 +606,34 @@ TESTCASE (detach)
   g_assert_cmpstr (fixture->result->str, ==, "c|d");
 }
 
+TESTCASE (detach_should_stop_leave_of_in_flight_call)
+{
+  TestCallbackListener * listener;
+
+  interceptor_fixture_attach (fixture, 0, target_function, 'a', 'b');
+
+  listener = test_callback_listener_new ();
+  listener->on_enter =
+      (TestCallbackListenerFunc) detach_first_listener_on_enter;
+  listener->user_data = fixture;
+  gum_interceptor_attach (fixture->interceptor, target_function,
+      GUM_INVOCATION_LISTENER (listener), NULL);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "a|");
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static void
+detach_first_listener_on_enter (TestInterceptorFixture * fixture,
+                                GumInvocationContext * context)
+{
+  interceptor_fixture_detach (fixture, 0);
+}
+
 TESTCASE (listener_ref_count)
 {
   interceptor_fixture_attach (fixture, 0, target_function, 'a', 'b');
@@ -443,6 +720,537 @@ TESTCASE (function_data)
   g_object_unref (fd_listener);
 }
 
+TESTCASE (invocation_data_should_be_sized_at_attach_time)
+{
+  TestFunctionDataListener * fd_listeners[3];
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (fd_listeners); i++)
+  {
+    fd_listeners[i] = g_object_new (TEST_TYPE_FUNCTION_DATA_LISTENER, NULL);
+    g_assert_cmpint (gum_interceptor_attach_full (fixture->interceptor,
+        target_nop_function_a, GUM_INVOCATION_LISTENER (fd_listeners[i]),
+        NULL, GUM_LISTENER_PROFILE_FULL, sizeof (TestFuncInvState)), ==,
+        GUM_ATTACH_OK);
+  }
+
+  target_nop_function_a ("badger");
+
+  for (i = 0; i != G_N_ELEMENTS (fd_listeners); i++)
+  {
+    TestFunctionDataListener * fd_listener = fd_listeners[i];
+
+    g_assert_cmpuint (fd_listener->on_enter_call_count, ==, 1);
+    g_assert_cmpuint (fd_listener->on_leave_call_count, ==, 1);
+    g_assert_cmpstr (fd_listener->last_on_leave_data.invocation_data.arg,
+        ==, "badger");
+
+    gum_interceptor_detach (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (fd_listener));
+    g_object_unref (fd_listener);
+  }
+}
+
+TESTCASE (invocation_data_should_grow_on_demand)
+{
+  TestCallbackListener * listeners[2];
+  guint count = 0;
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (listeners); i++)
+  {
+    TestCallbackListener * listener;
+
+    listener = test_callback_listener_new ();
+    listener->on_enter =
+        (TestCallbackListenerFunc) store_small_invocation_data_on_enter;
+    listener->on_leave =
+        (TestCallbackListenerFunc) check_large_invocation_data_on_leave;
+    listener->user_data = &count;
+
+    g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+        target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+        GUM_ATTACH_OK);
+
+    listeners[i] = listener;
+  }
+
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (count, ==, 2);
+
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (count, ==, 4);
+
+  for (i = 0; i != G_N_ELEMENTS (listeners); i++)
+  {
+    gum_interceptor_detach (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (listeners[i]));
+    g_object_unref (listeners[i]);
+  }
+}
+
+static void
+store_small_invocation_data_on_enter (guint * count,
+                                      GumInvocationContext * context)
+{
+  guint64 * data;
+
+  data = gum_invocation_context_get_listener_invocation_data (context,
+      sizeof (guint64));
+  g_assert_cmpuint (*data, ==, 0);
+
+  *data = G_GUINT64_CONSTANT (0x1337133713371337);
+}
+
+static void
+check_large_invocation_data_on_leave (guint * count,
+                                      GumInvocationContext * context)
+{
+  guint8 * data;
+  guint i;
+
+  data = gum_invocation_context_get_listener_invocation_data (context, 256);
+  g_assert_nonnull (data);
+  g_assert_cmpuint (*((guint64 *) data), ==,
+      G_GUINT64_CONSTANT (0x1337133713371337));
+  for (i = sizeof (guint64); i != 256; i++)
+    g_assert_cmpuint (data[i], ==, 0);
+
+  (*count)++;
+}
+
+TESTCASE (lightweight_listener_should_only_see_enter)
+{
+  interceptor_fixture_attach_with_profile (fixture, 0, target_function,
+      '>', '<', GUM_LISTENER_PROFILE_LIGHTWEIGHT);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|");
+}
+
+TESTCASE (lightweight_listener_should_coexist_with_full_listener)
+{
+  interceptor_fixture_attach_with_profile (fixture, 0, target_function,
+      'a', 'b', GUM_LISTENER_PROFILE_LIGHTWEIGHT);
+  interceptor_fixture_attach (fixture, 1, target_function, 'c', 'd');
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "ac|d");
+
+  interceptor_fixture_detach (fixture, 1);
+  g_string_truncate (fixture->result, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "a|");
+
+  interceptor_fixture_attach (fixture, 1, target_function, 'e', 'f');
+  g_string_truncate (fixture->result, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "ae|f");
+}
+
+TESTCASE (lightweight_listener_should_see_arguments)
+{
+  interceptor_fixture_attach_with_profile (fixture, 0, target_nop_function_a,
+      'a', 'b', GUM_LISTENER_PROFILE_LIGHTWEIGHT);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x12349876));
+  g_assert_cmpstr (fixture->result->str, ==, "a");
+  g_assert_cmphex (fixture->listener_context[0]->last_seen_argument,
+      ==, 0x12349876);
+  g_assert_cmpuint (fixture->listener_context[0]->last_thread_id, ==,
+      gum_process_get_current_thread_id ());
+}
+
+TESTCASE (lightweight_listener_should_respect_ignore_current_thread)
+{
+  interceptor_fixture_attach_with_profile (fixture, 0, target_function,
+      '>', '<', GUM_LISTENER_PROFILE_LIGHTWEIGHT);
+
+  gum_interceptor_ignore_current_thread (fixture->interceptor);
+  target_function (fixture->result);
+  gum_interceptor_unignore_current_thread (fixture->interceptor);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|>|");
+}
+
+TESTCASE (lightweight_listener_should_see_current_invocation)
+{
+  TestCallbackListener * listener;
+  guint count;
+
+  count = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter =
+      (TestCallbackListenerFunc) check_current_invocation_on_enter;
+  listener->user_data = &count;
+
+  g_assert_cmpint (gum_interceptor_attach_with_profile (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL,
+      GUM_LISTENER_PROFILE_LIGHTWEIGHT), ==, GUM_ATTACH_OK);
+
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (count, ==, 1);
+  g_assert_null (gum_interceptor_get_current_invocation ());
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+TESTCASE (lightweight_listener_performance)
+{
+  const guint n = 1000000;
+  gpointer (* volatile target) (gpointer data) = target_nop_function_a;
+  GumListenerProfile profiles[] = {
+    GUM_LISTENER_PROFILE_FULL,
+    GUM_LISTENER_PROFILE_LIGHTWEIGHT,
+  };
+  gdouble durations[G_N_ELEMENTS (profiles)];
+  GTimer * timer;
+  guint p;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  timer = g_timer_new ();
+
+  for (p = 0; p != G_N_ELEMENTS (profiles); p++)
+  {
+    TestCallbackListener * listener;
+    guint count, i;
+
+    count = 0;
+
+    listener = test_callback_listener_new ();
+    listener->on_enter = (TestCallbackListenerFunc) count_on_enter;
+    listener->user_data = &count;
+
+    g_assert_cmpint (gum_interceptor_attach_with_profile (fixture->interceptor,
+        target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL,
+        profiles[p]), ==, GUM_ATTACH_OK);
+
+    g_timer_reset (timer);
+    for (i = 0; i != n; i++)
+      target (NULL);
+    durations[p] = g_timer_elapsed (timer, NULL);
+
+    gum_interceptor_detach (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (listener));
+    g_object_unref (listener);
+
+    g_assert_cmpuint (count, ==, n);
+  }
+
+  g_timer_destroy (timer);
+
+  g_print ("<calls=%u full=%f lightweight=%f ratio=%f> ", n, durations[0],
+      durations[1], durations[0] / durations[1]);
+}
+
+static void
+count_on_enter (guint * count,
+                GumInvocationContext * context)
+{
+  (*count)++;
+}
+
+static void
+count_on_enter_atomically (volatile gint * count,
+                           GumInvocationContext * context)
+{
+  g_atomic_int_inc (count);
+}
+
+static void
+check_current_invocation_on_enter (guint * count,
+                                   GumInvocationContext * context)
+{
+  g_assert_true (gum_interceptor_get_current_invocation () == context);
+  g_assert_cmpuint (gum_invocation_context_get_depth (context), ==, 0);
+
+  (*count)++;
+}
+
+TESTCASE (probe_should_count_calls)
+{
+  GumProbeProgram program = { 0, };
+  GumProbe * probe, * other_probe;
+
+  program.count_calls = TRUE;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &probe), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &other_probe), ==,
+      GUM_ATTACH_ALREADY_ATTACHED);
+  g_assert_null (other_probe);
+
+  target_nop_function_a (NULL);
+  target_nop_function_a (NULL);
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (gum_probe_get_call_count (probe), ==, 3);
+
+  gum_interceptor_detach_probe (fixture->interceptor, probe);
+}
+
+TESTCASE (probe_should_record_arguments)
+{
+  GumProbeProgram program = { 0, };
+  GumProbe * probe;
+  GumProbeRecord records[4];
+  guint64 n_dropped;
+
+  program.n_arguments = 1;
+  program.arguments[0] = 0;
+  program.capacity = 16;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &probe), ==, GUM_ATTACH_OK);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x1234));
+  target_nop_function_a (GSIZE_TO_POINTER (0x5678));
+  g_assert_cmpuint (gum_probe_get_call_count (probe), ==, 0);
+
+  g_assert_cmpuint (gum_probe_drain (probe, records, G_N_ELEMENTS (records),
+      &n_dropped), ==, 2);
+  g_assert_cmpuint (n_dropped, ==, 0);
+  g_assert_cmphex (GPOINTER_TO_SIZE (records[0].arguments[0]), ==, 0x1234);
+  g_assert_cmphex (GPOINTER_TO_SIZE (records[1].arguments[0]), ==, 0x5678);
+
+  g_assert_cmpuint (gum_probe_drain (probe, records, G_N_ELEMENTS (records),
+      &n_dropped), ==, 0);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x9abc));
+  g_assert_cmpuint (gum_probe_drain (probe, records, G_N_ELEMENTS (records),
+      NULL), ==, 1);
+  g_assert_cmphex (GPOINTER_TO_SIZE (records[0].arguments[0]), ==, 0x9abc);
+
+  gum_interceptor_detach_probe (fixture->interceptor, probe);
+}
+
+TESTCASE (probe_should_report_dropped_records)
+{
+  GumProbeProgram program = { 0, };
+  GumProbe * probe;
+  GumProbeRecord records[8];
+  guint64 n_dropped;
+  guint i;
+
+  program.count_calls = TRUE;
+  program.n_arguments = 1;
+  program.arguments[0] = 0;
+  program.capacity = 3;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &probe), ==, GUM_ATTACH_OK);
+
+  for (i = 0; i != 10; i++)
+    target_nop_function_a (GSIZE_TO_POINTER (i));
+  g_assert_cmpuint (gum_probe_get_call_count (probe), ==, 10);
+
+  g_assert_cmpuint (gum_probe_drain (probe, records, G_N_ELEMENTS (records),
+      &n_dropped), ==, 4);
+  g_assert_cmpuint (n_dropped, ==, 6);
+  for (i = 0; i != 4; i++)
+  {
+    g_assert_cmpuint (GPOINTER_TO_SIZE (records[i].arguments[0]), ==,
+        6 + i);
+  }
+
+  gum_interceptor_detach_probe (fixture->interceptor, probe);
+}
+
+TESTCASE (probe_should_coexist_with_listener)
+{
+  GumProbeProgram program = { 0, };
+  GumProbe * probe;
+  GumProbeRecord record;
+
+  program.count_calls = TRUE;
+  program.n_arguments = 1;
+  program.arguments[0] = 0;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &probe), ==, GUM_ATTACH_OK);
+  interceptor_fixture_attach (fixture, 0, target_nop_function_a, 'a', 'b');
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x4321));
+  g_assert_cmpstr (fixture->result->str, ==, "ab");
+  g_assert_cmpuint (gum_probe_get_call_count (probe), ==, 1);
+  g_assert_cmpuint (gum_probe_drain (probe, &record, 1, NULL), ==, 1);
+  g_assert_cmphex (GPOINTER_TO_SIZE (record.arguments[0]), ==, 0x4321);
+
+  gum_interceptor_detach_probe (fixture->interceptor, probe);
+
+  target_nop_function_a (NULL);
+  g_assert_cmpstr (fixture->result->str, ==, "abab");
+}
+
+TESTCASE (probe_performance)
+{
+  const guint n = 1000000;
+  gpointer (* volatile target) (gpointer data) = target_nop_function_a;
+  GumProbeProgram program = { 0, };
+  GumProbe * probe;
+  TestCallbackListener * listener;
+  GTimer * timer;
+  gdouble listener_duration, probe_duration;
+  guint count, i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  timer = g_timer_new ();
+
+  count = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_on_enter;
+  listener->user_data = &count;
+
+  g_assert_cmpint (gum_interceptor_attach_with_profile (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL,
+      GUM_LISTENER_PROFILE_LIGHTWEIGHT), ==, GUM_ATTACH_OK);
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+    target (NULL);
+  listener_duration = g_timer_elapsed (timer, NULL);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+
+  g_assert_cmpuint (count, ==, n);
+
+  program.count_calls = TRUE;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_nop_function_a, &program, &probe), ==, GUM_ATTACH_OK);
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+    target (NULL);
+  probe_duration = g_timer_elapsed (timer, NULL);
+
+  g_assert_cmpuint (gum_probe_get_call_count (probe), ==, n);
+
+  gum_interceptor_detach_probe (fixture->interceptor, probe);
+
+  g_timer_destroy (timer);
+
+  g_print ("<calls=%u lightweight=%f probe=%f ratio=%f> ", n,
+      listener_duration, probe_duration, listener_duration / probe_duration);
+}
+
+TESTCASE (statistics_should_count_calls)
+{
+  GumInvocationStatistics stats;
+
+  g_assert_false (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+
+  g_assert_cmpint (gum_interceptor_enable_statistics (fixture->interceptor,
+      target_nop_function_a), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_enable_statistics (fixture->interceptor,
+      target_nop_function_a), ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  g_assert_true (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+  g_assert_cmpuint (stats.calls, ==, 0);
+  g_assert_cmpuint (stats.total_ticks, ==, 0);
+  g_assert_cmpuint (stats.min_ticks, ==, 0);
+  g_assert_cmpuint (stats.max_ticks, ==, 0);
+
+  g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_a (NULL)), ==,
+      0x1337);
+  target_nop_function_a (NULL);
+  target_nop_function_a (NULL);
+
+  g_assert_true (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+  g_assert_cmpuint (stats.calls, ==, 3);
+  g_assert_cmpuint (stats.min_ticks, <=, stats.max_ticks);
+  g_assert_cmpuint (stats.total_ticks, >=, stats.max_ticks);
+
+  gum_interceptor_disable_statistics (fixture->interceptor,
+      target_nop_function_a);
+
+  g_assert_false (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+  g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_a (NULL)), ==,
+      0x1337);
+}
+
+TESTCASE (statistics_should_coexist_with_lightweight_listener)
+{
+  TestCallbackListener * listener;
+  GumInvocationStatistics stats;
+  guint count;
+
+  count = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_on_enter;
+  listener->user_data = &count;
+
+  g_assert_cmpint (gum_interceptor_attach_with_profile (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL,
+      GUM_LISTENER_PROFILE_LIGHTWEIGHT), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_enable_statistics (fixture->interceptor,
+      target_nop_function_a), ==, GUM_ATTACH_OK);
+
+  target_nop_function_a (NULL);
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (count, ==, 2);
+
+  g_assert_true (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+  g_assert_cmpuint (stats.calls, ==, 2);
+
+  gum_interceptor_disable_statistics (fixture->interceptor,
+      target_nop_function_a);
+
+  target_nop_function_a (NULL);
+  g_assert_cmpuint (count, ==, 3);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+TESTCASE (statistics_should_not_count_ignored_threads)
+{
+  GumInvocationStatistics stats;
+
+  g_assert_cmpint (gum_interceptor_enable_statistics (fixture->interceptor,
+      target_nop_function_a), ==, GUM_ATTACH_OK);
+
+  gum_interceptor_ignore_current_thread (fixture->interceptor);
+  target_nop_function_a (NULL);
+  gum_interceptor_unignore_current_thread (fixture->interceptor);
+
+  target_nop_function_a (NULL);
+
+  g_assert_true (gum_interceptor_get_statistics (fixture->interceptor,
+      target_nop_function_a, &stats));
+  g_assert_cmpuint (stats.calls, ==, 1);
+
+  gum_interceptor_disable_statistics (fixture->interceptor,
+      target_nop_function_a);
+}
+
 #ifdef HAVE_I386
 
 TESTCASE (cpu_register_clobber)
@@ -708,6 +1516,61 @@ replacement_target_function (GString * str)
   return result;
 }
 
+static gpointer (* original_nop_function_a) (gpointer data);
+
+TESTCASE (replace_fast)
+{
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_nop_function_a, fast_replacement_nop_function,
+      (gpointer *) &original_nop_function_a), ==, GUM_REPLACE_OK);
+  g_assert_nonnull (original_nop_function_a);
+
+  g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_a (
+      GSIZE_TO_POINTER (0x1000))), ==, 0x2337);
+  g_assert_cmphex (GPOINTER_TO_SIZE (original_nop_function_a (NULL)), ==,
+      0x1337);
+
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_nop_function_a, fast_replacement_nop_function,
+      (gpointer *) &original_nop_function_a), ==,
+      GUM_REPLACE_ALREADY_REPLACED);
+
+  gum_interceptor_revert (fixture->interceptor, target_nop_function_a);
+
+  g_assert_cmphex (GPOINTER_TO_SIZE (target_nop_function_a (
+      GSIZE_TO_POINTER (0x1000))), ==, 0x1337);
+}
+
+TESTCASE (replace_fast_should_not_coexist_with_listeners)
+{
+  gpointer original;
+  GumProbeProgram program = { 0, };
+  GumProbe * probe;
+
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_function, replacement_target_function, &original), ==,
+      GUM_REPLACE_OK);
+  g_assert_cmpint (interceptor_fixture_try_attach (fixture, 0,
+      target_function, '>', '<'), ==, GUM_ATTACH_WRONG_TYPE);
+  program.count_calls = TRUE;
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, &program, &probe), ==, GUM_ATTACH_WRONG_TYPE);
+  gum_interceptor_revert (fixture->interceptor, target_function);
+
+  interceptor_fixture_attach (fixture, 0, target_function, '>', '<');
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_function, replacement_target_function, &original), ==,
+      GUM_REPLACE_WRONG_TYPE);
+  g_assert_null (original);
+}
+
+static gpointer
+fast_replacement_nop_function (gpointer data)
+{
+  return GSIZE_TO_POINTER (GPOINTER_TO_SIZE (data) +
+      GPOINTER_TO_SIZE (original_nop_function_a (data)));
+}
+
 TESTCASE (i_can_has_replaceability)
 {
   UnsupportedFunction * unsupported_functions;
@@ -834,3 +1697,269 @@ replacement_malloc (gsize size)
 
   return GSIZE_TO_POINTER (size);
 }
+
+#define INTERCEPTOR_BENCHMARK_CALLS 1000000
+#define INTERCEPTOR_BENCHMARK_MAX_THREADS 8
+
+TESTCASE (call_to_unhooked_function)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+
+  benchmark.target = target_nop_function_a;
+
+  interceptor_benchmark_run (&benchmark, "unhooked");
+}
+
+TESTCASE (call_to_replaced_function)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+
+  benchmark.target = target_nop_function_a;
+
+  g_assert_cmpint (gum_interceptor_replace (fixture->interceptor,
+      target_nop_function_a, replacement_nop_function, NULL), ==,
+      GUM_REPLACE_OK);
+
+  interceptor_benchmark_run (&benchmark, "replaced");
+
+  gum_interceptor_revert (fixture->interceptor, target_nop_function_a);
+}
+
+TESTCASE (call_to_fast_replaced_function)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  gpointer original;
+
+  benchmark.target = target_nop_function_a;
+
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_nop_function_a, replacement_nop_function, &original), ==,
+      GUM_REPLACE_OK);
+
+  interceptor_benchmark_run (&benchmark, "fast_replaced");
+
+  gum_interceptor_revert (fixture->interceptor, target_nop_function_a);
+}
+
+TESTCASE (call_with_enter_only_listener)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  TestCallbackListener * listener;
+
+  benchmark.target = target_nop_function_a;
+
+  listener = interceptor_benchmark_attach (&benchmark,
+      GUM_LISTENER_PROFILE_ENTER_ONLY);
+  interceptor_benchmark_run (&benchmark, "enter_only");
+  interceptor_benchmark_detach (&benchmark, listener);
+}
+
+TESTCASE (call_with_enter_and_leave_listener)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  TestCallbackListener * listener;
+
+  benchmark.target = target_nop_function_a;
+
+  listener = interceptor_benchmark_attach (&benchmark,
+      GUM_LISTENER_PROFILE_FULL);
+  interceptor_benchmark_run (&benchmark, "enter_leave");
+  interceptor_benchmark_detach (&benchmark, listener);
+}
+
+TESTCASE (call_with_two_listeners)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  TestCallbackListener * first, * second;
+
+  benchmark.target = target_nop_function_a;
+
+  first = interceptor_benchmark_attach (&benchmark, GUM_LISTENER_PROFILE_FULL);
+  second = interceptor_benchmark_attach (&benchmark, GUM_LISTENER_PROFILE_FULL);
+  interceptor_benchmark_run (&benchmark, "two_listeners");
+  interceptor_benchmark_detach (&benchmark, second);
+  interceptor_benchmark_detach (&benchmark, first);
+}
+
+TESTCASE (recursive_call_with_listener)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  TestCallbackListener * listener;
+
+  benchmark.target = recursive_nop_function;
+  benchmark.recursion_depth = 7;
+
+  listener = interceptor_benchmark_attach (&benchmark,
+      GUM_LISTENER_PROFILE_FULL);
+  interceptor_benchmark_run (&benchmark, "recursive");
+  interceptor_benchmark_detach (&benchmark, listener);
+}
+
+TESTCASE (call_from_ignored_thread)
+{
+  InterceptorBenchmark benchmark = { fixture->interceptor, };
+  TestCallbackListener * listener;
+
+  benchmark.target = target_nop_function_a;
+  benchmark.ignore_current_thread = TRUE;
+
+  listener = interceptor_benchmark_attach (&benchmark,
+      GUM_LISTENER_PROFILE_FULL);
+  interceptor_benchmark_run (&benchmark, "ignored");
+  interceptor_benchmark_detach (&benchmark, listener);
+}
+
+/*
+ * Reports the cost of each hooked call in nanoseconds, first on a single
+ * thread and then with several threads hammering the same function, as one
+ * line of key=value pairs that is easy to scrape and compare across runs.
+ * The contended timing starts once every thread is waiting at the starting
+ * line, so thread creation and teardown are not part of it.
+ */
+static void
+interceptor_benchmark_run (InterceptorBenchmark * self,
+                           const gchar * scenario)
+{
+  const guint n = INTERCEPTOR_BENCHMARK_CALLS;
+  GThread * threads[INTERCEPTOR_BENCHMARK_MAX_THREADS];
+  guint n_threads, calls_per_iteration, i;
+  GTimer * timer;
+  gdouble single_duration, contended_duration;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  n_threads = CLAMP (g_get_num_processors (), 2,
+      INTERCEPTOR_BENCHMARK_MAX_THREADS);
+  calls_per_iteration = self->recursion_depth + 1;
+
+  interceptor_benchmark_call_repeatedly (self);
+
+  timer = g_timer_new ();
+
+  interceptor_benchmark_call_repeatedly (self);
+  single_duration = g_timer_elapsed (timer, NULL);
+
+  self->n_ready = 0;
+  self->n_done = 0;
+  self->started = FALSE;
+  for (i = 0; i != n_threads; i++)
+  {
+    threads[i] = g_thread_new ("interceptor-benchmark",
+        interceptor_benchmark_contend, self);
+  }
+  while (g_atomic_int_get (&self->n_ready) != (gint) n_threads)
+    g_thread_yield ();
+
+  g_timer_reset (timer);
+  g_atomic_int_set (&self->started, TRUE);
+  while (g_atomic_int_get (&self->n_done) != (gint) n_threads)
+    g_thread_yield ();
+  contended_duration = g_timer_elapsed (timer, NULL);
+
+  for (i = 0; i != n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_timer_destroy (timer);
+
+  g_print ("<scenario=%s calls=%u ns_per_call=%.2f threads=%u "
+      "contended_ns_per_call=%.2f> ", scenario, n * calls_per_iteration,
+      single_duration * 1e9 / (n * calls_per_iteration), n_threads,
+      contended_duration * 1e9 / (n * calls_per_iteration));
+}
+
+static gpointer
+interceptor_benchmark_contend (gpointer data)
+{
+  InterceptorBenchmark * self = data;
+
+  g_atomic_int_inc (&self->n_ready);
+  while (!g_atomic_int_get (&self->started))
+    ;
+
+  interceptor_benchmark_call_repeatedly (self);
+
+  g_atomic_int_inc (&self->n_done);
+
+  return NULL;
+}
+
+static gpointer
+interceptor_benchmark_call_repeatedly (gpointer data)
+{
+  InterceptorBenchmark * self = data;
+  gpointer (* volatile target) (gpointer data) = self->target;
+  gpointer argument;
+  guint i;
+
+  argument = GSIZE_TO_POINTER (self->recursion_depth);
+
+  if (self->ignore_current_thread)
+    gum_interceptor_ignore_current_thread (self->interceptor);
+
+  for (i = 0; i != INTERCEPTOR_BENCHMARK_CALLS; i++)
+    target (argument);
+
+  if (self->ignore_current_thread)
+    gum_interceptor_unignore_current_thread (self->interceptor);
+
+  return NULL;
+}
+
+static TestCallbackListener *
+interceptor_benchmark_attach (InterceptorBenchmark * self,
+                              GumListenerProfile profile)
+{
+  TestCallbackListener * listener;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = do_nothing_on_invocation;
+  if ((profile & GUM_LISTENER_PROFILE_ENTER_ONLY) == 0)
+    listener->on_leave = do_nothing_on_invocation;
+
+  g_assert_cmpint (gum_interceptor_attach_with_profile (self->interceptor,
+      self->target, GUM_INVOCATION_LISTENER (listener), NULL, profile), ==,
+      GUM_ATTACH_OK);
+
+  return listener;
+}
+
+static void
+interceptor_benchmark_detach (InterceptorBenchmark * self,
+                              TestCallbackListener * listener)
+{
+  gum_interceptor_detach (self->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static void
+do_nothing_on_invocation (gpointer user_data,
+                          GumInvocationContext * context)
+{
+}
+
+static gpointer
+replacement_nop_function (gpointer data)
+{
+  return data;
+}
+
+static gpointer GUM_NOINLINE
+recursive_nop_function (gpointer data)
+{
+  gsize depth = GPOINTER_TO_SIZE (data);
+  volatile gsize result = depth;
+
+  /*
+   * Reading back a local after the call keeps it from becoming a tail call
+   * without having every thread write to the same cache line.
+   */
+  if (depth != 0)
+    recursive_nop_function (GSIZE_TO_POINTER (depth - 1));
+
+  return GSIZE_TO_POINTER (result);
+}
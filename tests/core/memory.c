@@ -25,6 +25,11 @@ TESTLIST_BEGIN (memory)
   TESTENTRY (scan_range_finds_three_exact_matches)
   TESTENTRY (scan_range_finds_three_wildcarded_matches)
   TESTENTRY (scan_range_finds_three_masked_matches)
+  TESTENTRY (scan_range_finds_matches_across_vector_boundaries)
+  TESTENTRY (scan_range_finds_matches_of_multiple_patterns)
+  TESTENTRY (scan_range_for_multiple_patterns_overlaps_like_single_scan)
+  TESTENTRY (scan_range_performance)
+  TESTENTRY (scan_ranges_in_parallel_finds_same_matches_as_sequential_scan)
   TESTENTRY (is_memory_readable_handles_mixed_page_protections)
   TESTENTRY (alloc_n_pages_returns_aligned_rw_address)
   TESTENTRY (alloc_n_pages_near_returns_aligned_rw_address_within_range)
@@ -41,8 +46,25 @@ typedef struct _TestForEachContext {
   guint expected_size;
 } TestForEachContext;
 
+typedef struct _TestMultiMatch {
+  guint pattern_index;
+  GumAddress address;
+} TestMultiMatch;
+
 static gboolean match_found_cb (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean store_match (GumAddress address, gsize size,
+    gpointer user_data);
+static gboolean store_multi_match (guint pattern_index, GumAddress address,
+    gsize size, gpointer user_data);
+static guint count_matches_legacy (const GumMemoryRange * range,
+    const GumMatchPattern * pattern);
+static GumMatchToken * legacy_get_longest_token (
+    const GumMatchPattern * pattern, GumMatchType type);
+static gboolean legacy_try_match_on (const GumMatchPattern * pattern,
+    const guint8 * bytes);
+static gint legacy_memcmp_mask (const guint8 * haystack, const guint8 * needle,
+    const guint8 * mask, guint len);
 
 TESTCASE (read_from_valid_address_should_succeed)
 {
@@ -376,6 +398,319 @@ TESTCASE (scan_range_finds_three_masked_matches)
   gum_match_pattern_free (pattern);
 }
 
+TESTCASE (scan_range_finds_matches_across_vector_boundaries)
+{
+  const guint offsets[] = { 0, 12, 17, 28, 32, 63, 100, 250 };
+  guint8 buf[256];
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  GArray * matches;
+  guint i;
+
+  memset (buf, 0x13, sizeof (buf));
+  for (i = 0; i != G_N_ELEMENTS (offsets); i++)
+  {
+    buf[offsets[i] + 0] = 0xc0;
+    buf[offsets[i] + 1] = 0x01;
+    buf[offsets[i] + 2] = 0xca;
+    buf[offsets[i] + 3] = 0xfe;
+  }
+  buf[sizeof (buf) - 2] = 0xc0;
+  buf[sizeof (buf) - 1] = 0x01;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+
+  pattern = gum_match_pattern_new_from_string ("c0 01 ca fe");
+  gum_memory_scan (&range, pattern, store_match, matches);
+  g_assert_cmpuint (matches->len, ==, G_N_ELEMENTS (offsets));
+  for (i = 0; i != G_N_ELEMENTS (offsets); i++)
+  {
+    g_assert_cmphex (g_array_index (matches, GumAddress, i), ==,
+        GUM_ADDRESS (buf + offsets[i]));
+  }
+  gum_match_pattern_free (pattern);
+
+  g_array_set_size (matches, 0);
+
+  pattern = gum_match_pattern_new_from_string ("c0 01 ?? fe : ff 0f 00 f0");
+  gum_memory_scan (&range, pattern, store_match, matches);
+  g_assert_cmpuint (matches->len, ==, G_N_ELEMENTS (offsets));
+  for (i = 0; i != G_N_ELEMENTS (offsets); i++)
+  {
+    g_assert_cmphex (g_array_index (matches, GumAddress, i), ==,
+        GUM_ADDRESS (buf + offsets[i]));
+  }
+  gum_match_pattern_free (pattern);
+
+  g_array_free (matches, TRUE);
+}
+
+TESTCASE (scan_range_finds_matches_of_multiple_patterns)
+{
+  guint8 buf[] = {
+    0x13, 0x37,
+    0x12, 0x11, 0x13, 0x35,
+    0x13, 0x37,
+    0x72, 0xc0, 0x13, 0x37,
+    0x13, 0x37
+  };
+  GumMemoryRange range;
+  GumMatchPattern * patterns[2];
+  GArray * matches;
+  TestMultiMatch * m;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  patterns[0] = gum_match_pattern_new_from_string ("13 37");
+  patterns[1] = gum_match_pattern_new_from_string ("12 ?? 13 37 : 1f ff ff f1");
+
+  matches = g_array_new (FALSE, FALSE, sizeof (TestMultiMatch));
+
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), store_multi_match, matches);
+  g_assert_cmpuint (matches->len, ==, 6);
+
+  m = &g_array_index (matches, TestMultiMatch, 0);
+  g_assert_cmpuint (m->pattern_index, ==, 0);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 0));
+
+  m = &g_array_index (matches, TestMultiMatch, 1);
+  g_assert_cmpuint (m->pattern_index, ==, 1);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 2));
+
+  m = &g_array_index (matches, TestMultiMatch, 2);
+  g_assert_cmpuint (m->pattern_index, ==, 0);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 6));
+
+  m = &g_array_index (matches, TestMultiMatch, 3);
+  g_assert_cmpuint (m->pattern_index, ==, 1);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 8));
+
+  m = &g_array_index (matches, TestMultiMatch, 4);
+  g_assert_cmpuint (m->pattern_index, ==, 0);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 10));
+
+  m = &g_array_index (matches, TestMultiMatch, 5);
+  g_assert_cmpuint (m->pattern_index, ==, 0);
+  g_assert_cmphex (m->address, ==, GUM_ADDRESS (buf + 12));
+
+  g_array_free (matches, TRUE);
+
+  gum_match_pattern_free (patterns[1]);
+  gum_match_pattern_free (patterns[0]);
+}
+
+TESTCASE (scan_range_for_multiple_patterns_overlaps_like_single_scan)
+{
+  guint8 buf[] = { 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
+  const guint expected_offsets[] = { 0, 2, 4 };
+  GumMemoryRange range;
+  GumMatchPattern * patterns[2];
+  GArray * expected, * actual;
+  guint pattern_index, i;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  /* The needle is "41 41" at offset 2, so matches overlap by two bytes. */
+  patterns[0] = gum_match_pattern_new_from_string ("41 ?? 41 41");
+  patterns[1] = gum_match_pattern_new_from_string ("41 41 41");
+
+  actual = g_array_new (FALSE, FALSE, sizeof (TestMultiMatch));
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), store_multi_match, actual);
+
+  expected = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+
+  for (pattern_index = 0; pattern_index != G_N_ELEMENTS (patterns);
+      pattern_index++)
+  {
+    guint n = 0;
+
+    g_array_set_size (expected, 0);
+    gum_memory_scan (&range, patterns[pattern_index], store_match, expected);
+
+    for (i = 0; i != actual->len; i++)
+    {
+      TestMultiMatch * m = &g_array_index (actual, TestMultiMatch, i);
+
+      if (m->pattern_index != pattern_index)
+        continue;
+
+      g_assert_cmpuint (n, <, expected->len);
+      g_assert_cmphex (m->address, ==,
+          g_array_index (expected, GumAddress, n));
+      n++;
+    }
+    g_assert_cmpuint (n, ==, expected->len);
+
+    if (pattern_index == 0)
+    {
+      g_assert_cmpuint (expected->len, ==, G_N_ELEMENTS (expected_offsets));
+      for (i = 0; i != G_N_ELEMENTS (expected_offsets); i++)
+      {
+        g_assert_cmphex (g_array_index (expected, GumAddress, i), ==,
+            GUM_ADDRESS (buf + expected_offsets[i]));
+      }
+    }
+  }
+
+  for (i = 1; i < actual->len; i++)
+  {
+    g_assert_cmphex (g_array_index (actual, TestMultiMatch, i - 1).address,
+        <=, g_array_index (actual, TestMultiMatch, i).address);
+  }
+
+  g_array_free (expected, TRUE);
+  g_array_free (actual, TRUE);
+
+  gum_match_pattern_free (patterns[1]);
+  gum_match_pattern_free (patterns[0]);
+}
+
+TESTCASE (scan_range_performance)
+{
+  const gchar * pattern_strings[] = {
+    "48 8b 05 ?? ?? ?? ?? 48 85 c0",
+    "55 48 89 e5 41 57 41 56",
+    "e8 ?? ?? ?? ?? 84 c0 74",
+    "0f 1f 44 00 00 : ff ff ff 00 00",
+    "ff 25 ?? ?? ?? ?? 68",
+    "c0 01 ca fe",
+    "de ad be ef 13 37",
+    "13 37 ?? 42 : ff ff 00 f0",
+  };
+  const gsize size = 64 * 1024 * 1024;
+  guint8 * buf;
+  GRand * rand;
+  GumMemoryRange range;
+  GumMatchPattern * patterns[G_N_ELEMENTS (pattern_strings)];
+  GArray * matches;
+  GTimer * timer;
+  gdouble legacy_time, vector_time, multi_time;
+  guint legacy_matches, vector_matches, i;
+  gsize offset;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  buf = g_malloc (size);
+  rand = g_rand_new_with_seed (42);
+  for (offset = 0; offset != size; offset += sizeof (guint32))
+    *((guint32 *) (buf + offset)) = g_rand_int (rand);
+  g_rand_free (rand);
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = size;
+
+  for (i = 0; i != G_N_ELEMENTS (pattern_strings); i++)
+    patterns[i] = gum_match_pattern_new_from_string (pattern_strings[i]);
+
+  matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  timer = g_timer_new ();
+
+  legacy_matches = 0;
+  g_timer_start (timer);
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+    legacy_matches += count_matches_legacy (&range, patterns[i]);
+  legacy_time = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+    gum_memory_scan (&range, patterns[i], store_match, matches);
+  vector_time = g_timer_elapsed (timer, NULL);
+  vector_matches = matches->len;
+
+  g_array_free (matches, TRUE);
+  matches = g_array_new (FALSE, FALSE, sizeof (TestMultiMatch));
+
+  g_timer_start (timer);
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), store_multi_match, matches);
+  multi_time = g_timer_elapsed (timer, NULL);
+
+  g_assert_cmpuint (vector_matches, ==, legacy_matches);
+  g_assert_cmpuint (matches->len, ==, legacy_matches);
+
+  g_print ("<%u patterns over %u MB: legacy=%u ms scan=%u ms multi=%u ms> ",
+      (guint) G_N_ELEMENTS (patterns), (guint) (size / (1024 * 1024)),
+      (guint) (legacy_time * 1000.0),
+      (guint) (vector_time * 1000.0),
+      (guint) (multi_time * 1000.0));
+
+  g_timer_destroy (timer);
+  g_array_free (matches, TRUE);
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+    gum_match_pattern_free (patterns[i]);
+
+  g_free (buf);
+}
+
+TESTCASE (scan_ranges_in_parallel_finds_same_matches_as_sequential_scan)
+{
+  const guint8 needle[] = { 0x13, 0x37, 0x13, 0x37, 0x13 };
+  const gsize size = 10 * 1024 * 1024;
+  guint8 * buf;
+  GumMemoryRange ranges[3];
+  GumMatchPattern * pattern;
+  GArray * expected, * actual;
+  gsize offset;
+  guint i;
+
+  buf = g_malloc0 (size);
+
+  /*
+   * Sprinkle matches, some of which straddle the internal chunk boundaries,
+   * and a run of overlapping ones where the chunk after the boundary would
+   * find different matches than a scan continuing from before it.
+   */
+  for (offset = 4096; offset < size - 4096; offset += 256 * 1024)
+    memcpy (buf + offset, needle, sizeof (needle));
+  for (offset = (4 * 1024 * 1024) - 8; offset != (4 * 1024 * 1024) + 8;
+      offset += 2)
+  {
+    memcpy (buf + offset, needle, sizeof (needle));
+  }
+
+  ranges[0].base_address = GUM_ADDRESS (buf);
+  ranges[0].size = 7 * 1024 * 1024;
+  ranges[1].base_address = GUM_ADDRESS (buf + ranges[0].size + 3);
+  ranges[1].size = size - ranges[0].size - 3;
+  ranges[2].base_address = GUM_ADDRESS (buf);
+  ranges[2].size = 2;
+
+  pattern = gum_match_pattern_new_from_string ("13 37 13 37 13");
+
+  expected = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  for (i = 0; i != G_N_ELEMENTS (ranges); i++)
+    gum_memory_scan (&ranges[i], pattern, store_match, expected);
+  g_assert_cmpuint (expected->len, >, 0);
+
+  actual = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+  gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges), pattern, 4,
+      store_match, actual);
+
+  g_assert_cmpuint (actual->len, ==, expected->len);
+  for (i = 0; i != expected->len; i++)
+  {
+    g_assert_cmphex (g_array_index (actual, GumAddress, i), ==,
+        g_array_index (expected, GumAddress, i));
+  }
+
+  g_array_free (actual, TRUE);
+  g_array_free (expected, TRUE);
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
 TESTCASE (is_memory_readable_handles_mixed_page_protections)
 {
   guint8 * pages;
@@ -528,3 +863,166 @@ match_found_cb (GumAddress address,
 
   return ctx->value_to_return;
 }
+
+static gboolean
+store_match (GumAddress address,
+             gsize size,
+             gpointer user_data)
+{
+  GArray * matches = user_data;
+
+  g_array_append_val (matches, address);
+
+  return TRUE;
+}
+
+static gboolean
+store_multi_match (guint pattern_index,
+                   GumAddress address,
+                   gsize size,
+                   gpointer user_data)
+{
+  GArray * matches = user_data;
+  TestMultiMatch m;
+
+  m.pattern_index = pattern_index;
+  m.address = address;
+  g_array_append_val (matches, m);
+
+  return TRUE;
+}
+
+/*
+ * The gum_memory_scan() we had before it was vectorized: find the longest
+ * token by comparing its first byte and then memcmp()ing the rest, and verify
+ * the whole pattern on each hit. The only difference is that the scan starts
+ * at the token's offset, as reading before the range would otherwise make the
+ * match counts depend on what happens to precede the buffer.
+ */
+static guint
+count_matches_legacy (const GumMemoryRange * range,
+                      const GumMatchPattern * pattern)
+{
+  guint count = 0;
+  GumMatchToken * needle;
+  const guint8 * needle_data, * mask_data = NULL;
+  guint needle_len;
+  const guint8 * cur, * end_address;
+
+  needle = legacy_get_longest_token (pattern, GUM_MATCH_EXACT);
+  if (needle == NULL)
+  {
+    needle = legacy_get_longest_token (pattern, GUM_MATCH_MASK);
+    mask_data = (const guint8 *) needle->masks->data;
+  }
+
+  needle_data = (const guint8 *) needle->bytes->data;
+  needle_len = needle->bytes->len;
+
+  cur = GSIZE_TO_POINTER (range->base_address);
+  end_address = cur + range->size - (pattern->size - needle->offset) + 1;
+  cur += needle->offset;
+
+  for (; cur < end_address; cur++)
+  {
+    const guint8 * start;
+
+    if (mask_data == NULL)
+    {
+      if (cur[0] != needle_data[0] ||
+          memcmp (cur, needle_data, needle_len) != 0)
+      {
+        continue;
+      }
+    }
+    else
+    {
+      if ((cur[0] & mask_data[0]) != (needle_data[0] & mask_data[0]) ||
+          legacy_memcmp_mask (cur, needle_data, mask_data, needle_len) != 0)
+      {
+        continue;
+      }
+    }
+
+    start = cur - needle->offset;
+
+    if (legacy_try_match_on (pattern, start))
+    {
+      count++;
+
+      cur = start + pattern->size - 1;
+    }
+  }
+
+  return count;
+}
+
+static GumMatchToken *
+legacy_get_longest_token (const GumMatchPattern * pattern,
+                          GumMatchType type)
+{
+  GumMatchToken * longest = NULL;
+  guint i;
+
+  for (i = 0; i != pattern->tokens->len; i++)
+  {
+    GumMatchToken * token = g_ptr_array_index (pattern->tokens, i);
+
+    if (token->type == type && (longest == NULL
+        || token->bytes->len > longest->bytes->len))
+    {
+      longest = token;
+    }
+  }
+
+  return longest;
+}
+
+static gboolean
+legacy_try_match_on (const GumMatchPattern * pattern,
+                     const guint8 * bytes)
+{
+  guint i;
+
+  for (i = 0; i != pattern->tokens->len; i++)
+  {
+    GumMatchToken * token = g_ptr_array_index (pattern->tokens, i);
+    const guint8 * p = bytes + token->offset;
+
+    if (token->type == GUM_MATCH_EXACT)
+    {
+      if (memcmp (p, token->bytes->data, token->bytes->len) != 0)
+        return FALSE;
+    }
+    else if (token->type == GUM_MATCH_MASK)
+    {
+      if (legacy_memcmp_mask (p, (const guint8 *) token->bytes->data,
+          (const guint8 *) token->masks->data, token->masks->len) != 0)
+      {
+        return FALSE;
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static gint
+legacy_memcmp_mask (const guint8 * haystack,
+                    const guint8 * needle,
+                    const guint8 * mask,
+                    guint len)
+{
+  guint i;
+
+  for (i = 0; i != len; i++)
+  {
+    guint8 value = haystack[i] & mask[i];
+    guint8 test_value = needle[i] & mask[i];
+
+    if (value != test_value)
+      return value - test_value;
+  }
+
+  return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2020 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummetalhash.h"
+
+#include "testutil.h"
+
+#define TESTCASE(NAME) \
+    void test_metal_hash_ ## NAME (void)
+#define TESTENTRY(NAME) \
+    TESTENTRY_SIMPLE ("Core/MetalHash", test_metal_hash, NAME)
+
+#define KEY(i) GSIZE_TO_POINTER (0x10000 + ((gsize) (i) * 16))
+#define VALUE(i) GSIZE_TO_POINTER ((gsize) (i) + 1)
+
+typedef struct _ConcurrentLookupContext ConcurrentLookupContext;
+
+struct _ConcurrentLookupContext
+{
+  GumMetalPointerTable * table;
+  volatile gint n_inserted;
+  volatile gboolean done;
+  guint n_mismatches;
+};
+
+TESTLIST_BEGIN (metalhash)
+  TESTENTRY (pointer_table_should_support_basic_operations)
+  TESTENTRY (pointer_table_should_grow)
+  TESTENTRY (pointer_table_should_support_iteration)
+  TESTENTRY (pointer_table_lookup_should_be_safe_during_resize)
+  TESTENTRY (pointer_table_performance)
+TESTLIST_END ()
+
+static gpointer lookup_concurrently (gpointer data);
+
+TESTCASE (pointer_table_should_support_basic_operations)
+{
+  GumMetalPointerTable * table;
+
+  table = gum_metal_pointer_table_new ();
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 0);
+  g_assert_null (gum_metal_pointer_table_lookup (table, KEY (1)));
+
+  g_assert_true (gum_metal_pointer_table_insert (table, KEY (1), VALUE (1)));
+  g_assert_true (gum_metal_pointer_table_insert (table, KEY (2), VALUE (2)));
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 2);
+  g_assert_true (gum_metal_pointer_table_lookup (table, KEY (1)) == VALUE (1));
+  g_assert_true (gum_metal_pointer_table_lookup (table, KEY (2)) == VALUE (2));
+
+  g_assert_false (gum_metal_pointer_table_insert (table, KEY (1), VALUE (3)));
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 2);
+  g_assert_true (gum_metal_pointer_table_lookup (table, KEY (1)) == VALUE (3));
+
+  g_assert_true (gum_metal_pointer_table_remove (table, KEY (1)));
+  g_assert_false (gum_metal_pointer_table_remove (table, KEY (1)));
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 1);
+  g_assert_null (gum_metal_pointer_table_lookup (table, KEY (1)));
+  g_assert_true (gum_metal_pointer_table_lookup (table, KEY (2)) == VALUE (2));
+
+  g_assert_true (gum_metal_pointer_table_insert (table, KEY (1), VALUE (1)));
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 2);
+  g_assert_true (gum_metal_pointer_table_lookup (table, KEY (1)) == VALUE (1));
+
+  gum_metal_pointer_table_free (table);
+}
+
+TESTCASE (pointer_table_should_grow)
+{
+  GumMetalPointerTable * table;
+  guint i;
+
+  table = gum_metal_pointer_table_new ();
+
+  for (i = 0; i != 10000; i++)
+    gum_metal_pointer_table_insert (table, KEY (i), VALUE (i));
+  g_assert_cmpuint (gum_metal_pointer_table_size (table), ==, 10000);
+
+  for (i = 0; i != 10000; i++)
+  {
+    g_assert_true (gum_metal_pointer_table_lookup (table, KEY (i)) ==
+        VALUE (i));
+  }
+  g_assert_null (gum_metal_pointer_table_lookup (table, KEY (10000)));
+
+  gum_metal_pointer_table_free (table);
+}
+
+TESTCASE (pointer_table_should_support_iteration)
+{
+  GumMetalPointerTable * table;
+  GumMetalPointerTableIter iter;
+  gpointer key, value;
+  gsize key_sum, value_sum;
+  guint i, n;
+
+  table = gum_metal_pointer_table_new ();
+
+  for (i = 0; i != 100; i++)
+    gum_metal_pointer_table_insert (table, KEY (i), VALUE (i));
+  gum_metal_pointer_table_remove (table, KEY (50));
+
+  n = 0;
+  key_sum = 0;
+  value_sum = 0;
+  gum_metal_pointer_table_iter_init (&iter, table);
+  while (gum_metal_pointer_table_iter_next (&iter, &key, &value))
+  {
+    n++;
+    key_sum += GPOINTER_TO_SIZE (key);
+    value_sum += GPOINTER_TO_SIZE (value);
+  }
+
+  g_assert_cmpuint (n, ==, 99);
+  g_assert_cmpuint (key_sum, ==, (100 * 0x10000) + (16 * 4950) -
+      GPOINTER_TO_SIZE (KEY (50)));
+  g_assert_cmpuint (value_sum, ==, 5050 - GPOINTER_TO_SIZE (VALUE (50)));
+
+  gum_metal_pointer_table_free (table);
+}
+
+TESTCASE (pointer_table_lookup_should_be_safe_during_resize)
+{
+  ConcurrentLookupContext ctx;
+  GThread * reader;
+  guint i;
+
+  ctx.table = gum_metal_pointer_table_new ();
+  ctx.n_inserted = 0;
+  ctx.done = FALSE;
+  ctx.n_mismatches = 0;
+
+  reader = g_thread_new ("metal-hash-reader", lookup_concurrently, &ctx);
+
+  for (i = 0; i != 100000; i++)
+  {
+    gum_metal_pointer_table_insert (ctx.table, KEY (i), VALUE (i));
+    g_atomic_int_set (&ctx.n_inserted, i + 1);
+  }
+
+  g_atomic_int_set (&ctx.done, TRUE);
+  g_thread_join (reader);
+
+  g_assert_cmpuint (ctx.n_mismatches, ==, 0);
+
+  gum_metal_pointer_table_free (ctx.table);
+}
+
+static gpointer
+lookup_concurrently (gpointer data)
+{
+  ConcurrentLookupContext * ctx = data;
+
+  while (!g_atomic_int_get (&ctx->done))
+  {
+    gint n, i;
+
+    n = g_atomic_int_get (&ctx->n_inserted);
+
+    for (i = MAX (n - 64, 0); i != n; i++)
+    {
+      if (gum_metal_pointer_table_lookup (ctx->table, KEY (i)) != VALUE (i))
+        ctx->n_mismatches++;
+    }
+  }
+
+  return NULL;
+}
+
+TESTCASE (pointer_table_performance)
+{
+  const guint n = 1000000;
+  GumMetalHashTable * hash_table;
+  GumMetalPointerTable * pointer_table;
+  GTimer * timer;
+  gdouble hash_insert, hash_lookup, pointer_insert, pointer_lookup;
+  guint i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  timer = g_timer_new ();
+
+  hash_table = gum_metal_hash_table_new (NULL, NULL);
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+    gum_metal_hash_table_insert (hash_table, KEY (i), VALUE (i));
+  hash_insert = g_timer_elapsed (timer, NULL);
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+  {
+    g_assert_true (gum_metal_hash_table_lookup (hash_table, KEY (i)) ==
+        VALUE (i));
+  }
+  hash_lookup = g_timer_elapsed (timer, NULL);
+
+  gum_metal_hash_table_unref (hash_table);
+
+  pointer_table = gum_metal_pointer_table_new ();
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+    gum_metal_pointer_table_insert (pointer_table, KEY (i), VALUE (i));
+  pointer_insert = g_timer_elapsed (timer, NULL);
+
+  g_timer_reset (timer);
+  for (i = 0; i != n; i++)
+  {
+    g_assert_true (gum_metal_pointer_table_lookup (pointer_table, KEY (i)) ==
+        VALUE (i));
+  }
+  pointer_lookup = g_timer_elapsed (timer, NULL);
+
+  gum_metal_pointer_table_free (pointer_table);
+
+  g_timer_destroy (timer);
+
+  g_print ("<entries=%u hash_insert=%f hash_lookup=%f pointer_insert=%f "
+      "pointer_lookup=%f lookup_ratio=%f> ", n, hash_insert, hash_lookup,
+      pointer_insert, pointer_lookup, hash_lookup / pointer_lookup);
+}
@@ -23,7 +23,10 @@
 #endif
 
 #if defined (HAVE_LINUX)
-# include "backend-linux/gumlinux.h"
+# include "backend-elf/gumelfmodule.h"
+# include "backend-linux/gumlinux-priv.h"
+# include <sys/mman.h>
+# include <unistd.h>
 #endif
 
 #define TESTCASE(NAME) \
@@ -49,6 +52,8 @@ TESTLIST_BEGIN (process)
 #ifndef HAVE_ASAN
   TESTENTRY (module_export_matches_system_lookup)
 #endif
+  TESTENTRY (incremental_module_map_should_find_loaded_module)
+  TESTENTRY (module_map_values_should_survive_updates)
 #ifdef HAVE_WINDOWS
   TESTENTRY (get_set_system_error)
   TESTENTRY (get_current_thread_id)
@@ -67,8 +72,14 @@ TESTLIST_BEGIN (process)
 #endif
 #if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
   TESTENTRY (linux_process_modules)
+  TESTENTRY (elf_module_export_lookup_should_match_enumeration)
+#endif
+#ifdef HAVE_LINUX
+  TESTENTRY (proc_maps_iter_should_parse_tricky_lines)
+  TESTENTRY (ranges_snapshot_should_be_reused_until_ended)
 #endif
 #if defined (HAVE_LINUX) && defined (HAVE_SYS_AUXV_H)
+  TESTENTRY (elf_module_export_lookup_should_support_sysv_hash)
   TESTENTRY (linux_get_cpu_from_auxv_null_32bit)
   TESTENTRY (linux_get_cpu_from_auxv_null_64bit)
   TESTENTRY (linux_get_cpu_from_auxv_representative_32bit)
@@ -282,6 +293,8 @@ static gboolean find_module_bounds (const GumRangeDetails * details,
     gpointer user_data);
 static gboolean verify_module_bounds (const GumModuleDetails * details,
     gpointer user_data);
+static gboolean collect_elf_export (const GumExportDetails * details,
+    gpointer user_data);
 
 TESTCASE (linux_process_modules)
 {
@@ -350,10 +363,139 @@ verify_module_bounds (const GumModuleDetails * details,
   return TRUE;
 }
 
+TESTCASE (elf_module_export_lookup_should_match_enumeration)
+{
+  const gchar * libc_name;
+  GumElfModule * module;
+  GHashTable * exports;
+  GHashTableIter iter;
+  gpointer name;
+  void * libc;
+
+  libc_name = gum_process_query_libc_name ();
+  module = gum_elf_module_new_from_memory (libc_name,
+      gum_module_find_base_address (libc_name));
+  g_assert_nonnull (module);
+  g_assert_true (module->dynamic_gnu_hash != NULL ||
+      module->dynamic_sysv_hash != NULL);
+
+  exports = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  gum_elf_module_enumerate_exports (module, collect_elf_export, exports);
+  g_assert_cmpuint (g_hash_table_size (exports), >, 0);
+
+  /*
+   * Symbols with several versions are enumerated once per version, and the
+   * lookup must land on one of them.
+   */
+  g_hash_table_iter_init (&iter, exports);
+  while (g_hash_table_iter_next (&iter, &name, NULL))
+  {
+    const gchar * separator;
+    gchar * export_name, * key;
+    GumAddress address;
+
+    separator = strrchr (name, '@');
+    export_name = g_strndup (name, separator - (const gchar *) name);
+
+    address = gum_elf_module_find_export_by_name (module, export_name);
+    key = g_strdup_printf ("%s@%" G_GINT64_MODIFIER "x", export_name, address);
+    g_assert_true (g_hash_table_contains (exports, key));
+
+    g_free (key);
+    g_free (export_name);
+  }
+
+  g_assert_cmphex (gum_elf_module_find_export_by_name (module,
+      "gum_process_test_no_such_export"), ==, 0);
+
+  libc = dlopen (libc_name, RTLD_LAZY | RTLD_NOLOAD);
+  g_assert_nonnull (libc);
+  g_assert_cmphex (gum_elf_module_find_export_by_name (module, "realpath"),
+      ==, GUM_ADDRESS (dlsym (libc, "realpath")));
+  g_assert_cmphex (gum_module_find_export_by_name (libc_name, "realpath"),
+      ==, GUM_ADDRESS (dlsym (libc, "realpath")));
+  dlclose (libc);
+
+  g_hash_table_unref (exports);
+  g_object_unref (module);
+}
+
+static gboolean
+collect_elf_export (const GumExportDetails * details,
+                    gpointer user_data)
+{
+  GHashTable * exports = user_data;
+
+  g_hash_table_add (exports, g_strdup_printf ("%s@%" G_GINT64_MODIFIER "x",
+      details->name, details->address));
+
+  return TRUE;
+}
+
 #endif
 
 #if defined (HAVE_LINUX) && defined (HAVE_SYS_AUXV_H)
 
+typedef struct _ElfExportLookupContext ElfExportLookupContext;
+
+struct _ElfExportLookupContext
+{
+  GumElfModule * module;
+  guint export_count;
+};
+
+static gboolean check_elf_export_lookup (const GumExportDetails * details,
+    gpointer user_data);
+
+TESTCASE (elf_module_export_lookup_should_support_sysv_hash)
+{
+  GumAddress vdso_base;
+  GumElfModule * module;
+  ElfExportLookupContext ctx;
+
+  vdso_base = getauxval (AT_SYSINFO_EHDR);
+  if (vdso_base == 0)
+  {
+    g_print ("<skipping, no vDSO> ");
+    return;
+  }
+
+  module = gum_elf_module_new_from_memory ("linux-vdso.so.1", vdso_base);
+  g_assert_nonnull (module);
+
+  if (module->dynamic_sysv_hash == NULL)
+  {
+    g_print ("<skipping, vDSO has no DT_HASH> ");
+    g_object_unref (module);
+    return;
+  }
+
+  module->dynamic_gnu_hash = NULL;
+
+  ctx.module = module;
+  ctx.export_count = 0;
+  gum_elf_module_enumerate_exports (module, check_elf_export_lookup, &ctx);
+  g_assert_cmpuint (ctx.export_count, >, 0);
+
+  g_assert_cmphex (gum_elf_module_find_export_by_name (module,
+      "gum_process_test_no_such_export"), ==, 0);
+
+  g_object_unref (module);
+}
+
+static gboolean
+check_elf_export_lookup (const GumExportDetails * details,
+                         gpointer user_data)
+{
+  ElfExportLookupContext * ctx = user_data;
+
+  g_assert_cmphex (gum_elf_module_find_export_by_name (ctx->module,
+      details->name), ==, details->address);
+  ctx->export_count++;
+
+  return TRUE;
+}
+
 TESTCASE (linux_get_cpu_from_auxv_null_32bit)
 {
   const guint32 v[] = { AT_NULL, 0 };
@@ -466,6 +608,176 @@ TESTCASE (linux_get_cpu_from_auxv_representative_64bit)
 
 #endif
 
+#ifdef HAVE_LINUX
+
+#define PROC_MAPS_FILLER_FORMAT \
+    "%012" G_GINT64_MODIFIER "x-%012" G_GINT64_MODIFIER "x rw-p 00000000 " \
+    "00:00 0\n"
+#define PROC_MAPS_FILLER_LENGTH 48
+#define PROC_MAPS_FILLER_COUNT 3000
+
+typedef struct _FileMappingContext FileMappingContext;
+
+struct _FileMappingContext
+{
+  GumAddress address;
+  gboolean found;
+};
+
+static gboolean find_file_mapping (const GumRangeDetails * details,
+    gpointer user_data);
+
+TESTCASE (proc_maps_iter_should_parse_tricky_lines)
+{
+  GString * contents;
+  gchar * path;
+  gint fd;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+  guint i;
+
+  /*
+   * The iterator reads at most 65535 bytes at a time, so make sure lines end
+   * up straddling those boundaries.
+   */
+  g_assert_cmpuint (65535 % PROC_MAPS_FILLER_LENGTH, !=, 0);
+  g_assert_cmpuint (PROC_MAPS_FILLER_COUNT * PROC_MAPS_FILLER_LENGTH, >,
+      2 * 65536);
+
+  contents = g_string_new (NULL);
+  for (i = 0; i != PROC_MAPS_FILLER_COUNT; i++)
+  {
+    guint64 start = G_GUINT64_CONSTANT (0x10000000) + (i * 0x1000);
+
+    g_string_append_printf (contents, PROC_MAPS_FILLER_FORMAT,
+        start, start + 0x1000);
+  }
+  g_assert_cmpuint (contents->len, ==,
+      PROC_MAPS_FILLER_COUNT * PROC_MAPS_FILLER_LENGTH);
+  g_string_append (contents,
+      "20000000-20001000 r-xp 00001000 08:01 1234           "
+      "/opt/my lib/libfoo.so\n"
+      "20001000-20002000 r--p 00000000 08:01 5678           "
+      "/tmp/gone.so (deleted)\n"
+      "20002000-20004000 r-xp 00000000 00:00 0              [vdso]\n"
+      "20004000-20005000 rw-p 00000000 00:00 0 \n"
+      "20005000-20006000 ---p 00000000 00:00 0");
+
+  fd = g_file_open_tmp ("gum-proc-maps-XXXXXX", &path, NULL);
+  g_assert_cmpint (fd, !=, -1);
+  g_assert_true (g_file_set_contents (path, contents->str, contents->len,
+      NULL));
+  close (fd);
+
+  gum_proc_maps_iter_init_for_path (&iter, path);
+
+  for (i = 0; i != PROC_MAPS_FILLER_COUNT; i++)
+  {
+    guint64 start = G_GUINT64_CONSTANT (0x10000000) + (i * 0x1000);
+
+    g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+    g_assert_cmphex (entry.start, ==, start);
+    g_assert_cmphex (entry.end, ==, start + 0x1000);
+    g_assert_cmpstr (entry.perms, ==, "rw-p");
+    g_assert_cmpstr (entry.path, ==, "");
+  }
+
+  g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+  g_assert_cmphex (entry.start, ==, 0x20000000);
+  g_assert_cmpstr (entry.perms, ==, "r-xp");
+  g_assert_cmphex (entry.offset, ==, 0x1000);
+  g_assert_cmpuint (entry.inode, ==, 1234);
+  g_assert_cmpstr (entry.path, ==, "/opt/my lib/libfoo.so");
+
+  g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+  g_assert_cmphex (entry.start, ==, 0x20001000);
+  g_assert_cmpuint (entry.inode, ==, 5678);
+  g_assert_cmpstr (entry.path, ==, "/tmp/gone.so (deleted)");
+
+  g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+  g_assert_cmphex (entry.start, ==, 0x20002000);
+  g_assert_cmphex (entry.end, ==, 0x20004000);
+  g_assert_cmpuint (entry.inode, ==, 0);
+  g_assert_cmpstr (entry.path, ==, "[vdso]");
+
+  g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+  g_assert_cmphex (entry.start, ==, 0x20004000);
+  g_assert_cmpstr (entry.path, ==, "");
+
+  g_assert_true (gum_proc_maps_iter_next (&iter, &entry));
+  g_assert_cmphex (entry.start, ==, 0x20005000);
+  g_assert_cmphex (entry.end, ==, 0x20006000);
+  g_assert_cmpstr (entry.perms, ==, "---p");
+  g_assert_cmpstr (entry.path, ==, "");
+
+  g_assert_false (gum_proc_maps_iter_next (&iter, &entry));
+
+  gum_proc_maps_iter_destroy (&iter);
+
+  unlink (path);
+  g_free (path);
+  g_string_free (contents, TRUE);
+}
+
+TESTCASE (ranges_snapshot_should_be_reused_until_ended)
+{
+  gchar * path;
+  gint fd;
+  gsize page_size;
+  gpointer page;
+  FileMappingContext ctx;
+
+  page_size = gum_query_page_size ();
+
+  fd = g_file_open_tmp ("gum-ranges-snapshot-XXXXXX", &path, NULL);
+  g_assert_cmpint (fd, !=, -1);
+  g_assert_cmpint (ftruncate (fd, page_size), ==, 0);
+
+  gum_linux_begin_ranges_snapshot ();
+
+  ctx.address = 0;
+  ctx.found = FALSE;
+  gum_process_enumerate_ranges (GUM_PAGE_READ, find_file_mapping, &ctx);
+
+  page = mmap (NULL, page_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  g_assert_true (page != MAP_FAILED);
+
+  ctx.address = GUM_ADDRESS (page);
+  ctx.found = FALSE;
+  gum_process_enumerate_ranges (GUM_PAGE_READ, find_file_mapping, &ctx);
+  g_assert_false (ctx.found);
+
+  gum_linux_end_ranges_snapshot ();
+
+  ctx.found = FALSE;
+  gum_process_enumerate_ranges (GUM_PAGE_READ, find_file_mapping, &ctx);
+  g_assert_true (ctx.found);
+
+  munmap (page, page_size);
+  close (fd);
+  unlink (path);
+  g_free (path);
+}
+
+static gboolean
+find_file_mapping (const GumRangeDetails * details,
+                   gpointer user_data)
+{
+  FileMappingContext * ctx = user_data;
+  const GumMemoryRange * range = details->range;
+
+  if (details->file != NULL && ctx->address >= range->base_address &&
+      ctx->address < range->base_address + range->size)
+  {
+    ctx->found = TRUE;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+#endif
+
 TESTCASE (process_ranges)
 {
   {
@@ -805,6 +1117,58 @@ TESTCASE (module_export_matches_system_lookup)
 #endif
 }
 
+TESTCASE (incremental_module_map_should_find_loaded_module)
+{
+#ifndef HAVE_WINDOWS
+  GumModuleMap * map;
+  void * lib, * system_address;
+  const GumModuleDetails * details;
+  const GumMemoryRange * range;
+
+  map = gum_module_map_new ();
+  gum_module_map_set_incremental (map, TRUE);
+
+  lib = dlopen (TRICKY_MODULE_NAME, RTLD_NOW | RTLD_GLOBAL);
+  g_assert_true (lib != NULL);
+  system_address = dlsym (lib, TRICKY_MODULE_EXPORT);
+  g_assert_true (system_address != NULL);
+
+  details = gum_module_map_find (map, GUM_ADDRESS (system_address));
+  g_assert_nonnull (details);
+  g_assert_cmphex (GUM_ADDRESS (system_address), >=,
+      details->range->base_address);
+  range = details->range;
+
+  gum_module_map_update (map);
+  g_assert_true (gum_module_map_find (map,
+      GUM_ADDRESS (system_address))->range == range);
+
+  dlclose (lib);
+  g_object_unref (map);
+#endif
+}
+
+TESTCASE (module_map_values_should_survive_updates)
+{
+  GumModuleMap * map;
+  GArray * values;
+
+  map = gum_module_map_new ();
+  gum_module_map_set_incremental (map, TRUE);
+
+  values = gum_module_map_get_values (map);
+  g_assert_cmpuint (values->len, >, 0);
+
+  gum_module_map_find (map, 0);
+  gum_module_map_update (map);
+  gum_module_map_update (map);
+
+  g_assert_true (gum_module_map_get_values (map) == values);
+  g_assert_cmpuint (values->len, >, 0);
+
+  g_object_unref (map);
+}
+
 #ifndef HAVE_WINDOWS
 
 static gboolean
@@ -20,6 +20,10 @@
 TESTLIST_BEGIN (symbolutil)
   TESTENTRY (symbol_details_from_address)
   TESTENTRY (symbol_details_from_address_objc_fallback)
+  TESTENTRY (symbol_details_from_addresses)
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+  TESTENTRY (symbol_name_from_address_inside_sizeless_symbol)
+#endif
   TESTENTRY (symbol_name_from_address)
   TESTENTRY (find_external_public_function)
   TESTENTRY (find_local_static_function)
@@ -34,6 +38,28 @@ static guint gum_dummy_variable;
 static void GUM_CDECL gum_dummy_function_0 (void);
 static void GUM_STDCALL gum_dummy_function_1 (void);
 
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+/*
+ * Defined in assembly without a .size directive, and in a section of its own
+ * so it is not covered by any compilation unit's debug info.
+ */
+extern void gum_dummy_sizeless_function (void);
+
+__asm__ (
+    ".pushsection .text.gum_dummy_sizeless_function, \"ax\"\n"
+    ".globl gum_dummy_sizeless_function\n"
+    ".hidden gum_dummy_sizeless_function\n"
+    ".type gum_dummy_sizeless_function, %function\n"
+    "gum_dummy_sizeless_function:\n"
+    "  nop\n"
+    "  nop\n"
+    "  nop\n"
+    "  nop\n"
+    "  ret\n"
+    ".popsection\n"
+);
+#endif
+
 TESTCASE (symbol_details_from_address)
 {
   GumDebugSymbolDetails details;
@@ -71,6 +97,44 @@ TESTCASE (symbol_details_from_address_objc_fallback)
 #endif
 }
 
+TESTCASE (symbol_details_from_addresses)
+{
+  gpointer addresses[3];
+  GumDebugSymbolDetails details[3];
+
+  addresses[0] = gum_dummy_function_0;
+  addresses[1] = NULL;
+  addresses[2] = gum_dummy_function_1;
+
+  g_assert_cmpuint (gum_symbol_details_from_addresses (addresses,
+      G_N_ELEMENTS (addresses), details), ==, 2);
+
+  g_assert_cmphex (GPOINTER_TO_SIZE (details[0].address), ==,
+      GPOINTER_TO_SIZE (gum_dummy_function_0));
+  g_assert_cmpstr (details[0].symbol_name, ==, "gum_dummy_function_0");
+
+  g_assert_cmphex (details[1].address, ==, 0);
+  g_assert_cmpstr (details[1].symbol_name, ==, "");
+
+  g_assert_cmphex (GPOINTER_TO_SIZE (details[2].address), ==,
+      GPOINTER_TO_SIZE (gum_dummy_function_1));
+  g_assert_cmpstr (details[2].symbol_name, ==, "gum_dummy_function_1");
+}
+
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+
+TESTCASE (symbol_name_from_address_inside_sizeless_symbol)
+{
+  gchar * symbol_name;
+
+  symbol_name = gum_symbol_name_from_address (
+      (guint8 *) gum_dummy_sizeless_function + 4);
+  g_assert_cmpstr (symbol_name, ==, "gum_dummy_sizeless_function+0x4");
+  g_free (symbol_name);
+}
+
+#endif
+
 TESTCASE (symbol_name_from_address)
 {
   gchar * symbol_name;
@@ -358,6 +358,8 @@ TESTLIST_BEGIN (script)
   TESTGROUP_BEGIN ("Stalker")
 #if defined (HAVE_I386) || defined (HAVE_ARM) || defined (HAVE_ARM64)
     TESTENTRY (execution_can_be_traced)
+    TESTENTRY (execution_can_be_traced_with_dropped_events_reported)
+    TESTENTRY (execution_can_be_traced_with_compact_events)
     TESTENTRY (execution_can_be_traced_with_custom_transformer)
     TESTENTRY (execution_can_be_traced_with_faulty_transformer)
     TESTENTRY (execution_can_be_traced_during_immediate_native_function_call)
@@ -370,6 +372,7 @@ TESTLIST_BEGIN (script)
     TESTENTRY (call_can_be_probed)
 #endif
     TESTENTRY (stalker_events_can_be_parsed)
+    TESTENTRY (compact_stalker_events_can_be_parsed)
   TESTGROUP_END ()
 
   TESTENTRY (script_can_be_compiled_to_bytecode)
@@ -3287,6 +3290,99 @@ TESTCASE (execution_can_be_traced)
   EXPECT_SEND_MESSAGE_WITH ("\"onReceive: true\"");
 }
 
+TESTCASE (execution_can_be_traced_with_dropped_events_reported)
+{
+  GumThreadId test_thread_id;
+
+#ifdef __ARM_PCS_VFP
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "Stalker.queueDrainInterval = 0;"
+      "Stalker.queueCapacity = 1;"
+      "const testsRange = Process.getModuleByName('%s');"
+      "Stalker.exclude(testsRange);"
+
+      "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+      "  events: {"
+      "    call: true"
+      "  },"
+      "  onReceive(events, drops) {"
+      "    send('onReceive: ' + (drops['%" G_GSIZE_FORMAT "'] > 0));"
+      "  }"
+      "});"
+
+      "recv('stop', message => {"
+      "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+      "  Stalker.flush();"
+      "});",
+
+      GUM_TESTS_MODULE_NAME,
+      test_thread_id,
+      test_thread_id,
+      test_thread_id);
+  EXPECT_NO_MESSAGES ();
+
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("\"onReceive: true\"");
+}
+
+TESTCASE (execution_can_be_traced_with_compact_events)
+{
+  GumThreadId test_thread_id;
+
+#ifdef __ARM_PCS_VFP
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "Stalker.queueDrainInterval = 0;"
+      "Stalker.eventEncoding = 'compact';"
+      "const testsRange = Process.getModuleByName('%s');"
+      "Stalker.exclude(testsRange);"
+
+      "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+      "  events: {"
+      "    call: true"
+      "  },"
+      "  onReceive(events) {"
+      "    const parsed = Stalker.parse(events);"
+      "    send('onReceive: ' + (parsed.length > 0) + ' ' +"
+      "        parsed.every(e => e[0] === 'call'));"
+      "  },"
+      "  onCallSummary(summary) {"
+      "    send('onCallSummary: ' + (Object.keys(summary).length > 0));"
+      "  }"
+      "});"
+
+      "recv('stop', message => {"
+      "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+      "  Stalker.flush();"
+      "});",
+
+      GUM_TESTS_MODULE_NAME,
+      test_thread_id,
+      test_thread_id);
+  EXPECT_NO_MESSAGES ();
+
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("\"onCallSummary: true\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onReceive: true true\"");
+}
+
 TESTCASE (execution_can_be_traced_with_custom_transformer)
 {
   GumThreadId test_thread_id;
@@ -3806,6 +3902,24 @@ TESTCASE (stalker_events_can_be_parsed)
   EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER, "Error: invalid event type");
 }
 
+TESTCASE (compact_stalker_events_can_be_parsed)
+{
+  const guint8 events[] = {
+    0xff, 'E', 'V', '1',
+    0x00, 0x0e, 0x0a, 0x54,
+    0x02, 0x32,
+  };
+
+  COMPILE_AND_LOAD_SCRIPT ("send(Stalker.parse(" GUM_PTR_CONST ".readByteArray("
+      "%" G_GSIZE_FORMAT ")));", events, sizeof (events));
+  EXPECT_SEND_MESSAGE_WITH ("[[\"call\",\"0x7\",\"0xc\",42],"
+      "[\"exec\",\"0x20\"]]");
+
+  COMPILE_AND_LOAD_SCRIPT ("send(Stalker.parse(" GUM_PTR_CONST ".readByteArray("
+      "%" G_GSIZE_FORMAT ")));", events, sizeof (events) - 1);
+  EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER, "Error: invalid buffer shape");
+}
+
 TESTCASE (frida_version_is_available)
 {
   COMPILE_AND_LOAD_SCRIPT ("send(typeof Frida.version);");
@@ -172,6 +172,7 @@ main (gint argc, gchar * argv[])
   TESTLIST_REGISTER (tls);
   TESTLIST_REGISTER (cloak);
   TESTLIST_REGISTER (memory);
+  TESTLIST_REGISTER (metalhash);
   TESTLIST_REGISTER (process);
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TESTLIST_REGISTER (symbolutil);
@@ -12,6 +12,9 @@ static void gum_fake_event_sink_finalize (GObject * obj);
 static GumEventType gum_fake_event_sink_query_mask (GumEventSink * sink);
 static void gum_fake_event_sink_process (GumEventSink * sink,
     const GumEvent * event, GumCpuContext * cpu_context);
+static guint gum_fake_event_sink_query_buffer_capacity (GumEventSink * sink);
+static void gum_fake_event_sink_process_buffer (GumEventSink * sink,
+    const GumEvent * events, guint n_events);
 
 G_DEFINE_TYPE_EXTENDED (GumFakeEventSink,
                         gum_fake_event_sink,
@@ -36,6 +39,8 @@ gum_fake_event_sink_iface_init (gpointer g_iface,
 
   iface->query_mask = gum_fake_event_sink_query_mask;
   iface->process = gum_fake_event_sink_process;
+  iface->query_buffer_capacity = gum_fake_event_sink_query_buffer_capacity;
+  iface->process_buffer = gum_fake_event_sink_process_buffer;
 }
 
 static void
@@ -69,6 +74,7 @@ gum_fake_event_sink_reset (GumFakeEventSink * self)
 {
   self->mask = 0;
   g_array_set_size (self->events, 0);
+  self->n_buffers = 0;
 }
 
 const GumCallEvent *
@@ -152,3 +158,22 @@ gum_fake_event_sink_process (GumEventSink * sink,
 
   g_array_append_val (self->events, *event);
 }
+
+static guint
+gum_fake_event_sink_query_buffer_capacity (GumEventSink * sink)
+{
+  GumFakeEventSink * self = GUM_FAKE_EVENT_SINK (sink);
+
+  return self->buffer_capacity;
+}
+
+static void
+gum_fake_event_sink_process_buffer (GumEventSink * sink,
+                                    const GumEvent * events,
+                                    guint n_events)
+{
+  GumFakeEventSink * self = GUM_FAKE_EVENT_SINK (sink);
+
+  g_array_append_vals (self->events, events, n_events);
+  self->n_buffers++;
+}
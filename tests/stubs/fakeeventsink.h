@@ -21,7 +21,9 @@ struct _GumFakeEventSink
   GObject parent;
 
   GumEventType mask;
+  guint buffer_capacity;
   GArray * events;
+  guint n_buffers;
 };
 
 GumEventSink * gum_fake_event_sink_new (void);